@@ -0,0 +1,306 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef BEAST_TEST_PIPE_STREAM_HPP
+#define BEAST_TEST_PIPE_STREAM_HPP
+
+#include <beast/core/async_result.hpp>
+#include <beast/core/bind_handler.hpp>
+#include <beast/core/error.hpp>
+#include <beast/core/flat_buffer.hpp>
+#include <beast/websocket/teardown.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/io_service.hpp>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace beast {
+namespace test {
+
+/** A pair of connected in-memory streams.
+
+    Data written to one end of the pipe is read from the other,
+    like a connected pair of sockets without the operating
+    system. Each end is a SyncStream and an AsyncStream. The
+    ends may be used from different threads, which allows
+    synchronous peers to run without deadlock.
+
+    Writes never block. Reads wait for data from the peer, and
+    report end of file once the pipe is closed and drained.
+*/
+class pipe
+{
+    struct read_op
+    {
+        virtual ~read_op() = default;
+        virtual void operator()(error_code const& ec) = 0;
+    };
+
+    struct state
+    {
+        std::mutex m;
+        std::condition_variable cv;
+        flat_buffer b;
+        std::unique_ptr<read_op> op;
+        bool closed = false;
+    };
+
+    template<class Handler, class Buffers>
+    class read_op_impl;
+
+public:
+    /// One end of the pipe
+    class stream
+    {
+        friend class pipe;
+
+        state& in_;
+        state& out_;
+        boost::asio::io_service& ios_;
+
+        stream(state& in, state& out,
+                boost::asio::io_service& ios)
+            : in_(in)
+            , out_(out)
+            , ios_(ios)
+        {
+        }
+
+    public:
+        boost::asio::io_service&
+        get_io_service()
+        {
+            return ios_;
+        }
+
+        /// Close both directions of the pipe
+        void
+        close()
+        {
+            shutdown(in_);
+            shutdown(out_);
+        }
+
+        template<class MutableBufferSequence>
+        std::size_t
+        read_some(MutableBufferSequence const& buffers)
+        {
+            error_code ec;
+            auto const n = read_some(buffers, ec);
+            if(ec)
+                throw system_error{ec};
+            return n;
+        }
+
+        template<class MutableBufferSequence>
+        std::size_t
+        read_some(MutableBufferSequence const& buffers,
+            error_code& ec)
+        {
+            std::unique_lock<std::mutex> lock{in_.m};
+            in_.cv.wait(lock,
+                [&]
+                {
+                    return in_.b.size() > 0 || in_.closed;
+                });
+            return copy(in_, buffers, ec);
+        }
+
+        template<class MutableBufferSequence, class ReadHandler>
+        async_return_type<
+            ReadHandler, void(error_code, std::size_t)>
+        async_read_some(MutableBufferSequence const& buffers,
+            ReadHandler&& handler)
+        {
+            async_completion<ReadHandler,
+                void(error_code, std::size_t)> init{handler};
+            std::unique_ptr<read_op> op{new read_op_impl<
+                handler_type<ReadHandler,
+                    void(error_code, std::size_t)>,
+                        MutableBufferSequence>{
+                            std::move(init.completion_handler),
+                                in_, ios_, buffers}};
+            std::lock_guard<std::mutex> lock{in_.m};
+            BOOST_ASSERT(! in_.op);
+            if(in_.b.size() > 0 || in_.closed)
+                (*op)(error_code{});
+            else
+                in_.op = std::move(op);
+            return init.result.get();
+        }
+
+        template<class ConstBufferSequence>
+        std::size_t
+        write_some(ConstBufferSequence const& buffers)
+        {
+            error_code ec;
+            auto const n = write_some(buffers, ec);
+            if(ec)
+                throw system_error{ec};
+            return n;
+        }
+
+        template<class ConstBufferSequence>
+        std::size_t
+        write_some(ConstBufferSequence const& buffers,
+            error_code& ec)
+        {
+            using boost::asio::buffer_copy;
+            using boost::asio::buffer_size;
+            std::lock_guard<std::mutex> lock{out_.m};
+            if(out_.closed)
+            {
+                ec = boost::asio::error::broken_pipe;
+                return 0;
+            }
+            ec = {};
+            auto const n = buffer_copy(
+                out_.b.prepare(buffer_size(buffers)), buffers);
+            out_.b.commit(n);
+            if(out_.op)
+            {
+                (*out_.op)(error_code{});
+                out_.op.reset();
+            }
+            out_.cv.notify_all();
+            return n;
+        }
+
+        template<class ConstBufferSequence, class WriteHandler>
+        async_return_type<
+            WriteHandler, void(error_code, std::size_t)>
+        async_write_some(ConstBufferSequence const& buffers,
+            WriteHandler&& handler)
+        {
+            error_code ec;
+            auto const n = write_some(buffers, ec);
+            async_completion<WriteHandler,
+                void(error_code, std::size_t)> init{handler};
+            ios_.post(bind_handler(
+                init.completion_handler, ec, n));
+            return init.result.get();
+        }
+
+        friend
+        void
+        teardown(websocket::teardown_tag,
+            stream& s, boost::system::error_code& ec)
+        {
+            s.close();
+            ec = {};
+        }
+
+        template<class TeardownHandler>
+        friend
+        void
+        async_teardown(websocket::teardown_tag,
+            stream& s, TeardownHandler&& handler)
+        {
+            s.close();
+            s.ios_.post(bind_handler(std::move(handler),
+                error_code{}));
+        }
+
+    private:
+        // Called with the lock held
+        template<class MutableBufferSequence>
+        static
+        std::size_t
+        copy(state& s, MutableBufferSequence const& buffers,
+            error_code& ec)
+        {
+            auto const n = boost::asio::buffer_copy(
+                buffers, s.b.data());
+            s.b.consume(n);
+            if(n == 0 && boost::asio::buffer_size(buffers) > 0)
+                ec = boost::asio::error::eof;
+            else
+                ec = {};
+            return n;
+        }
+
+        static
+        void
+        shutdown(state& s)
+        {
+            std::lock_guard<std::mutex> lock{s.m};
+            s.closed = true;
+            if(s.op)
+            {
+                (*s.op)(error_code{});
+                s.op.reset();
+            }
+            s.cv.notify_all();
+        }
+    };
+
+private:
+    state s0_;
+    state s1_;
+
+public:
+    /// The first end of the pipe
+    stream client;
+
+    /// The second end of the pipe
+    stream server;
+
+    /// Constructor, using one io_service for both ends.
+    explicit
+    pipe(boost::asio::io_service& ios)
+        : pipe(ios, ios)
+    {
+    }
+
+    /// Constructor, using a separate io_service for each end.
+    pipe(boost::asio::io_service& client_ios,
+            boost::asio::io_service& server_ios)
+        : client(s0_, s1_, client_ios)
+        , server(s1_, s0_, server_ios)
+    {
+    }
+
+    pipe(pipe const&) = delete;
+    pipe& operator=(pipe const&) = delete;
+};
+
+template<class Handler, class Buffers>
+class pipe::read_op_impl : public pipe::read_op
+{
+    Handler h_;
+    state& s_;
+    boost::asio::io_service& ios_;
+    Buffers b_;
+
+public:
+    read_op_impl(Handler&& h, state& s,
+            boost::asio::io_service& ios,
+                Buffers const& b)
+        : h_(std::move(h))
+        , s_(s)
+        , ios_(ios)
+        , b_(b)
+    {
+    }
+
+    // Called with the lock held
+    void
+    operator()(error_code const&) override
+    {
+        error_code ec;
+        auto const n = stream::copy(s_, b_, ec);
+        ios_.post(bind_handler(std::move(h_), ec, n));
+    }
+};
+
+} // test
+} // beast
+
+#endif
@@ -213,6 +213,13 @@ public:
         capacity_ = size;
     }
 
+    /// Returns the maximum buffer size.
+    std::size_t
+    capacity() const
+    {
+        return capacity_;
+    }
+
     /** Read some data from the stream.
 
         This function is used to read data from the stream.
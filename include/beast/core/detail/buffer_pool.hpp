@@ -0,0 +1,96 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef BEAST_CORE_DETAIL_BUFFER_POOL_HPP
+#define BEAST_CORE_DETAIL_BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace beast {
+namespace detail {
+
+// A per-thread pool of idle byte buffers.
+//
+// Objects which pool their buffers borrow them at the start
+// of each message and give them back at the end, so the
+// memory used follows the number of messages in flight
+// rather than the number of connections. Buffers are only
+// handed out again for the same size. The websocket read
+// and write buffers and the deflate pending buffers share
+// the pool.
+//
+class buffer_pool
+{
+    struct element
+    {
+        std::size_t size;
+        std::unique_ptr<std::uint8_t[]> p;
+    };
+
+    std::vector<element> v_;
+
+public:
+    // Largest number of idle buffers kept by each thread
+    static std::size_t constexpr max_size = 16;
+
+    static
+    buffer_pool&
+    instance()
+    {
+        static thread_local buffer_pool pool;
+        return pool;
+    }
+
+    std::size_t
+    size() const
+    {
+        return v_.size();
+    }
+
+    std::unique_ptr<std::uint8_t[]>
+    acquire(std::size_t size)
+    {
+        for(auto it = v_.rbegin(); it != v_.rend(); ++it)
+        {
+            if(it->size == size)
+            {
+                auto p = std::move(it->p);
+                v_.erase(std::next(it).base());
+                return p;
+            }
+        }
+        return std::unique_ptr<
+            std::uint8_t[]>(new std::uint8_t[size]);
+    }
+
+    void
+    release(std::unique_ptr<std::uint8_t[]> p,
+        std::size_t size)
+    {
+        if(! p)
+            return;
+        if(v_.size() >= max_size)
+            v_.erase(v_.begin());
+        v_.push_back(element{size, std::move(p)});
+    }
+
+    void
+    clear()
+    {
+        v_.clear();
+    }
+};
+
+} // detail
+} // beast
+
+#endif
@@ -12,6 +12,19 @@
 #include <cstdint>
 #include <cstring>
 
+#ifndef BEAST_SHA1_SSE2
+# if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define BEAST_SHA1_SSE2 1
+# else
+#  define BEAST_SHA1_SSE2 0
+# endif
+#endif
+
+#if BEAST_SHA1_SSE2
+#include <emmintrin.h>
+#endif
+
 // Based on https://github.com/vog/sha1
 /*
     Original authors:
@@ -214,6 +227,288 @@ transform(
     digest[4] += e;
 }
 
+// Fill block `i` of the padded form of a message
+inline
+void
+pad_block(std::uint8_t const* p, std::size_t size,
+    std::size_t i, std::uint32_t block[BLOCK_INTS])
+{
+    std::uint8_t buf[BLOCK_BYTES];
+    auto const pos = i * BLOCK_BYTES;
+    std::size_t n = 0;
+    if(pos < size)
+    {
+        n = (std::min)(size - pos, BLOCK_BYTES);
+        std::memcpy(buf, p + pos, n);
+    }
+    std::memset(buf + n, 0, BLOCK_BYTES - n);
+    if(pos + n == size && n < BLOCK_BYTES)
+        buf[n] = 0x80;
+    make_block(buf, block);
+    if(i + 1 == (size + 8) / BLOCK_BYTES + 1)
+    {
+        std::uint64_t const bits =
+            static_cast<std::uint64_t>(size) * 8;
+        block[BLOCK_INTS - 2] =
+            static_cast<std::uint32_t>(bits >> 32);
+        block[BLOCK_INTS - 1] =
+            static_cast<std::uint32_t>(bits & 0xffffffff);
+    }
+}
+
+// Number of messages compressed together by transform_n
+static std::size_t constexpr LANES = 8;
+
+using lanes = std::uint32_t[LANES];
+
+// One 32-bit word from each of LANES messages
+//
+#if BEAST_SHA1_SSE2
+struct vec
+{
+    __m128i lo;
+    __m128i hi;
+
+    static
+    vec
+    load(lanes const& p)
+    {
+        return {
+            _mm_loadu_si128(reinterpret_cast<__m128i const*>(&p[0])),
+            _mm_loadu_si128(reinterpret_cast<__m128i const*>(&p[4]))};
+    }
+
+    static
+    vec
+    fill(std::uint32_t x)
+    {
+        auto const v = _mm_set1_epi32(static_cast<int>(x));
+        return {v, v};
+    }
+
+    void
+    store(lanes& p) const
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&p[0]), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&p[4]), hi);
+    }
+
+    friend
+    vec
+    operator+(vec const& a, vec const& b)
+    {
+        return {_mm_add_epi32(a.lo, b.lo), _mm_add_epi32(a.hi, b.hi)};
+    }
+
+    friend
+    vec
+    operator^(vec const& a, vec const& b)
+    {
+        return {_mm_xor_si128(a.lo, b.lo), _mm_xor_si128(a.hi, b.hi)};
+    }
+
+    friend
+    vec
+    operator&(vec const& a, vec const& b)
+    {
+        return {_mm_and_si128(a.lo, b.lo), _mm_and_si128(a.hi, b.hi)};
+    }
+
+    friend
+    vec
+    operator|(vec const& a, vec const& b)
+    {
+        return {_mm_or_si128(a.lo, b.lo), _mm_or_si128(a.hi, b.hi)};
+    }
+};
+
+template<int N>
+inline
+vec
+rol(vec const& a)
+{
+    return {
+        _mm_or_si128(_mm_slli_epi32(a.lo, N), _mm_srli_epi32(a.lo, 32 - N)),
+        _mm_or_si128(_mm_slli_epi32(a.hi, N), _mm_srli_epi32(a.hi, 32 - N))};
+}
+#else
+struct vec
+{
+    lanes v;
+
+    static
+    vec
+    load(lanes const& p)
+    {
+        vec r;
+        std::memcpy(r.v, p, sizeof(r.v));
+        return r;
+    }
+
+    static
+    vec
+    fill(std::uint32_t x)
+    {
+        vec r;
+        for(std::size_t l = 0; l < LANES; ++l)
+            r.v[l] = x;
+        return r;
+    }
+
+    void
+    store(lanes& p) const
+    {
+        std::memcpy(p, v, sizeof(v));
+    }
+
+    template<class F>
+    static
+    vec
+    apply(vec const& a, vec const& b, F const& f)
+    {
+        vec r;
+        for(std::size_t l = 0; l < LANES; ++l)
+            r.v[l] = f(a.v[l], b.v[l]);
+        return r;
+    }
+
+    friend
+    vec
+    operator+(vec const& a, vec const& b)
+    {
+        return apply(a, b, [](std::uint32_t x, std::uint32_t y)
+            { return x + y; });
+    }
+
+    friend
+    vec
+    operator^(vec const& a, vec const& b)
+    {
+        return apply(a, b, [](std::uint32_t x, std::uint32_t y)
+            { return x ^ y; });
+    }
+
+    friend
+    vec
+    operator&(vec const& a, vec const& b)
+    {
+        return apply(a, b, [](std::uint32_t x, std::uint32_t y)
+            { return x & y; });
+    }
+
+    friend
+    vec
+    operator|(vec const& a, vec const& b)
+    {
+        return apply(a, b, [](std::uint32_t x, std::uint32_t y)
+            { return x | y; });
+    }
+};
+
+template<int N>
+inline
+vec
+rol(vec const& a)
+{
+    vec r;
+    for(std::size_t l = 0; l < LANES; ++l)
+        r.v[l] = rol(a.v[l], N);
+    return r;
+}
+#endif
+
+struct f_ch
+{
+    vec
+    operator()(vec const& x, vec const& y, vec const& z) const
+    {
+        return (x&(y^z))^z;
+    }
+};
+
+struct f_parity
+{
+    vec
+    operator()(vec const& x, vec const& y, vec const& z) const
+    {
+        return x^y^z;
+    }
+};
+
+struct f_maj
+{
+    vec
+    operator()(vec const& x, vec const& y, vec const& z) const
+    {
+        return ((x|y)&z)|(x&y);
+    }
+};
+
+// One round for every lane. As in R0 through R4, the
+// variables are rotated by the caller instead of moved.
+//
+template<class F>
+inline
+void
+round_n(vec const& v, vec& w, vec const& x, vec const& y,
+    vec& z, vec* m, std::size_t i, vec const& k, F const& f)
+{
+    vec t;
+    if(i < 16)
+    {
+        t = m[i];
+    }
+    else
+    {
+        t = rol<1>(m[(i+13)&15] ^ m[(i+8)&15] ^
+            m[(i+2)&15] ^ m[i&15]);
+        m[i&15] = t;
+    }
+    z = z + f(w, x, y) + t + k + rol<5>(v);
+    w = rol<30>(w);
+}
+
+template<class F>
+inline
+void
+rounds_n(vec (&s)[5], vec* m,
+    std::size_t first, std::uint32_t k, F const& f)
+{
+    auto const kv = vec::fill(k);
+    for(auto i = first; i < first + 20; i += 5)
+    {
+        round_n(s[0], s[1], s[2], s[3], s[4], m, i,   kv, f);
+        round_n(s[4], s[0], s[1], s[2], s[3], m, i+1, kv, f);
+        round_n(s[3], s[4], s[0], s[1], s[2], m, i+2, kv, f);
+        round_n(s[2], s[3], s[4], s[0], s[1], m, i+3, kv, f);
+        round_n(s[1], s[2], s[3], s[4], s[0], m, i+4, kv, f);
+    }
+}
+
+/*  Compress one block in each of LANES messages.
+
+    The words of the state and of the message schedule hold
+    one value per lane, so each round operates on all of the
+    messages at once using SSE2 when it is available.
+*/
+template<class = void>
+void
+transform_n(lanes (&digest)[5], lanes const (&block)[BLOCK_INTS])
+{
+    vec m[BLOCK_INTS];
+    for(std::size_t i = 0; i < BLOCK_INTS; ++i)
+        m[i] = vec::load(block[i]);
+    vec s[5];
+    for(std::size_t i = 0; i < 5; ++i)
+        s[i] = vec::load(digest[i]);
+    rounds_n(s, m,  0, 0x5a827999, f_ch{});
+    rounds_n(s, m, 20, 0x6ed9eba1, f_parity{});
+    rounds_n(s, m, 40, 0x8f1bbcdc, f_maj{});
+    rounds_n(s, m, 60, 0xca62c1d6, f_parity{});
+    for(std::size_t i = 0; i < 5; ++i)
+        (vec::load(digest[i]) + s[i]).store(digest[i]);
+}
+
 } // sha1
 
 struct sha1_context
@@ -303,6 +598,79 @@ finish(sha1_context& ctx, void* digest) noexcept
     }
 }
 
+/** Compute the digests of several messages of the same size.
+
+    Up to `sha1::LANES` messages are hashed together, which
+    is faster than hashing them one after the other when
+    the messages are short.
+
+    @param n The number of messages.
+
+    @param messages Pointers to the messages.
+
+    @param size The size of each message in bytes.
+
+    @param digests Pointers to the storage for each digest,
+    which must have room for `sha1_context::digest_size` bytes.
+*/
+template<class = void>
+void
+sha1_n(std::size_t n, void const* const* messages,
+    std::size_t size, void* const* digests) noexcept
+{
+    using sha1::BLOCK_INTS;
+    using sha1::BLOCK_BYTES;
+    using sha1::LANES;
+    auto const blocks = (size + 8) / BLOCK_BYTES + 1;
+    for(std::size_t first = 0; first < n; first += LANES)
+    {
+        auto const count = (std::min)(n - first, LANES);
+        if(count == 1)
+        {
+            sha1_context ctx;
+            init(ctx);
+            update(ctx, messages[first], size);
+            finish(ctx, digests[first]);
+            continue;
+        }
+        std::uint32_t digest[5][LANES];
+        for(std::size_t l = 0; l < LANES; ++l)
+        {
+            digest[0][l] = 0x67452301;
+            digest[1][l] = 0xefcdab89;
+            digest[2][l] = 0x98badcfe;
+            digest[3][l] = 0x10325476;
+            digest[4][l] = 0xc3d2e1f0;
+        }
+        for(std::size_t i = 0; i < blocks; ++i)
+        {
+            std::uint32_t w[BLOCK_INTS][LANES] = {};
+            for(std::size_t l = 0; l < count; ++l)
+            {
+                std::uint32_t block[BLOCK_INTS];
+                sha1::pad_block(reinterpret_cast<
+                    std::uint8_t const*>(messages[first + l]),
+                        size, i, block);
+                for(std::size_t j = 0; j < BLOCK_INTS; ++j)
+                    w[j][l] = block[j];
+            }
+            sha1::transform_n(digest, w);
+        }
+        for(std::size_t l = 0; l < count; ++l)
+        {
+            auto const d = reinterpret_cast<
+                std::uint8_t*>(digests[first + l]);
+            for(std::size_t i = 0; i < 5; ++i)
+            {
+                d[4*i+3] =  digest[i][l]        & 0xff;
+                d[4*i+2] = (digest[i][l] >>  8) & 0xff;
+                d[4*i+1] = (digest[i][l] >> 16) & 0xff;
+                d[4*i+0] = (digest[i][l] >> 24) & 0xff;
+            }
+        }
+    }
+}
+
 } // detail
 } // beast
 
@@ -0,0 +1,122 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef BEAST_WEBSOCKET_DETAIL_FRAGMENT_HPP
+#define BEAST_WEBSOCKET_DETAIL_FRAGMENT_HPP
+
+#include <beast/core/error.hpp>
+#include <boost/asio/socket_base.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <utility>
+
+namespace beast {
+namespace websocket {
+namespace detail {
+
+// Chooses the size of automatic fragments.
+//
+// Fragments which take long to send are made smaller, so
+// that control frames are not held up behind them on slow
+// links, and so are the fragments sent while a control
+// frame is waiting. Fragments which are sent quickly are
+// made larger, to save frame headers and system calls.
+//
+class fragment_sizer
+{
+    std::size_t min_;
+    std::size_t max_;
+    std::size_t size_;
+    std::chrono::steady_clock::time_point start_;
+
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    // A fragment taking longer than this to send is halved,
+    // and one taking less than a quarter of it is doubled.
+    static
+    clock_type::duration
+    target()
+    {
+        return std::chrono::milliseconds(10);
+    }
+
+    fragment_sizer(std::size_t min_size, std::size_t max_size)
+        : min_(min_size)
+        , max_(max_size)
+        , size_(max_size)
+    {
+    }
+
+    std::size_t
+    size() const
+    {
+        return size_;
+    }
+
+    // Start over from a size suggested by the connection
+    void
+    reset(std::size_t hint)
+    {
+        size_ = (std::min)(max_, (std::max)(min_, hint));
+    }
+
+    // Called before sending a fragment
+    void
+    begin()
+    {
+        start_ = clock_type::now();
+    }
+
+    // Called after sending a fragment
+    void
+    end(bool waiting)
+    {
+        update(clock_type::now() - start_, waiting);
+    }
+
+    void
+    update(clock_type::duration elapsed, bool waiting)
+    {
+        if(waiting || elapsed > target())
+            size_ = (std::max)(min_, size_ / 2);
+        else if(elapsed < target() / 4)
+            size_ = (std::min)(max_, size_ * 2);
+    }
+};
+
+// Returns the size of the send buffer of the stream's
+// lowest layer, or zero if that is not a socket.
+//
+template<class Stream>
+auto
+send_buffer_size(Stream& s, int) ->
+    decltype(s.lowest_layer().get_option(std::declval<
+        boost::asio::socket_base::send_buffer_size&>(),
+            std::declval<error_code&>()), std::size_t{})
+{
+    boost::asio::socket_base::send_buffer_size o;
+    error_code ec;
+    s.lowest_layer().get_option(o, ec);
+    if(ec || o.value() <= 0)
+        return 0;
+    return static_cast<std::size_t>(o.value());
+}
+
+template<class Stream>
+std::size_t
+send_buffer_size(Stream&, long)
+{
+    return 0;
+}
+
+} // detail
+} // websocket
+} // beast
+
+#endif
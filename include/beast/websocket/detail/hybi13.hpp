@@ -13,8 +13,10 @@
 #include <beast/core/detail/base64.hpp>
 #include <beast/core/detail/sha1.hpp>
 #include <boost/assert.hpp>
+#include <algorithm>
 #include <array>
 #include <cstdint>
+#include <cstring>
 #include <string>
 #include <type_traits>
 
@@ -64,6 +66,57 @@ make_sec_ws_accept(sec_ws_accept_type& accept,
         accept.data(), &digest[0], sizeof(digest)));
 }
 
+/*  Compute the Sec-WebSocket-Accept values for several keys.
+
+    Keys of the size produced by conforming clients are
+    hashed together, several at a time, which is faster
+    than computing each value separately.
+*/
+template<class = void>
+void
+make_sec_ws_accept(sec_ws_accept_type* accepts,
+    string_view const* keys, std::size_t n)
+{
+    using beast::detail::sha1::LANES;
+    static string_view const guid =
+        "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    static std::size_t constexpr size =
+        sec_ws_key_type::max_size_n + 36;
+    for(std::size_t first = 0; first < n; first += LANES)
+    {
+        auto const count = (std::min)(n - first, LANES);
+        char m[LANES][size];
+        char digest[LANES][beast::detail::sha1_context::digest_size];
+        void const* mp[LANES];
+        void* dp[LANES];
+        std::size_t index[LANES];
+        std::size_t batch = 0;
+        for(std::size_t i = first; i < first + count; ++i)
+        {
+            if(keys[i].size() != sec_ws_key_type::max_size_n)
+            {
+                make_sec_ws_accept(accepts[i], keys[i]);
+                continue;
+            }
+            std::memcpy(&m[batch][0],
+                keys[i].data(), keys[i].size());
+            std::memcpy(&m[batch][keys[i].size()],
+                guid.data(), guid.size());
+            mp[batch] = &m[batch][0];
+            dp[batch] = &digest[batch][0];
+            index[batch++] = i;
+        }
+        beast::detail::sha1_n(batch, mp, size, dp);
+        for(std::size_t j = 0; j < batch; ++j)
+        {
+            auto& accept = accepts[index[j]];
+            accept.resize(accept.max_size());
+            accept.resize(beast::detail::base64::encode(
+                accept.data(), &digest[j][0], sizeof(digest[j])));
+        }
+    }
+}
+
 } // detail
 } // websocket
 } // beast
@@ -0,0 +1,583 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef BEAST_WEBSOCKET_DETAIL_KEEPALIVE_HPP
+#define BEAST_WEBSOCKET_DETAIL_KEEPALIVE_HPP
+
+#include <beast/core/error.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/assert.hpp>
+#include <boost/intrusive/list.hpp>
+#include <boost/optional.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace beast {
+namespace websocket {
+namespace detail {
+
+class keepalive_service;
+
+// Shared by a stream, the wheel and the pings and closes
+// which the keepalive performs on its own, since these may
+// still be pending when the stream is destroyed.
+//
+// `alive` and `count` are only accessed on the stream's
+// side: in its strand if it has one, else on the single
+// thread running the io_service.
+//
+struct keepalive_ops
+{
+    // `false` once the stream is destroyed
+    bool alive = true;
+
+    // Number of operations in flight
+    std::size_t count = 0;
+
+    // The strand of the stream's operations, if any
+    boost::optional<boost::asio::io_service::strand> strand;
+};
+
+// Completion handler for the pings and closes
+// which the keepalive performs on its own.
+//
+// Every step of the operation is run through the
+// invoke hook, which runs it in the stream's strand
+// and drops it without touching the stream once the
+// stream is gone.
+//
+class keepalive_handler
+{
+    std::shared_ptr<keepalive_ops> sp_;
+
+    template<class Function>
+    struct invoker
+    {
+        std::shared_ptr<keepalive_ops> sp;
+        Function f;
+
+        void
+        operator()()
+        {
+            if(sp->alive)
+                f();
+        }
+    };
+
+public:
+    explicit
+    keepalive_handler(
+            std::shared_ptr<keepalive_ops> const& sp)
+        : sp_(sp)
+    {
+        ++sp_->count;
+    }
+
+    void
+    operator()(error_code const&) const
+    {
+        --sp_->count;
+    }
+
+    template<class Function>
+    friend
+    void
+    asio_handler_invoke(Function&& f, keepalive_handler* h)
+    {
+        if(h->sp_->strand)
+            h->sp_->strand->dispatch(invoker<
+                typename std::decay<Function>::type>{
+                    h->sp_, std::forward<Function>(f)});
+        else if(h->sp_->alive)
+            f();
+    }
+};
+
+// The keepalive state of one stream.
+//
+// While it is scheduled, the object is linked into one
+// slot of the wheel owned by the io_service's keepalive
+// service. All times are measured in ticks of the wheel.
+//
+// The hook and `rounds_` belong to the wheel and are
+// guarded by its mutex. Everything else is used on the
+// stream's side, where the wheel runs `expire` too.
+//
+class keepalive_timer
+    : public boost::intrusive::list_base_hook<
+        boost::intrusive::link_mode<
+            boost::intrusive::auto_unlink>>
+{
+    friend class keepalive_service;
+
+    keepalive_service* svc_;
+
+    // Revolutions of the wheel left before expiring
+    std::uint64_t rounds_ = 0;
+
+protected:
+    std::shared_ptr<keepalive_ops> ops_;
+
+public:
+    // Settings, zero means disabled
+    std::uint64_t ping = 0;
+    std::uint64_t pong = 0;
+    std::uint64_t idle = 0;
+
+    // When a frame, or message data, was last seen
+    std::uint64_t last_rx = 0;
+    std::uint64_t last_msg = 0;
+
+    // When the last automatic ping was sent, and
+    // whether a response to it is still awaited
+    std::uint64_t ping_at = 0;
+    bool ping_pending = false;
+
+    explicit
+    keepalive_timer(keepalive_service& svc)
+        : svc_(&svc)
+        , ops_(std::make_shared<keepalive_ops>())
+    {
+    }
+
+    // Run the keepalive in the strand, or
+    // without one if the pointer is null.
+    inline
+    void
+    strand(boost::asio::io_service::strand* s);
+
+    inline
+    virtual
+    ~keepalive_timer();
+
+    // Called when the handshake completes
+    inline
+    void
+    start();
+
+    // Called when the option is disabled
+    inline
+    void
+    stop();
+
+    // Called for each frame received
+    inline
+    void
+    touch(bool data);
+
+    // Called for each message sent
+    inline
+    void
+    touch_msg();
+
+    // Called on the stream's side when the time is due
+    inline
+    void
+    expire();
+
+protected:
+    // Returns `true` if the connection is usable
+    virtual
+    bool
+    is_open() const = 0;
+
+    // Send a ping
+    virtual
+    void
+    on_ping() = 0;
+
+    // The peer did not respond to a ping in time
+    virtual
+    void
+    on_pong_timeout() = 0;
+
+    // No message data was sent or received in time
+    virtual
+    void
+    on_idle() = 0;
+};
+
+template<class = void>
+struct keepalive_service_id
+{
+    static boost::asio::io_service::id id;
+};
+
+template<class _>
+boost::asio::io_service::id
+keepalive_service_id<_>::id;
+
+// A timing wheel shared by all streams of an io_service.
+//
+// The wheel advances one slot per tick and expires the
+// timers found in that slot, so the cost of each tick is
+// proportional to the number of timers which are due
+// rather than to the number of streams. Timers further
+// away than one revolution wait in the slot for the
+// remaining number of rounds. Only one asio timer is
+// used, and it is only armed while a stream is scheduled.
+//
+// The wheel is guarded by a mutex, since streams running
+// on different threads schedule and cancel their timers.
+// The timer handler does not call into the streams. It
+// posts each due timer to the strand of its stream, or to
+// the io_service for a stream without one, where `expire`
+// checks that the stream still exists.
+//
+class keepalive_service
+    : public boost::asio::io_service::service
+    , public keepalive_service_id<>
+{
+    using clock_type = std::chrono::steady_clock;
+
+    using list_type = boost::intrusive::list<
+        keepalive_timer, boost::intrusive::
+            constant_time_size<false>>;
+
+    static std::size_t constexpr slots = 1024;
+
+    std::mutex mutable mutex_;
+    boost::asio::io_service& ios_;
+    std::vector<list_type> wheel_;
+    boost::asio::steady_timer timer_;
+    clock_type::time_point start_;
+    std::atomic<std::uint64_t> now_{0};
+    std::size_t count_ = 0;
+    bool running_ = false;
+
+public:
+    /// The duration of one tick of the wheel
+    static
+    std::chrono::milliseconds
+    tick()
+    {
+        return std::chrono::milliseconds(100);
+    }
+
+    /// Convert a duration to ticks, rounding up
+    static
+    std::uint64_t
+    to_ticks(std::chrono::milliseconds d)
+    {
+        if(d.count() <= 0)
+            return 0;
+        return static_cast<std::uint64_t>(
+            (d.count() + tick().count() - 1) /
+                tick().count());
+    }
+
+    explicit
+    keepalive_service(boost::asio::io_service& ios)
+        : boost::asio::io_service::service(ios)
+        , ios_(ios)
+        , wheel_(slots)
+        , timer_(ios)
+        , start_(clock_type::now())
+    {
+    }
+
+    ~keepalive_service()
+    {
+        clear();
+    }
+
+    void
+    shutdown_service()
+    {
+        clear();
+        error_code ec;
+        timer_.cancel(ec);
+    }
+
+    /// Returns the current time in ticks
+    std::uint64_t
+    now() const
+    {
+        return now_;
+    }
+
+    /// Returns the number of scheduled timers
+    std::size_t
+    size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return count_;
+    }
+
+    /// Expire a timer after `n` ticks
+    void
+    schedule(keepalive_timer& t, std::uint64_t n)
+    {
+        BOOST_ASSERT(t.svc_ == this);
+        std::lock_guard<std::mutex> lock(mutex_);
+        unlink(t);
+        if(! running_)
+        {
+            // catch up with the clock before
+            // choosing the slot.
+            now_ = elapsed();
+            arm();
+        }
+        if(n == 0)
+            n = 1;
+        t.rounds_ = (n - 1) / slots;
+        wheel_[(now_ + n) % slots].push_back(t);
+        ++count_;
+    }
+
+    /// Remove a timer from the wheel
+    void
+    cancel(keepalive_timer& t)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        unlink(t);
+    }
+
+    /// Set the strand used to expire a timer
+    void
+    strand(keepalive_timer& t,
+        boost::asio::io_service::strand* s)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(s)
+            t.ops_->strand.emplace(*s);
+        else
+            t.ops_->strand = boost::none;
+    }
+
+private:
+    void
+    unlink(keepalive_timer& t)
+    {
+        if(! t.is_linked())
+            return;
+        t.unlink();
+        --count_;
+    }
+
+    std::uint64_t
+    elapsed() const
+    {
+        return static_cast<std::uint64_t>(
+            (clock_type::now() - start_) / tick());
+    }
+
+    void
+    arm()
+    {
+        running_ = true;
+        timer_.expires_at(start_ + tick() *
+            static_cast<std::chrono::milliseconds::rep>(now_ + 1));
+        timer_.async_wait(
+            [this](error_code const& ec)
+            {
+                on_timer(ec);
+            });
+    }
+
+    void
+    on_timer(error_code const& ec)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(ec == boost::asio::error::operation_aborted)
+        {
+            running_ = false;
+            return;
+        }
+        auto const target = elapsed();
+        while(now_ < target && count_ > 0)
+        {
+            auto const slot = ++now_ % slots;
+            list_type due;
+            due.splice(due.end(), wheel_[slot]);
+            while(! due.empty())
+            {
+                auto& t = due.front();
+                due.pop_front();
+                if(t.rounds_ > 0)
+                {
+                    --t.rounds_;
+                    wheel_[slot].push_back(t);
+                    continue;
+                }
+                --count_;
+                post(t);
+            }
+        }
+        if(count_ == 0)
+        {
+            running_ = false;
+            return;
+        }
+        if(now_ < target)
+            now_ = target;
+        arm();
+    }
+
+    // Expire the timer on its stream's side. Posting
+    // never runs the function, so the lock may be held.
+    void
+    post(keepalive_timer& t)
+    {
+        auto const p = &t;
+        auto const ops = t.ops_;
+        auto f =
+            [p, ops]
+            {
+                // may reschedule the timer
+                if(ops->alive)
+                    p->expire();
+            };
+        if(ops->strand)
+            ops->strand->post(std::move(f));
+        else
+            ios_.post(std::move(f));
+    }
+
+    void
+    clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for(auto& slot : wheel_)
+        {
+            while(! slot.empty())
+            {
+                auto& t = slot.front();
+                slot.pop_front();
+                t.svc_ = nullptr;
+            }
+        }
+        count_ = 0;
+    }
+};
+
+keepalive_timer::
+~keepalive_timer()
+{
+    // Operations still in flight, and a pending
+    // expiration, must not touch the stream any more.
+    ops_->alive = false;
+    if(svc_)
+        svc_->cancel(*this);
+}
+
+void
+keepalive_timer::
+start()
+{
+    if(! svc_)
+        return;
+    last_rx = svc_->now();
+    last_msg = last_rx;
+    ping_at = last_rx;
+    ping_pending = false;
+    if(ping != 0 || idle != 0)
+        svc_->schedule(*this, ping != 0 ? ping : idle);
+    else
+        svc_->cancel(*this);
+}
+
+void
+keepalive_timer::
+stop()
+{
+    if(svc_)
+        svc_->cancel(*this);
+}
+
+void
+keepalive_timer::
+strand(boost::asio::io_service::strand* s)
+{
+    if(svc_)
+        svc_->strand(*this, s);
+}
+
+void
+keepalive_timer::
+touch(bool data)
+{
+    if(! svc_)
+        return;
+    last_rx = svc_->now();
+    if(data)
+        last_msg = last_rx;
+}
+
+void
+keepalive_timer::
+touch_msg()
+{
+    if(! svc_)
+        return;
+    last_msg = svc_->now();
+}
+
+void
+keepalive_timer::
+expire()
+{
+    if(! svc_ || ! is_open())
+        return;
+    auto const now = svc_->now();
+    if(idle != 0 && now - last_msg >= idle)
+        return on_idle();
+    // Any frame received counts as the response
+    if(ping_pending && last_rx >= ping_at)
+        ping_pending = false;
+    if(ping_pending)
+    {
+        if(now - ping_at >= pong)
+            return on_pong_timeout();
+    }
+    else if(ping != 0 && now - std::max(
+        last_rx, ping_at) >= ping)
+    {
+        ping_at = now;
+        ping_pending = pong != 0;
+        on_ping();
+    }
+    // Find the next time something is due
+    std::uint64_t next = 0;
+    auto const due =
+        [&](std::uint64_t t)
+        {
+            auto const n = t > now ? t - now : 1;
+            if(next == 0 || n < next)
+                next = n;
+        };
+    if(idle != 0)
+        due(last_msg + idle);
+    if(ping_pending)
+    {
+        due(ping_at + pong);
+        // wake up for the next ping in
+        // case the response arrives first
+        if(ping != 0 && ping_at + ping > now)
+            due(ping_at + ping);
+    }
+    else if(ping != 0)
+    {
+        due(std::max(last_rx, ping_at) + ping);
+    }
+    svc_->schedule(*this, next);
+}
+
+} // detail
+} // websocket
+} // beast
+
+#endif
@@ -73,9 +73,135 @@ maskgen_t<_>::rekey()
 #endif
 }
 
-// VFALCO NOTE This generator has 5KB of state!
-//using maskgen = maskgen_t<std::mt19937>;
-using maskgen = maskgen_t<std::minstd_rand>;
+// Per-thread source of mask keys
+//
+// Keys are taken from a ChaCha20 keystream whose key and
+// nonce are read from std::random_device once per thread,
+// so opening a connection costs no system call. Each block
+// of the cipher yields sixteen keys.
+//
+class mask_source
+{
+    std::uint32_t state_[16];
+    std::uint32_t keys_[16];
+    unsigned i_ = 16;
+
+    static
+    std::uint32_t
+    rotl(std::uint32_t v, int n)
+    {
+        return (v << n) | (v >> (32 - n));
+    }
+
+    static
+    void
+    quarter_round(std::uint32_t* x,
+        int a, int b, int c, int d)
+    {
+        x[a] += x[b]; x[d] = rotl(x[d] ^ x[a], 16);
+        x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 12);
+        x[a] += x[b]; x[d] = rotl(x[d] ^ x[a],  8);
+        x[c] += x[d]; x[b] = rotl(x[b] ^ x[c],  7);
+    }
+
+    void
+    init(std::uint32_t const* seed)
+    {
+        state_[0] = 0x61707865;
+        state_[1] = 0x3320646e;
+        state_[2] = 0x79622d32;
+        state_[3] = 0x6b206574;
+        for(int i = 0; i < 12; ++i)
+            state_[4 + i] = seed[i];
+        i_ = 16;
+    }
+
+    void
+    rekey()
+    {
+        std::random_device rng;
+        std::uint32_t seed[12];
+        for(auto& v : seed)
+            v = rng();
+        seed[8] = 0;
+        init(seed);
+    }
+
+    void
+    refill()
+    {
+        auto& x = keys_;
+        for(int i = 0; i < 16; ++i)
+            x[i] = state_[i];
+        for(int i = 0; i < 10; ++i)
+        {
+            quarter_round(x, 0, 4,  8, 12);
+            quarter_round(x, 1, 5,  9, 13);
+            quarter_round(x, 2, 6, 10, 14);
+            quarter_round(x, 3, 7, 11, 15);
+            quarter_round(x, 0, 5, 10, 15);
+            quarter_round(x, 1, 6, 11, 12);
+            quarter_round(x, 2, 7,  8, 13);
+            quarter_round(x, 3, 4,  9, 14);
+        }
+        for(int i = 0; i < 16; ++i)
+            x[i] += state_[i];
+        i_ = 0;
+        // Never reuse the keystream
+        if(++state_[12] == 0)
+            rekey();
+    }
+
+public:
+    using result_type = std::uint32_t;
+
+    mask_source()
+    {
+        rekey();
+    }
+
+    // Construct with a fixed cipher key, counter and
+    // nonce, in the word order of RFC 7539. For tests.
+    explicit
+    mask_source(std::uint32_t const (&seed)[12])
+    {
+        init(seed);
+    }
+
+    static
+    mask_source&
+    instance()
+    {
+        static thread_local mask_source ms;
+        return ms;
+    }
+
+    // Returns the next word of the keystream
+    result_type
+    next()
+    {
+        if(i_ == 16)
+            refill();
+        return keys_[i_++];
+    }
+
+    // Returns a non-zero mask key
+    result_type
+    operator()()
+    {
+        for(;;)
+            if(auto key = next())
+                return key;
+    }
+};
+
+// Returns a new mask key from the calling thread's source
+inline
+std::uint32_t
+make_mask_key()
+{
+    return mask_source::instance()();
+}
 
 //------------------------------------------------------------------------------
 
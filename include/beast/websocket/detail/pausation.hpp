@@ -11,6 +11,7 @@
 #include <beast/core/handler_ptr.hpp>
 #include <boost/assert.hpp>
 #include <array>
+#include <list>
 #include <memory>
 #include <new>
 #include <utility>
@@ -125,6 +126,12 @@ public:
         return *this;
     }
 
+    bool
+    empty() const
+    {
+        return base_ == nullptr;
+    }
+
     template<class F>
     void
     emplace(F&& f);
@@ -155,6 +162,71 @@ pausation::emplace(F&& f)
     base_ = reinterpret_cast<base*>(&buf_[0]);
 }
 
+//------------------------------------------------------------------------------
+
+// A first-in, first-out sequence of suspended operations.
+// The front element is stored inline, so that the common
+// case of a single suspended operation does not allocate.
+//
+class pausation_queue
+{
+    pausation p_;
+    std::list<pausation> q_;
+
+public:
+    bool
+    empty() const
+    {
+        return p_.empty();
+    }
+
+    std::size_t
+    size() const
+    {
+        return p_.empty() ? 0 : 1 + q_.size();
+    }
+
+    // Append an operation to the back
+    template<class F>
+    void
+    emplace(F&& f)
+    {
+        if(p_.empty())
+        {
+            p_.emplace(std::forward<F>(f));
+            return;
+        }
+        q_.emplace_back();
+        q_.back().emplace(std::forward<F>(f));
+    }
+
+    // Insert an operation at the front
+    template<class F>
+    void
+    emplace_front(F&& f)
+    {
+        if(! p_.empty())
+            q_.emplace_front(std::move(p_));
+        p_.emplace(std::forward<F>(f));
+    }
+
+    // Remove and invoke the front operation
+    bool
+    maybe_invoke()
+    {
+        if(p_.empty())
+            return false;
+        pausation p{std::move(p_)};
+        if(! q_.empty())
+        {
+            p_ = std::move(q_.front());
+            q_.pop_front();
+        }
+        // invocation can emplace new operations
+        return p.maybe_invoke();
+    }
+};
+
 } // detail
 } // websocket
 } // beast
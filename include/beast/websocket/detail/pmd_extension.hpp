@@ -8,14 +8,22 @@
 #ifndef BEAST_WEBSOCKET_DETAIL_PMD_EXTENSION_HPP
 #define BEAST_WEBSOCKET_DETAIL_PMD_EXTENSION_HPP
 
+#include <beast/core/buffers_adapter.hpp>
 #include <beast/core/error.hpp>
+#include <beast/core/static_string.hpp>
 #include <beast/core/consuming_buffers.hpp>
+#include <beast/core/detail/buffer_pool.hpp>
 #include <beast/core/detail/ci_char_traits.hpp>
 #include <beast/zlib/deflate_stream.hpp>
 #include <beast/zlib/inflate_stream.hpp>
 #include <beast/websocket/option.hpp>
 #include <beast/http/rfc7230.hpp>
 #include <boost/asio/buffer.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
 #include <utility>
 
 namespace beast {
@@ -255,7 +263,7 @@ pmd_negotiate(
     }
     config.accept = true;
 
-    std::string s = "permessage-deflate";
+    static_string<256> s = "permessage-deflate";
 
     config.server_no_context_takeover =
         offer.server_no_context_takeover ||
@@ -285,7 +293,7 @@ pmd_negotiate(
             config.server_max_window_bits = 9;
 
         s += "; server_max_window_bits=";
-        s += std::to_string(
+        s += to_static_string(
             config.server_max_window_bits);
     }
 
@@ -298,7 +306,7 @@ pmd_negotiate(
         if(config.client_max_window_bits < 15)
         {
             s += "; client_max_window_bits=";
-            s += std::to_string(
+            s += to_static_string(
                 config.client_max_window_bits);
         }
         break;
@@ -323,12 +331,13 @@ pmd_negotiate(
             o.client_max_window_bits,
                 offer.client_max_window_bits);
         s += "; client_max_window_bits=";
-        s += std::to_string(
+        s += to_static_string(
             config.client_max_window_bits);
         break;
     }
     if(config.accept)
-        fields.replace("Sec-WebSocket-Extensions", s);
+        fields.replace("Sec-WebSocket-Extensions",
+            string_view{s.data(), s.size()});
 }
 
 // Normalize the server's response
@@ -350,14 +359,91 @@ pmd_normalize(pmd_offer& offer)
 
 //--------------------------------------------------------------------
 
+// Returns `true` if the start of a payload looks compressible.
+//
+// This estimates the entropy of the bytes in a small sample,
+// and compares it to the largest value the sample can show.
+// Random data, such as compressed or encrypted payloads,
+// comes close to that limit.
+//
+template<class ConstBufferSequence>
+bool
+pmd_compressible(ConstBufferSequence const& buffers)
+{
+    using boost::asio::buffer_cast;
+    using boost::asio::buffer_size;
+    std::size_t constexpr limit = 512;
+    std::uint16_t count[256] = {};
+    std::size_t n = 0;
+    for(boost::asio::const_buffer b : buffers)
+    {
+        auto const p =
+            buffer_cast<std::uint8_t const*>(b);
+        auto const len = (std::min)(
+            buffer_size(b), limit - n);
+        for(std::size_t i = 0; i < len; ++i)
+            ++count[p[i]];
+        n += len;
+        if(n == limit)
+            break;
+    }
+    // Too small to tell
+    if(n < 32)
+        return true;
+    double h = 0;
+    for(auto const c : count)
+    {
+        if(c == 0)
+            continue;
+        auto const f = static_cast<double>(c) / n;
+        h -= f * std::log2(f);
+    }
+    return h < 0.9 * std::log2(static_cast<double>(
+        (std::min<std::size_t>)(n, 256)));
+}
+
+// The marker removed from the end of each compressed message
+//
+inline
+boost::asio::const_buffer
+pmd_tail()
+{
+    static std::uint8_t constexpr b[4] = {
+        0x00, 0x00, 0xff, 0xff };
+    return {&b[0], sizeof(b)};
+}
+
+template<class DynamicBuffer>
+std::size_t
+pmd_read_size(DynamicBuffer& buffer, std::size_t n)
+{
+    return read_size_helper(buffer, n);
+}
+
+template<class MutableBufferSequence>
+std::size_t
+pmd_read_size(
+    buffers_adapter<MutableBufferSequence>& buffer,
+        std::size_t n)
+{
+    return (std::min)(buffer.max_size(), n);
+}
+
 // Decompress into a DynamicBuffer
 //
+// At most `limit` bytes are produced, and `limit` is reduced
+// by the number of bytes produced. `in` is adjusted to refer
+// to the input which was not consumed. Returns `true` if
+// the limit was reached, in which case the stream may hold
+// more output.
+//
 template<class InflateStream, class DynamicBuffer>
-void
+bool
 inflate(
     InflateStream& zi,
     DynamicBuffer& buffer,
-    boost::asio::const_buffer const& in,
+    boost::asio::const_buffer& in,
+    std::size_t& limit,
     error_code& ec)
 {
     using boost::asio::buffer_cast;
@@ -365,16 +451,23 @@ inflate(
     zlib::z_params zs;
     zs.avail_in = buffer_size(in);
     zs.next_in = buffer_cast<void const*>(in);
+    bool full = false;
     for(;;)
     {
+        if(limit == 0)
+        {
+            full = true;
+            break;
+        }
         // VFALCO we could be smarter about the size
-        auto const bs = buffer.prepare(
-            read_size_helper(buffer, 65536));
+        auto const bs = buffer.prepare((std::min)(
+            limit, pmd_read_size(buffer, 65536)));
         auto const out = *bs.begin();
         zs.avail_out = buffer_size(out);
         zs.next_out = buffer_cast<void*>(out);
         zi.write(zs, zlib::Flush::sync, ec);
         buffer.commit(zs.total_out);
+        limit -= zs.total_out;
         zs.total_out = 0;
         if( ec == zlib::error::need_buffers ||
             ec == zlib::error::end_of_stream)
@@ -383,85 +476,215 @@ inflate(
             break;
         }
         if(ec)
-            return;
+            break;
     }
+    in = in + zs.total_in;
+    return full;
 }
 
+// Compressed output, held in blocks from the buffer pool.
+//
+// The payload of a frame may span many blocks and is sent
+// with a single gathered write. When the blocks run out the
+// caller sends all but the last one, which may hold part of
+// the flush marker that is removed from the final frame.
+//
+class deflate_buffers
+{
+public:
+    static std::size_t constexpr max_blocks = 16;
+
+    using buffers_type = std::array<
+        boost::asio::mutable_buffer, max_blocks>;
+
+private:
+    std::unique_ptr<std::uint8_t[]> b_[max_blocks];
+    std::size_t block_size_ = 0;
+    std::size_t n_ = 0;
+    std::size_t size_ = 0;
+
+public:
+    deflate_buffers() = default;
+
+    ~deflate_buffers()
+    {
+        consume(size_);
+    }
+
+    // Set the size of the blocks, if none are held
+    void
+    block_size(std::size_t n)
+    {
+        if(n_ == 0)
+            block_size_ = n;
+    }
+
+    // Returns the number of bytes of output
+    std::size_t
+    size() const
+    {
+        return size_;
+    }
+
+    // Returns the number of bytes in the blocks
+    std::size_t
+    capacity() const
+    {
+        return n_ * block_size_;
+    }
+
+    // Returns the output which can be sent
+    // before the compressor is finished.
+    std::size_t
+    ready() const
+    {
+        return n_ > 0 ? (n_ - 1) * block_size_ : 0;
+    }
+
+    // Returns space for more output, which
+    // is empty if all of the blocks are full.
+    boost::asio::mutable_buffer
+    prepare()
+    {
+        if(size_ == capacity())
+        {
+            if(n_ == max_blocks)
+                return {};
+            b_[n_++] = beast::detail::buffer_pool::instance(
+                ).acquire(block_size_);
+        }
+        auto const used = size_ - ready();
+        return {b_[n_ - 1].get() + used,
+            block_size_ - used};
+    }
+
+    void
+    commit(std::size_t n)
+    {
+        size_ += n;
+    }
+
+    // Remove bytes from the end of the output
+    void
+    shrink(std::size_t n)
+    {
+        BOOST_ASSERT(n <= size_);
+        size_ -= n;
+    }
+
+    // Returns the first `n` bytes of output
+    buffers_type
+    data(std::size_t n) const
+    {
+        BOOST_ASSERT(n <= size_);
+        buffers_type v;
+        for(std::size_t i = 0; i < n_ && n > 0; ++i)
+        {
+            auto const len = (std::min)(n, block_size_);
+            v[i] = boost::asio::mutable_buffer{
+                b_[i].get(), len};
+            n -= len;
+        }
+        return v;
+    }
+
+    // Remove `n` bytes from the front, which
+    // must be all of the output or ready().
+    void
+    consume(std::size_t n)
+    {
+        BOOST_ASSERT(n == size_ || n == ready());
+        auto const count =
+            n == size_ ? n_ : n_ - 1;
+        for(std::size_t i = 0; i < count; ++i)
+            beast::detail::buffer_pool::instance().release(
+                std::move(b_[i]), block_size_);
+        if(count < n_)
+            b_[0] = std::move(b_[n_ - 1]);
+        n_ -= count;
+        size_ -= n;
+    }
+};
+
 // Compress a buffer sequence
-// Returns: `true` if more calls are needed
+// Returns: `true` if all of the input was consumed and,
+//          when `fin` is set, flushed. Otherwise the
+//          output is full.
 //
 template<class DeflateStream, class ConstBufferSequence>
 bool
 deflate(
     DeflateStream& zo,
-    boost::asio::mutable_buffer& out,
+    deflate_buffers& out,
     consuming_buffers<ConstBufferSequence>& cb,
     bool fin,
     error_code& ec)
 {
-    using boost::asio::buffer;
     using boost::asio::buffer_cast;
     using boost::asio::buffer_size;
-    BOOST_ASSERT(buffer_size(out) >= 6);
     zlib::z_params zs;
     zs.avail_in = 0;
     zs.next_in = nullptr;
-    zs.avail_out = buffer_size(out);
-    zs.next_out = buffer_cast<void*>(out);
+    auto const write =
+        [&](zlib::Flush flush)
+        {
+            auto const b = out.prepare();
+            if(buffer_size(b) == 0)
+                return false;
+            zs.next_out = buffer_cast<void*>(b);
+            zs.avail_out = buffer_size(b);
+            zo.write(zs, flush, ec);
+            out.commit(buffer_size(b) - zs.avail_out);
+            return true;
+        };
     for(auto const& in : cb)
     {
         zs.avail_in = buffer_size(in);
-        if(zs.avail_in == 0)
-            continue;
         zs.next_in = buffer_cast<void const*>(in);
-        zo.write(zs, zlib::Flush::none, ec);
-        if(ec)
+        while(zs.avail_in > 0)
         {
-            if(ec != zlib::error::need_buffers)
+            if(! write(zlib::Flush::none))
+            {
+                cb.consume(zs.total_in);
+                return false;
+            }
+            if(ec)
                 return false;
-            BOOST_ASSERT(zs.avail_out == 0);
-            BOOST_ASSERT(zs.total_out == buffer_size(out));
-            ec = {};
-            break;
-        }
-        if(zs.avail_out == 0)
-        {
-            BOOST_ASSERT(zs.total_out == buffer_size(out));
-            break;
         }
-        BOOST_ASSERT(zs.avail_in == 0);
     }
     cb.consume(zs.total_in);
-    if(zs.avail_out > 0 && fin)
+    if(! fin)
+        return true;
+    // Inspired by Mark Adler
+    // https://github.com/madler/zlib/issues/149
+    //
+    // A single sync flush ends the message. It is complete
+    // when output space is left over, and since a full block
+    // is offered each time, at most one empty marker block
+    // is ever produced.
+    for(;;)
     {
-        auto const remain = buffer_size(cb);
-        if(remain == 0)
+        if(! write(zlib::Flush::sync))
+            return false;
+        if(ec == zlib::error::need_buffers)
         {
-            // Inspired by Mark Adler
-            // https://github.com/madler/zlib/issues/149
-            //
-            // VFALCO We could do this flush twice depending
-            //        on how much space is in the output.
-            zo.write(zs, zlib::Flush::block, ec);
-            BOOST_ASSERT(! ec || ec == zlib::error::need_buffers);
-            if(ec == zlib::error::need_buffers)
-                ec = {};
-            if(ec)
-                return false;
-            if(zs.avail_out >= 6)
-            {
-                zo.write(zs, zlib::Flush::full, ec);
-                BOOST_ASSERT(! ec);
-                // remove flush marker
-                zs.total_out -= 4;
-                out = buffer(
-                    buffer_cast<void*>(out), zs.total_out);
-                return false;
-            }
+            // Nothing was written since the last
+            // flush, send an empty block instead.
+            // See RFC 7692 section 7.2.3.6
+            ec = {};
+            BOOST_ASSERT(out.size() == 0);
+            *buffer_cast<std::uint8_t*>(out.prepare()) = 0;
+            out.commit(1);
+            return true;
         }
+        if(ec)
+            return false;
+        if(zs.avail_out > 0)
+            break;
     }
-    out = buffer(
-        buffer_cast<void*>(out), zs.total_out);
+    // remove flush marker
+    BOOST_ASSERT(out.size() >= 4);
+    out.shrink(4);
     return true;
 }
 
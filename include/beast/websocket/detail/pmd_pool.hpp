@@ -0,0 +1,86 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef BEAST_WEBSOCKET_DETAIL_PMD_POOL_HPP
+#define BEAST_WEBSOCKET_DETAIL_PMD_POOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace beast {
+namespace websocket {
+namespace detail {
+
+// A per-thread pool of idle compression streams.
+//
+// When context takeover is disabled in a direction, the
+// stream used for it holds no state between messages. Such
+// streams are borrowed from the pool at the start of each
+// message and given back at the end, so the memory used
+// follows the number of messages in flight rather than
+// the number of connections.
+//
+// Streams are given back in an unspecified state; the
+// borrower must reset them with its own settings.
+//
+template<class Stream>
+class pmd_pool
+{
+    std::vector<std::unique_ptr<Stream>> v_;
+
+public:
+    // Largest number of idle streams kept by each thread
+    static std::size_t constexpr max_size = 16;
+
+    static
+    pmd_pool&
+    instance()
+    {
+        static thread_local pmd_pool pool;
+        return pool;
+    }
+
+    std::size_t
+    size() const
+    {
+        return v_.size();
+    }
+
+    std::unique_ptr<Stream>
+    acquire()
+    {
+        if(v_.empty())
+            return std::unique_ptr<Stream>(new Stream);
+        auto p = std::move(v_.back());
+        v_.pop_back();
+        return p;
+    }
+
+    void
+    release(std::unique_ptr<Stream> p)
+    {
+        if(v_.size() < max_size)
+            v_.emplace_back(std::move(p));
+    }
+
+    void
+    clear()
+    {
+        v_.clear();
+    }
+};
+
+template<class Stream>
+std::size_t constexpr pmd_pool<Stream>::max_size;
+
+} // detail
+} // websocket
+} // beast
+
+#endif
@@ -11,13 +11,18 @@
 #include <beast/websocket/error.hpp>
 #include <beast/websocket/option.hpp>
 #include <beast/websocket/rfc6455.hpp>
+#include <beast/websocket/detail/fragment.hpp>
 #include <beast/websocket/detail/frame.hpp>
+#include <beast/websocket/detail/keepalive.hpp>
 #include <beast/websocket/detail/mask.hpp>
 #include <beast/websocket/detail/pausation.hpp>
 #include <beast/websocket/detail/pmd_extension.hpp>
+#include <beast/websocket/detail/pmd_pool.hpp>
 #include <beast/websocket/detail/utf8_checker.hpp>
 #include <beast/http/message.hpp>
 #include <beast/http/string_body.hpp>
+#include <beast/core/multi_buffer.hpp>
+#include <beast/core/detail/buffer_pool.hpp>
 #include <beast/zlib/deflate_stream.hpp>
 #include <beast/zlib/inflate_stream.hpp>
 #include <boost/asio/error.hpp>
@@ -39,8 +44,6 @@ enum class role_type
     server
 };
 
-//------------------------------------------------------------------------------
-
 struct stream_base
 {
 protected:
@@ -48,12 +51,12 @@ protected:
 
     struct op {};
 
-    detail::maskgen maskgen_;               // source of mask keys
     std::size_t rd_msg_max_ =
         16 * 1024 * 1024;                   // max message size
     bool wr_autofrag_ = true;               // auto fragment
     std::size_t wr_buf_size_ = 4096;        // write buffer size
     std::size_t rd_buf_size_ = 4096;        // read buffer size
+    bool pool_bufs_ = false;                // borrow buffers from pool
     opcode wr_opcode_ = opcode::text;       // outgoing message type
     ping_cb ping_cb_;                       // ping callback
     role_type role_;                        // server or client
@@ -64,9 +67,9 @@ protected:
 
     ping_data* ping_data_;                  // where to put the payload
     pausation rd_op_;                       // parked read op
-    pausation wr_op_;                       // parked write op
-    pausation ping_op_;                     // parked ping op
-    close_reason cr_;                       // set from received close frame
+    pausation_queue wr_op_;                 // parked write ops
+    pausation_queue ping_op_;               // parked ping ops
+    std::unique_ptr<close_reason> cr_;      // set from received close frame
 
     // State information for the message being received
     //
@@ -92,6 +95,24 @@ protected:
 
         // The read buffer. Used for compression and masking.
         std::unique_ptr<std::uint8_t[]> buf;
+
+        // `true` if the payload of the current frame has
+        // not been completely delivered to the caller.
+        bool partial;
+
+        // `true` if the end of message marker was given
+        // to the inflate stream for the current frame.
+        bool ztail;
+
+        // Header and prepared mask key of the current frame
+        detail::frame_header fh;
+        detail::prepared_key key;
+
+        // Payload bytes of the current frame still to be read
+        std::uint64_t remain;
+
+        // Compressed input in `buf` which is not yet inflated
+        boost::asio::const_buffer zin;
     };
 
     rd_t rd_;
@@ -130,14 +151,79 @@ protected:
 
     wr_t wr_;
 
+    // State information for the write queue
+    //
+    struct wq_t
+    {
+        // Maximum number of waiting operations.
+        // Zero means the queue is disabled.
+        std::size_t depth = 0;
+
+        // Maximum payload bytes in waiting operations
+        std::size_t bytes = 64 * 1024;
+
+        // Payload bytes in queued operations which
+        // have not yet completed.
+        std::size_t size = 0;
+
+        // Number of operations at the front of wr_op_
+        // whose frames are being sent by a flush.
+        std::size_t nflush = 0;
+
+        // Number of operations following those, whose
+        // frames are serialized into `buf`.
+        std::size_t nser = 0;
+
+        // Limit for coalesced messages, zero to disable
+        std::size_t cork = 0;
+
+        // `true` if the first operation of a batch of
+        // coalesced messages holds the write block
+        // while it waits for the rest of the batch.
+        bool cork_lead = false;
+
+        struct buffers_t
+        {
+            // Serialized frames waiting for a flush,
+            // preceded by any coalesced frames.
+            multi_buffer buf;
+
+            // Serialized frames being sent by a flush
+            multi_buffer wb;
+
+            // The result of the last flush
+            error_code ec;
+        };
+
+        // Allocated when the first frame is serialized
+        std::unique_ptr<buffers_t> bufs;
+    };
+
+    wq_t wq_;
+
     // State information for the permessage-deflate extension
     struct pmd_t
     {
         // `true` if current read message is compressed
         bool rd_set;
 
-        zlib::deflate_stream zo;
-        zlib::inflate_stream zi;
+        // Settings for the compression streams,
+        // which are created when first needed.
+        int zo_level;
+        int zo_bits;
+        int zo_mem;
+        int zi_bits;
+
+        // `true` if the stream is borrowed from
+        // the thread's pool for each message.
+        bool zo_pool;
+        bool zi_pool;
+
+        std::unique_ptr<zlib::deflate_stream> zo;
+        std::unique_ptr<zlib::inflate_stream> zi;
+
+        // Compressed output of the current message
+        deflate_buffers zo_out;
     };
 
     // If not engaged, then permessage-deflate is not
@@ -150,6 +236,109 @@ protected:
     // Offer for clients, negotiated result for servers
     pmd_offer pmd_config_;
 
+    // Counters for outgoing compressed messages
+    compression_stats pmd_stats_;
+
+    // Keepalive settings, or empty if not enabled
+    std::unique_ptr<keepalive_timer> ka_;
+
+    // Adaptive fragment size, or empty if not enabled
+    std::unique_ptr<fragment_sizer> frag_;
+
+    // Returns the size of the next automatic fragment
+    std::size_t
+    wr_frag_size() const
+    {
+        if(! frag_)
+            return wr_.buf_size;
+        if(role_ == role_type::client)
+            return (std::min)(frag_->size(), wr_.buf_size);
+        return frag_->size();
+    }
+
+    // Returns `true` if a control frame waits to be sent
+    bool
+    wr_ctrl_waiting() const
+    {
+        return ! rd_op_.empty() || ! ping_op_.empty();
+    }
+
+    // Returns the number of serialized bytes waiting for a flush
+    std::size_t
+    wq_pending() const
+    {
+        return wq_.bufs ? wq_.bufs->buf.size() : 0;
+    }
+
+    // Returns a read or write buffer of size `n`
+    std::unique_ptr<std::uint8_t[]>
+    buf_alloc(std::size_t n)
+    {
+        if(pool_bufs_)
+            return beast::detail::buffer_pool::instance().acquire(n);
+        return std::unique_ptr<
+            std::uint8_t[]>(new std::uint8_t[n]);
+    }
+
+    // Frees a read or write buffer of size `n`
+    void
+    buf_free(std::unique_ptr<std::uint8_t[]>& p, std::size_t n)
+    {
+        if(pool_bufs_)
+            beast::detail::buffer_pool::instance().release(std::move(p), n);
+        else
+            p.reset();
+    }
+
+    // Returns the deflate stream, creating it if needed
+    zlib::deflate_stream&
+    pmd_zo()
+    {
+        if(! pmd_->zo)
+        {
+            if(pmd_->zo_pool)
+                pmd_->zo = pmd_pool<
+                    zlib::deflate_stream>::instance().acquire();
+            else
+                pmd_->zo.reset(new zlib::deflate_stream);
+            pmd_->zo->reset(pmd_->zo_level, pmd_->zo_bits,
+                pmd_->zo_mem, zlib::Strategy::normal);
+            pmd_dictionary(*pmd_->zo);
+        }
+        pmd_->zo->pool_pending(pmd_opts_.release_memory);
+        return *pmd_->zo;
+    }
+
+    // Returns the inflate stream, creating it if needed
+    zlib::inflate_stream&
+    pmd_zi()
+    {
+        if(! pmd_->zi)
+        {
+            if(pmd_->zi_pool)
+                pmd_->zi = pmd_pool<
+                    zlib::inflate_stream>::instance().acquire();
+            else
+                pmd_->zi.reset(new zlib::inflate_stream);
+            pmd_->zi->reset(pmd_->zi_bits);
+            pmd_dictionary(*pmd_->zi);
+        }
+        return *pmd_->zi;
+    }
+
+    // Load the preset dictionary, if any, into a reset stream
+    template<class Stream>
+    void
+    pmd_dictionary(Stream& z)
+    {
+        if(pmd_opts_.dictionary)
+        {
+            error_code ec;
+            z.dictionary(*pmd_opts_.dictionary, ec);
+            BOOST_ASSERT(! ec);
+        }
+    }
+
     stream_base() = default;
     stream_base(stream_base&&) = default;
     stream_base(stream_base const&) = delete;
@@ -181,9 +370,54 @@ protected:
 
     // Called before sending the first frame of each message
     //
+    template<class ConstBufferSequence>
+    void
+    wr_begin(ConstBufferSequence const& bs, bool fin);
+
+    // Called after sending the last frame of each message
+    //
     template<class = void>
     void
-    wr_begin();
+    wr_end();
+
+    // Called after sending the last frame of a compressed message
+    //
+    template<class = void>
+    void
+    pmd_end_write();
+
+    // Called after receiving the last frame of a compressed message
+    //
+    template<class = void>
+    void
+    pmd_end_read();
+
+    template<class = void>
+    void
+    pmd_release();
+
+    template<class = void>
+    std::size_t
+    pmd_memory() const;
+
+    // Called to queue a complete message as a single frame
+    //
+    template<class ConstBufferSequence>
+    void
+    wq_serialize(ConstBufferSequence const& bs);
+
+    // Returns `true` if a complete message
+    // of size `n` may be coalesced
+    //
+    bool
+    wq_corkable(std::size_t n) const
+    {
+        return wq_.cork > 0 && n <= wq_.cork &&
+            wq_pending() + n <= wq_.cork &&
+            ! pmd_ && ! wr_.cont && ! failed_ &&
+            ! wr_close_ && wq_.nflush == 0 &&
+            wr_op_.size() + (wq_.cork_lead ? 1 : 0) == wq_.nser;
+    }
 
     template<class DynamicBuffer>
     void
@@ -210,33 +444,46 @@ open(role_type role)
     wr_.cont = false;
     wr_.buf_size = 0;
 
+    wq_.size = 0;
+    wq_.nflush = 0;
+    wq_.nser = 0;
+    wq_.cork_lead = false;
+    if(wq_.bufs)
+        wq_.bufs->buf.consume(wq_.bufs->buf.size());
+
     if(((role_ == role_type::client && pmd_opts_.client_enable) ||
         (role_ == role_type::server && pmd_opts_.server_enable)) &&
             pmd_config_.accept)
     {
         pmd_normalize(pmd_config_);
         pmd_.reset(new pmd_t);
+        pmd_->zo_level = pmd_opts_.compLevel;
+        pmd_->zo_mem = pmd_opts_.memLevel;
         if(role_ == role_type::client)
         {
-            pmd_->zi.reset(
-                pmd_config_.server_max_window_bits);
-            pmd_->zo.reset(
-                pmd_opts_.compLevel,
-                pmd_config_.client_max_window_bits,
-                pmd_opts_.memLevel,
-                zlib::Strategy::normal);
+            pmd_->zi_bits =
+                pmd_config_.server_max_window_bits;
+            pmd_->zo_bits =
+                pmd_config_.client_max_window_bits;
         }
         else
         {
-            pmd_->zi.reset(
-                pmd_config_.client_max_window_bits);
-            pmd_->zo.reset(
-                pmd_opts_.compLevel,
-                pmd_config_.server_max_window_bits,
-                pmd_opts_.memLevel,
-                zlib::Strategy::normal);
+            pmd_->zi_bits =
+                pmd_config_.client_max_window_bits;
+            pmd_->zo_bits =
+                pmd_config_.server_max_window_bits;
         }
+        pmd_->zo_pool = pmd_opts_.use_pool && (
+            role_ == role_type::client ?
+                pmd_config_.client_no_context_takeover :
+                pmd_config_.server_no_context_takeover);
+        pmd_->zi_pool = pmd_opts_.use_pool && (
+            role_ == role_type::client ?
+                pmd_config_.server_no_context_takeover :
+                pmd_config_.client_no_context_takeover);
     }
+    if(ka_)
+        ka_->start();
 }
 
 template<class>
@@ -244,8 +491,8 @@ void
 stream_base::
 close()
 {
-    rd_.buf.reset();
-    wr_.buf.reset();
+    buf_free(rd_.buf, rd_.buf_size);
+    buf_free(wr_.buf, wr_.buf_size);
     pmd_.reset();
 }
 
@@ -440,41 +687,207 @@ stream_base::
 rd_begin()
 {
     // Maintain the read buffer
-    if(pmd_)
+    if(pmd_ && pmd_->rd_set)
     {
         if(! rd_.buf || rd_.buf_size != rd_buf_size_)
         {
+            buf_free(rd_.buf, rd_.buf_size);
             rd_.buf_size = rd_buf_size_;
-            rd_.buf.reset(new std::uint8_t[rd_.buf_size]);
+            rd_.buf = buf_alloc(rd_.buf_size);
         }
     }
 }
 
-template<class>
+template<class ConstBufferSequence>
 void
 stream_base::
-wr_begin()
+wr_begin(ConstBufferSequence const& bs, bool fin)
 {
+    if(ka_)
+        ka_->touch_msg();
     wr_.autofrag = wr_autofrag_;
-    wr_.compress = static_cast<bool>(pmd_);
+    wr_.compress = false;
+    if(pmd_)
+    {
+        if( (fin && boost::asio::buffer_size(bs) <
+                pmd_opts_.compress_min_size) ||
+            (pmd_opts_.compress_check &&
+                ! pmd_compressible(bs)))
+        {
+            ++pmd_stats_.skipped;
+        }
+        else
+        {
+            wr_.compress = true;
+            ++pmd_stats_.compressed;
+        }
+    }
 
-    // Maintain the write buffer
-    if( wr_.compress ||
-        role_ == detail::role_type::client)
+    // Maintain the write buffer. Compressed
+    // output goes to blocks from the pool.
+    if(wr_.compress)
+    {
+        pmd_->zo_out.block_size(wr_buf_size_);
+    }
+    else if(role_ == detail::role_type::client)
     {
         if(! wr_.buf || wr_.buf_size != wr_buf_size_)
         {
+            buf_free(wr_.buf, wr_.buf_size);
             wr_.buf_size = wr_buf_size_;
-            wr_.buf.reset(new std::uint8_t[wr_.buf_size]);
+            wr_.buf = buf_alloc(wr_.buf_size);
         }
     }
     else
     {
+        buf_free(wr_.buf, wr_.buf_size);
         wr_.buf_size = wr_buf_size_;
-        wr_.buf.reset();
     }
 }
 
+template<class>
+void
+stream_base::
+wr_end()
+{
+    if(pool_bufs_ && wr_.buf)
+        beast::detail::buffer_pool::instance().release(
+            std::move(wr_.buf), wr_.buf_size);
+}
+
+template<class>
+void
+stream_base::
+pmd_end_write()
+{
+    if(pmd_->zo_pool)
+    {
+        if(pmd_->zo)
+            pmd_pool<zlib::deflate_stream>::instance(
+                ).release(std::move(pmd_->zo));
+    }
+    else if(
+        (role_ == role_type::client &&
+            pmd_config_.client_no_context_takeover) ||
+        (role_ == role_type::server &&
+            pmd_config_.server_no_context_takeover))
+    {
+        if(pmd_opts_.release_memory)
+            pmd_->zo.reset();
+        else if(pmd_->zo)
+        {
+            pmd_->zo->reset();
+            pmd_dictionary(*pmd_->zo);
+        }
+    }
+}
+
+template<class>
+void
+stream_base::
+pmd_end_read()
+{
+    if(pool_bufs_ && rd_.buf)
+        beast::detail::buffer_pool::instance().release(
+            std::move(rd_.buf), rd_.buf_size);
+    if(pmd_->zi_pool)
+    {
+        if(pmd_->zi)
+            pmd_pool<zlib::inflate_stream>::instance(
+                ).release(std::move(pmd_->zi));
+    }
+    else if(
+        (role_ == role_type::client &&
+            pmd_config_.server_no_context_takeover) ||
+        (role_ == role_type::server &&
+            pmd_config_.client_no_context_takeover))
+    {
+        if(pmd_opts_.release_memory)
+            pmd_->zi.reset();
+        else if(pmd_->zi)
+        {
+            pmd_->zi->reset();
+            pmd_dictionary(*pmd_->zi);
+        }
+    }
+}
+
+template<class>
+void
+stream_base::
+pmd_release()
+{
+    if(! pmd_)
+        return;
+    // A new message may be compressed without the
+    // history of previous ones, the peer can't tell.
+    if(! wr_.cont)
+        pmd_->zo.reset();
+    // The peer's messages may refer to the history
+    // of previous ones, unless context takeover is off.
+    if(! rd_.cont && ! rd_.partial && (
+        (role_ == role_type::client &&
+            pmd_config_.server_no_context_takeover) ||
+        (role_ == role_type::server &&
+            pmd_config_.client_no_context_takeover)))
+        pmd_->zi.reset();
+}
+
+template<class>
+std::size_t
+stream_base::
+pmd_memory() const
+{
+    std::size_t n = 0;
+    if(pmd_)
+    {
+        n += sizeof(pmd_t);
+        if(pmd_->zo)
+            n += sizeof(zlib::deflate_stream) +
+                pmd_->zo->allocated();
+        if(pmd_->zi)
+            n += sizeof(zlib::inflate_stream) +
+                pmd_->zi->allocated();
+    }
+    return n;
+}
+
+template<class ConstBufferSequence>
+void
+stream_base::
+wq_serialize(ConstBufferSequence const& bs)
+{
+    using boost::asio::buffer_copy;
+    using boost::asio::buffer_size;
+    if(ka_)
+        ka_->touch_msg();
+    frame_header fh;
+    BOOST_ASSERT(! wr_.cont);
+    fh.op = wr_opcode_;
+    fh.fin = true;
+    fh.rsv1 = false;
+    fh.rsv2 = false;
+    fh.rsv3 = false;
+    fh.len = buffer_size(bs);
+    fh.mask = role_ == role_type::client;
+    if(fh.mask)
+        fh.key = make_mask_key();
+    if(! wq_.bufs)
+        wq_.bufs.reset(new wq_t::buffers_t);
+    auto& b = wq_.bufs->buf;
+    detail::write(b, fh);
+    auto const n = static_cast<std::size_t>(fh.len);
+    auto const mb = b.prepare(n);
+    buffer_copy(mb, bs);
+    if(fh.mask)
+    {
+        detail::prepared_key key;
+        detail::prepare_key(key, fh.key);
+        detail::mask_inplace(mb, key);
+    }
+    b.commit(n);
+}
+
 template<class DynamicBuffer>
 void
 stream_base::
@@ -491,7 +904,7 @@ write_close(DynamicBuffer& db, close_reason const& cr)
         0 : 2 + cr.reason.size();
     fh.mask = role_ == detail::role_type::client;
     if(fh.mask)
-        fh.key = maskgen_();
+        fh.key = make_mask_key();
     detail::write(db, fh);
     if(cr.code != close_code::none)
     {
@@ -537,7 +950,7 @@ write_ping(
     fh.len = data.size();
     fh.mask = role_ == role_type::client;
     if(fh.mask)
-        fh.key = maskgen_();
+        fh.key = make_mask_key();
     detail::write(db, fh);
     if(data.empty())
         return;
@@ -0,0 +1,328 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef BEAST_WEBSOCKET_DETAIL_UPGRADE_HPP
+#define BEAST_WEBSOCKET_DETAIL_UPGRADE_HPP
+
+#include <beast/websocket/detail/hybi13.hpp>
+#include <beast/version.hpp>
+#include <beast/http/rfc7230.hpp>
+#include <beast/core/static_string.hpp>
+#include <beast/core/string_view.hpp>
+#include <beast/core/detail/ci_char_traits.hpp>
+#include <boost/asio/buffer.hpp>
+#include <array>
+#include <cstddef>
+
+namespace beast {
+namespace websocket {
+namespace detail {
+
+// Parses a WebSocket Upgrade request in place.
+//
+// Only the fields needed to accept the upgrade are kept,
+// as views into the input. Requests which are anything but
+// a plain, valid upgrade are left to the general HTTP
+// parser, which also produces the error response.
+//
+class upgrade_request
+{
+    string_view host_;
+    string_view upgrade_;
+    string_view connection_;
+    string_view key_;
+    string_view version_;
+    string_view extensions_;
+    std::size_t size_ = 0;
+
+public:
+    enum result
+    {
+        // The header is not complete yet
+        need_more,
+
+        // The request was parsed
+        done,
+
+        // Use the general parser
+        other
+    };
+
+    // Largest header handled here
+    static std::size_t constexpr max_size = 4096;
+
+    // Returns the number of bytes in the header
+    std::size_t
+    size() const
+    {
+        return size_;
+    }
+
+    string_view
+    key() const
+    {
+        return key_;
+    }
+
+    // Returns the value of a field, for pmd_read
+    string_view
+    operator[](string_view name) const
+    {
+        using beast::detail::ci_equal;
+        if(ci_equal(name, "Sec-WebSocket-Extensions"))
+            return extensions_;
+        if(ci_equal(name, "Sec-WebSocket-Key"))
+            return key_;
+        if(ci_equal(name, "Sec-WebSocket-Version"))
+            return version_;
+        if(ci_equal(name, "Upgrade"))
+            return upgrade_;
+        if(ci_equal(name, "Connection"))
+            return connection_;
+        if(ci_equal(name, "Host"))
+            return host_;
+        return {};
+    }
+
+    template<class ConstBufferSequence>
+    result
+    parse(ConstBufferSequence const& buffers)
+    {
+        using boost::asio::buffer_cast;
+        using boost::asio::buffer_size;
+        string_view s;
+        for(auto it = buffers.begin();
+            it != buffers.end(); ++it)
+        {
+            boost::asio::const_buffer b{*it};
+            auto const n = buffer_size(b);
+            if(n == 0)
+                continue;
+            if(! s.empty())
+                return other;
+            s = {buffer_cast<char const*>(b), n};
+        }
+        return parse(s);
+    }
+
+    inline
+    result
+    parse(string_view s);
+
+private:
+    static
+    bool
+    is_tchar(char c)
+    {
+        /*
+            tchar = "!" | "#" | "$" | "%" | "&" |
+                    "'" | "*" | "+" | "-" | "." |
+                    "^" | "_" | "`" | "|" | "~" |
+                    DIGIT | ALPHA
+        */
+        switch(c)
+        {
+        case '!': case '#': case '$': case '%':
+        case '&': case '\'': case '*': case '+':
+        case '-': case '.': case '^': case '_':
+        case '`': case '|': case '~':
+            return true;
+        default:
+            return
+                (c >= '0' && c <= '9') ||
+                (c >= 'a' && c <= 'z') ||
+                (c >= 'A' && c <= 'Z');
+        }
+    }
+
+    static
+    bool
+    is_vchar(char c)
+    {
+        auto const u = static_cast<unsigned char>(c);
+        return u > 32 && u != 127;
+    }
+
+    static
+    bool
+    is_text(char c)
+    {
+        auto const u = static_cast<unsigned char>(c);
+        return u == '\t' || (u >= 32 && u != 127);
+    }
+
+    inline
+    bool
+    set(string_view name, string_view value);
+};
+
+auto
+upgrade_request::
+parse(string_view s) ->
+    result
+{
+    static string_view const method = "GET ";
+    if(s.substr(0, method.size()) !=
+            method.substr(0, s.size()))
+        return other;
+    auto const end = s.find("\r\n\r\n");
+    if(end == string_view::npos)
+        return s.size() < max_size ? need_more : other;
+    size_ = end + 4;
+    auto it = s.data() + method.size();
+    auto const last = s.data() + end + 2;
+
+    // request-target
+    auto const target = it;
+    while(it < last && is_vchar(*it))
+        ++it;
+    if(it == target)
+        return other;
+    static string_view const version = " HTTP/1.1\r\n";
+    if(string_view(it, last - it).substr(
+            0, version.size()) != version)
+        return other;
+    it += version.size();
+
+    // header-field = field-name ":" OWS field-value OWS CRLF
+    while(it < last)
+    {
+        auto const name = it;
+        while(it < last && is_tchar(*it))
+            ++it;
+        if(it == name || *it != ':')
+            return other;
+        string_view const n(name, it - name);
+        ++it;
+        auto first = it;
+        while(it < last && *it != '\r')
+        {
+            if(! is_text(*it))
+                return other;
+            ++it;
+        }
+        if(it[1] != '\n')
+            return other;
+        auto e = it;
+        while(first < e && (*first == ' ' || *first == '\t'))
+            ++first;
+        while(e > first && (e[-1] == ' ' || e[-1] == '\t'))
+            --e;
+        if(! set(n, string_view(first, e - first)))
+            return other;
+        it += 2;
+    }
+
+    // Anything which would not be accepted
+    // gets its response from the general path.
+    if(host_.data() == nullptr || key_.empty() ||
+        key_.size() > sec_ws_key_type::max_size_n ||
+            version_ != "13")
+        return other;
+    if(! http::token_list{upgrade_}.exists("websocket"))
+        return other;
+    if(! http::token_list{connection_}.exists("upgrade"))
+        return other;
+    return done;
+}
+
+bool
+upgrade_request::
+set(string_view name, string_view value)
+{
+    using beast::detail::ci_equal;
+    string_view* p;
+    if(ci_equal(name, "Host"))
+        p = &host_;
+    else if(ci_equal(name, "Upgrade"))
+        p = &upgrade_;
+    else if(ci_equal(name, "Connection"))
+        p = &connection_;
+    else if(ci_equal(name, "Sec-WebSocket-Key"))
+        p = &key_;
+    else if(ci_equal(name, "Sec-WebSocket-Version"))
+        p = &version_;
+    else if(ci_equal(name, "Sec-WebSocket-Extensions"))
+        p = &extensions_;
+    else if(ci_equal(name, "Content-Length") ||
+            ci_equal(name, "Transfer-Encoding"))
+        return false;
+    else
+        return true;
+    // Repeated fields are combined by the general parser
+    if(p->data() != nullptr)
+        return false;
+    *p = value;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+// The 101 response to an accepted upgrade request.
+//
+// The response is sent from static text plus the two
+// values computed for each connection, which are kept
+// in fixed size storage.
+//
+class upgrade_response
+{
+    sec_ws_accept_type accept_;
+    static_string<256> ext_;
+
+public:
+    using buffers_type =
+        std::array<boost::asio::const_buffer, 6>;
+
+    explicit
+    upgrade_response(string_view key)
+    {
+        make_sec_ws_accept(accept_, key);
+    }
+
+    // Called by pmd_negotiate
+    void
+    replace(string_view, string_view value)
+    {
+        ext_ = value;
+    }
+
+    // Returns the serialized response
+    buffers_type
+    buffers() const
+    {
+        using boost::asio::const_buffer;
+        static string_view const s0 =
+            "HTTP/1.1 101 Switching Protocols\r\n";
+        static string_view const s1 =
+            "Sec-WebSocket-Extensions: ";
+        static string_view const s2 =
+            "\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: upgrade\r\n"
+            "Sec-WebSocket-Accept: ";
+        static string_view const s3 =
+            "\r\n"
+            "Server: " BEAST_VERSION_STRING "\r\n"
+            "\r\n";
+        auto const b =
+            [](string_view s)
+            {
+                return const_buffer{s.data(), s.size()};
+            };
+        if(ext_.empty())
+            return {{b(s0), const_buffer{}, const_buffer{},
+                b(s2.substr(2)), b(accept_), b(s3)}};
+        return {{b(s0), b(s1), b(ext_),
+            b(s2), b(accept_), b(s3)}};
+    }
+};
+
+} // detail
+} // websocket
+} // beast
+
+#endif
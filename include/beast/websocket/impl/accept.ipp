@@ -21,6 +21,7 @@
 #include <boost/asio/handler_continuation_hook.hpp>
 #include <boost/asio/handler_invoke_hook.hpp>
 #include <boost/assert.hpp>
+#include <boost/optional.hpp>
 #include <memory>
 #include <type_traits>
 
@@ -174,12 +175,16 @@ class stream<NextLayer>::accept_op
         stream<NextLayer>& ws;
         Decorator decorator;
         http::header_parser<true, http::fields> p;
+        detail::upgrade_request req;
+        boost::optional<detail::upgrade_response> res;
+        bool fast;
         int state = 0;
 
         data(Handler& handler, stream<NextLayer>& ws_,
                 Decorator const& decorator_)
             : ws(ws_)
             , decorator(decorator_)
+            , fast(ws_.is_default_decorator(decorator_))
         {
             using boost::asio::asio_handler_is_continuation;
             cont = asio_handler_is_continuation(std::addressof(handler));
@@ -191,6 +196,7 @@ class stream<NextLayer>::accept_op
                     Decorator const& decorator_)
             : ws(ws_)
             , decorator(decorator_)
+            , fast(ws_.is_default_decorator(decorator_))
         {
             using boost::asio::asio_handler_is_continuation;
             cont = asio_handler_is_continuation(std::addressof(handler));
@@ -262,13 +268,52 @@ stream<NextLayer>::accept_op<Decorator, Handler>::
 operator()(error_code ec,
     std::size_t bytes_used, bool again)
 {
+    using upgrade_request = detail::upgrade_request;
     auto& d = *d_;
     d.cont = d.cont || again;
+    if(ec == boost::asio::error::eof && d.state == 2)
+    {
+        // reported by the general parser
+        ec = {};
+        d.fast = false;
+        bytes_used = 0;
+    }
     if(ec)
         goto upcall;
     switch(d.state)
     {
+    case 2:
+        d.ws.stream_.buffer().commit(bytes_used);
+        // fall through
+
     case 0:
+        if(d.fast)
+        {
+            // Parse the request in place and send the
+            // response without building HTTP messages.
+            auto& b = d.ws.stream_.buffer();
+            switch(d.req.parse(b.data()))
+            {
+            case upgrade_request::done:
+                d.res.emplace(d.req.key());
+                d.ws.build_response(d.req, *d.res);
+                b.consume(d.req.size());
+                d.state = 3;
+                boost::asio::async_write(d.ws.stream_,
+                    d.res->buffers(), std::move(*this));
+                return;
+
+            case upgrade_request::need_more:
+                d.state = 2;
+                d.ws.next_layer().async_read_some(b.prepare(
+                    upgrade_request::max_size - b.size()),
+                        std::move(*this));
+                return;
+
+            case upgrade_request::other:
+                break;
+            }
+        }
         // read message
         d.state = 1;
         http::async_read_some(d.ws.next_layer(),
@@ -299,6 +344,11 @@ operator()(error_code ec,
     #endif
         return;
     }
+
+    case 3:
+        // sent response
+        d.ws.open(detail::role_type::server);
+        break;
     }
 upcall:
     d_.invoke(ec);
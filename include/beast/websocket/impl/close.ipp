@@ -8,6 +8,7 @@
 #ifndef BEAST_WEBSOCKET_IMPL_CLOSE_IPP
 #define BEAST_WEBSOCKET_IMPL_CLOSE_IPP
 
+#include <beast/core/buffer_cat.hpp>
 #include <beast/core/handler_ptr.hpp>
 #include <beast/core/static_buffer.hpp>
 #include <beast/core/type_traits.hpp>
@@ -15,6 +16,7 @@
 #include <boost/asio/handler_continuation_hook.hpp>
 #include <boost/asio/handler_invoke_hook.hpp>
 #include <memory>
+#include <utility>
 
 namespace beast {
 namespace websocket {
@@ -160,6 +162,16 @@ operator()(error_code ec, bool again)
             BOOST_ASSERT(d.ws.wr_block_ == &d);
             d.state = 99;
             d.ws.wr_close_ = true;
+            if(d.ws.wq_.nser == 0 && d.ws.wq_pending() > 0)
+            {
+                // coalesced frames go first
+                auto& b = *d.ws.wq_.bufs;
+                std::swap(b.buf, b.wb);
+                boost::asio::async_write(d.ws.stream_,
+                    buffer_cat(b.wb.data(),
+                        d.fb.data()), std::move(*this));
+                return;
+            }
             boost::asio::async_write(d.ws.stream_,
                 d.fb.data(), std::move(*this));
             return;
@@ -194,9 +206,16 @@ operator()(error_code ec, bool again)
     }
 upcall:
     if(d.ws.wr_block_ == &d)
+    {
+        if(d.ws.wq_.bufs)
+            d.ws.wq_.bufs->wb.consume(
+                d.ws.wq_.bufs->wb.size());
         d.ws.wr_block_ = nullptr;
-    d.ws.rd_op_.maybe_invoke() ||
-        d.ws.ping_op_.maybe_invoke();
+    }
+    if(! d.ws.wr_block_)
+        d.ws.rd_op_.maybe_invoke() ||
+            d.ws.ping_op_.maybe_invoke() ||
+                d.ws.wr_op_.maybe_invoke();
     d_.invoke(ec);
 }
 
@@ -241,7 +260,18 @@ close(close_reason const& cr, error_code& ec)
     wr_close_ = true;
     detail::frame_streambuf fb;
     write_close<static_buffer>(fb, cr);
-    boost::asio::write(stream_, fb.data(), ec);
+    if(wq_pending() > 0)
+    {
+        // coalesced frames go first
+        auto& b = wq_.bufs->buf;
+        boost::asio::write(stream_,
+            buffer_cat(b.data(), fb.data()), ec);
+        b.consume(b.size());
+    }
+    else
+    {
+        boost::asio::write(stream_, fb.data(), ec);
+    }
     failed_ = ec != 0;
 }
 
@@ -193,8 +193,10 @@ operator()(error_code ec, bool again)
 upcall:
     if(d.ws.wr_block_ == &d)
         d.ws.wr_block_ = nullptr;
-    d.ws.rd_op_.maybe_invoke() ||
-        d.ws.wr_op_.maybe_invoke();
+    if(! d.ws.wr_block_)
+        d.ws.rd_op_.maybe_invoke() ||
+            d.ws.ping_op_.maybe_invoke() ||
+                d.ws.wr_op_.maybe_invoke();
     d_.invoke(ec);
 }
 
@@ -10,6 +10,7 @@
 
 #include <beast/websocket/teardown.hpp>
 #include <beast/core/buffer_prefix.hpp>
+#include <beast/core/buffers_adapter.hpp>
 #include <beast/core/handler_ptr.hpp>
 #include <beast/core/static_buffer.hpp>
 #include <beast/core/type_traits.hpp>
@@ -49,8 +50,8 @@ class stream<NextLayer>::read_frame_op
         stream<NextLayer>& ws;
         frame_info& fi;
         DynamicBuffer& db;
+        std::size_t limit;
         fb_type fb;
-        std::uint64_t remain;
         detail::frame_header fh;
         detail::prepared_key key;
         boost::optional<dmb_type> dmb;
@@ -58,10 +59,12 @@ class stream<NextLayer>::read_frame_op
         int state = 0;
 
         data(Handler& handler, stream<NextLayer>& ws_,
-                frame_info& fi_, DynamicBuffer& sb_)
+                frame_info& fi_, DynamicBuffer& sb_,
+                    std::size_t limit_)
             : ws(ws_)
             , fi(fi_)
             , db(sb_)
+            , limit(limit_)
         {
             using boost::asio::asio_handler_is_continuation;
             cont = asio_handler_is_continuation(std::addressof(handler));
@@ -197,51 +200,80 @@ operator()(error_code ec,
                             boost::asio::error::operation_aborted, 0));
                     return;
                 }
+                if(d.ws.rd_.partial)
+                {
+                    // Continue the current frame
+                    d.state = d.ws.pmd_ &&
+                        d.ws.pmd_->rd_set ?
+                            do_inflate_payload + 3 :
+                            do_read_payload + 1;
+                    break;
+                }
                 d.state = do_read_fh;
                 break;
 
             //------------------------------------------------------------------
 
             case do_read_payload:
-                if(d.fh.len == 0)
+                if(d.ws.rd_.fh.len == 0)
                 {
                     d.state = do_frame_done;
                     break;
                 }
                 // Enforce message size limit
-                if(d.ws.rd_msg_max_ && d.fh.len >
+                if(d.ws.rd_msg_max_ && d.ws.rd_.fh.len >
                     d.ws.rd_msg_max_ - d.ws.rd_.size)
                 {
                     code = close_code::too_big;
                     d.state = do_fail;
                     break;
                 }
-                d.ws.rd_.size += d.fh.len;
-                d.remain = d.fh.len;
-                if(d.fh.mask)
-                    detail::prepare_key(d.key, d.fh.key);
+                d.ws.rd_.size += d.ws.rd_.fh.len;
                 // fall through
 
             case do_read_payload + 1:
+                if(d.ws.rd_.remain == 0)
+                {
+                    d.state = do_frame_done;
+                    break;
+                }
+                if(d.limit == 0)
+                {
+                    // The caller's buffer is full
+                    d.fi.op = d.ws.rd_.op;
+                    d.fi.fin = false;
+                    goto upcall;
+                }
                 d.state = do_read_payload + 2;
-                d.dmb = d.db.prepare(clamp(d.remain));
+                d.dmb = d.db.prepare(clamp(
+                    d.ws.rd_.remain, d.limit));
+                bytes_transferred =
+                    d.ws.rd_ahead(*d.dmb, 0);
+                if(bytes_transferred > 0)
+                    break;
                 // Read frame payload data
-                d.ws.stream_.async_read_some(
-                    *d.dmb, std::move(*this));
+                if(d.ws.rd_direct(d.ws.rd_.remain))
+                    d.ws.next_layer().async_read_some(
+                        *d.dmb, std::move(*this));
+                else
+                    d.ws.stream_.async_read_some(
+                        *d.dmb, std::move(*this));
                 return;
 
             case do_read_payload + 2:
             {
-                d.remain -= bytes_transferred;
+                d.ws.rd_.remain -= bytes_transferred;
+                d.limit -= bytes_transferred;
                 auto const pb = buffer_prefix(
                     bytes_transferred, *d.dmb);
-                if(d.fh.mask)
-                    detail::mask_inplace(pb, d.key);
+                if(d.ws.rd_.fh.mask)
+                    detail::mask_inplace(pb, d.ws.rd_.key);
                 if(d.ws.rd_.op == opcode::text)
                 {
                     if(! d.ws.rd_.utf8.write(pb) ||
-                        (d.remain == 0 && d.fh.fin &&
-                            ! d.ws.rd_.utf8.finish()))
+                        (d.ws.rd_.remain == 0 &&
+                            d.ws.rd_.fh.fin &&
+                                ! d.ws.rd_.utf8.finish()))
                     {
                         // invalid utf8
                         code = close_code::bad_payload;
@@ -250,74 +282,59 @@ operator()(error_code ec,
                     }
                 }
                 d.db.commit(bytes_transferred);
-                if(d.remain > 0)
-                {
-                    d.state = do_read_payload + 1;
-                    break;
-                }
-                d.state = do_frame_done;
+                d.state = do_read_payload + 1;
                 break;
             }
 
             //------------------------------------------------------------------
 
             case do_inflate_payload:
-                d.remain = d.fh.len;
-                if(d.fh.len == 0)
-                {
-                    // inflate even if fh.len == 0, otherwise we
-                    // never emit the end-of-stream deflate block.
-                    bytes_transferred = 0;
-                    d.state = do_inflate_payload + 2;
-                    break;
-                }
-                if(d.fh.mask)
-                    detail::prepare_key(d.key, d.fh.key);
-                // fall through
+                // inflate even if fh.len == 0, otherwise we
+                // never emit the end-of-stream deflate block.
+                d.state = do_inflate_payload + 3;
+                break;
 
             case do_inflate_payload + 1:
             {
                 d.state = do_inflate_payload + 2;
+                auto const b = buffer(d.ws.rd_.buf.get(),
+                    clamp(d.ws.rd_.remain, d.ws.rd_.buf_size));
+                bytes_transferred = d.ws.rd_ahead(b, 0);
+                if(bytes_transferred > 0)
+                    break;
                 // Read compressed frame payload data
                 d.ws.stream_.async_read_some(
-                    buffer(d.ws.rd_.buf.get(), clamp(
-                        d.remain, d.ws.rd_.buf_size)),
-                            std::move(*this));
+                    b, std::move(*this));
                 return;
             }
 
             case do_inflate_payload + 2:
             {
-                d.remain -= bytes_transferred;
+                d.ws.rd_.remain -= bytes_transferred;
                 auto const in = buffer(
                     d.ws.rd_.buf.get(), bytes_transferred);
-                if(d.fh.mask)
-                    detail::mask_inplace(in, d.key);
+                if(d.ws.rd_.fh.mask)
+                    detail::mask_inplace(in, d.ws.rd_.key);
+                d.ws.rd_.zin = in;
+            }
+                // fall through
+
+            case do_inflate_payload + 3:
+            {
                 auto const prev = d.db.size();
-                detail::inflate(d.ws.pmd_->zi, d.db, in, ec);
+                auto const full = detail::inflate(
+                    d.ws.pmd_zi(), d.db, d.ws.rd_.zin,
+                        d.limit, ec);
                 d.ws.failed_ = ec != 0;
                 if(d.ws.failed_)
                     break;
-                if(d.remain == 0 && d.fh.fin)
-                {
-                    static std::uint8_t constexpr
-                        empty_block[4] = {
-                            0x00, 0x00, 0xff, 0xff };
-                    detail::inflate(d.ws.pmd_->zi, d.db,
-                        buffer(&empty_block[0], 4), ec);
-                    d.ws.failed_ = ec != 0;
-                    if(d.ws.failed_)
-                        break;
-                }
                 if(d.ws.rd_.op == opcode::text)
                 {
                     consuming_buffers<typename
                         DynamicBuffer::const_buffers_type
                             > cb{d.db.data()};
                     cb.consume(prev);
-                    if(! d.ws.rd_.utf8.write(cb) ||
-                        (d.remain == 0 && d.fh.fin &&
-                            ! d.ws.rd_.utf8.finish()))
+                    if(! d.ws.rd_.utf8.write(cb))
                     {
                         // invalid utf8
                         code = close_code::bad_payload;
@@ -325,17 +342,37 @@ operator()(error_code ec,
                         break;
                     }
                 }
-                if(d.remain > 0)
+                if(full)
+                {
+                    // The caller's buffer is full
+                    d.fi.op = d.ws.rd_.op;
+                    d.fi.fin = false;
+                    goto upcall;
+                }
+                if(d.ws.rd_.remain > 0)
                 {
                     d.state = do_inflate_payload + 1;
                     break;
                 }
-                if(d.fh.fin && (
-                    (d.ws.role_ == detail::role_type::client &&
-                        d.ws.pmd_config_.server_no_context_takeover) ||
-                    (d.ws.role_ == detail::role_type::server &&
-                        d.ws.pmd_config_.client_no_context_takeover)))
-                    d.ws.pmd_->zi.reset();
+                if(d.ws.rd_.fh.fin && ! d.ws.rd_.ztail)
+                {
+                    d.ws.rd_.ztail = true;
+                    d.ws.rd_.zin = detail::pmd_tail();
+                    d.state = do_inflate_payload + 3;
+                    break;
+                }
+                if(d.ws.rd_.fh.fin)
+                {
+                    if(d.ws.rd_.op == opcode::text &&
+                        ! d.ws.rd_.utf8.finish())
+                    {
+                        // invalid utf8
+                        code = close_code::bad_payload;
+                        d.state = do_fail;
+                        break;
+                    }
+                    d.ws.pmd_end_read();
+                }
                 d.state = do_frame_done;
                 break;
             }
@@ -344,17 +381,24 @@ operator()(error_code ec,
 
             case do_frame_done:
                 // call handler
+                d.ws.rd_.partial = false;
                 d.fi.op = d.ws.rd_.op;
-                d.fi.fin = d.fh.fin;
+                d.fi.fin = d.ws.rd_.fh.fin;
                 goto upcall;
 
             //------------------------------------------------------------------
 
             case do_read_fh:
+            {
                 d.state = do_read_fh + 1;
+                auto const mb = d.fb.prepare(2);
+                bytes_transferred = d.ws.rd_ahead(mb, 2);
+                if(bytes_transferred > 0)
+                    break;
                 boost::asio::async_read(d.ws.stream_,
-                    d.fb.prepare(2), std::move(*this));
+                    mb, std::move(*this));
                 return;
+            }
 
             case do_read_fh + 1:
             {
@@ -374,9 +418,13 @@ operator()(error_code ec,
                     bytes_transferred = 0;
                     break;
                 }
+                auto const mb = d.fb.prepare(n);
+                bytes_transferred = d.ws.rd_ahead(mb, n);
+                if(bytes_transferred > 0)
+                    break;
                 // read variable header
                 boost::asio::async_read(d.ws.stream_,
-                    d.fb.prepare(n), std::move(*this));
+                    mb, std::move(*this));
                 return;
             }
 
@@ -390,6 +438,9 @@ operator()(error_code ec,
                     d.state = do_fail;
                     break;
                 }
+                if(d.ws.ka_)
+                    d.ws.ka_->touch(
+                        ! detail::is_control(d.fh.op));
                 if(detail::is_control(d.fh.op))
                 {
                     if(d.fh.len > 0)
@@ -398,6 +449,11 @@ operator()(error_code ec,
                         d.state = do_control_payload;
                         d.fmb = d.fb.prepare(static_cast<
                             std::size_t>(d.fh.len));
+                        bytes_transferred = d.ws.rd_ahead(
+                            *d.fmb, static_cast<
+                                std::size_t>(d.fh.len));
+                        if(bytes_transferred > 0)
+                            break;
                         boost::asio::async_read(d.ws.stream_,
                             *d.fmb, std::move(*this));
                         return;
@@ -408,12 +464,20 @@ operator()(error_code ec,
                 if(d.fh.op == opcode::text ||
                         d.fh.op == opcode::binary)
                     d.ws.rd_begin();
+                d.ws.rd_.fh = d.fh;
                 if(d.fh.len == 0 && ! d.fh.fin)
                 {
                     // Empty message frame
                     d.state = do_frame_done;
                     break;
                 }
+                d.ws.rd_.partial = true;
+                d.ws.rd_.ztail = false;
+                d.ws.rd_.remain = d.fh.len;
+                d.ws.rd_.zin = {};
+                if(d.fh.mask)
+                    detail::prepare_key(
+                        d.ws.rd_.key, d.fh.key);
                 if(! d.ws.pmd_ || ! d.ws.pmd_->rd_set)
                     d.state = do_read_payload;
                 else
@@ -475,7 +539,9 @@ operator()(error_code ec,
                 }
                 BOOST_ASSERT(d.fh.op == opcode::close);
                 {
-                    detail::read(d.ws.cr_, d.fb.data(), code);
+                    if(! d.ws.cr_)
+                        d.ws.cr_.reset(new close_reason);
+                    detail::read(*d.ws.cr_, d.fb.data(), code);
                     if(code != close_code::none)
                     {
                         // protocol error
@@ -484,7 +550,7 @@ operator()(error_code ec,
                     }
                     if(! d.ws.wr_close_)
                     {
-                        auto cr = d.ws.cr_;
+                        auto cr = *d.ws.cr_;
                         if(cr.code == close_code::none)
                             cr.code = close_code::normal;
                         cr.reason = "";
@@ -554,6 +620,10 @@ operator()(error_code ec,
                 d.fb.reset();
                 d.state = do_read_fh;
                 d.ws.wr_block_ = nullptr;
+                // Resume any operations that were
+                // waiting for the pong to be sent.
+                d.ws.ping_op_.maybe_invoke() ||
+                    d.ws.wr_op_.maybe_invoke();
                 break;
 
             //------------------------------------------------------------------
@@ -681,10 +751,20 @@ operator()(error_code ec,
         while(! ec);
     }
 upcall:
+    if(! again)
+    {
+        // The frame was decoded from read-ahead
+        // data without performing any I/O.
+        d.state = do_call_handler;
+        d.ws.get_io_service().post(
+            bind_handler(std::move(*this), ec));
+        return;
+    }
     if(d.ws.wr_block_ == &d)
         d.ws.wr_block_ = nullptr;
-    d.ws.ping_op_.maybe_invoke() ||
-        d.ws.wr_op_.maybe_invoke();
+    if(! d.ws.wr_block_)
+        d.ws.ping_op_.maybe_invoke() ||
+            d.ws.wr_op_.maybe_invoke();
     d_.invoke(ec);
 }
 
@@ -704,7 +784,8 @@ async_read_frame(frame_info& fi,
         void(error_code)> init{handler};
     read_frame_op<DynamicBuffer, handler_type<
         ReadHandler, void(error_code)>>{init.completion_handler,
-            *this, fi, buffer};
+            *this, fi, buffer,
+                (std::numeric_limits<std::size_t>::max)()};
     return init.result.get();
 }
 
@@ -734,149 +815,191 @@ read_frame(frame_info& fi, DynamicBuffer& dynabuf, error_code& ec)
         "SyncStream requirements not met");
     static_assert(beast::is_dynamic_buffer<DynamicBuffer>::value,
         "DynamicBuffer requirements not met");
+    do_read_frame(fi, dynabuf,
+        (std::numeric_limits<std::size_t>::max)(), ec);
+}
+
+template<class NextLayer>
+template<class DynamicBuffer>
+void
+stream<NextLayer>::
+do_read_frame(frame_info& fi, DynamicBuffer& dynabuf,
+    std::size_t limit, error_code& ec)
+{
     using beast::detail::clamp;
     using boost::asio::buffer;
     using boost::asio::buffer_cast;
     using boost::asio::buffer_size;
+    if(wq_pending() > 0)
+    {
+        // Send coalesced messages first,
+        // the peer may be waiting for them.
+        flush(ec);
+        if(ec)
+            return;
+    }
     close_code code{};
     for(;;)
     {
-        // Read frame header
-        detail::frame_header fh;
-        detail::frame_streambuf fb;
+        if(! rd_.partial)
         {
-            fb.commit(boost::asio::read(
-                stream_, fb.prepare(2), ec));
-            failed_ = ec != 0;
-            if(failed_)
-                return;
-            {
-                auto const n = read_fh1(fh, fb, code);
-                if(code != close_code::none)
-                    goto do_close;
-                if(n > 0)
-                {
-                    fb.commit(boost::asio::read(
-                        stream_, fb.prepare(n), ec));
-                    failed_ = ec != 0;
-                    if(failed_)
-                        return;
-                }
-            }
-            read_fh2(fh, fb, code);
-
-            failed_ = ec != 0;
-            if(failed_)
-                return;
-            if(code != close_code::none)
-                goto do_close;
-        }
-        if(detail::is_control(fh.op))
-        {
-            // Read control frame payload
-            if(fh.len > 0)
+            // Read frame header
+            detail::frame_header fh;
+            detail::frame_streambuf fb;
             {
-                auto const mb = fb.prepare(
-                    static_cast<std::size_t>(fh.len));
-                fb.commit(boost::asio::read(stream_, mb, ec));
+                fb.commit(boost::asio::read(
+                    stream_, fb.prepare(2), ec));
                 failed_ = ec != 0;
                 if(failed_)
                     return;
-                if(fh.mask)
                 {
-                    detail::prepared_key key;
-                    detail::prepare_key(key, fh.key);
-                    detail::mask_inplace(mb, key);
+                    auto const n = read_fh1(fh, fb, code);
+                    if(code != close_code::none)
+                        goto do_close;
+                    if(n > 0)
+                    {
+                        fb.commit(boost::asio::read(
+                            stream_, fb.prepare(n), ec));
+                        failed_ = ec != 0;
+                        if(failed_)
+                            return;
+                    }
                 }
-                fb.commit(static_cast<std::size_t>(fh.len));
-            }
-            // Process control frame
-            if(fh.op == opcode::ping)
-            {
-                ping_data payload;
-                detail::read(payload, fb.data());
-                fb.reset();
-                if(ping_cb_)
-                    ping_cb_(false, payload);
-                write_ping<static_buffer>(
-                    fb, opcode::pong, payload);
-                boost::asio::write(stream_, fb.data(), ec);
+                read_fh2(fh, fb, code);
+
                 failed_ = ec != 0;
                 if(failed_)
                     return;
-                continue;
-            }
-            else if(fh.op == opcode::pong)
-            {
-                ping_data payload;
-                detail::read(payload, fb.data());
-                if(ping_cb_)
-                    ping_cb_(true, payload);
-                continue;
-            }
-            BOOST_ASSERT(fh.op == opcode::close);
-            {
-                detail::read(cr_, fb.data(), code);
                 if(code != close_code::none)
                     goto do_close;
-                if(! wr_close_)
+                if(ka_)
+                    ka_->touch(! detail::is_control(fh.op));
+            }
+            if(detail::is_control(fh.op))
+            {
+                // Read control frame payload
+                if(fh.len > 0)
                 {
-                    auto cr = cr_;
-                    if(cr.code == close_code::none)
-                        cr.code = close_code::normal;
-                    cr.reason = "";
+                    auto const mb = fb.prepare(
+                        static_cast<std::size_t>(fh.len));
+                    fb.commit(boost::asio::read(stream_, mb, ec));
+                    failed_ = ec != 0;
+                    if(failed_)
+                        return;
+                    if(fh.mask)
+                    {
+                        detail::prepared_key key;
+                        detail::prepare_key(key, fh.key);
+                        detail::mask_inplace(mb, key);
+                    }
+                    fb.commit(static_cast<std::size_t>(fh.len));
+                }
+                // Process control frame
+                if(fh.op == opcode::ping)
+                {
+                    ping_data payload;
+                    detail::read(payload, fb.data());
                     fb.reset();
-                    wr_close_ = true;
-                    write_close<static_buffer>(fb, cr);
+                    if(ping_cb_)
+                        ping_cb_(false, payload);
+                    write_ping<static_buffer>(
+                        fb, opcode::pong, payload);
                     boost::asio::write(stream_, fb.data(), ec);
                     failed_ = ec != 0;
                     if(failed_)
                         return;
+                    continue;
+                }
+                else if(fh.op == opcode::pong)
+                {
+                    ping_data payload;
+                    detail::read(payload, fb.data());
+                    if(ping_cb_)
+                        ping_cb_(true, payload);
+                    continue;
+                }
+                BOOST_ASSERT(fh.op == opcode::close);
+                {
+                    if(! cr_)
+                        cr_.reset(new close_reason);
+                    detail::read(*cr_, fb.data(), code);
+                    if(code != close_code::none)
+                        goto do_close;
+                    if(! wr_close_)
+                    {
+                        auto cr = *cr_;
+                        if(cr.code == close_code::none)
+                            cr.code = close_code::normal;
+                        cr.reason = "";
+                        fb.reset();
+                        wr_close_ = true;
+                        write_close<static_buffer>(fb, cr);
+                        boost::asio::write(stream_, fb.data(), ec);
+                        failed_ = ec != 0;
+                        if(failed_)
+                            return;
+                    }
+                    goto do_close;
                 }
-                goto do_close;
             }
+            if(fh.op != opcode::cont)
+                rd_begin();
+            rd_.fh = fh;
+            if(fh.len == 0 && ! fh.fin)
+            {
+                // empty frame
+                continue;
+            }
+            if(! pmd_ || ! pmd_->rd_set)
+            {
+                // Enforce message size limit
+                if(rd_msg_max_ && fh.len >
+                    rd_msg_max_ - rd_.size)
+                {
+                    code = close_code::too_big;
+                    goto do_close;
+                }
+                rd_.size += fh.len;
+            }
+            rd_.partial = true;
+            rd_.ztail = false;
+            rd_.remain = fh.len;
+            rd_.zin = {};
+            if(fh.mask)
+                detail::prepare_key(rd_.key, fh.key);
         }
-        if(fh.op != opcode::cont)
-            rd_begin();
-        if(fh.len == 0 && ! fh.fin)
-        {
-            // empty frame
-            continue;
-        }
-        auto remain = fh.len;
-        detail::prepared_key key;
-        if(fh.mask)
-            detail::prepare_key(key, fh.key);
         if(! pmd_ || ! pmd_->rd_set)
         {
-            // Enforce message size limit
-            if(rd_msg_max_ && fh.len >
-                rd_msg_max_ - rd_.size)
-            {
-                code = close_code::too_big;
-                goto do_close;
-            }
-            rd_.size += fh.len;
             // Read message frame payload
-            while(remain > 0)
+            while(rd_.remain > 0)
             {
-                auto b =
-                    dynabuf.prepare(clamp(remain));
+                if(limit == 0)
+                {
+                    // The caller's buffer is full
+                    fi.op = rd_.op;
+                    fi.fin = false;
+                    return;
+                }
+                auto b = dynabuf.prepare(
+                    clamp(rd_.remain, limit));
                 auto const bytes_transferred =
-                    stream_.read_some(b, ec);
+                    rd_direct(rd_.remain) ?
+                        next_layer().read_some(b, ec) :
+                        stream_.read_some(b, ec);
                 failed_ = ec != 0;
                 if(failed_)
                     return;
                 BOOST_ASSERT(bytes_transferred > 0);
-                remain -= bytes_transferred;
+                rd_.remain -= bytes_transferred;
+                limit -= bytes_transferred;
                 auto const pb = buffer_prefix(
                     bytes_transferred, b);
-                if(fh.mask)
-                    detail::mask_inplace(pb, key);
+                if(rd_.fh.mask)
+                    detail::mask_inplace(pb, rd_.key);
                 if(rd_.op == opcode::text)
                 {
                     if(! rd_.utf8.write(pb) ||
-                        (remain == 0 && fh.fin &&
+                        (rd_.remain == 0 && rd_.fh.fin &&
                             ! rd_.utf8.finish()))
                     {
                         code = close_code::bad_payload;
@@ -893,59 +1016,69 @@ read_frame(frame_info& fi, DynamicBuffer& dynabuf, error_code& ec)
             // never emit the end-of-stream deflate block.
             for(;;)
             {
-                auto const bytes_transferred =
-                    stream_.read_some(buffer(rd_.buf.get(),
-                        clamp(remain, rd_.buf_size)), ec);
-                failed_ = ec != 0;
-                if(failed_)
-                    return;
-                remain -= bytes_transferred;
-                auto const in = buffer(
-                    rd_.buf.get(), bytes_transferred);
-                if(fh.mask)
-                    detail::mask_inplace(in, key);
                 auto const prev = dynabuf.size();
-                detail::inflate(pmd_->zi, dynabuf, in, ec);
+                auto const full = detail::inflate(
+                    pmd_zi(), dynabuf, rd_.zin, limit, ec);
                 failed_ = ec != 0;
                 if(failed_)
                     return;
-                if(remain == 0 && fh.fin)
-                {
-                    static std::uint8_t constexpr
-                        empty_block[4] = {
-                            0x00, 0x00, 0xff, 0xff };
-                    detail::inflate(pmd_->zi, dynabuf,
-                        buffer(&empty_block[0], 4), ec);
-                    failed_ = ec != 0;
-                    if(failed_)
-                        return;
-                }
                 if(rd_.op == opcode::text)
                 {
                     consuming_buffers<typename
                         DynamicBuffer::const_buffers_type
                             > cb{dynabuf.data()};
                     cb.consume(prev);
-                    if(! rd_.utf8.write(cb) || (
-                        remain == 0 && fh.fin &&
-                            ! rd_.utf8.finish()))
+                    if(! rd_.utf8.write(cb))
                     {
                         code = close_code::bad_payload;
                         goto do_close;
                     }
                 }
-                if(remain == 0)
-                    break;
+                if(full)
+                {
+                    // The caller's buffer is full
+                    fi.op = rd_.op;
+                    fi.fin = false;
+                    return;
+                }
+                if(rd_.remain > 0)
+                {
+                    auto const bytes_transferred =
+                        stream_.read_some(buffer(rd_.buf.get(),
+                            clamp(rd_.remain, rd_.buf_size)), ec);
+                    failed_ = ec != 0;
+                    if(failed_)
+                        return;
+                    rd_.remain -= bytes_transferred;
+                    auto const in = buffer(
+                        rd_.buf.get(), bytes_transferred);
+                    if(rd_.fh.mask)
+                        detail::mask_inplace(in, rd_.key);
+                    rd_.zin = in;
+                    continue;
+                }
+                if(rd_.fh.fin && ! rd_.ztail)
+                {
+                    rd_.ztail = true;
+                    rd_.zin = detail::pmd_tail();
+                    continue;
+                }
+                break;
+            }
+            if(rd_.fh.fin)
+            {
+                if(rd_.op == opcode::text &&
+                    ! rd_.utf8.finish())
+                {
+                    code = close_code::bad_payload;
+                    goto do_close;
+                }
+                pmd_end_read();
             }
-            if(fh.fin && (
-                (role_ == detail::role_type::client &&
-                    pmd_config_.server_no_context_takeover) ||
-                (role_ == detail::role_type::server &&
-                    pmd_config_.client_no_context_takeover)))
-                pmd_->zi.reset();
         }
+        rd_.partial = false;
         fi.op = rd_.op;
-        fi.fin = fh.fin;
+        fi.fin = rd_.fh.fin;
         return;
     }
 do_close:
@@ -1163,6 +1296,162 @@ read(opcode& op, DynamicBuffer& buffer, error_code& ec)
 
 //------------------------------------------------------------------------------
 
+// read some message data into caller buffers
+//
+template<class NextLayer>
+template<class Buffers, class Handler>
+class stream<NextLayer>::read_some_op
+{
+    struct data
+    {
+        bool cont;
+        stream<NextLayer>& ws;
+        buffers_adapter<Buffers> ba;
+        frame_info fi;
+        int state = 0;
+
+        data(Handler& handler,
+            stream<NextLayer>& ws_, Buffers const& bs)
+            : ws(ws_)
+            , ba(bs)
+        {
+            using boost::asio::asio_handler_is_continuation;
+            cont = asio_handler_is_continuation(std::addressof(handler));
+        }
+    };
+
+    handler_ptr<data, Handler> d_;
+
+public:
+    read_some_op(read_some_op&&) = default;
+    read_some_op(read_some_op const&) = default;
+
+    template<class DeducedHandler, class... Args>
+    read_some_op(DeducedHandler&& h,
+            stream<NextLayer>& ws, Args&&... args)
+        : d_(std::forward<DeducedHandler>(h),
+            ws, std::forward<Args>(args)...)
+    {
+        (*this)(error_code{}, false);
+    }
+
+    void operator()(
+        error_code const& ec, bool again = true);
+
+    friend
+    void* asio_handler_allocate(
+        std::size_t size, read_some_op* op)
+    {
+        using boost::asio::asio_handler_allocate;
+        return asio_handler_allocate(
+            size, std::addressof(op->d_.handler()));
+    }
+
+    friend
+    void asio_handler_deallocate(
+        void* p, std::size_t size, read_some_op* op)
+    {
+        using boost::asio::asio_handler_deallocate;
+        asio_handler_deallocate(
+            p, size, std::addressof(op->d_.handler()));
+    }
+
+    friend
+    bool asio_handler_is_continuation(read_some_op* op)
+    {
+        return op->d_->cont;
+    }
+
+    template<class Function>
+    friend
+    void asio_handler_invoke(Function&& f, read_some_op* op)
+    {
+        using boost::asio::asio_handler_invoke;
+        asio_handler_invoke(
+            f, std::addressof(op->d_.handler()));
+    }
+};
+
+template<class NextLayer>
+template<class Buffers, class Handler>
+void
+stream<NextLayer>::read_some_op<Buffers, Handler>::
+operator()(error_code const& ec, bool again)
+{
+    auto& d = *d_;
+    d.cont = d.cont || again;
+    if(! ec && d.state == 0)
+    {
+        // read payload, up to the size of the buffers
+        d.state = 1;
+        read_frame_op<buffers_adapter<Buffers>, read_some_op>{
+            std::move(*this), d.ws, d.fi, d.ba, d.ba.max_size()};
+        return;
+    }
+    auto const bytes_transferred = d.ba.size();
+    d_.invoke(ec, bytes_transferred);
+}
+
+template<class NextLayer>
+template<class MutableBufferSequence, class ReadHandler>
+async_return_type<
+    ReadHandler, void(error_code, std::size_t)>
+stream<NextLayer>::
+async_read_some(MutableBufferSequence const& buffers,
+    ReadHandler&& handler)
+{
+    static_assert(is_async_stream<next_layer_type>::value,
+        "AsyncStream requirements requirements not met");
+    static_assert(beast::is_mutable_buffer_sequence<
+        MutableBufferSequence>::value,
+            "MutableBufferSequence requirements not met");
+    async_completion<ReadHandler,
+        void(error_code, std::size_t)> init{handler};
+    read_some_op<MutableBufferSequence, handler_type<
+        ReadHandler, void(error_code, std::size_t)>>{
+            init.completion_handler, *this, buffers};
+    return init.result.get();
+}
+
+template<class NextLayer>
+template<class MutableBufferSequence>
+std::size_t
+stream<NextLayer>::
+read_some(MutableBufferSequence const& buffers)
+{
+    static_assert(is_sync_stream<next_layer_type>::value,
+        "SyncStream requirements not met");
+    static_assert(beast::is_mutable_buffer_sequence<
+        MutableBufferSequence>::value,
+            "MutableBufferSequence requirements not met");
+    error_code ec;
+    auto const bytes_transferred =
+        read_some(buffers, ec);
+    if(ec)
+        throw system_error{ec};
+    return bytes_transferred;
+}
+
+template<class NextLayer>
+template<class MutableBufferSequence>
+std::size_t
+stream<NextLayer>::
+read_some(MutableBufferSequence const& buffers,
+    error_code& ec)
+{
+    static_assert(is_sync_stream<next_layer_type>::value,
+        "SyncStream requirements not met");
+    static_assert(beast::is_mutable_buffer_sequence<
+        MutableBufferSequence>::value,
+            "MutableBufferSequence requirements not met");
+    buffers_adapter<MutableBufferSequence> ba{buffers};
+    frame_info fi;
+    do_read_frame(fi, ba, ba.max_size(), ec);
+    return ba.size();
+}
+
+//------------------------------------------------------------------------------
+
 } // websocket
 } // beast
 
@@ -65,6 +65,107 @@ set_option(permessage_deflate const& o)
     pmd_opts_ = o;
 }
 
+template<class NextLayer>
+std::size_t
+stream<NextLayer>::
+buffer_memory() const
+{
+    std::size_t n = stream_.buffer().capacity();
+    if(rd_.buf)
+        n += rd_.buf_size;
+    if(wr_.buf)
+        n += wr_.buf_size;
+    if(pmd_)
+        n += pmd_->zo_out.capacity();
+    if(wq_.bufs)
+        n += sizeof(*wq_.bufs) +
+            wq_.bufs->buf.capacity() +
+            wq_.bufs->wb.capacity();
+    return n;
+}
+
+// Performs the keepalive actions on behalf of a stream
+//
+template<class NextLayer>
+class stream<NextLayer>::ka_timer
+    : public detail::keepalive_timer
+{
+    stream<NextLayer>& ws_;
+
+public:
+    explicit
+    ka_timer(stream<NextLayer>& ws)
+        : detail::keepalive_timer(boost::asio::use_service<
+            detail::keepalive_service>(ws.get_io_service()))
+        , ws_(ws)
+    {
+    }
+
+private:
+    bool
+    is_open() const override
+    {
+        return ! ws_.failed_ && ! ws_.wr_close_;
+    }
+
+    void
+    on_ping() override
+    {
+        // The previous ping is still waiting to be sent
+        if(ops_->count > 0)
+            return;
+        ping_op<detail::keepalive_handler>{
+            detail::keepalive_handler{ops_},
+                ws_, opcode::ping, ping_data{}};
+    }
+
+    void
+    on_pong_timeout() override
+    {
+        error_code ec;
+        ws_.lowest_layer().close(ec);
+    }
+
+    void
+    on_idle() override
+    {
+        close_op<detail::keepalive_handler>{
+            detail::keepalive_handler{ops_},
+                ws_, close_reason{close_code::going_away}};
+    }
+};
+
+template<class NextLayer>
+void
+stream<NextLayer>::
+set_option(keepalive const& o)
+{
+    static_assert(is_async_stream<next_layer_type>::value,
+        "AsyncStream requirements not met");
+    using detail::keepalive_service;
+    if( o.ping_interval.count() <= 0 &&
+        o.idle_timeout.count() <= 0)
+    {
+        // The timer is kept until the stream is
+        // destroyed, since operations it started
+        // may still be in flight.
+        if(ka_)
+        {
+            ka_->ping = 0;
+            ka_->pong = 0;
+            ka_->idle = 0;
+            ka_->stop();
+        }
+        return;
+    }
+    if(! ka_)
+        ka_.reset(new ka_timer{*this});
+    ka_->ping = keepalive_service::to_ticks(o.ping_interval);
+    ka_->pong = keepalive_service::to_ticks(o.pong_timeout);
+    ka_->idle = keepalive_service::to_ticks(o.idle_timeout);
+    ka_->strand(o.strand);
+}
+
 //------------------------------------------------------------------------------
 
 template<class NextLayer>
@@ -74,6 +175,7 @@ reset()
 {
     failed_ = false;
     rd_.cont = false;
+    rd_.partial = false;
     wr_close_ = false;
     wr_.cont = false;
     wr_block_ = nullptr;    // should be nullptr on close anyway
@@ -83,6 +185,52 @@ reset()
         stream_.buffer().size());
 }
 
+template<class NextLayer>
+void
+stream<NextLayer>::
+open(detail::role_type role)
+{
+    stream_base::open(role);
+    // Free the memory used to read the HTTP message,
+    // which is usually larger than the frames to come.
+    if(stream_.buffer().size() == 0)
+        stream_.buffer() = multi_buffer{};
+    frag_reset();
+}
+
+template<class NextLayer>
+void
+stream<NextLayer>::
+frag_reset()
+{
+    if(! frag_)
+        return;
+    // Half the send buffer lets one fragment be
+    // queued while the previous one drains.
+    auto const n = detail::send_buffer_size(
+        stream_.next_layer(), 0);
+    frag_->reset(n > 0 ? n / 2 : wr_buf_size_);
+}
+
+// Copy read-ahead data into the buffers, if at least
+// `need` bytes are available. Returns the bytes copied.
+//
+template<class NextLayer>
+template<class MutableBufferSequence>
+std::size_t
+stream<NextLayer>::
+rd_ahead(MutableBufferSequence const& buffers,
+    std::size_t need)
+{
+    auto& b = stream_.buffer();
+    if(b.size() == 0 || b.size() < need)
+        return 0;
+    auto const n =
+        boost::asio::buffer_copy(buffers, b.data());
+    b.consume(n);
+    return n;
+}
+
 template<class NextLayer>
 template<class Decorator>
 void
@@ -90,6 +238,43 @@ stream<NextLayer>::
 do_accept(
     Decorator const& decorator, error_code& ec)
 {
+    if(is_default_decorator(decorator))
+    {
+        // Parse the request in place and send the
+        // response without building HTTP messages.
+        using upgrade_request = detail::upgrade_request;
+        upgrade_request req;
+        auto& b = stream_.buffer();
+        for(;;)
+        {
+            auto const result = req.parse(b.data());
+            if(result == upgrade_request::done)
+            {
+                detail::upgrade_response res{req.key()};
+                build_response(req, res);
+                b.consume(req.size());
+                boost::asio::write(stream_, res.buffers(), ec);
+                if(ec)
+                    return;
+                open(detail::role_type::server);
+                return;
+            }
+            if(result == upgrade_request::other)
+                break;
+            auto const bytes_transferred =
+                next_layer().read_some(b.prepare(
+                    upgrade_request::max_size - b.size()), ec);
+            if(ec == boost::asio::error::eof)
+            {
+                // reported by the general parser
+                ec = {};
+                break;
+            }
+            if(ec)
+                return;
+            b.commit(bytes_transferred);
+        }
+    }
     http::header_parser<true, http::fields> p;
     auto const bytes_used = http::read_some(
         next_layer(), stream_.buffer(), p, ec);
@@ -167,7 +352,7 @@ build_request(detail::sec_ws_key_type& key,
     req.fields.insert("Host", host);
     req.fields.insert("Upgrade", "websocket");
     req.fields.insert("Connection", "upgrade");
-    detail::make_sec_ws_key(key, maskgen_);
+    detail::make_sec_ws_key(key, detail::mask_source::instance());
     req.fields.insert("Sec-WebSocket-Key", key);
     req.fields.insert("Sec-WebSocket-Version", "13");
     if(pmd_opts_.client_enable)
@@ -278,6 +463,17 @@ build_response(request_type const& req,
     return res;
 }
 
+template<class NextLayer>
+void
+stream<NextLayer>::
+build_response(detail::upgrade_request const& req,
+    detail::upgrade_response& res)
+{
+    pmd_read(pmd_config_, req);
+    detail::pmd_offer unused;
+    pmd_negotiate(res, unused, pmd_config_, pmd_opts_);
+}
+
 template<class NextLayer>
 void
 stream<NextLayer>::
@@ -23,10 +23,191 @@
 #include <boost/assert.hpp>
 #include <algorithm>
 #include <memory>
+#include <utility>
 
 namespace beast {
 namespace websocket {
 
+// send coalesced frames
+//
+template<class NextLayer>
+template<class Handler>
+class stream<NextLayer>::flush_op
+{
+    struct data : op
+    {
+        bool cont;
+        stream<NextLayer>& ws;
+        int state = 0;
+
+        data(Handler& handler, stream<NextLayer>& ws_)
+            : ws(ws_)
+        {
+            using boost::asio::asio_handler_is_continuation;
+            cont = asio_handler_is_continuation(std::addressof(handler));
+        }
+    };
+
+    handler_ptr<data, Handler> d_;
+
+public:
+    flush_op(flush_op&&) = default;
+    flush_op(flush_op const&) = default;
+
+    template<class DeducedHandler, class... Args>
+    flush_op(DeducedHandler&& h,
+            stream<NextLayer>& ws, Args&&... args)
+        : d_(std::forward<DeducedHandler>(h),
+            ws, std::forward<Args>(args)...)
+    {
+        (*this)(error_code{}, false);
+    }
+
+    void operator()()
+    {
+        (*this)(error_code{});
+    }
+
+    void operator()(error_code ec, std::size_t);
+
+    void operator()(error_code ec, bool again = true);
+
+    friend
+    void* asio_handler_allocate(
+        std::size_t size, flush_op* op)
+    {
+        using boost::asio::asio_handler_allocate;
+        return asio_handler_allocate(
+            size, std::addressof(op->d_.handler()));
+    }
+
+    friend
+    void asio_handler_deallocate(
+        void* p, std::size_t size, flush_op* op)
+    {
+        using boost::asio::asio_handler_deallocate;
+        asio_handler_deallocate(
+            p, size, std::addressof(op->d_.handler()));
+    }
+
+    friend
+    bool asio_handler_is_continuation(flush_op* op)
+    {
+        return op->d_->cont;
+    }
+
+    template<class Function>
+    friend
+    void asio_handler_invoke(Function&& f, flush_op* op)
+    {
+        using boost::asio::asio_handler_invoke;
+        asio_handler_invoke(
+            f, std::addressof(op->d_.handler()));
+    }
+};
+
+template<class NextLayer>
+template<class Handler>
+void
+stream<NextLayer>::flush_op<Handler>::
+operator()(error_code ec, std::size_t)
+{
+    auto& d = *d_;
+    if(ec)
+        d.ws.failed_ = true;
+    (*this)(ec);
+}
+
+template<class NextLayer>
+template<class Handler>
+void
+stream<NextLayer>::
+flush_op<Handler>::
+operator()(error_code ec, bool again)
+{
+    auto& d = *d_;
+    d.cont = d.cont || again;
+    if(ec)
+        goto upcall;
+    for(;;)
+    {
+        switch(d.state)
+        {
+        case 0:
+            // Let the io_service run the handlers
+            // that are ready, so their messages can
+            // be coalesced with the ones we have.
+            d.state = 1;
+            d.ws.get_io_service().post(
+                bind_handler(std::move(*this), ec));
+            return;
+
+        case 1:
+            if(d.ws.wr_block_)
+            {
+                // suspend
+                d.state = 2;
+                d.ws.wr_op_.template emplace<
+                    flush_op>(std::move(*this));
+                return;
+            }
+            d.ws.wr_block_ = &d;
+            d.state = 3;
+            break;
+
+        case 2:
+            BOOST_ASSERT(! d.ws.wr_block_);
+            d.ws.wr_block_ = &d;
+            d.state = 3;
+            // The current context is safe but might not be
+            // the same as the one for this operation (since
+            // we are being called from a write operation).
+            // Call post to make sure we are invoked the same
+            // way as the final handler for this operation.
+            d.ws.get_io_service().post(
+                bind_handler(std::move(*this), ec));
+            return;
+
+        case 3:
+            BOOST_ASSERT(d.ws.wr_block_ == &d);
+            if(d.ws.failed_ || d.ws.wr_close_)
+            {
+                // call handler
+                ec = boost::asio::error::operation_aborted;
+                goto upcall;
+            }
+            // Frames serialized by the write
+            // queue are sent by their owners.
+            if( d.ws.wq_pending() == 0 ||
+                d.ws.wq_.nser > 0)
+                goto upcall;
+            std::swap(d.ws.wq_.bufs->buf, d.ws.wq_.bufs->wb);
+            d.state = 99;
+            boost::asio::async_write(d.ws.stream_,
+                d.ws.wq_.bufs->wb.data(), std::move(*this));
+            return;
+
+        case 99:
+            goto upcall;
+        }
+    }
+upcall:
+    if(d.ws.wr_block_ == &d)
+    {
+        if(d.ws.wq_.bufs)
+            d.ws.wq_.bufs->wb.consume(
+                d.ws.wq_.bufs->wb.size());
+        d.ws.wr_block_ = nullptr;
+    }
+    if(! d.ws.wr_block_)
+        d.ws.rd_op_.maybe_invoke() ||
+            d.ws.ping_op_.maybe_invoke() ||
+                d.ws.wr_op_.maybe_invoke();
+    d_.invoke(ec);
+}
+
+//------------------------------------------------------------------------------
+
 template<class NextLayer>
 template<class Buffers, class Handler>
 class stream<NextLayer>::write_frame_op
@@ -41,6 +222,7 @@ class stream<NextLayer>::write_frame_op
         detail::fh_streambuf fh_buf;
         detail::prepared_key key;
         std::uint64_t remain;
+        std::size_t queued = 0;
         int state = 0;
         int entry_state;
 
@@ -153,7 +335,12 @@ operator()(error_code ec,
         do_mask_nofrag = 40,
         do_mask_frag = 50,
         do_deflate = 60,
+        do_flush = 70,
+        do_flushed = 75,
         do_maybe_suspend = 80,
+        do_uncork = 85,
+        do_queued = 90,
+        do_cork = 95,
         do_upcall = 99
     };
     auto& d = *d_;
@@ -165,9 +352,68 @@ operator()(error_code ec,
         switch(d.state)
         {
         case do_init:
+            if( d.fin && d.ws.wr_block_ != &d &&
+                d.ws.wq_corkable(buffer_size(d.cb)))
+            {
+                // Coalesce the message with its neighbors.
+                // The first operation of the batch sends
+                // the frames, and each operation completes
+                // when they are sent.
+                auto& ws = d.ws;
+                ws.wq_serialize(d.cb);
+                if(ws.wq_.nser++ > 0)
+                {
+                    d.state = do_flushed;
+                    ws.wr_op_.template emplace<
+                        write_frame_op>(std::move(*this));
+                    return;
+                }
+                d.state = do_cork;
+                break;
+            }
+            if(d.ws.wq_.depth > 0 && d.ws.wr_block_ != &d && (
+                d.ws.wr_block_ || ! d.ws.wr_op_.empty()))
+            {
+                // Another operation is writing, join the queue
+                auto& ws = d.ws;
+                auto const n = buffer_size(d.cb);
+                if(ws.wr_op_.size() >= ws.wq_.depth ||
+                    n > ws.wq_.bytes - ws.wq_.size)
+                {
+                    // call handler
+                    d.state = do_upcall;
+                    ws.get_io_service().post(
+                        bind_handler(std::move(*this),
+                            boost::asio::error::no_buffer_space));
+                    return;
+                }
+                d.queued = n;
+                ws.wq_.size += n;
+                if( d.fin && ! ws.pmd_ && ! ws.wr_.cont &&
+                    n <= ws.wr_buf_size_ &&
+                    ws.wr_op_.size() ==
+                        ws.wq_.nflush + ws.wq_.nser)
+                {
+                    // Send the frame along with its neighbors.
+                    // The first of them performs the write.
+                    ws.wq_serialize(d.cb);
+                    d.state = ws.wq_.nser == 0 ?
+                        do_flush : do_flushed;
+                    ++ws.wq_.nser;
+                }
+                else
+                {
+                    d.state = do_queued;
+                }
+                ws.wr_op_.template emplace<
+                    write_frame_op>(std::move(*this));
+                if(! ws.wr_block_)
+                    ws.wr_op_.maybe_invoke();
+                return;
+            }
             if(! d.ws.wr_.cont)
             {
-                d.ws.wr_begin();
+                d.ws.wr_begin(d.cb, d.fin);
                 d.fh.rsv1 = d.ws.wr_.compress;
             }
             else
@@ -187,6 +433,7 @@ operator()(error_code ec,
             // the resume.
             if(d.ws.wr_.compress)
             {
+                d.ws.pmd_stats_.bytes_in += buffer_size(d.cb);
                 d.entry_state = do_deflate;
             }
             else if(! d.fh.mask)
@@ -221,6 +468,12 @@ operator()(error_code ec,
                         d.entry_state = do_mask_nofrag;
                 }
             }
+            if(d.ws.wr_block_ == &d)
+            {
+                // resumed from the write queue
+                d.state = do_uncork;
+                break;
+            }
             d.state = do_maybe_suspend;
             break;
 
@@ -258,13 +511,15 @@ operator()(error_code ec,
         {
             BOOST_ASSERT(d.ws.wr_block_ == &d);
             auto const n = clamp(
-                d.remain, d.ws.wr_.buf_size);
+                d.remain, d.ws.wr_frag_size());
             d.remain -= n;
             d.fh.len = n;
             d.fh.fin = d.fin ? d.remain == 0 : false;
             detail::write<static_buffer>(
                 d.fh_buf, d.fh);
-            d.ws.wr_.cont = ! d.fin;
+            d.ws.wr_.cont = ! d.fh.fin;
+            if(d.ws.frag_)
+                d.ws.frag_->begin();
             // Send frame
             d.state = d.remain == 0 ?
                 do_upcall : do_nomask_frag + 2;
@@ -280,6 +535,8 @@ operator()(error_code ec,
                 bytes_transferred - d.fh_buf.size());
             d.fh_buf.reset();
             d.fh.op = opcode::cont;
+            if(d.ws.frag_)
+                d.ws.frag_->end(d.ws.wr_ctrl_waiting());
             if(d.ws.wr_block_ == &d)
                 d.ws.wr_block_ = nullptr;
             // Allow outgoing control frames to
@@ -287,9 +544,11 @@ operator()(error_code ec,
             if(d.ws.rd_op_.maybe_invoke() ||
                 d.ws.ping_op_.maybe_invoke())
             {
-                d.state = do_maybe_suspend;
-                d.ws.get_io_service().post(
-                    std::move(*this));
+                // Resume ahead of any queued
+                // writes, to finish the message.
+                d.state = do_maybe_suspend + 1;
+                d.ws.wr_op_.template emplace_front<
+                    write_frame_op>(std::move(*this));
                 return;
             }
             d.state = d.entry_state;
@@ -308,7 +567,7 @@ operator()(error_code ec,
             d.remain = buffer_size(d.cb);
             d.fh.fin = d.fin;
             d.fh.len = d.remain;
-            d.fh.key = d.ws.maskgen_();
+            d.fh.key = detail::make_mask_key();
             detail::prepare_key(d.key, d.fh.key);
             detail::write<static_buffer>(
                 d.fh_buf, d.fh);
@@ -358,10 +617,10 @@ operator()(error_code ec,
         {
             BOOST_ASSERT(d.ws.wr_block_ == &d);
             auto const n = clamp(
-                d.remain, d.ws.wr_.buf_size);
+                d.remain, d.ws.wr_frag_size());
             d.remain -= n;
             d.fh.len = n;
-            d.fh.key = d.ws.maskgen_();
+            d.fh.key = detail::make_mask_key();
             d.fh.fin = d.fin ? d.remain == 0 : false;
             detail::prepare_key(d.key, d.fh.key);
             auto const b = buffer(
@@ -370,7 +629,9 @@ operator()(error_code ec,
             detail::mask_inplace(b, d.key);
             detail::write<static_buffer>(
                 d.fh_buf, d.fh);
-            d.ws.wr_.cont = ! d.fin;
+            d.ws.wr_.cont = ! d.fh.fin;
+            if(d.ws.frag_)
+                d.ws.frag_->begin();
             // Send frame
             d.state = d.remain == 0 ?
                 do_upcall : do_mask_frag + 2;
@@ -385,6 +646,8 @@ operator()(error_code ec,
                 bytes_transferred - d.fh_buf.size());
             d.fh_buf.reset();
             d.fh.op = opcode::cont;
+            if(d.ws.frag_)
+                d.ws.frag_->end(d.ws.wr_ctrl_waiting());
             BOOST_ASSERT(d.ws.wr_block_ == &d);
             d.ws.wr_block_ = nullptr;
             // Allow outgoing control frames to
@@ -392,9 +655,11 @@ operator()(error_code ec,
             if(d.ws.rd_op_.maybe_invoke() ||
                 d.ws.ping_op_.maybe_invoke())
             {
-                d.state = do_maybe_suspend;
-                d.ws.get_io_service().post(
-                    std::move(*this));
+                // Resume ahead of any queued
+                // writes, to finish the message.
+                d.state = do_maybe_suspend + 1;
+                d.ws.wr_op_.template emplace_front<
+                    write_frame_op>(std::move(*this));
                 return;
             }
             d.state = d.entry_state;
@@ -410,14 +675,13 @@ operator()(error_code ec,
         case do_deflate + 1:
         {
             BOOST_ASSERT(d.ws.wr_block_ == &d);
-            auto b = buffer(d.ws.wr_.buf.get(),
-                d.ws.wr_.buf_size);
-            auto const more = detail::deflate(
-                d.ws.pmd_->zo, b, d.cb, d.fin, ec);
+            auto& out = d.ws.pmd_->zo_out;
+            auto const done = detail::deflate(
+                d.ws.pmd_zo(), out, d.cb, d.fin, ec);
             d.ws.failed_ = ec != 0;
             if(d.ws.failed_)
                 goto upcall;
-            auto const n = buffer_size(b);
+            auto const n = done ? out.size() : out.ready();
             if(n == 0)
             {
                 // The input was consumed, but there
@@ -434,28 +698,33 @@ operator()(error_code ec,
                 d.ws.get_io_service().post(std::move(*this));
                 return;
             }
+            d.ws.pmd_stats_.bytes_out += n;
+            auto const b = out.data(n);
             if(d.fh.mask)
             {
-                d.fh.key = d.ws.maskgen_();
+                d.fh.key = detail::make_mask_key();
                 detail::prepared_key key;
                 detail::prepare_key(key, d.fh.key);
                 detail::mask_inplace(b, key);
             }
-            d.fh.fin = ! more;
+            d.fh.fin = d.fin && done;
             d.fh.len = n;
-            detail::fh_streambuf fh_buf;
-            detail::write<static_buffer>(fh_buf, d.fh);
-            d.ws.wr_.cont = ! d.fin;
+            // The header must outlive the write
+            detail::write<static_buffer>(
+                d.fh_buf, d.fh);
+            d.ws.wr_.cont = ! d.fh.fin;
             // Send frame
-            d.state = more ?
-                do_deflate + 2 : do_deflate + 3;
+            d.state = done ?
+                do_deflate + 3 : do_deflate + 2;
             boost::asio::async_write(d.ws.stream_,
-                buffer_cat(fh_buf.data(), b),
+                buffer_cat(d.fh_buf.data(), b),
                     std::move(*this));
             return;
         }
 
         case do_deflate + 2:
+            d.ws.pmd_->zo_out.consume(d.fh.len);
+            d.fh_buf.reset();
             d.fh.op = opcode::cont;
             d.fh.rsv1 = false;
             BOOST_ASSERT(d.ws.wr_block_ == &d);
@@ -465,21 +734,66 @@ operator()(error_code ec,
             if(d.ws.rd_op_.maybe_invoke() ||
                 d.ws.ping_op_.maybe_invoke())
             {
-                d.state = do_maybe_suspend;
-                d.ws.get_io_service().post(
-                    std::move(*this));
+                // Resume ahead of any queued
+                // writes, to finish the message.
+                d.state = do_maybe_suspend + 1;
+                d.ws.wr_op_.template emplace_front<
+                    write_frame_op>(std::move(*this));
                 return;
             }
             d.state = d.entry_state;
             break;
 
+        //----------------------------------------------------------------------
+
+        case do_flush:
+            BOOST_ASSERT(! d.ws.wr_block_);
+            BOOST_ASSERT(d.ws.wq_.nflush == 0);
+            BOOST_ASSERT(d.ws.wq_.nser > 0);
+            d.ws.wr_block_ = &d;
+            // The serialized operations following
+            // this one complete when the flush does.
+            // Frames queued from now on go to a new batch.
+            d.ws.wq_.nflush = d.ws.wq_.nser - 1;
+            d.ws.wq_.nser = 0;
+            std::swap(d.ws.wq_.bufs->buf, d.ws.wq_.bufs->wb);
+            d.state = do_flush + 1;
+            // (See do_maybe_suspend + 1)
+            d.ws.get_io_service().post(bind_handler(
+                std::move(*this), ec));
+            return;
+
+        case do_flush + 1:
+            BOOST_ASSERT(d.ws.wr_block_ == &d);
+            d.state = do_flush + 2;
+            if(d.ws.failed_ || d.ws.wr_close_)
+            {
+                // call handlers
+                ec = boost::asio::error::operation_aborted;
+                goto upcall;
+            }
+            // Send all the queued frames at once
+            boost::asio::async_write(d.ws.stream_,
+                d.ws.wq_.bufs->wb.data(), std::move(*this));
+            return;
+
+        case do_flush + 2:
+            goto upcall;
+
+        case do_flushed:
+            // Our frame was sent by another operation
+            d.state = do_upcall;
+            d.ws.get_io_service().post(bind_handler(
+                std::move(*this), d.ws.wq_.bufs->ec));
+            return;
+
+        //----------------------------------------------------------------------
+
         case do_deflate + 3:
-            if(d.fh.fin && (
-                (d.ws.role_ == detail::role_type::client &&
-                    d.ws.pmd_config_.client_no_context_takeover) ||
-                (d.ws.role_ == detail::role_type::server &&
-                    d.ws.pmd_config_.server_no_context_takeover)))
-                d.ws.pmd_->zo.reset();
+            d.ws.pmd_->zo_out.consume(d.fh.len);
+            d.fh_buf.reset();
+            if(d.fh.fin)
+                d.ws.pmd_end_write();
             goto upcall;
 
         //----------------------------------------------------------------------
@@ -503,7 +817,8 @@ operator()(error_code ec,
                         boost::asio::error::operation_aborted));
                 return;
             }
-            d.state = d.entry_state;
+            d.ws.wr_block_ = &d;
+            d.state = do_uncork;
             break;
         }
 
@@ -528,20 +843,119 @@ operator()(error_code ec,
                 ec = boost::asio::error::operation_aborted;
                 goto upcall;
             }
+            d.state = do_uncork;
+            break;
+
+        //----------------------------------------------------------------------
+
+        case do_uncork:
+            BOOST_ASSERT(d.ws.wr_block_ == &d);
+            if(d.ws.wq_pending() > 0 && d.ws.wq_.nser == 0)
+            {
+                // Send coalesced frames ahead of ours
+                std::swap(d.ws.wq_.bufs->buf, d.ws.wq_.bufs->wb);
+                d.state = do_uncork + 1;
+                boost::asio::async_write(d.ws.stream_,
+                    d.ws.wq_.bufs->wb.data(), std::move(*this));
+                return;
+            }
+            d.state = d.entry_state + 1;
+            break;
+
+        case do_uncork + 1:
+            d.ws.wq_.bufs->wb.consume(d.ws.wq_.bufs->wb.size());
             d.state = d.entry_state + 1;
             break;
 
         //----------------------------------------------------------------------
 
+        case do_cork:
+            if(d.ws.wr_block_)
+            {
+                // suspend, ahead of the rest of the batch
+                d.state = do_cork + 1;
+                d.ws.wr_op_.template emplace<
+                    write_frame_op>(std::move(*this));
+                return;
+            }
+            d.state = do_cork + 1;
+            break;
+
+        case do_cork + 1:
+            BOOST_ASSERT(! d.ws.wr_block_);
+            d.ws.wr_block_ = &d;
+            d.ws.wq_.cork_lead = true;
+            d.state = do_cork + 2;
+            // Let the io_service run the handlers
+            // that are ready, so their messages can
+            // join the batch.
+            d.ws.get_io_service().post(bind_handler(
+                std::move(*this), ec));
+            return;
+
+        case do_cork + 2:
+            BOOST_ASSERT(d.ws.wr_block_ == &d);
+            BOOST_ASSERT(d.ws.wq_.nser > 0);
+            d.ws.wq_.cork_lead = false;
+            d.ws.wq_.nflush = d.ws.wq_.nser - 1;
+            d.ws.wq_.nser = 0;
+            std::swap(d.ws.wq_.bufs->buf, d.ws.wq_.bufs->wb);
+            d.state = do_flush + 1;
+            break;
+
+        //----------------------------------------------------------------------
+
+        case do_queued:
+            BOOST_ASSERT(! d.ws.wr_block_);
+            d.ws.wr_block_ = &d;
+            d.state = do_queued + 1;
+            // (See do_maybe_suspend + 1)
+            d.ws.get_io_service().post(bind_handler(
+                std::move(*this), ec));
+            return;
+
+        case do_queued + 1:
+            BOOST_ASSERT(d.ws.wr_block_ == &d);
+            if(d.ws.failed_ || d.ws.wr_close_)
+            {
+                // call handler
+                ec = boost::asio::error::operation_aborted;
+                goto upcall;
+            }
+            d.state = do_init;
+            break;
+
+        //----------------------------------------------------------------------
+
         case do_upcall:
             goto upcall;
         }
     }
 upcall:
+    if(d.ws.wr_block_ == &d)
+    {
+        if(d.ws.wq_.bufs)
+            d.ws.wq_.bufs->wb.consume(
+                d.ws.wq_.bufs->wb.size());
+        if(! d.ws.wr_.cont)
+            d.ws.wr_end();
+    }
+    if(d.state == do_flush + 2)
+    {
+        d.ws.wq_.bufs->ec = ec;
+        while(d.ws.wq_.nflush > 0)
+        {
+            --d.ws.wq_.nflush;
+            d.ws.wr_op_.maybe_invoke();
+        }
+    }
+    d.ws.wq_.size -= d.queued;
     if(d.ws.wr_block_ == &d)
         d.ws.wr_block_ = nullptr;
-    d.ws.rd_op_.maybe_invoke() ||
-        d.ws.ping_op_.maybe_invoke();
+    if(! d.ws.wr_block_)
+        d.ws.rd_op_.maybe_invoke() ||
+            d.ws.ping_op_.maybe_invoke() ||
+                d.ws.wr_op_.maybe_invoke();
     d_.invoke(ec);
 }
 
@@ -595,14 +1009,42 @@ write_frame(bool fin,
     static_assert(beast::is_const_buffer_sequence<
         ConstBufferSequence>::value,
             "ConstBufferSequence requirements not met");
+    do_write_frame(fin, buffers, ec);
+    if(! wr_.cont)
+        wr_end();
+}
+
+template<class NextLayer>
+template<class ConstBufferSequence>
+void
+stream<NextLayer>::
+do_write_frame(bool fin,
+    ConstBufferSequence const& buffers, error_code& ec)
+{
     using beast::detail::clamp;
     using boost::asio::buffer;
     using boost::asio::buffer_copy;
     using boost::asio::buffer_size;
+    if(fin && wq_corkable(buffer_size(buffers)))
+    {
+        // Coalesce the message with its neighbors
+        wq_serialize(buffers);
+        if(wq_pending() >= wq_.cork)
+            flush(ec);
+        else
+            ec = {};
+        return;
+    }
+    if(wq_pending() > 0)
+    {
+        flush(ec);
+        if(ec)
+            return;
+    }
     detail::frame_header fh;
     if(! wr_.cont)
     {
-        wr_begin();
+        wr_begin(buffers, fin);
         fh.rsv1 = wr_.compress;
     }
     else
@@ -616,18 +1058,18 @@ write_frame(bool fin,
     auto remain = buffer_size(buffers);
     if(wr_.compress)
     {
+        pmd_stats_.bytes_in += remain;
         consuming_buffers<
             ConstBufferSequence> cb{buffers};
+        auto& out = pmd_->zo_out;
         for(;;)
         {
-            auto b = buffer(
-                wr_.buf.get(), wr_.buf_size);
-            auto const more = detail::deflate(
-                pmd_->zo, b, cb, fin, ec);
+            auto const done = detail::deflate(
+                pmd_zo(), out, cb, fin, ec);
             failed_ = ec != 0;
             if(failed_)
                 return;
-            auto const n = buffer_size(b);
+            auto const n = done ? out.size() : out.ready();
             if(n == 0)
             {
                 // The input was consumed, but there
@@ -638,34 +1080,33 @@ write_frame(bool fin,
                 fh.fin = false;
                 break;
             }
+            pmd_stats_.bytes_out += n;
+            auto const b = out.data(n);
             if(fh.mask)
             {
-                fh.key = maskgen_();
+                fh.key = detail::make_mask_key();
                 detail::prepared_key key;
                 detail::prepare_key(key, fh.key);
                 detail::mask_inplace(b, key);
             }
-            fh.fin = ! more;
+            fh.fin = fin && done;
             fh.len = n;
             detail::fh_streambuf fh_buf;
             detail::write<static_buffer>(fh_buf, fh);
-            wr_.cont = ! fin;
+            wr_.cont = ! fh.fin;
             boost::asio::write(stream_,
                 buffer_cat(fh_buf.data(), b), ec);
             failed_ = ec != 0;
             if(failed_)
                 return;
-            if(! more)
+            out.consume(n);
+            if(done)
                 break;
             fh.op = opcode::cont;
             fh.rsv1 = false;
         }
-        if(fh.fin && (
-            (role_ == detail::role_type::client &&
-                pmd_config_.client_no_context_takeover) ||
-            (role_ == detail::role_type::server &&
-                pmd_config_.server_no_context_takeover)))
-            pmd_->zo.reset();
+        if(fh.fin)
+            pmd_end_write();
         return;
     }
     if(! fh.mask)
@@ -692,19 +1133,23 @@ write_frame(bool fin,
                 ConstBufferSequence> cb{buffers};
             for(;;)
             {
-                auto const n = clamp(remain, wr_.buf_size);
+                auto const n = clamp(remain, wr_frag_size());
                 remain -= n;
                 fh.len = n;
                 fh.fin = fin ? remain == 0 : false;
                 detail::fh_streambuf fh_buf;
                 detail::write<static_buffer>(fh_buf, fh);
                 wr_.cont = ! fin;
+                if(frag_)
+                    frag_->begin();
                 boost::asio::write(stream_,
                     buffer_cat(fh_buf.data(),
                         buffer_prefix(n, cb)), ec);
                 failed_ = ec != 0;
                 if(failed_)
                     return;
+                if(frag_)
+                    frag_->end(false);
                 if(remain == 0)
                     break;
                 fh.op = opcode::cont;
@@ -718,7 +1163,7 @@ write_frame(bool fin,
         // mask, no autofrag
         fh.fin = fin;
         fh.len = remain;
-        fh.key = maskgen_();
+        fh.key = detail::make_mask_key();
         detail::prepared_key key;
         detail::prepare_key(key, fh.key);
         detail::fh_streambuf fh_buf;
@@ -761,10 +1206,10 @@ write_frame(bool fin,
             ConstBufferSequence> cb{buffers};
         for(;;)
         {
-            fh.key = maskgen_();
+            fh.key = detail::make_mask_key();
             detail::prepared_key key;
             detail::prepare_key(key, fh.key);
-            auto const n = clamp(remain, wr_.buf_size);
+            auto const n = clamp(remain, wr_frag_size());
             auto const b = buffer(wr_.buf.get(), n);
             buffer_copy(b, cb);
             detail::mask_inplace(b, key);
@@ -774,11 +1219,15 @@ write_frame(bool fin,
             wr_.cont = ! fh.fin;
             detail::fh_streambuf fh_buf;
             detail::write<static_buffer>(fh_buf, fh);
+            if(frag_)
+                frag_->begin();
             boost::asio::write(stream_,
                 buffer_cat(fh_buf.data(), b), ec);
             failed_ = ec != 0;
             if(failed_)
                 return;
+            if(frag_)
+                frag_->end(false);
             if(remain == 0)
                 break;
             fh.op = opcode::cont;
@@ -949,6 +1398,54 @@ write(ConstBufferSequence const& buffers, error_code& ec)
     write_frame(true, buffers, ec);
 }
 
+//------------------------------------------------------------------------------
+
+template<class NextLayer>
+void
+stream<NextLayer>::
+flush()
+{
+    static_assert(is_sync_stream<next_layer_type>::value,
+        "SyncStream requirements not met");
+    error_code ec;
+    flush(ec);
+    if(ec)
+        throw system_error{ec};
+}
+
+template<class NextLayer>
+void
+stream<NextLayer>::
+flush(error_code& ec)
+{
+    static_assert(is_sync_stream<next_layer_type>::value,
+        "SyncStream requirements not met");
+    ec = {};
+    if(wq_pending() == 0)
+        return;
+    auto& b = wq_.bufs->buf;
+    boost::asio::write(stream_, b.data(), ec);
+    b.consume(b.size());
+    failed_ = ec != 0;
+}
+
+template<class NextLayer>
+template<class WriteHandler>
+async_return_type<
+    WriteHandler, void(error_code)>
+stream<NextLayer>::
+async_flush(WriteHandler&& handler)
+{
+    static_assert(is_async_stream<next_layer_type>::value,
+        "AsyncStream requirements not met");
+    async_completion<WriteHandler,
+        void(error_code)> init{handler};
+    flush_op<handler_type<
+        WriteHandler, void(error_code)>>{
+            init.completion_handler, *this};
+    return init.result.get();
+}
+
 } // websocket
 } // beast
 
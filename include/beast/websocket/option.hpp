@@ -10,10 +10,14 @@
 
 #include <beast/config.hpp>
 #include <beast/websocket/rfc6455.hpp>
+#include <beast/zlib/preset_dictionary.hpp>
+#include <boost/asio/strand.hpp>
 #include <beast/core/detail/type_traits.hpp>
 #include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <stdexcept>
 #include <type_traits>
 #include <utility>
@@ -58,6 +62,133 @@ struct auto_fragment
 };
 #endif
 
+/** Adaptive fragmentation option.
+
+    When enabled, messages which are automatically fragmented use
+    fragments whose size adapts to the connection, instead of the
+    fixed write buffer size. The first fragments are sized from the
+    send buffer of the socket. Fragments which take long to send are
+    made smaller, so that control frames are not held up behind them
+    on slow links, and so are fragments sent while a ping or pong is
+    waiting. Fragments which are sent quickly are made larger, to
+    save frame headers and system calls.
+
+    The size of fragments stays between `min_size` and `max_size`.
+    For clients, it is also limited by the write buffer size, since
+    client frames are masked in that buffer.
+
+    The default setting is disabled, which fragments messages at
+    the write buffer size.
+
+    @note Objects of this type are used with
+          @ref beast::websocket::stream::set_option.
+
+    @par Example
+    Setting the adaptive fragmentation option:
+    @code
+    ...
+    websocket::stream<ip::tcp::socket> ws(ios);
+    ws.set_option(adaptive_fragment{true, 1024, 256 * 1024});
+    @endcode
+*/
+#if BEAST_DOXYGEN
+using adaptive_fragment = implementation_defined;
+#else
+struct adaptive_fragment
+{
+    bool value;
+    std::size_t min_size;
+    std::size_t max_size;
+
+    explicit
+    adaptive_fragment(bool v,
+        std::size_t min_size_ = 512,
+        std::size_t max_size_ = 64 * 1024)
+        : value(v)
+        , min_size(min_size_)
+        , max_size(max_size_)
+    {
+        if(min_size == 0 || min_size > max_size)
+            throw beast::detail::make_exception<std::invalid_argument>(
+                "invalid fragment size", __FILE__, __LINE__);
+    }
+};
+#endif
+
+/** Keepalive option.
+
+    Enables automatic pings and timeouts for the connection. The
+    times are tracked by a timing wheel shared by all streams of
+    the `io_service`, so that enabling the option on a large number
+    of connections does not add a separate timer for each one.
+
+    @li When no frame has been received for `ping_interval`, a
+    ping is sent. The ping waits for any write in progress, in
+    the same way as a call to @ref stream::async_ping.
+
+    @li When no frame has been received for `pong_timeout` after
+    sending the ping, the connection is considered dead and the
+    lowest layer is closed. Pending operations complete with
+    an error.
+
+    @li When no message data has been sent or received for
+    `idle_timeout`, the connection is closed with the code
+    @ref close_code::going_away.
+
+    A duration of zero disables the corresponding behavior. The
+    durations are rounded up to a multiple of 100 milliseconds.
+    The option takes effect when the next handshake completes.
+
+    Frames are only received while a read operation is pending,
+    so the application should keep one outstanding at all times.
+    The stream must only be used with asynchronous operations,
+    and must not be moved while the option is in effect.
+
+    When the `io_service` is run from more than one thread, set
+    `strand` to the strand used for the stream's operations. The
+    pings, closes and checks performed by the keepalive are then
+    dispatched through it. Without a strand they are posted to
+    the `io_service`, which must be run from a single thread.
+
+    @note Objects of this type are used with
+          @ref beast::websocket::stream::set_option.
+
+    @par Example
+    Ping after 30 seconds of silence and close after 10 more:
+    @code
+    ...
+    websocket::stream<ip::tcp::socket> ws(ios);
+    ws.set_option(keepalive{
+        std::chrono::seconds(30), std::chrono::seconds(10)});
+    @endcode
+*/
+#if BEAST_DOXYGEN
+using keepalive = implementation_defined;
+#else
+struct keepalive
+{
+    std::chrono::milliseconds ping_interval;
+    std::chrono::milliseconds pong_timeout;
+    std::chrono::milliseconds idle_timeout;
+    boost::asio::io_service::strand* strand;
+
+    explicit
+    keepalive(
+        std::chrono::milliseconds ping_interval_,
+        std::chrono::milliseconds pong_timeout_ =
+            std::chrono::milliseconds(0),
+        std::chrono::milliseconds idle_timeout_ =
+            std::chrono::milliseconds(0),
+        boost::asio::io_service::strand* strand_ = nullptr)
+        : ping_interval(ping_interval_)
+        , pong_timeout(pong_timeout_)
+        , idle_timeout(idle_timeout_)
+        , strand(strand_)
+    {
+    }
+};
+#endif
+
 /** Message type option.
 
     This controls the opcode set for outgoing messages. Valid
@@ -142,6 +273,97 @@ struct permessage_deflate
 
     /// Deflate memory level, 1..9
     int memLevel = 4;
+
+    /** `true` to free the compression state between messages.
+
+        The state used to compress or decompress messages is always
+        allocated when first needed. When this is set, the state for
+        a direction in which context takeover is disabled is also
+        freed at the end of each message, instead of being kept for
+        the next one. This lowers the memory used by connections
+        which are mostly idle, at the cost of an allocation for
+        each compressed message. When context takeover is enabled
+        for outgoing messages, the pending buffer of the compressor
+        is still given back to a per-thread pool at the end of each
+        message, see @ref beast::zlib::deflate_stream::pool_pending.
+
+        @see @ref beast::websocket::stream::release_compression_memory
+    */
+    bool release_memory = false;
+
+    /** `true` to share compression state between connections.
+
+        When this is set, the state for a direction in which context
+        takeover is disabled is borrowed from a pool at the start of
+        each message, and given back at the end. Each thread keeps its
+        own pool, shared by every stream used on that thread, so the
+        memory used for compression follows the number of messages
+        being sent or received at once instead of the number of
+        connections. This setting takes precedence over
+        @ref release_memory for such directions.
+    */
+    bool use_pool = false;
+
+    /** Size below which messages are sent uncompressed.
+
+        A message written in a single frame whose payload is smaller
+        than this is sent without compression, as deflate would only
+        add work and framing to it. The default of zero compresses
+        every message.
+    */
+    std::size_t compress_min_size = 0;
+
+    /** `true` to send incompressible messages uncompressed.
+
+        When this is set, the first bytes of each outgoing message are
+        sampled, and the message is sent without compression when they
+        look random, for example when the payload is already compressed
+        or encrypted.
+    */
+    bool compress_check = false;
+
+    /** A preset dictionary for compressed messages.
+
+        When this is set, the dictionary is loaded into the
+        state used to compress and to decompress messages
+        whenever that state starts afresh: when it is first
+        created, and at the start of each message in a direction
+        for which context takeover is disabled. Messages which
+        share strings with the dictionary, such as small JSON
+        documents with common keys, compress much better.
+
+        The permessage-deflate extension has no way to agree on
+        a dictionary, so this must only be set when both peers
+        are known to use the same dictionary, for example in a
+        closed deployment of clients and servers. The dictionary
+        is prepared once and may be shared by every stream; it
+        is best prepared for the `memLevel` above and a window
+        size of 15 bits.
+    */
+    std::shared_ptr<zlib::preset_dictionary const> dictionary;
+};
+
+/** Statistics for the permessage-deflate extension.
+
+    These counters are kept for the lifetime of the stream, across
+    sessions, and describe outgoing messages. The compression ratio
+    achieved is `bytes_out / bytes_in`.
+
+    @see @ref beast::websocket::stream::get_compression_stats
+*/
+struct compression_stats
+{
+    /// The number of messages sent with compression
+    std::uint64_t compressed = 0;
+
+    /// The number of messages sent uncompressed by choice
+    std::uint64_t skipped = 0;
+
+    /// The payload bytes given to the compressor
+    std::uint64_t bytes_in = 0;
+
+    /// The payload bytes sent after compression
+    std::uint64_t bytes_out = 0;
 };
 
 /** Ping callback option.
@@ -199,6 +421,44 @@ struct ping_callback
 };
 #endif
 
+/** Buffer pooling option.
+
+    When enabled, the buffers used to mask and compress outgoing
+    messages and to decompress incoming messages are borrowed from
+    a pool owned by the calling thread at the start of each message,
+    and given back when the message is complete. A connection which
+    is idle then holds no buffer memory, which reduces the footprint
+    of servers with many mostly quiet connections.
+
+    The default setting is to keep the buffers for the lifetime
+    of the connection.
+
+    @note Objects of this type are used with
+          @ref beast::websocket::stream::set_option.
+
+    @par Example
+    Setting the buffer pooling option:
+    @code
+    ...
+    websocket::stream<ip::tcp::socket> ws(ios);
+    ws.set_option(pool_buffers{true});
+    @endcode
+*/
+#if BEAST_DOXYGEN
+using pool_buffers = implementation_defined;
+#else
+struct pool_buffers
+{
+    bool value;
+
+    explicit
+    pool_buffers(bool v)
+        : value(v)
+    {
+    }
+};
+#endif
+
 /** Read buffer size option.
 
     Sets the size of the read buffer used by the implementation to
@@ -240,6 +500,45 @@ struct read_buffer_size
 };
 #endif
 
+/** Read-ahead option.
+
+    Sets the size of a buffer used to read ahead of the frame being
+    received. When this is non-zero, each read on the next layer asks
+    for up to this many bytes, and the frame headers and payloads
+    already present in the buffer are decoded from it without further
+    I/O. This saves system calls and handler invocations when the
+    peer sends many small frames. Payloads larger than the buffer
+    are read directly into the caller's buffer.
+
+    The default setting is zero, which reads exactly the bytes
+    needed for each part of a frame.
+
+    @note Objects of this type are used with
+          @ref beast::websocket::stream::set_option.
+
+    @par Example
+    Reading up to 16KB at a time:
+    @code
+    ...
+    websocket::stream<ip::tcp::socket> ws(ios);
+    ws.set_option(read_ahead{16 * 1024});
+    @endcode
+*/
+#if BEAST_DOXYGEN
+using read_ahead = implementation_defined;
+#else
+struct read_ahead
+{
+    std::size_t value;
+
+    explicit
+    read_ahead(std::size_t n)
+        : value(n)
+    {
+    }
+};
+#endif
+
 /** Maximum incoming message size option.
 
     Sets the largest permissible incoming message size. Message
@@ -321,6 +620,121 @@ struct write_buffer_size
 };
 #endif
 
+/** Write queue option.
+
+    Sets the limits of the write queue. When the queue is enabled,
+    the application may start new asynchronous write operations
+    while previous ones are still pending. The operations are
+    performed in the order they were started, and each completion
+    handler is invoked once its message has been sent.
+
+    Complete messages which are not compressed and whose payload
+    fits in the write buffer are copied into the queue as frames
+    when they are started. Consecutive frames waiting in the queue
+    are sent together in a single write on the next layer.
+
+    When the queue already holds `depth` operations, or adding the
+    message would bring the payload bytes held in the queue over
+    `bytes`, the new operation completes immediately with the error
+    `boost::asio::error::no_buffer_space`. The current levels may
+    be inspected with @ref beast::websocket::stream::write_queue_size
+    and @ref beast::websocket::stream::write_queue_bytes.
+
+    The default setting is a depth of zero, which disables the
+    queue. In this case the application must wait for each
+    asynchronous write to complete before starting another.
+
+    @note Objects of this type are used with
+          @ref beast::websocket::stream::set_option.
+
+    @par Example
+    Allowing up to 64 queued writes holding at most 1MB of payload:
+    @code
+    ...
+    websocket::stream<ip::tcp::socket> ws(ios);
+    ws.set_option(write_queue{64, 1024 * 1024});
+    @endcode
+*/
+#if BEAST_DOXYGEN
+using write_queue = implementation_defined;
+#else
+struct write_queue
+{
+    std::size_t depth;
+    std::size_t bytes;
+
+    explicit
+    write_queue(std::size_t depth_,
+            std::size_t bytes_ = 64 * 1024)
+        : depth(depth_)
+        , bytes(bytes_)
+    {
+    }
+};
+#endif
+
+/** Write coalescing option.
+
+    Sets the limit for coalescing ("corking") small messages. When
+    the limit is non-zero, complete messages which are not compressed
+    and whose payload is no larger than the limit are copied into a
+    buffer inside the stream as frames, so that several of them can
+    be sent in a single write on the next layer.
+
+    Asynchronous writes are coalesced when more than one of them is
+    outstanding, which the @ref write_queue option allows. The first
+    write of a batch lets the handlers which are ready run, so their
+    writes can join the batch, then sends the frames of the batch.
+    Every write in the batch completes when the frames are sent, with
+    the result of that send. No operation is left running in the
+    stream after the handlers of its writes are called, so the usual
+    rule applies: the stream must outlive its pending operations.
+
+    Synchronous writes return without performing I/O. The buffered
+    frames are sent when one of the following occurs:
+
+    @li The buffered frames would exceed the limit in size.
+
+    @li A write which is not coalesced, or a close, is performed.
+
+    @li A call to read is made.
+
+    @li The application calls @ref beast::websocket::stream::flush.
+
+    An error from sending the frames is reported by the call which
+    sends them. Frames which are still buffered when the stream is
+    destroyed are not sent, so call `flush` first.
+
+    Pings and pongs may be sent ahead of buffered messages.
+
+    The default setting is zero, which disables coalescing.
+
+    @note Objects of this type are used with
+          @ref beast::websocket::stream::set_option.
+
+    @par Example
+    Coalescing messages up to 16KB:
+    @code
+    ...
+    websocket::stream<ip::tcp::socket> ws(ios);
+    ws.set_option(write_cork{16384});
+    @endcode
+*/
+#if BEAST_DOXYGEN
+using write_cork = implementation_defined;
+#else
+struct write_cork
+{
+    std::size_t value;
+
+    explicit
+    write_cork(std::size_t n)
+        : value(n)
+    {
+    }
+};
+#endif
+
 } // websocket
 } // beast
 
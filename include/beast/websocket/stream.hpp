@@ -12,6 +12,7 @@
 #include <beast/websocket/option.hpp>
 #include <beast/websocket/detail/hybi13.hpp>
 #include <beast/websocket/detail/stream_base.hpp>
+#include <beast/websocket/detail/upgrade.hpp>
 #include <beast/http/message.hpp>
 #include <beast/http/string_body.hpp>
 #include <beast/core/async_result.hpp>
@@ -185,6 +186,24 @@ public:
         wr_autofrag_ = o.value;
     }
 
+    /// Set the adaptive fragmentation option
+    void
+    set_option(adaptive_fragment const& o)
+    {
+        if(! o.value)
+        {
+            frag_.reset();
+            return;
+        }
+        frag_.reset(new detail::fragment_sizer{
+            o.min_size, o.max_size});
+        frag_reset();
+    }
+
+    /// Set the keepalive option
+    void
+    set_option(keepalive const& o);
+
     /// Set the outgoing message type
     void
     set_option(message_type const& o)
@@ -203,6 +222,53 @@ public:
         o = pmd_opts_;
     }
 
+    /** Returns the memory used by the permessage-deflate extension.
+
+        This is the number of bytes currently allocated by the stream
+        to compress and decompress messages. It is zero when the
+        extension is not in use for the current session. State which
+        is borrowed from the shared pool is only counted while a
+        message is in progress.
+
+        @see permessage_deflate::use_pool
+    */
+    std::size_t
+    compression_memory() const
+    {
+        return pmd_memory();
+    }
+
+    /** Release the memory used by the permessage-deflate extension.
+
+        This frees the state used to compress and decompress messages,
+        so long as it is not needed to process a message which is
+        partially sent or received. The state used to decompress is
+        only freed when the peer does not use context takeover. The
+        freed state is allocated again when next needed.
+
+        Applications can call this function on connections which
+        have been idle for a while, to reduce their memory use.
+
+        @note This function must not be called while a read or
+        write operation is outstanding.
+    */
+    void
+    release_compression_memory()
+    {
+        pmd_release();
+    }
+
+    /** Returns statistics for the permessage-deflate extension.
+
+        The counters describe the outgoing messages for which the
+        extension was in use, over the lifetime of the stream.
+    */
+    compression_stats const&
+    get_compression_stats() const
+    {
+        return pmd_stats_;
+    }
+
     /// Set the ping callback
     void
     set_option(ping_callback o)
@@ -210,6 +276,25 @@ public:
         ping_cb_ = std::move(o.value);
     }
 
+    /// Set the buffer pooling option
+    void
+    set_option(pool_buffers const& o)
+    {
+        pool_bufs_ = o.value;
+    }
+
+    /** Returns the memory used by the stream's buffers.
+
+        This is the number of bytes currently allocated by the stream
+        to hold frames being sent or received, including the read-ahead
+        buffer and the write queue. It does not include the memory
+        used by the permessage-deflate extension.
+
+        @see compression_memory, pool_buffers
+    */
+    std::size_t
+    buffer_memory() const;
+
     /// Set the read buffer size
     void
     set_option(read_buffer_size const& o)
@@ -219,6 +304,13 @@ public:
         //stream_.capacity(o.value);
     }
 
+    /// Set the read-ahead buffer size
+    void
+    set_option(read_ahead const& o)
+    {
+        stream_.capacity(o.value);
+    }
+
     /// Set the maximum incoming message size allowed
     void
     set_option(read_message_max const& o)
@@ -233,6 +325,46 @@ public:
         wr_buf_size_ = o.value;
     }
 
+    /// Set the write queue limits
+    void
+    set_option(write_queue const& o)
+    {
+        wq_.depth = o.depth;
+        wq_.bytes = o.bytes;
+    }
+
+    /// Set the write coalescing limit
+    void
+    set_option(write_cork const& o)
+    {
+        wq_.cork = o.value;
+    }
+
+    /// Get the write queue limits
+    void
+    get_option(write_queue& o)
+    {
+        o = write_queue{wq_.depth, wq_.bytes};
+    }
+
+    /** Returns the number of write operations waiting in the queue.
+
+        This includes operations whose frames have been sent but
+        whose completion handlers have not yet been invoked.
+    */
+    std::size_t
+    write_queue_size() const
+    {
+        return wr_op_.size();
+    }
+
+    /// Returns the payload bytes of incomplete queued write operations
+    std::size_t
+    write_queue_bytes() const
+    {
+        return wq_.size;
+    }
+
     /** Get the io_service associated with the stream.
 
         This function may be used to obtain the io_service object
@@ -312,7 +444,8 @@ public:
     close_reason const&
     reason() const
     {
-        return cr_;
+        static close_reason const none{};
+        return cr_ ? *cr_ : none;
     }
 
     /** Read and respond to a WebSocket HTTP Upgrade request.
@@ -2619,6 +2752,149 @@ public:
     async_read_frame(frame_info& fi,
         DynamicBuffer& buffer, ReadHandler&& handler);
 
+    /** Read some message data from the stream.
+
+        This function is used to synchronously read some of the payload
+        of the current message into the caller's buffers. The call blocks
+        until one of the following is true:
+
+        @li Some payload data is received, or the end of a frame
+            is reached.
+
+        @li An error occurs on the stream.
+
+        This call is implemented in terms of one or more calls to the
+        stream's `read_some` and `write_some` operations.
+
+        The data is placed directly into the buffers, after any masking
+        or decompression has been applied, and no other memory is used
+        to hold it. The number of bytes may be zero, for example when an
+        empty frame is received. Callers should keep calling this
+        function until @ref is_message_done returns `true` to receive
+        the entire message. The type of the message may be determined
+        with @ref got_text.
+
+        Control frames are handled in the same manner as for
+        @ref read_frame.
+
+        @param buffers The buffers to fill with message data.
+
+        @return The number of bytes placed into the buffers.
+
+        @throws system_error Thrown on failure.
+    */
+    template<class MutableBufferSequence>
+    std::size_t
+    read_some(MutableBufferSequence const& buffers);
+
+    /** Read some message data from the stream.
+
+        This function is used to synchronously read some of the payload
+        of the current message into the caller's buffers. The call blocks
+        until one of the following is true:
+
+        @li Some payload data is received, or the end of a frame
+            is reached.
+
+        @li An error occurs on the stream.
+
+        This call is implemented in terms of one or more calls to the
+        stream's `read_some` and `write_some` operations.
+
+        The data is placed directly into the buffers, after any masking
+        or decompression has been applied, and no other memory is used
+        to hold it. The number of bytes may be zero, for example when an
+        empty frame is received. Callers should keep calling this
+        function until @ref is_message_done returns `true` to receive
+        the entire message. The type of the message may be determined
+        with @ref got_text.
+
+        Control frames are handled in the same manner as for
+        @ref read_frame.
+
+        @param buffers The buffers to fill with message data.
+
+        @param ec Set to indicate what error occurred, if any.
+
+        @return The number of bytes placed into the buffers.
+    */
+    template<class MutableBufferSequence>
+    std::size_t
+    read_some(MutableBufferSequence const& buffers,
+        error_code& ec);
+
+    /** Start an asynchronous operation to read some message data from the stream.
+
+        This function is used to asynchronously read some of the payload
+        of the current message into the caller's buffers. The function
+        call always returns immediately. The asynchronous operation will
+        continue until one of the following conditions is true:
+
+        @li Some payload data is received, or the end of a frame
+            is reached.
+
+        @li An error occurs on the stream.
+
+        This operation is implemented in terms of one or more calls to the
+        next layer's `async_read_some` and `async_write_some` functions,
+        and is known as a <em>composed operation</em>. The program must
+        ensure that the stream performs no other reads until this operation
+        completes.
+
+        The data is placed directly into the buffers, after any masking
+        or decompression has been applied, and no other memory is used
+        to hold it. The number of bytes may be zero, for example when an
+        empty frame is received. Callers should keep reading until
+        @ref is_message_done returns `true` to receive the entire
+        message. The type of the message may be determined with
+        @ref got_text.
+
+        Control frames are handled in the same manner as for
+        @ref async_read_frame.
+
+        @param buffers The buffers to fill with message data. The
+        memory referenced by the buffers must remain valid until the
+        handler is called.
+
+        @param handler The handler to be called when the read operation
+        completes. Copies will be made of the handler as required. The
+        function signature of the handler must be:
+        @code
+        void handler(
+            error_code const& ec,           // Result of operation
+            std::size_t bytes_transferred   // Bytes placed in the buffers
+        );
+        @endcode
+        Regardless of whether the asynchronous operation completes
+        immediately or not, the handler will not be invoked from within
+        this function. Invocation of the handler will be performed in a
+        manner equivalent to using boost::asio::io_service::post().
+    */
+    template<class MutableBufferSequence, class ReadHandler>
+    async_return_type<
+        ReadHandler, void(error_code, std::size_t)>
+    async_read_some(MutableBufferSequence const& buffers,
+        ReadHandler&& handler);
+
+    /** Returns `true` if the last message was completely read.
+
+        This is `true` before the first message is read, and after
+        all of the payload of a message has been delivered by a
+        read operation.
+    */
+    bool
+    is_message_done() const
+    {
+        return ! rd_.cont && ! rd_.partial;
+    }
+
+    /// Returns `true` if the current or last message read is text
+    bool
+    got_text() const
+    {
+        return rd_.op == opcode::text;
+    }
+
     /** Write a message to the stream.
 
         This function is used to synchronously write a message to
@@ -2853,16 +3129,86 @@ public:
     async_write_frame(bool fin,
         ConstBufferSequence const& buffers, WriteHandler&& handler);
 
+    /** Send corked messages on the stream.
+
+        This function is used to send the frames held in the stream
+        as a result of the @ref write_cork option. The call will block
+        until one of the following conditions is true:
+
+        @li All corked frames are sent.
+
+        @li An error occurs.
+
+        This operation is implemented in terms of one or more calls
+        to the next layer's `write_some` function. If there are no
+        corked frames, the function returns immediately.
+
+        @throws system_error Thrown on failure.
+    */
+    void
+    flush();
+
+    /** Send corked messages on the stream.
+
+        This function is used to send the frames held in the stream
+        as a result of the @ref write_cork option. The call will block
+        until one of the following conditions is true:
+
+        @li All corked frames are sent.
+
+        @li An error occurs.
+
+        This operation is implemented in terms of one or more calls
+        to the next layer's `write_some` function. If there are no
+        corked frames, the function returns immediately.
+
+        @param ec Set to indicate what error occurred, if any.
+    */
+    void
+    flush(error_code& ec);
+
+    /** Start an asynchronous operation to send corked messages on the stream.
+
+        This function is used to asynchronously send the frames held
+        in the stream as a result of the @ref write_cork option. This
+        function call always returns immediately. The asynchronous
+        operation will continue until one of the following conditions
+        is true:
+
+        @li All corked frames are sent.
+
+        @li An error occurs.
+
+        This operation is implemented in terms of one or more calls
+        to the next layer's `async_write_some` functions, and is known
+        as a <em>composed operation</em>. The operation waits for any
+        write operation already in progress to complete first.
+
+        @param handler The handler to be called when the flush completes.
+        Copies will be made of the handler as required. The equivalent
+        function signature of the handler must be:
+        @code void handler(
+            error_code const& ec    // Result of operation
+        ); @endcode
+    */
+    template<class WriteHandler>
+    async_return_type<
+        WriteHandler, void(error_code)>
+    async_flush(WriteHandler&& handler);
+
 private:
     template<class Decorator, class Handler> class accept_op;
     template<class Handler> class close_op;
+    template<class Handler> class flush_op;
     template<class Handler> class handshake_op;
+    class ka_timer;
     template<class Handler> class ping_op;
     template<class Handler> class response_op;
     template<class Buffers, class Handler> class write_op;
     template<class Buffers, class Handler> class write_frame_op;
     template<class DynamicBuffer, class Handler> class read_op;
     template<class DynamicBuffer, class Handler> class read_frame_op;
+    template<class Buffers, class Handler> class read_some_op;
 
     static
     void
@@ -2876,9 +3222,52 @@ private:
     {
     }
 
+    template<class Decorator>
+    static
+    bool
+    is_default_decorator(Decorator const&)
+    {
+        return false;
+    }
+
+    static
+    bool
+    is_default_decorator(void(*f)(response_type&))
+    {
+        return f == &default_decorate_res;
+    }
+
     void
     reset();
 
+    void
+    open(detail::role_type role);
+
+    void
+    frag_reset();
+
+    template<class MutableBufferSequence>
+    std::size_t
+    rd_ahead(MutableBufferSequence const& buffers,
+        std::size_t need);
+
+    template<class DynamicBuffer>
+    void
+    do_read_frame(frame_info& fi, DynamicBuffer& buffer,
+        std::size_t limit, error_code& ec);
+
+    template<class ConstBufferSequence>
+    void
+    do_write_frame(bool fin,
+        ConstBufferSequence const& buffers, error_code& ec);
+
+    bool
+    rd_direct(std::uint64_t remain) const
+    {
+        return stream_.buffer().size() == 0 &&
+            remain >= stream_.capacity();
+    }
+
     template<class Decorator>
     void
     do_accept(Decorator const& decorator,
@@ -2909,6 +3298,10 @@ private:
     build_response(request_type const& req,
         Decorator const& decorator);
 
+    void
+    build_response(detail::upgrade_request const& req,
+        detail::upgrade_response& res);
+
     void
     do_response(http::response_header const& resp,
         detail::sec_ws_key_type const& key, error_code& ec);
@@ -10,7 +10,10 @@
 
 #include <beast/config.hpp>
 
+#include <beast/zlib/compress.hpp>
 #include <beast/zlib/deflate_stream.hpp>
 #include <beast/zlib/inflate_stream.hpp>
+#include <beast/zlib/parallel_deflate.hpp>
+#include <beast/zlib/preset_dictionary.hpp>
 
 #endif
@@ -0,0 +1,144 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef BEAST_ZLIB_COMPRESS_HPP
+#define BEAST_ZLIB_COMPRESS_HPP
+
+#include <beast/config.hpp>
+#include <beast/core/error.hpp>
+#include <beast/core/type_traits.hpp>
+#include <beast/zlib/deflate_stream.hpp>
+#include <beast/zlib/inflate_stream.hpp>
+#include <boost/asio/buffer.hpp>
+#include <cstddef>
+#include <type_traits>
+
+namespace beast {
+namespace zlib {
+
+/** Compress a buffer in one call.
+
+    The input is compressed to a raw deflate stream (RFC 1951),
+    which is appended to the dynamic buffer. Space for the largest
+    possible output, as given by @ref deflate_upper_bound, is
+    prepared first so that the compressor runs only once.
+
+    Each thread keeps the compressors used by this function, and
+    the window and hash table are sized to the input. Compressing
+    a small message therefore neither allocates memory nor clears
+    tables sized for large inputs, as a reset @ref deflate_stream
+    with the default settings would.
+
+    @param in The input to compress.
+
+    @param out The dynamic buffer to append the output to.
+
+    @param level The compression level, from 0 to 9, or -1
+    for the default level of 6.
+
+    @param ec Set to the error, if any occurred.
+
+    @throws std::invalid_argument if the level is invalid.
+*/
+template<class DynamicBuffer
+#if ! BEAST_DOXYGEN
+    , class = typename std::enable_if<
+        is_dynamic_buffer<DynamicBuffer>::value>::type
+#endif
+>
+void
+compress(
+    boost::asio::const_buffer const& in,
+    DynamicBuffer& out,
+    int level,
+    error_code& ec);
+
+/** Compress a buffer in one call into a caller provided buffer.
+
+    The input is compressed to a raw deflate stream (RFC 1951).
+    An output buffer of @ref deflate_upper_bound bytes is always
+    large enough.
+
+    @param in The input to compress.
+
+    @param out The buffer to store the output in.
+
+    @param level The compression level, from 0 to 9, or -1
+    for the default level of 6.
+
+    @param ec Set to the error, if any occurred. This will be
+    `error::need_buffers` if the output buffer is too small.
+
+    @return The number of bytes of output.
+
+    @throws std::invalid_argument if the level is invalid.
+*/
+std::size_t
+compress(
+    boost::asio::const_buffer const& in,
+    boost::asio::mutable_buffer const& out,
+    int level,
+    error_code& ec);
+
+/** Decompress a buffer in one call.
+
+    The input must be a complete raw deflate stream (RFC 1951),
+    whose output is appended to the dynamic buffer. The output
+    is produced in pieces of growing size until the end of the
+    stream is reached.
+
+    Each thread keeps the decompressor used by this function.
+
+    @param in The input to decompress.
+
+    @param out The dynamic buffer to append the output to.
+
+    @param ec Set to the error, if any occurred. This will be
+    `error::need_buffers` if the input ends before the end of
+    the stream, or the dynamic buffer reaches its maximum size.
+*/
+template<class DynamicBuffer
+#if ! BEAST_DOXYGEN
+    , class = typename std::enable_if<
+        is_dynamic_buffer<DynamicBuffer>::value>::type
+#endif
+>
+void
+decompress(
+    boost::asio::const_buffer const& in,
+    DynamicBuffer& out,
+    error_code& ec);
+
+/** Decompress a buffer in one call into a caller provided buffer.
+
+    The input must be a complete raw deflate stream (RFC 1951).
+    The output is written directly to the buffer, from which
+    back-references are also copied, so the decompressor does
+    not use or allocate a sliding window.
+
+    @param in The input to decompress.
+
+    @param out The buffer to store the output in.
+
+    @param ec Set to the error, if any occurred. This will be
+    `error::need_buffers` if the output buffer is too small or
+    the input ends before the end of the stream.
+
+    @return The number of bytes of output.
+*/
+std::size_t
+decompress(
+    boost::asio::const_buffer const& in,
+    boost::asio::mutable_buffer const& out,
+    error_code& ec);
+
+} // zlib
+} // beast
+
+#include <beast/zlib/impl/compress.ipp>
+
+#endif
@@ -37,6 +37,7 @@
 
 #include <beast/config.hpp>
 #include <beast/zlib/error.hpp>
+#include <beast/zlib/preset_dictionary.hpp>
 #include <beast/zlib/zlib.hpp>
 #include <beast/zlib/detail/deflate_stream.hpp>
 #include <algorithm>
@@ -51,6 +52,45 @@ namespace zlib {
 /** Raw deflate compressor.
 
     This is a port of zlib's "deflate" functionality to C++.
+    The output is raw deflate (RFC 1951) unless a zlib or
+    gzip wrapper is chosen with @ref reset.
+
+    @par Memory
+
+    The stream allocates two buffers when first used, whose
+    sizes depend only on `windowBits` and `memLevel`:
+
+    @li The window, hash chains and hash table, which hold
+    the history used to find matches, of
+    `4 << windowBits` plus `2 << (memLevel + 7)` bytes.
+
+    @li The pending buffer, which holds the symbols of the
+    current block and the output not yet delivered, of
+    `1 << (memLevel + 8)` bytes. With @ref pool_pending,
+    this buffer is only held while a message is being
+    compressed.
+
+    The function @ref deflate_memory returns the total, and
+    @ref allocated returns the amount currently held. When
+    many streams are kept open at once, as for a server with
+    many compressed WebSocket sessions, a lean configuration
+    may be chosen:
+
+    @code
+    windowBits  memLevel   window+hash   pending
+        15          8         192 KB       64 KB   (defaults)
+        15          4         132 KB        4 KB
+        12          3          18 KB        2 KB
+        10          2           5 KB        1 KB
+         9          1         2.5 KB      0.5 KB
+    @endcode
+
+    Smaller windows find fewer and shorter matches, and a
+    smaller `memLevel` gives a smaller hash table and shorter
+    blocks. Short blocks often cost less to send with the
+    static Huffman trees, which are shared by all streams.
+    With `Strategy::fixed` only the static trees are used,
+    and the dynamic trees are not built at all.
 */
 class deflate_stream
     : private detail::deflate_stream
@@ -81,7 +121,7 @@ public:
     /** Reset the stream and compression settings.
 
         This function initializes the stream to the specified
-        compression settings.
+        compression settings. The output is raw deflate.
 
         Although the stream is ready to be used immediately
         after a reset, any required internal buffers are not
@@ -100,6 +140,34 @@ public:
         doReset(level, windowBits, memLevel, strategy);
     }
 
+    /** Reset the stream, compression settings and wrapper.
+
+        This function initializes the stream to the specified
+        compression settings. The output is framed by `wrap`,
+        which may not be `Wrap::automatic`. The zlib or gzip
+        trailer is written when the stream is finished with
+        `Flush::finish`.
+
+        Although the stream is ready to be used immediately
+        after a reset, any required internal buffers are not
+        dynamically allocated until needed.
+
+        @note Any unprocessed input or pending output from
+        previous calls are discarded.
+
+        @throws std::invalid_argument if a setting is invalid.
+    */
+    void
+    reset(
+        int level,
+        int windowBits,
+        int memLevel,
+        Strategy strategy,
+        Wrap wrap)
+    {
+        doReset(level, windowBits, memLevel, strategy, wrap);
+    }
+
     /** Reset the stream without deallocating memory.
 
         This function performs the equivalent of calling `clear`
@@ -130,6 +198,46 @@ public:
         doClear();
     }
 
+    /** Returns the size of the dynamically allocated internal buffers.
+
+        The buffers are allocated when first needed after construction
+        or a call to `clear`. The value is the exact number of bytes
+        currently held, which includes the pending buffer only when
+        it is not in the pool. It does not include the size of the
+        stream object itself.
+
+        @see deflate_memory
+    */
+    std::size_t
+    allocated() const
+    {
+        return doAllocated();
+    }
+
+    /** Set whether the pending buffer is given back between messages.
+
+        When this is set, the pending buffer is returned to a pool
+        kept by the calling thread whenever a call to @ref write
+        leaves it holding nothing, as happens at the end of each
+        message which is finished with `Flush::sync`, `Flush::full`
+        or `Flush::finish` and fully written out. It is taken back
+        from the pool by the next call to @ref write. The window and
+        hash table are kept, so the history used by later messages
+        is unchanged.
+
+        This lowers the memory held by streams which are idle
+        between messages. The pool keeps a small number of idle
+        buffers for each thread, and frees the rest.
+
+        The setting is kept by @ref reset and @ref clear. It is
+        off by default.
+    */
+    void
+    pool_pending(bool value)
+    {
+        doPoolPending(value);
+    }
+
     /** Returns the upper limit on the size of a compressed block.
 
         This function makes a conservative estimate of the maximum number
@@ -283,6 +391,7 @@ public:
         error_code& ec)
     {
         doWrite(zs, flush, ec);
+        maybe_release_pending();
     }
 
     /** Update the compression level and strategy.
@@ -314,6 +423,58 @@ public:
         doParams(zs, level, strategy, ec);
     }
 
+    /** Set a preset dictionary.
+
+        The dictionary is loaded into the history, so that the
+        compressed data which follows may refer to it. For raw
+        deflate, this may be done before the first call to
+        @ref write, or after a flush which leaves no input
+        pending, and the decompressor must be given the same
+        dictionary at the same point. For the zlib wrapper this
+        must be done before the first call to @ref write, and
+        the header then names the dictionary by its Adler-32
+        checksum. The gzip wrapper does not allow a dictionary.
+
+        Only the last `1 << windowBits` bytes of the dictionary
+        are used. The most commonly used strings are best placed
+        towards its end.
+
+        @param data A pointer to the dictionary.
+
+        @param size The size of the dictionary in bytes.
+
+        @param ec Set to `error::stream_error` if the dictionary
+        cannot be set at this point.
+    */
+    void
+    dictionary(void const* data, std::size_t size, error_code& ec)
+    {
+        doDictionary(static_cast<Byte const*>(data),
+            static_cast<uInt>(size), ec);
+    }
+
+    /** Set a preset dictionary.
+
+        This is the same as setting the bytes of `dict`, except
+        that when the stream was reset with the `windowBits` and
+        `memLevel` for which `dict` was prepared, and has not
+        been written to, the prepared tables are copied instead
+        of hashing the dictionary.
+
+        @param dict The dictionary, which must remain valid
+        for the duration of the call.
+
+        @param ec Set to `error::stream_error` if the dictionary
+        cannot be set at this point.
+    */
+    void
+    dictionary(preset_dictionary const& dict, error_code& ec)
+    {
+        doDictionary(dict.preset_,
+            dict.data_.data(),
+            static_cast<uInt>(dict.data_.size()), ec);
+    }
+
     /** Return bits pending in the output.
 
         This function returns the number of bytes and bits of output
@@ -354,6 +515,29 @@ public:
     }
 };
 
+/** Returns the memory allocated by a deflate stream.
+
+    This returns the number of bytes of internal buffers which
+    a @ref deflate_stream allocates for the given settings,
+    including the pending buffer. The size of the stream object
+    itself is not included.
+
+    @param windowBits The base two logarithm of the window size.
+
+    @param memLevel The memory level, from 1 to 9.
+*/
+inline
+std::size_t
+deflate_memory(int windowBits, int memLevel)
+{
+    // Same as deflate_stream::reset
+    if(windowBits == 8)
+        windowBits = 9;
+    return
+        detail::deflate_buf_bytes(windowBits, memLevel) +
+        detail::deflate_pbuf_bytes(memLevel);
+}
+
 /** Returns the upper limit on the size of a compressed block.
 
     This function makes a conservative estimate of the maximum number
@@ -0,0 +1,149 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef BEAST_ZLIB_DETAIL_ADLER32_HPP
+#define BEAST_ZLIB_DETAIL_ADLER32_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef BEAST_ZLIB_SSE2
+# if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define BEAST_ZLIB_SSE2 1
+# else
+#  define BEAST_ZLIB_SSE2 0
+# endif
+#endif
+
+#if BEAST_ZLIB_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace beast {
+namespace zlib {
+namespace detail {
+
+/*  Update an Adler-32 (RFC 1950) with n bytes.
+
+    The initial value is one, and the result of one call may
+    be passed to the next to continue the checksum.
+
+    The sums are reduced modulo 65521 once for each 5552 bytes,
+    the most which cannot overflow 32 bits. With SSE2, sixteen
+    bytes are added at a time: s1 from the sum of the bytes,
+    and s2 from the bytes multiplied by their distance from
+    the end of the block plus sixteen times s1 at its start.
+*/
+inline
+std::uint32_t
+adler32(std::uint32_t adler, void const* data, std::size_t n)
+{
+    std::uint32_t constexpr base = 65521;
+    std::size_t constexpr nmax = 5552;
+    auto p = static_cast<std::uint8_t const*>(data);
+    std::uint32_t s1 = adler & 0xffff;
+    std::uint32_t s2 = adler >> 16;
+    while(n > 0)
+    {
+        auto m = n < nmax ? n : nmax;
+        n -= m;
+#if BEAST_ZLIB_SSE2
+        if(m >= 16)
+        {
+            auto const blocks = m / 16;
+            m -= blocks * 16;
+            // The block's part of s2 which
+            // comes from s1 at its start.
+            std::uint64_t t2 = std::uint64_t{s1} * blocks * 16;
+            auto const zero = _mm_setzero_si128();
+            auto const w0 = _mm_setr_epi16(
+                16, 15, 14, 13, 12, 11, 10, 9);
+            auto const w1 = _mm_setr_epi16(
+                8, 7, 6, 5, 4, 3, 2, 1);
+            auto v1 = zero;     // sums of bytes
+            auto vp = zero;     // sums of v1 before each block
+            auto v2 = zero;     // weighted sums of bytes
+            for(std::size_t i = 0; i < blocks; ++i)
+            {
+                auto const b = _mm_loadu_si128(
+                    reinterpret_cast<__m128i const*>(p));
+                vp = _mm_add_epi32(vp, v1);
+                v1 = _mm_add_epi32(v1, _mm_sad_epu8(b, zero));
+                v2 = _mm_add_epi32(v2, _mm_add_epi32(
+                    _mm_madd_epi16(_mm_unpacklo_epi8(b, zero), w0),
+                    _mm_madd_epi16(_mm_unpackhi_epi8(b, zero), w1)));
+                p += 16;
+            }
+            alignas(16) std::uint32_t a1[4];
+            alignas(16) std::uint32_t ap[4];
+            alignas(16) std::uint32_t a2[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(a1), v1);
+            _mm_store_si128(reinterpret_cast<__m128i*>(ap), vp);
+            _mm_store_si128(reinterpret_cast<__m128i*>(a2), v2);
+            auto const sum1 = std::uint64_t{a1[0]} + a1[2];
+            t2 += 16 * (std::uint64_t{ap[0]} + ap[2]) +
+                a2[0] + a2[1] + a2[2] + a2[3];
+            s2 = static_cast<std::uint32_t>((s2 + t2) % base);
+            s1 = static_cast<std::uint32_t>((s1 + sum1) % base);
+        }
+#endif
+        while(m >= 8)
+        {
+            s1 += p[0]; s2 += s1;
+            s1 += p[1]; s2 += s1;
+            s1 += p[2]; s2 += s1;
+            s1 += p[3]; s2 += s1;
+            s1 += p[4]; s2 += s1;
+            s1 += p[5]; s2 += s1;
+            s1 += p[6]; s2 += s1;
+            s1 += p[7]; s2 += s1;
+            p += 8;
+            m -= 8;
+        }
+        while(m--)
+        {
+            s1 += *p++;
+            s2 += s1;
+        }
+        s1 %= base;
+        s2 %= base;
+    }
+    return (s2 << 16) | s1;
+}
+
+/*  Return the Adler-32 of two pieces joined, given the
+    Adler-32 of each and the length of the second.
+*/
+inline
+std::uint32_t
+adler32_combine(std::uint32_t adler1,
+    std::uint32_t adler2, std::size_t len2)
+{
+    std::uint32_t constexpr base = 65521;
+    auto const rem = static_cast<std::uint32_t>(len2 % base);
+    std::uint32_t s1 = adler1 & 0xffff;
+    std::uint32_t s2 = static_cast<std::uint32_t>(
+        (std::uint64_t{rem} * s1) % base);
+    s1 += (adler2 & 0xffff) + base - 1;
+    s2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+    if(s1 >= base)
+        s1 -= base;
+    if(s1 >= base)
+        s1 -= base;
+    if(s2 >= 2 * base)
+        s2 -= 2 * base;
+    if(s2 >= base)
+        s2 -= base;
+    return (s2 << 16) | s1;
+}
+
+} // detail
+} // zlib
+} // beast
+
+#endif
@@ -45,7 +45,7 @@ namespace detail {
 
 class bitstream
 {
-    using value_type = std::uint32_t;
+    using value_type = std::uint64_t;
 
     value_type v_ = 0;
     unsigned n_ = 0;
@@ -87,21 +87,26 @@ public:
     bool
     fill(std::size_t n, FwdIt& first, FwdIt const& last);
 
-    // fill 8 bits, unchecked
-    template<class FwdIt>
+    // fill to at least 56 bits, unchecked
+    //
+    // Eight bytes are read from `it`, but only whole bytes
+    // which fit are consumed. The bits above size() are then
+    // the next input bits rather than zero, until rewind().
+    //
     void
-    fill_8(FwdIt& it);
-
-    // fill 16 bits, unchecked
-    template<class FwdIt>
-    void
-    fill_16(FwdIt& it);
+    refill(std::uint8_t const*& it);
 
     // return n bits
     template<class Unsigned>
     void
     peek(Unsigned& value, std::size_t n);
 
+    // return up to n bits, as many as there are,
+    // with the missing high bits set to zero
+    template<class Unsigned>
+    void
+    peek_some(Unsigned& value, std::size_t n);
+
     // return everything in the reservoir
     value_type
     peek_fast() const
@@ -136,36 +141,48 @@ fill(std::size_t n, FwdIt& first, FwdIt const& last)
     return true;
 }
 
-template<class FwdIt>
 inline
 void
 bitstream::
-fill_8(FwdIt& it)
+refill(std::uint8_t const*& it)
 {
-    v_ += static_cast<value_type>(*it++) << n_;
-    n_ += 8;
+    BOOST_ASSERT(n_ < 64);
+    // Compilers turn this into a single load
+    value_type const v =
+        static_cast<value_type>(it[0])       |
+        static_cast<value_type>(it[1]) <<  8 |
+        static_cast<value_type>(it[2]) << 16 |
+        static_cast<value_type>(it[3]) << 24 |
+        static_cast<value_type>(it[4]) << 32 |
+        static_cast<value_type>(it[5]) << 40 |
+        static_cast<value_type>(it[6]) << 48 |
+        static_cast<value_type>(it[7]) << 56;
+    v_ |= v << n_;
+    it += (63 - n_) >> 3;
+    n_ |= 56;
 }
 
-template<class FwdIt>
+template<class Unsigned>
 inline
 void
 bitstream::
-fill_16(FwdIt& it)
+peek(Unsigned& value, std::size_t n)
 {
-    v_ += static_cast<value_type>(*it++) << n_;
-    n_ += 8;
-    v_ += static_cast<value_type>(*it++) << n_;
-    n_ += 8;
+    BOOST_ASSERT(n <= sizeof(value)*8);
+    BOOST_ASSERT(n <= n_);
+    value = static_cast<Unsigned>(
+        v_ & ((1ULL << n) - 1));
 }
 
 template<class Unsigned>
 inline
 void
 bitstream::
-peek(Unsigned& value, std::size_t n)
+peek_some(Unsigned& value, std::size_t n)
 {
     BOOST_ASSERT(n <= sizeof(value)*8);
-    BOOST_ASSERT(n <= n_);
+    if(n > n_)
+        n = n_;
     value = static_cast<Unsigned>(
         v_ & ((1ULL << n) - 1));
 }
@@ -193,7 +210,7 @@ rewind(BidirIt& it)
     auto len = n_ >> 3;
     it = std::prev(it, len);
     n_ &= 7;
-    v_ &= (1U << n_) - 1;
+    v_ &= (value_type{1} << n_) - 1;
 }
 
 } // detail
@@ -0,0 +1,272 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef BEAST_ZLIB_DETAIL_CRC32_HPP
+#define BEAST_ZLIB_DETAIL_CRC32_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef BEAST_ZLIB_CLMUL
+# if defined(__PCLMUL__) && defined(__SSE4_1__)
+#  define BEAST_ZLIB_CLMUL 1
+# else
+#  define BEAST_ZLIB_CLMUL 0
+# endif
+#endif
+
+#if BEAST_ZLIB_CLMUL
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+namespace beast {
+namespace zlib {
+namespace detail {
+
+/*  CRC-32 as used by gzip (RFC 1952) and zlib's crc32().
+
+    Eight bytes are processed per step using eight lookup
+    tables ("slice-by-8"). When the compiler targets a CPU
+    with carry-less multiply, blocks of 64 bytes or more are
+    instead folded 128 bits at a time with PCLMULQDQ, as in
+    "Fast CRC Computation for Generic Polynomials Using
+    PCLMULQDQ Instruction", Gopal et al., Intel, 2009.
+*/
+struct crc32_tables
+{
+    std::uint32_t t[8][256];
+
+    crc32_tables()
+    {
+        for(std::uint32_t i = 0; i < 256; ++i)
+        {
+            auto c = i;
+            for(int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            t[0][i] = c;
+        }
+        for(std::uint32_t i = 0; i < 256; ++i)
+            for(int k = 1; k < 8; ++k)
+                t[k][i] = (t[k-1][i] >> 8) ^
+                    t[0][t[k-1][i] & 0xff];
+    }
+};
+
+template<class = void>
+crc32_tables const&
+get_crc32_tables()
+{
+    static crc32_tables const tables;
+    return tables;
+}
+
+#if BEAST_ZLIB_CLMUL
+
+// Fold n bytes, where n is at least 64 and a
+// multiple of 16. `crc` is the inverted state.
+inline
+std::uint32_t
+crc32_clmul(std::uint32_t crc,
+    std::uint8_t const* p, std::size_t n)
+{
+    alignas(16) static std::uint64_t const k1k2[] =
+        { 0x0154442bd4, 0x01c6e41596 };
+    alignas(16) static std::uint64_t const k3k4[] =
+        { 0x01751997d0, 0x00ccaa009e };
+    alignas(16) static std::uint64_t const k5k0[] =
+        { 0x0163cd6124, 0x0000000000 };
+    alignas(16) static std::uint64_t const poly[] =
+        { 0x01db710641, 0x01f7011641 };
+
+    auto const load =
+        [](std::uint8_t const* p)
+        {
+            return _mm_loadu_si128(
+                reinterpret_cast<__m128i const*>(p));
+        };
+    auto const fold =
+        [](__m128i x, __m128i k, __m128i y)
+        {
+            return _mm_xor_si128(_mm_xor_si128(
+                _mm_clmulepi64_si128(x, k, 0x00),
+                _mm_clmulepi64_si128(x, k, 0x11)), y);
+        };
+
+    auto x1 = _mm_xor_si128(load(p),
+        _mm_cvtsi32_si128(static_cast<int>(crc)));
+    auto x2 = load(p + 16);
+    auto x3 = load(p + 32);
+    auto x4 = load(p + 48);
+    p += 64;
+    n -= 64;
+
+    // Four folds in parallel for each 64 bytes
+    auto k = _mm_load_si128(
+        reinterpret_cast<__m128i const*>(k1k2));
+    while(n >= 64)
+    {
+        x1 = fold(x1, k, load(p));
+        x2 = fold(x2, k, load(p + 16));
+        x3 = fold(x3, k, load(p + 32));
+        x4 = fold(x4, k, load(p + 48));
+        p += 64;
+        n -= 64;
+    }
+
+    // Fold into 128 bits
+    k = _mm_load_si128(
+        reinterpret_cast<__m128i const*>(k3k4));
+    x1 = fold(x1, k, x2);
+    x1 = fold(x1, k, x3);
+    x1 = fold(x1, k, x4);
+    while(n >= 16)
+    {
+        x1 = fold(x1, k, load(p));
+        p += 16;
+        n -= 16;
+    }
+
+    // Fold 128 bits to 64 bits
+    auto const mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    k = _mm_loadl_epi64(
+        reinterpret_cast<__m128i const*>(k5k0));
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k, 0x00), x2);
+
+    // Barrett reduction to 32 bits
+    k = _mm_load_si128(
+        reinterpret_cast<__m128i const*>(poly));
+    x2 = _mm_and_si128(x1, mask);
+    x2 = _mm_clmulepi64_si128(x2, k, 0x10);
+    x2 = _mm_and_si128(x2, mask);
+    x2 = _mm_clmulepi64_si128(x2, k, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return static_cast<std::uint32_t>(
+        _mm_extract_epi32(x1, 1));
+}
+
+#endif
+
+/*  Update a CRC-32 with n bytes.
+
+    The initial value is zero, and the result of one call
+    may be passed to the next to continue the checksum.
+*/
+inline
+std::uint32_t
+crc32(std::uint32_t crc, void const* data, std::size_t n)
+{
+    auto p = static_cast<std::uint8_t const*>(data);
+    auto const& t = get_crc32_tables().t;
+    crc = ~crc;
+#if BEAST_ZLIB_CLMUL
+    if(n >= 64)
+    {
+        auto const m = n & ~std::size_t{15};
+        crc = crc32_clmul(crc, p, m);
+        p += m;
+        n -= m;
+    }
+#endif
+    auto const load =
+        [](std::uint8_t const* p)
+        {
+            return
+                static_cast<std::uint32_t>(p[0])       |
+                static_cast<std::uint32_t>(p[1]) <<  8 |
+                static_cast<std::uint32_t>(p[2]) << 16 |
+                static_cast<std::uint32_t>(p[3]) << 24;
+        };
+    while(n >= 8)
+    {
+        auto const a = load(p) ^ crc;
+        auto const b = load(p + 4);
+        crc =
+            t[7][ a        & 0xff] ^
+            t[6][(a >>  8) & 0xff] ^
+            t[5][(a >> 16) & 0xff] ^
+            t[4][ a >> 24        ] ^
+            t[3][ b        & 0xff] ^
+            t[2][(b >>  8) & 0xff] ^
+            t[1][(b >> 16) & 0xff] ^
+            t[0][ b >> 24        ];
+        p += 8;
+        n -= 8;
+    }
+    while(n--)
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+/*  Return the CRC-32 of two pieces joined, given the CRC-32
+    of each and the length of the second.
+
+    Appending n zero bytes to the first piece is a linear
+    operator on its CRC, applied by squaring the operator for
+    one zero bit, as in zlib's crc32_combine.
+*/
+inline
+std::uint32_t
+crc32_combine(std::uint32_t crc1,
+    std::uint32_t crc2, std::size_t len2)
+{
+    auto const times =
+        [](std::uint32_t const* mat, std::uint32_t vec)
+        {
+            std::uint32_t sum = 0;
+            for(; vec; vec >>= 1, ++mat)
+                if(vec & 1)
+                    sum ^= *mat;
+            return sum;
+        };
+    auto const square =
+        [&](std::uint32_t* sq, std::uint32_t const* mat)
+        {
+            for(int n = 0; n < 32; ++n)
+                sq[n] = times(mat, mat[n]);
+        };
+    if(len2 == 0)
+        return crc1;
+    std::uint32_t even[32];     // operator for an even power of two zeros
+    std::uint32_t odd[32];      // operator for an odd power of two zeros
+    odd[0] = 0xedb88320;        // one zero bit
+    std::uint32_t row = 1;
+    for(int n = 1; n < 32; ++n)
+    {
+        odd[n] = row;
+        row <<= 1;
+    }
+    square(even, odd);          // two zero bits
+    square(odd, even);          // four zero bits
+    for(;;)
+    {
+        // One zero byte the first time through
+        square(even, odd);
+        if(len2 & 1)
+            crc1 = times(even, crc1);
+        len2 >>= 1;
+        if(len2 == 0)
+            break;
+        square(odd, even);
+        if(len2 & 1)
+            crc1 = times(odd, crc1);
+        len2 >>= 1;
+        if(len2 == 0)
+            break;
+    }
+    return crc1 ^ crc2;
+}
+
+} // detail
+} // zlib
+} // beast
+
+#endif
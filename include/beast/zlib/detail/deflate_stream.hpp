@@ -35,8 +35,12 @@
 #ifndef BEAST_ZLIB_DETAIL_DEFLATE_STREAM_HPP
 #define BEAST_ZLIB_DETAIL_DEFLATE_STREAM_HPP
 
+#include <beast/zlib/error.hpp>
 #include <beast/zlib/zlib.hpp>
+#include <beast/zlib/detail/adler32.hpp>
+#include <beast/zlib/detail/crc32.hpp>
 #include <beast/zlib/detail/ranges.hpp>
+#include <beast/core/detail/buffer_pool.hpp>
 #include <beast/core/detail/type_traits.hpp>
 #include <boost/assert.hpp>
 #include <boost/optional.hpp>
@@ -46,6 +50,27 @@
 #include <memory>
 #include <stdexcept>
 #include <type_traits>
+#include <vector>
+
+#ifndef BEAST_ZLIB_SSE2
+# if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define BEAST_ZLIB_SSE2 1
+# else
+#  define BEAST_ZLIB_SSE2 0
+# endif
+#endif
+
+#if BEAST_ZLIB_SSE2
+# if defined(__AVX2__)
+#  include <immintrin.h>
+# else
+#  include <emmintrin.h>
+# endif
+# ifdef _MSC_VER
+#  include <intrin.h>
+# endif
+#endif
 
 namespace beast {
 namespace zlib {
@@ -101,6 +126,41 @@ namespace detail {
  *
  */
 
+/*  A preset dictionary loaded into a stream, with its hash chains
+    built. It may be copied into any new stream using the same window
+    and hash table sizes, instead of inserting each string again.
+*/
+struct deflate_preset
+{
+    uInt w_bits = 0;
+    uInt hash_bits = 0;
+    std::uint32_t adler = 1;        // Adler-32 of the whole dictionary
+    uInt insert = 0;                // bytes at the end left to insert
+    std::vector<std::uint8_t> window;
+    std::vector<std::uint16_t> head;
+    std::vector<std::uint16_t> prev;
+};
+
+// Size of the buffer holding the window, prev and head
+inline
+std::size_t
+deflate_buf_bytes(int windowBits, int memLevel)
+{
+    return (std::size_t{1} << windowBits) *
+            (2 + sizeof(std::uint16_t)) +
+        (std::size_t{1} << (memLevel + 7)) *
+            sizeof(std::uint16_t);
+}
+
+// Size of the buffer holding the pending output and symbols
+inline
+std::size_t
+deflate_pbuf_bytes(int memLevel)
+{
+    return (std::size_t{1} << (memLevel + 6)) *
+        (sizeof(std::uint16_t) + 2);
+}
+
 class deflate_stream
 {
 protected:
@@ -274,6 +334,7 @@ protected:
     // VFALCO This might not be needed, e.g. for zip/gzip
     enum StreamStatus
     {
+        INIT_STATE = 42,
         EXTRA_STATE = 69,
         NAME_STATE = 73,
         COMMENT_STATE = 91,
@@ -296,9 +357,16 @@ protected:
 
     bool inited_ = false;
     std::size_t buf_size_;
-    std::unique_ptr<std::uint8_t[]> buf_;
+    std::unique_ptr<std::uint8_t[]> buf_;   // window, prev and head
+    std::size_t pbuf_size_;
+    std::unique_ptr<std::uint8_t[]> pbuf_;  // pending and symbols
+    bool pool_pending_ = false;
 
     int status_;                    // as the name implies
+    Wrap wrap_ = Wrap::none;        // header and trailer to write
+    bool trailer_;                  // trailer was written
+    std::uint32_t check_;           // Adler-32 or CRC-32 of the input
+    std::uint32_t length_;          // input size modulo 2^32, for gzip
     Byte* pending_buf_;             // output still pending
     std::uint32_t
         pending_buf_size_;          // size of pending_buf
@@ -334,15 +402,12 @@ protected:
 
     std::uint16_t* head_;           // Heads of the hash chains or 0
 
-    uInt  ins_h_;                   // hash index of string to be inserted
     uInt  hash_size_;               // number of elements in hash table
     uInt  hash_bits_;               // log2(hash_size)
     uInt  hash_mask_;               // hash_size-1
 
-    /*  Number of bits by which ins_h must be shifted at each input
-        step. It must be such that after minMatch steps,
-        the oldest byte no longer takes part in the hash key, that is:
-        hash_shift * minMatch >= hash_bits
+    /*  Number of bits by which the product in hash() is shifted
+        to leave its top hash_bits bits, that is 32 - hash_bits.
     */
     uInt hash_shift_;
 
@@ -534,16 +599,24 @@ protected:
         return lut_.dist_code[256+(dist>>7)];
     }
 
-    /*  Update a hash value with the given input byte
-        IN  assertion: all calls to to update_hash are made with
-            consecutive input characters, so that a running hash
-            key can be computed from the previous key instead of
-            complete recalculation each time.
+    /*  Return the hash of the minMatch bytes at p.
+        The bytes are multiplied by a large odd constant and the
+        high bits of the product are kept. This spreads similar
+        strings, such as text differing only in the last byte,
+        over the whole table, unlike the original shift-and-xor
+        rolling hash, so hash chains hold fewer false candidates.
+        Each hash depends only on its own bytes, so strings may be
+        inserted in any order.
     */
-    void
-    update_hash(uInt& h, std::uint8_t c)
+    uInt
+    hash(Byte const* p) const
     {
-        h = ((h << hash_shift_) ^ c) & hash_mask_;
+        std::uint32_t const v =
+            static_cast<std::uint32_t>(p[0]) |
+            (static_cast<std::uint32_t>(p[1]) << 8) |
+            (static_cast<std::uint32_t>(p[2]) << 16);
+        return static_cast<uInt>(
+            (v * 2654435761u) >> hash_shift_);
     }
 
     /*  Initialize the hash table (avoiding 64K overflow for 16
@@ -574,17 +647,15 @@ protected:
         same hash key). Return the previous length of the hash chain.
         If this file is compiled with -DFASTEST, the compression level
         is forced to 1, and no hash chains are maintained.
-        IN  assertion: all calls to to INSERT_STRING are made with
-            consecutive input characters and the first minMatch
-            bytes of str are valid (except for the last minMatch-1
-            bytes of the input file).
+        IN  assertion: the first minMatch bytes of str are valid
+            (except for the last minMatch-1 bytes of the input file).
     */
     void
     insert_string(IPos& hash_head)
     {
-        update_hash(ins_h_, window_[strstart_ + (minMatch-1)]);
-        hash_head = prev_[strstart_ & w_mask_] = head_[ins_h_];
-        head_[ins_h_] = (std::uint16_t)strstart_;
+        auto const h = hash(window_ + strstart_);
+        hash_head = prev_[strstart_ & w_mask_] = head_[h];
+        head_[h] = (std::uint16_t)strstart_;
     }
 
     //--------------------------------------------------------------------------
@@ -645,6 +716,36 @@ protected:
             init();
     }
 
+    std::size_t
+    doAllocated() const
+    {
+        return
+            (buf_ ? buf_size_ : 0) +
+            (pbuf_ ? pbuf_size_ : 0);
+    }
+
+    void
+    doPoolPending(bool value)
+    {
+        pool_pending_ = value;
+    }
+
+    // Give the pending buffer back to the pool if it holds nothing
+    void
+    maybe_release_pending()
+    {
+        if(pool_pending_ && pbuf_ && inited_ &&
+            pending_ == 0 && last_lit_ == 0)
+        {
+            beast::detail::buffer_pool::instance().release(
+                std::move(pbuf_), pbuf_size_);
+            pending_buf_ = nullptr;
+            pending_out_ = nullptr;
+            d_buf_ = nullptr;
+            l_buf_ = nullptr;
+        }
+    }
+
     static
     unsigned
     bi_reverse(unsigned code, int len);
@@ -659,7 +760,7 @@ protected:
     lut_type const&
     get_lut();
 
-    template<class = void> void doReset             (int level, int windowBits, int memLevel, Strategy strategy);
+    template<class = void> void doReset             (int level, int windowBits, int memLevel, Strategy strategy, Wrap wrap = Wrap::none);
     template<class = void> void doReset             ();
     template<class = void> void doClear             ();
     template<class = void> std::size_t doUpperBound (std::size_t sourceLen) const;
@@ -667,10 +768,13 @@ protected:
     template<class = void> void doParams            (z_params& zs, int level, Strategy strategy, error_code& ec);
     template<class = void> void doWrite             (z_params& zs, Flush flush, error_code& ec);
     template<class = void> void doDictionary        (Byte const* dict, uInt dictLength, error_code& ec);
+    template<class = void> void doDictionary        (deflate_preset const& preset, Byte const* dict, uInt dictLength, error_code& ec);
+    template<class = void> void doSavePreset        (deflate_preset& preset, Byte const* dict, uInt dictLength);
     template<class = void> void doPrime             (int bits, int value, error_code& ec);
     template<class = void> void doPending           (unsigned* value, int* bits);
 
     template<class = void> void init                ();
+    template<class = void> void acquire_pending     ();
     template<class = void> void lm_init             ();
     template<class = void> void init_block          ();
     template<class = void> void pqdownheap          (ct_data const* tree, int k);
@@ -683,6 +787,7 @@ protected:
     template<class = void> void send_all_trees      (int lcodes, int dcodes, int blcodes);
     template<class = void> void compress_block      (ct_data const* ltree, ct_data const* dtree);
     template<class = void> int  detect_data_type    ();
+    template<class = void> std::uint32_t static_length();
     template<class = void> void bi_windup           ();
     template<class = void> void bi_flush            ();
     template<class = void> void copy_block          (char *buf, unsigned len, int header);
@@ -697,9 +802,13 @@ protected:
     template<class = void> void tr_flush_block      (z_params& zs, char *buf, std::uint32_t stored_len, int last);
     template<class = void> void fill_window         (z_params& zs);
     template<class = void> void flush_pending       (z_params& zs);
+    template<class = void> void put_header          ();
+    template<class = void> void put_trailer         ();
     template<class = void> void flush_block         (z_params& zs, bool last);
     template<class = void> int  read_buf            (z_params& zs, Byte *buf, unsigned size);
     template<class = void> uInt longest_match       (IPos cur_match);
+    static inline          uInt compare_258         (Byte const* a, Byte const* b);
+    static inline          void slide_hash          (std::uint16_t* p, uInt n, uInt wsize);
 
     template<class = void> block_state f_stored     (z_params& zs, Flush flush);
     template<class = void> block_state f_fast       (z_params& zs, Flush flush);
@@ -884,7 +993,8 @@ doReset(
     int level,
     int windowBits,
     int memLevel,
-    Strategy strategy)
+    Strategy strategy,
+    Wrap wrap)
 {
     if(level == Z_DEFAULT_COMPRESSION)
         level = 6;
@@ -908,6 +1018,10 @@ doReset(
         throw make_exception<std::invalid_argument>(
             "invalid memLevel", __FILE__, __LINE__);
 
+    if(wrap == Wrap::automatic)
+        throw make_exception<std::invalid_argument>(
+            "invalid wrap", __FILE__, __LINE__);
+
     w_bits_ = windowBits;
 
     hash_bits_ = memLevel + 7;
@@ -917,6 +1031,7 @@ doReset(
 
     level_ = level;
     strategy_ = strategy;
+    wrap_ = wrap;
     inited_ = false;
 }
 
@@ -935,6 +1050,7 @@ doClear()
 {
     inited_ = false;
     buf_.reset();
+    pbuf_.reset();
 }
 
 template<class>
@@ -950,7 +1066,20 @@ doUpperBound(std::size_t sourceLen) const
               ((sourceLen + 7) >> 3) + ((sourceLen + 63) >> 6) + 5;
 
     /* compute wrapper length */
-    wraplen = 0;
+    switch(wrap_)
+    {
+    case Wrap::zlib:
+        // header, dictionary id and Adler-32
+        wraplen = 2 + 4 + 4;
+        break;
+    case Wrap::gzip:
+        // header, CRC-32 and length
+        wraplen = 10 + 4 + 4;
+        break;
+    default:
+        wraplen = 0;
+        break;
+    }
 
     /* if not default parameters, return conservative bound */
     if(w_bits_ != 15 || hash_bits_ != 8 + 7)
@@ -1017,6 +1146,8 @@ deflate_stream::
 doWrite(z_params& zs, Flush flush, error_code& ec)
 {
     maybe_init();
+    if(! pbuf_)
+        acquire_pending();
 
     if(zs.next_out == 0 || (zs.next_in == 0 && zs.avail_in != 0) ||
         (status_ == FINISH_STATE && flush != Flush::finish))
@@ -1068,6 +1199,20 @@ doWrite(z_params& zs, Flush flush, error_code& ec)
         return;
     }
 
+    if(status_ == INIT_STATE)
+    {
+        put_header();
+        status_ = BUSY_STATE;
+
+        // Compression must start with an empty pending buffer
+        flush_pending(zs);
+        if(pending_ != 0)
+        {
+            last_flush_ = boost::none;
+            return;
+        }
+    }
+
     /* Start a new block or continue the current one.
      */
     if(zs.avail_in != 0 || lookahead_ != 0 ||
@@ -1144,24 +1289,40 @@ doWrite(z_params& zs, Flush flush, error_code& ec)
 
     if(flush == Flush::finish)
     {
+        if(wrap_ != Wrap::none && ! trailer_)
+        {
+            put_trailer();
+            trailer_ = true;
+            flush_pending(zs);
+            if(pending_ != 0)
+                return;
+        }
         ec = error::end_of_stream;
         return;
     }
 }
 
-// VFALCO Warning: untested
 template<class>
 void
 deflate_stream::
 doDictionary(Byte const* dict, uInt dictLength, error_code& ec)
 {
-    if(lookahead_)
+    maybe_init();
+
+    // The zlib header names the dictionary, so it must come first
+    if(lookahead_ || wrap_ == Wrap::gzip ||
+        (wrap_ == Wrap::zlib && status_ != INIT_STATE))
     {
         ec = error::stream_error;
         return;
     }
 
-    maybe_init();
+    if(wrap_ == Wrap::zlib)
+        check_ = adler32(check_, dict, dictLength);
+
+    // The dictionary is not part of the checked input
+    auto const wrap = wrap_;
+    wrap_ = Wrap::none;
 
     /* if dict would fill window, just replace the history */
     if(dictLength >= w_size_)
@@ -1187,9 +1348,9 @@ doDictionary(Byte const* dict, uInt dictLength, error_code& ec)
         uInt n = lookahead_ - (minMatch-1);
         do
         {
-            update_hash(ins_h_, window_[str + minMatch-1]);
-            prev_[str & w_mask_] = head_[ins_h_];
-            head_[ins_h_] = (std::uint16_t)str;
+            auto const h = hash(window_ + str);
+            prev_[str & w_mask_] = head_[h];
+            head_[h] = (std::uint16_t)str;
             str++;
         }
         while(--n);
@@ -1203,6 +1364,71 @@ doDictionary(Byte const* dict, uInt dictLength, error_code& ec)
     lookahead_ = 0;
     match_length_ = prev_length_ = minMatch-1;
     match_available_ = 0;
+    wrap_ = wrap;
+}
+
+/*  Load a dictionary from a preset, or from its bytes when the
+    preset was built for other settings or the stream already
+    has history, to which the dictionary would be appended.
+*/
+template<class>
+void
+deflate_stream::
+doDictionary(
+    deflate_preset const& preset,
+    Byte const* dict,
+    uInt dictLength,
+    error_code& ec)
+{
+    maybe_init();
+
+    if(preset.w_bits != w_bits_ ||
+        preset.hash_bits != hash_bits_ ||
+        strstart_ != 0 || insert_ != 0)
+        return doDictionary(dict, dictLength, ec);
+
+    if(lookahead_ || wrap_ == Wrap::gzip ||
+        (wrap_ == Wrap::zlib && status_ != INIT_STATE))
+    {
+        ec = error::stream_error;
+        return;
+    }
+
+    if(wrap_ == Wrap::zlib)
+        check_ = preset.adler;
+
+    auto const n = static_cast<uInt>(preset.window.size());
+    std::memcpy(window_, preset.window.data(), n);
+    std::memcpy(head_, preset.head.data(),
+        hash_size_ * sizeof(*head_));
+    std::memcpy(prev_, preset.prev.data(),
+        n * sizeof(*prev_));
+    strstart_ = n;
+    block_start_ = (long)strstart_;
+    insert_ = preset.insert;
+    lookahead_ = 0;
+    match_length_ = prev_length_ = minMatch-1;
+    match_available_ = 0;
+}
+
+/*  Load a dictionary into this new stream,
+    then save the result in a preset.
+*/
+template<class>
+void
+deflate_stream::
+doSavePreset(deflate_preset& preset, Byte const* dict, uInt dictLength)
+{
+    error_code ec;
+    doDictionary(dict, dictLength, ec);
+    BOOST_ASSERT(! ec);
+    preset.w_bits = w_bits_;
+    preset.hash_bits = hash_bits_;
+    preset.adler = adler32(1, dict, dictLength);
+    preset.insert = insert_;
+    preset.window.assign(window_, window_ + strstart_);
+    preset.head.assign(head_, head_ + hash_size_);
+    preset.prev.assign(prev_, prev_ + strstart_);
 }
 
 template<class>
@@ -1211,6 +1437,8 @@ deflate_stream::
 doPrime(int bits, int value, error_code& ec)
 {
     maybe_init();
+    if(! pbuf_)
+        acquire_pending();
 
     if((Byte *)(d_buf_) < pending_out_ + ((Buf_size + 7) >> 3))
     {
@@ -1263,13 +1491,11 @@ init()
 
     hash_size_ = 1 << hash_bits_;
     hash_mask_ = hash_size_ - 1;
-    hash_shift_ =  ((hash_bits_+minMatch-1)/minMatch);
+    hash_shift_ = 32 - hash_bits_;
 
     auto const nwindow  = w_size_ * 2*sizeof(Byte);
     auto const nprev    = w_size_ * sizeof(std::uint16_t);
-    auto const nhead    = hash_size_ * sizeof(std::uint16_t);
-    auto const noverlay = lit_bufsize_ * (sizeof(std::uint16_t)+2);
-    auto const needed   = nwindow + nprev + nhead + noverlay;
+    auto const needed   = deflate_buf_bytes(w_bits_, hash_bits_ - 7);
 
     if(! buf_ || buf_size_ != needed)
     {
@@ -1281,15 +1507,51 @@ init()
     prev_   = reinterpret_cast<std::uint16_t*>(buf_.get() + nwindow);
     head_   = reinterpret_cast<std::uint16_t*>(buf_.get() + nwindow + nprev);
 
+    // nothing written to window_ yet
+    high_water_ = 0;
+
+    pending_ = 0;
+    last_lit_ = 0;
+    acquire_pending();
+
+    status_ = wrap_ == Wrap::none ? BUSY_STATE : INIT_STATE;
+    last_flush_ = Flush::none;
+    trailer_ = false;
+    check_ = wrap_ == Wrap::gzip ? 0 : 1;
+    length_ = 0;
+
+    tr_init();
+    lm_init();
+
+    inited_ = true;
+}
+
+/*  Point the pending and symbol buffers into pbuf_, allocating
+    it or taking it from the pool first if needed. The buffer is
+    separate from the window so that it can be given back between
+    messages, when nothing is pending and no symbols are held.
+*/
+template<class>
+void
+deflate_stream::
+acquire_pending()
+{
+    BOOST_ASSERT(pending_ == 0);
+    auto const needed = deflate_pbuf_bytes(hash_bits_ - 7);
+    if(! pbuf_ || pbuf_size_ != needed)
+    {
+        if(pool_pending_)
+            beast::detail::buffer_pool::instance().release(
+                std::move(pbuf_), pbuf_size_);
+        pbuf_ = beast::detail::buffer_pool::instance().acquire(needed);
+        pbuf_size_ = needed;
+    }
+
     /*  We overlay pending_buf_ and d_buf_ + l_buf_. This works
         since the average output size for(length, distance)
         codes is <= 24 bits.
     */
-    auto overlay = reinterpret_cast<std::uint16_t*>(
-        buf_.get() + nwindow + nprev + nhead);
-
-    // nothing written to window_ yet
-    high_water_ = 0;
+    auto overlay = reinterpret_cast<std::uint16_t*>(pbuf_.get());
 
     pending_buf_ =
         reinterpret_cast<std::uint8_t*>(overlay);
@@ -1300,16 +1562,7 @@ init()
     d_buf_ = overlay + lit_bufsize_ / sizeof(std::uint16_t);
     l_buf_ = pending_buf_ + (1 + sizeof(std::uint16_t)) * lit_bufsize_;
 
-    pending_ = 0;
     pending_out_ = pending_buf_;
-
-    status_ = BUSY_STATE;
-    last_flush_ = Flush::none;
-
-    tr_init();
-    lm_init();
-
-    inited_ = true;
 }
 
 /*  Initialize the "longest match" routines for a new zlib stream
@@ -1337,7 +1590,6 @@ lm_init()
     insert_ = 0;
     match_length_ = prev_length_ = minMatch-1;
     match_available_ = 0;
-    ins_h_ = 0;
 }
 
 // Initialize a new block.
@@ -1913,6 +2165,28 @@ detect_data_type()
     return Z_BINARY;
 }
 
+/*  Return the bit length of the current block coded with the
+    static trees, as gen_bitlen computes static_len_, from the
+    symbol frequencies alone.
+*/
+template<class>
+std::uint32_t
+deflate_stream::
+static_length()
+{
+    std::uint32_t len = 0;
+    int n;
+    for(n = 0; n <= literals; n++)
+        len += (std::uint32_t)dyn_ltree_[n].fc * lut_.ltree[n].dl;
+    for(; n < lCodes; n++)
+        len += (std::uint32_t)dyn_ltree_[n].fc * (lut_.ltree[n].dl +
+            lut_.extra_lbits[n - literals - 1]);
+    for(n = 0; n < dCodes; n++)
+        len += (std::uint32_t)dyn_dtree_[n].fc * (lut_.dtree[n].dl +
+            lut_.extra_dbits[n]);
+    return len;
+}
+
 /*  Flush the bit buffer and align the output on a byte boundary
 */
 template<class>
@@ -2085,25 +2359,41 @@ tr_flush_block(
         if(zs.data_type == Z_UNKNOWN)
             zs.data_type = detect_data_type();
 
-        // Construct the literal and distance trees
-        build_tree((tree_desc *)(&(l_desc_)));
+        if(strategy_ == Strategy::fixed)
+        {
+            /*  Only the shared static trees can be sent, so skip
+                building the dynamic ones and just size the block.
+                A stored block is sent when it is smaller than the
+                static one. zlib compares it with the smaller of the
+                static and the dynamic sizes instead, so for input
+                which only dynamic trees could compress, it sends a
+                static block larger than the stored one.
+            */
+            static_len_ = static_length();
+            opt_lenb = static_lenb = (static_len_+3+7)>>3;
+        }
+        else
+        {
+            // Construct the literal and distance trees
+            build_tree((tree_desc *)(&(l_desc_)));
 
-        build_tree((tree_desc *)(&(d_desc_)));
-        /* At this point, opt_len and static_len are the total bit lengths of
-         * the compressed block data, excluding the tree representations.
-         */
+            build_tree((tree_desc *)(&(d_desc_)));
+            /* At this point, opt_len and static_len are the total bit lengths of
+             * the compressed block data, excluding the tree representations.
+             */
 
-        /* Build the bit length tree for the above two trees, and get the index
-         * in bl_order of the last bit length code to send.
-         */
-        max_blindex = build_bl_tree();
+            /* Build the bit length tree for the above two trees, and get the index
+             * in bl_order of the last bit length code to send.
+             */
+            max_blindex = build_bl_tree();
 
-        /* Determine the best encoding. Compute the block lengths in bytes. */
-        opt_lenb = (opt_len_+3+7)>>3;
-        static_lenb = (static_len_+3+7)>>3;
+            /* Determine the best encoding. Compute the block lengths in bytes. */
+            opt_lenb = (opt_len_+3+7)>>3;
+            static_lenb = (static_len_+3+7)>>3;
 
-        if(static_lenb <= opt_lenb)
-            opt_lenb = static_lenb;
+            if(static_lenb <= opt_lenb)
+                opt_lenb = static_lenb;
+        }
     }
     else
     {
@@ -2166,9 +2456,8 @@ void
 deflate_stream::
 fill_window(z_params& zs)
 {
-    unsigned n, m;
+    unsigned n;
     unsigned more;    // Amount of free space at the end of the window.
-    std::uint16_t *p;
     uInt wsize = w_size_;
 
     do
@@ -2211,26 +2500,12 @@ fill_window(z_params& zs)
                later. (Using level 0 permanently is not an optimal usage of
                zlib, so we don't care about this pathological case.)
             */
-            n = hash_size_;
-            p = &head_[n];
-            do
-            {
-                m = *--p;
-                *p = (std::uint16_t)(m >= wsize ? m-wsize : 0);
-            }
-            while(--n);
+            slide_hash(head_, hash_size_, wsize);
 
-            n = wsize;
-            p = &prev_[n];
-            do
-            {
-                m = *--p;
-                *p = (std::uint16_t)(m >= wsize ? m-wsize : 0);
-                /*  If n is not on any hash chain, prev[n] is garbage but
-                    its value will never be used.
-                */
-            }
-            while(--n);
+            /*  If n is not on any hash chain, prev[n] is garbage but
+                its value will never be used.
+            */
+            slide_hash(prev_, wsize, wsize);
             more += wsize;
         }
         if(zs.avail_in == 0)
@@ -2250,26 +2525,21 @@ fill_window(z_params& zs)
         n = read_buf(zs, window_ + strstart_ + lookahead_, more);
         lookahead_ += n;
 
-        // Initialize the hash value now that we have some input:
+        // Insert the strings left over from the last call:
         if(lookahead_ + insert_ >= minMatch)
         {
             uInt str = strstart_ - insert_;
-            ins_h_ = window_[str];
-            update_hash(ins_h_, window_[str + 1]);
             while(insert_)
             {
-                update_hash(ins_h_, window_[str + minMatch-1]);
-                prev_[str & w_mask_] = head_[ins_h_];
-                head_[ins_h_] = (std::uint16_t)str;
+                auto const h = hash(window_ + str);
+                prev_[str & w_mask_] = head_[h];
+                head_[h] = (std::uint16_t)str;
                 str++;
                 insert_--;
                 if(lookahead_ + insert_ < minMatch)
                     break;
             }
         }
-        /*  If the whole input has less than minMatch bytes, ins_h is garbage,
-            but this is not important since only literal bytes will be emitted.
-        */
     }
     while(lookahead_ < kMinLookahead && zs.avail_in != 0);
 
@@ -2356,6 +2626,83 @@ flush_block(z_params& zs, bool last)
    flush_pending(zs);
 }
 
+/*  Put the zlib or gzip header into the pending buffer.
+    For zlib, a dictionary set before the first write
+    is identified by its Adler-32.
+*/
+template<class>
+void
+deflate_stream::
+put_header()
+{
+    if(wrap_ == Wrap::zlib)
+    {
+        unsigned header = (8 + ((w_bits_ - 8) << 4)) << 8;
+        unsigned level_flags;
+        if(strategy_ >= Strategy::huffman || level_ < 2)
+            level_flags = 0;
+        else if(level_ < 6)
+            level_flags = 1;
+        else if(level_ == 6)
+            level_flags = 2;
+        else
+            level_flags = 3;
+        header |= level_flags << 6;
+        if(strstart_ != 0)
+            header |= 0x20; // FDICT
+        header += 31 - (header % 31);
+        put_byte(static_cast<Byte>(header >> 8));
+        put_byte(static_cast<Byte>(header));
+        if(strstart_ != 0)
+        {
+            put_byte(static_cast<Byte>(check_ >> 24));
+            put_byte(static_cast<Byte>(check_ >> 16));
+            put_byte(static_cast<Byte>(check_ >> 8));
+            put_byte(static_cast<Byte>(check_));
+        }
+        check_ = 1;
+    }
+    else
+    {
+        // ID1, ID2, CM = deflate, no flags, no time
+        put_byte(0x1f);
+        put_byte(0x8b);
+        put_byte(8);
+        put_byte(0);
+        put_byte(0);
+        put_byte(0);
+        put_byte(0);
+        put_byte(0);
+        // XFL
+        put_byte(level_ == 9 ? 2 :
+            (strategy_ >= Strategy::huffman || level_ < 2) ? 4 : 0);
+        put_byte(255); // OS = unknown
+    }
+}
+
+/*  Put the zlib or gzip trailer into the pending buffer.
+*/
+template<class>
+void
+deflate_stream::
+put_trailer()
+{
+    if(wrap_ == Wrap::zlib)
+    {
+        put_byte(static_cast<Byte>(check_ >> 24));
+        put_byte(static_cast<Byte>(check_ >> 16));
+        put_byte(static_cast<Byte>(check_ >> 8));
+        put_byte(static_cast<Byte>(check_));
+    }
+    else
+    {
+        put_short(static_cast<std::uint16_t>(check_));
+        put_short(static_cast<std::uint16_t>(check_ >> 16));
+        put_short(static_cast<std::uint16_t>(length_));
+        put_short(static_cast<std::uint16_t>(length_ >> 16));
+    }
+}
+
 /*  Read a new buffer from the current input stream, update the adler32
     and total number of bytes read.  All write() input goes through
     this function so some applications may wish to modify it to avoid
@@ -2374,12 +2721,123 @@ read_buf(z_params& zs, Byte *buf, unsigned size)
     zs.avail_in  -= len;
 
     std::memcpy(buf, zs.next_in, len);
+    if(wrap_ == Wrap::zlib)
+    {
+        check_ = adler32(check_, buf, len);
+    }
+    else if(wrap_ == Wrap::gzip)
+    {
+        check_ = crc32(check_, buf, len);
+        length_ += static_cast<std::uint32_t>(len);
+    }
     zs.next_in = static_cast<
         std::uint8_t const*>(zs.next_in) + len;
     zs.total_in += len;
     return (int)len;
 }
 
+/*  Subtract wsize from each of the n positions at p, clamping
+    positions which fall out of the window to zero. This is a
+    saturating subtraction, done 8 or 16 positions at a time with
+    SIMD where available. It runs on the whole hash table and
+    the whole prev table each time the window slides.
+*/
+void
+deflate_stream::
+slide_hash(std::uint16_t* p, uInt n, uInt wsize)
+{
+    BOOST_ASSERT(wsize <= 0xffff);
+    auto const end = p + n;
+#if BEAST_ZLIB_SSE2
+# if defined(__AVX2__)
+    auto const w = _mm256_set1_epi16(static_cast<short>(wsize));
+    for(; end - p >= 16; p += 16)
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p),
+            _mm256_subs_epu16(_mm256_loadu_si256(
+                reinterpret_cast<__m256i const*>(p)), w));
+# else
+    auto const w = _mm_set1_epi16(static_cast<short>(wsize));
+    for(; end - p >= 8; p += 8)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p),
+            _mm_subs_epu16(_mm_loadu_si128(
+                reinterpret_cast<__m128i const*>(p)), w));
+# endif
+#endif
+    for(; p != end; ++p)
+        *p = static_cast<std::uint16_t>(
+            *p >= wsize ? *p - wsize : 0);
+}
+
+/*  Return the number of leading bytes which are equal in a and b,
+    up to maxMatch. Both strings must have maxMatch readable bytes.
+    The strings are compared 16 or 32 bytes at a time with SIMD
+    where available, otherwise 8 bytes at a time, and the first
+    difference is located in the mismatching chunk.
+*/
+uInt
+deflate_stream::
+compare_258(Byte const* a, Byte const* b)
+{
+    static_assert(maxMatch == 258, "");
+#if BEAST_ZLIB_SSE2
+    auto const ctz =
+        [](unsigned x) -> uInt
+        {
+        #ifdef _MSC_VER
+            unsigned long i;
+            _BitScanForward(&i, x);
+            return static_cast<uInt>(i);
+        #else
+            return static_cast<uInt>(__builtin_ctz(x));
+        #endif
+        };
+# if defined(__AVX2__)
+    for(uInt i = 0; i < 256; i += 32)
+    {
+        auto const m = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(
+                _mm256_loadu_si256(
+                    reinterpret_cast<__m256i const*>(a + i)),
+                _mm256_loadu_si256(
+                    reinterpret_cast<__m256i const*>(b + i)))));
+        if(m != 0xffffffff)
+            return i + ctz(~m);
+    }
+# else
+    for(uInt i = 0; i < 256; i += 16)
+    {
+        auto const m = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_cmpeq_epi8(
+                _mm_loadu_si128(
+                    reinterpret_cast<__m128i const*>(a + i)),
+                _mm_loadu_si128(
+                    reinterpret_cast<__m128i const*>(b + i)))));
+        if(m != 0xffff)
+            return i + ctz(~m & 0xffff);
+    }
+# endif
+#else
+    for(uInt i = 0; i < 256; i += 8)
+    {
+        std::uint64_t x;
+        std::uint64_t y;
+        std::memcpy(&x, a + i, 8);
+        std::memcpy(&y, b + i, 8);
+        if(x != y)
+        {
+            while(a[i] == b[i])
+                ++i;
+            return i;
+        }
+    }
+#endif
+    if(a[256] != b[256])
+        return 256;
+    if(a[257] != b[257])
+        return 257;
+    return 258;
+}
+
 /*  Set match_start to the longest match starting at the given string and
     return its length. Matches shorter or equal to prev_length are discarded,
     in which case the result is equal to prev_length and match_start is
@@ -2388,8 +2846,9 @@ read_buf(z_params& zs, Byte *buf, unsigned size)
         string (strstart) and its distance is <= max_dist, and prev_length >= 1
     OUT assertion: the match length is not greater than s->lookahead_.
 
-    For 80x86 and 680x0, an optimized version will be provided in match.asm or
-    match.S. The code will be functionally equivalent.
+    Candidates are rejected by comparing the two bytes which would
+    extend the best match and the first two bytes, loaded as 16 bit
+    words. The remaining candidates are measured with compare_258.
 */
 template<class>
 uInt
@@ -2399,9 +2858,9 @@ longest_match(IPos cur_match)
     unsigned chain_length = max_chain_length_;/* max hash chain length */
     Byte *scan = window_ + strstart_; /* current string */
     Byte *match;                       /* matched string */
-    int len;                           /* length of current match */
-    int best_len = prev_length_;              /* best match length so far */
-    int nice_match = nice_match_;             /* stop if match long enough */
+    uInt len;                          /* length of current match */
+    uInt best_len = prev_length_;             /* best match length so far */
+    uInt nice_match = nice_match_;            /* stop if match long enough */
     IPos limit = strstart_ > (IPos)max_dist() ?
         strstart_ - (IPos)max_dist() : 0;
     /* Stop when cur_match becomes <= limit. To simplify the code,
@@ -2410,14 +2869,17 @@ longest_match(IPos cur_match)
     std::uint16_t *prev = prev_;
     uInt wmask = w_mask_;
 
-    Byte *strend = window_ + strstart_ + maxMatch;
-    Byte scan_end1  = scan[best_len-1];
-    Byte scan_end   = scan[best_len];
+    auto const load16 =
+        [](Byte const* p)
+        {
+            std::uint16_t v;
+            std::memcpy(&v, p, 2);
+            return v;
+        };
+    std::uint16_t const scan_start = load16(scan);
+    std::uint16_t scan_end = load16(scan + best_len - 1);
 
-    /* The code is optimized for HASH_BITS >= 8 and maxMatch-2 multiple of 16.
-     * It is easy to get rid of this optimization if necessary.
-     */
-    BOOST_ASSERT(hash_bits_ >= 8 && maxMatch == 258);
+    BOOST_ASSERT(best_len >= 1);
 
     /* Do not waste too much time if we already have a good match: */
     if(prev_length_ >= good_match_) {
@@ -2426,7 +2888,7 @@ longest_match(IPos cur_match)
     /* Do not look for matches beyond the end of the input. This is necessary
      * to make deflate deterministic.
      */
-    if((uInt)nice_match > lookahead_)
+    if(nice_match > lookahead_)
         nice_match = lookahead_;
 
     BOOST_ASSERT((std::uint32_t)strstart_ <= window_size_-kMinLookahead);
@@ -2436,58 +2898,29 @@ longest_match(IPos cur_match)
         match = window_ + cur_match;
 
         /* Skip to next match if the match length cannot increase
-         * or if the match length is less than 2.  Note that the checks below
-         * for insufficient lookahead only occur occasionally for performance
-         * reasons.  Therefore uninitialized memory will be accessed, and
-         * conditional jumps will be made that depend on those values.
-         * However the length of the match is limited to the lookahead, so
-         * the output of deflate is not affected by the uninitialized values.
+         * or if the match length is less than 2.  Bytes past the
+         * lookahead may be compared, but the length of the match is
+         * limited to the lookahead, so the output of deflate is not
+         * affected by their values.
          */
-        if(     match[best_len]   != scan_end  ||
-                match[best_len-1] != scan_end1 ||
-                *match            != *scan     ||
-                *++match          != scan[1])
+        if(     load16(match + best_len - 1) != scan_end ||
+                load16(match) != scan_start)
             continue;
 
-        /* The check at best_len-1 can be removed because it will be made
-         * again later. (This heuristic is not always a win.)
-         * It is not necessary to compare scan[2] and match[2] since they
-         * are always equal when the other bytes match, given that
-         * the hash keys are equal and that HASH_BITS >= 8.
-         */
-        scan += 2, match++;
-        BOOST_ASSERT(*scan == *match);
-
-        /* We check for insufficient lookahead only every 8th comparison;
-         * the 256th check will be made at strstart+258.
-         */
-        do
-        {
-        }
-        while(  *++scan == *++match && *++scan == *++match &&
-                *++scan == *++match && *++scan == *++match &&
-                *++scan == *++match && *++scan == *++match &&
-                *++scan == *++match && *++scan == *++match &&
-                scan < strend);
-
-        BOOST_ASSERT(scan <= window_+(unsigned)(window_size_-1));
-
-        len = maxMatch - (int)(strend - scan);
-        scan = strend - maxMatch;
+        len = compare_258(scan, match);
 
         if(len > best_len) {
             match_start_ = cur_match;
             best_len = len;
             if(len >= nice_match) break;
-            scan_end1  = scan[best_len-1];
-            scan_end   = scan[best_len];
+            scan_end = load16(scan + best_len - 1);
         }
     }
     while((cur_match = prev[cur_match & wmask]) > limit
         && --chain_length != 0);
 
-    if((uInt)best_len <= lookahead_)
-        return (uInt)best_len;
+    if(best_len <= lookahead_)
+        return best_len;
     return lookahead_;
 }
 
@@ -2652,11 +3085,6 @@ f_fast(z_params& zs, Flush flush) ->
             {
                 strstart_ += match_length_;
                 match_length_ = 0;
-                ins_h_ = window_[strstart_];
-                update_hash(ins_h_, window_[strstart_+1]);
-                /* If lookahead < minMatch, ins_h is garbage, but it does not
-                 * matter since it will be recomputed at next deflate call.
-                 */
             }
         }
         else
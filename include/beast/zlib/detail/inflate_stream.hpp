@@ -37,7 +37,9 @@
 
 #include <beast/zlib/error.hpp>
 #include <beast/zlib/zlib.hpp>
+#include <beast/zlib/detail/adler32.hpp>
 #include <beast/zlib/detail/bitstream.hpp>
+#include <beast/zlib/detail/crc32.hpp>
 #include <beast/zlib/detail/ranges.hpp>
 #include <beast/zlib/detail/window.hpp>
 #include <beast/core/detail/type_traits.hpp>
@@ -60,13 +62,26 @@ protected:
     }
 
     template<class = void> void doClear();
-    template<class = void> void doReset(int windowBits);
+    template<class = void> void doReset(int windowBits, Wrap wrap = Wrap::none);
     template<class = void> void doWrite(z_params& zs, Flush flush, error_code& ec);
+    template<class = void> void doDictionary(std::uint8_t const* dict, std::size_t size, error_code& ec);
 
     void
     doReset()
     {
-        doReset(w_.bits());
+        doReset(w_.bits(), wrap_);
+    }
+
+    std::size_t
+    doAllocated() const
+    {
+        return w_.allocated();
+    }
+
+    void
+    doContiguous(bool value)
+    {
+        contig_ = value;
     }
 
 private:
@@ -81,6 +96,8 @@ private:
         NAME,       // i: waiting for end of file name (gzip)
         COMMENT,    // i: waiting for end of comment (gzip)
         HCRC,       // i: waiting for header crc (gzip)
+        DICTID,     // i: waiting for dictionary check value
+        DICT,       // waiting for inflateSetDictionary() call
         TYPE,       // i: waiting for type bits, including last-flag bit
         TYPEDO,     // i: same, but skip check to exit inflate on new block
         STORED,     // i: waiting for stored size (length and complement)
@@ -186,19 +203,42 @@ private:
     void
     fixedTables();
 
+    // Smallest input and output for inflate_fast: two
+    // refills, and two literals before a 258 byte match
+    // copied eight bytes at a time.
+    static std::size_t constexpr fast_in = 15;
+    static std::size_t constexpr fast_out = 2 + 258 + 7;
+
     template<class = void>
     void
     inflate_fast(ranges& r, error_code& ec);
 
+    template<class = void>
+    static
+    void
+    copy_match(unsigned char*& out, unsigned dist, unsigned len);
+
     bitstream bi_;
 
     Mode mode_ = HEAD;              // current inflate mode
     int last_ = 0;                  // true if processing last block
     unsigned dmax_ = 32768U;        // zlib header max distance (INFLATE_STRICT)
+    Wrap wrap_ = Wrap::none;        // wrappers accepted
+    Wrap format_ = Wrap::none;      // wrapper of the current stream
+    unsigned flags_ = 0;            // gzip header method and flags
+    bool havedict_ = false;         // true if dictionary provided
+    std::uint32_t check_;           // protected copy of check value
+    std::uint32_t total_;           // output size modulo 2^32, for gzip
 
     // sliding window
     window w_;
 
+    // When the output is contiguous, the number of bytes
+    // of previous output which precede next_out and may be
+    // referenced, instead of the window.
+    bool contig_ = false;
+    std::size_t hist_ = 0;
+
     // for string and stored block copying
     unsigned length_;               // literal or length of data to copy
     unsigned offset_;               // distance back to copy string from
@@ -230,7 +270,7 @@ private:
 template<class>
 void
 inflate_stream::
-doReset(int windowBits)
+doReset(int windowBits, Wrap wrap)
 {
     if(windowBits < 8 || windowBits > 15)
         throw beast::detail::make_exception<std::domain_error>(
@@ -241,6 +281,12 @@ doReset(int windowBits)
     mode_ = HEAD;
     last_ = 0;
     dmax_ = 32768U;
+    wrap_ = wrap;
+    format_ = Wrap::none;
+    flags_ = 0;
+    havedict_ = false;
+    total_ = 0;
+    hist_ = 0;
     lencode_ = codes_;
     distcode_ = codes_;
     next_ = codes_;
@@ -252,6 +298,32 @@ void
 inflate_stream::
 doClear()
 {
+    w_.clear();
+    doReset(w_.bits(), wrap_);
+}
+
+/*  A raw stream may be given a dictionary at any time, which is
+    added to the history. A wrapped stream needs the dictionary
+    named by its zlib header, once the header has been read.
+*/
+template<class>
+void
+inflate_stream::
+doDictionary(std::uint8_t const* dict, std::size_t size, error_code& ec)
+{
+    // Back-references are only copied from the output
+    if(contig_ || (wrap_ != Wrap::none && mode_ != DICT))
+    {
+        ec = error::stream_error;
+        return;
+    }
+    if(mode_ == DICT && adler32(1, dict, size) != check_)
+    {
+        ec = error::incorrect_dictionary;
+        return;
+    }
+    w_.write(dict, size);
+    havedict_ = true;
 }
 
 template<class>
@@ -269,6 +341,26 @@ doWrite(z_params& zs, Flush flush, error_code& ec)
     r.out.last = r.out.first + zs.avail_out;
     r.out.next = r.out.first;
 
+    // Output not yet added to the check value
+    auto checked = r.out.first;
+    auto const update_check =
+        [&]
+        {
+            auto const n = r.out.next - checked;
+            if(n == 0)
+                return;
+            if(format_ == Wrap::zlib)
+            {
+                check_ = adler32(check_, checked, n);
+            }
+            else if(format_ == Wrap::gzip)
+            {
+                check_ = crc32(check_, checked, n);
+                total_ += static_cast<std::uint32_t>(n);
+            }
+            checked = r.out.next;
+        };
+
     auto const done =
         [&]
         {
@@ -280,11 +372,17 @@ doWrite(z_params& zs, Flush flush, error_code& ec)
              */
 
 
-            // VFALCO TODO Don't allocate update the window unless necessary
-            if(/*wsize_ ||*/ (r.out.used() && mode_ < BAD &&
-                    (mode_ < CHECK || flush != Flush::finish)))
+            // Keep the last window of output for the next call. The
+            // window is not needed once the stream has ended, or when
+            // the output is contiguous, so it is not allocated for
+            // decompression in one call or into one buffer.
+            if(contig_)
+                hist_ = clamp(hist_ + r.out.used(), w_.capacity());
+            else if(r.out.used() && mode_ < CHECK)
                 w_.write(r.out.first, r.out.used());
 
+            update_check();
+
             zs.next_in = r.in.next;
             zs.avail_in = r.in.avail();
             zs.next_out = r.out.next;
@@ -314,7 +412,161 @@ doWrite(z_params& zs, Flush flush, error_code& ec)
         switch(mode_)
         {
         case HEAD:
-            mode_ = TYPEDO;
+        {
+            if(wrap_ == Wrap::none)
+            {
+                mode_ = TYPEDO;
+                break;
+            }
+            if(! bi_.fill(16, r.in.next, r.in.last))
+                return done();
+            std::uint16_t v;
+            bi_.peek(v, 16);
+            if(wrap_ != Wrap::zlib && v == 0x8b1f)
+            {
+                // gzip header
+                bi_.drop(16);
+                format_ = Wrap::gzip;
+                check_ = crc32(0, "\x1f\x8b", 2);
+                mode_ = FLAGS;
+                break;
+            }
+            if(wrap_ == Wrap::gzip ||
+                (((v & 0xff) << 8) + (v >> 8)) % 31)
+                return err(error::incorrect_header_check);
+            if((v & 0x0f) != 8)
+                return err(error::unknown_compression_method);
+            auto const len = ((v >> 4) & 0x0f) + 8u;
+            if(len > static_cast<unsigned>(w_.bits()))
+                return err(error::invalid_window_size);
+            bi_.drop(16);
+            format_ = Wrap::zlib;
+            dmax_ = 1U << len;
+            check_ = 1;
+            mode_ = (v & 0x2000) ? DICTID : TYPE;
+            break;
+        }
+
+        case FLAGS:
+        {
+            if(! bi_.fill(16, r.in.next, r.in.last))
+                return done();
+            std::uint16_t v;
+            bi_.read(v, 16);
+            flags_ = v;
+            if((flags_ & 0xff) != 8)
+                return err(error::unknown_compression_method);
+            if(flags_ & 0xe000)
+                return err(error::unknown_header_flags);
+            std::uint8_t const b[] = {
+                static_cast<std::uint8_t>(v),
+                static_cast<std::uint8_t>(v >> 8)};
+            check_ = crc32(check_, b, 2);
+            mode_ = TIME;
+        }
+        // fall through
+
+        case TIME:
+        case OS:
+        case EXLEN:
+        {
+            // Fields of four, two and two bytes
+            auto const n = mode_ == TIME ? 32 : 16;
+            if(mode_ == EXLEN && ! (flags_ & 0x0400))
+            {
+                mode_ = NAME;
+                break;
+            }
+            if(! bi_.fill(n, r.in.next, r.in.last))
+                return done();
+            std::uint32_t v;
+            bi_.read(v, n);
+            std::uint8_t const b[] = {
+                static_cast<std::uint8_t>(v),
+                static_cast<std::uint8_t>(v >> 8),
+                static_cast<std::uint8_t>(v >> 16),
+                static_cast<std::uint8_t>(v >> 24)};
+            check_ = crc32(check_, b, n / 8);
+            if(mode_ == EXLEN)
+            {
+                length_ = v;
+                mode_ = EXTRA;
+            }
+            else
+            {
+                mode_ = static_cast<Mode>(mode_ + 1);
+            }
+            break;
+        }
+
+        case EXTRA:
+        case NAME:
+        case COMMENT:
+        {
+            // Skip the extra field, then the
+            // zero terminated name and comment.
+            if((mode_ == NAME && ! (flags_ & 0x0800)) ||
+                (mode_ == COMMENT && ! (flags_ & 0x1000)))
+            {
+                mode_ = static_cast<Mode>(mode_ + 1);
+                break;
+            }
+            for(;;)
+            {
+                if(mode_ == EXTRA && length_ == 0)
+                    break;
+                if(! bi_.fill(8, r.in.next, r.in.last))
+                    return done();
+                std::uint8_t c;
+                bi_.read(c, 8);
+                check_ = crc32(check_, &c, 1);
+                if(mode_ == EXTRA)
+                    --length_;
+                else if(c == 0)
+                    break;
+            }
+            mode_ = static_cast<Mode>(mode_ + 1);
+            break;
+        }
+
+        case HCRC:
+        {
+            if(flags_ & 0x0200)
+            {
+                if(! bi_.fill(16, r.in.next, r.in.last))
+                    return done();
+                std::uint16_t v;
+                bi_.read(v, 16);
+                if(v != (check_ & 0xffff))
+                    return err(error::header_crc_mismatch);
+            }
+            check_ = 0;
+            mode_ = TYPE;
+            break;
+        }
+
+        case DICTID:
+        {
+            if(! bi_.fill(32, r.in.next, r.in.last))
+                return done();
+            std::uint32_t v;
+            bi_.read(v, 32);
+            // The identifier is the Adler-32 of the dictionary
+            check_ =
+                ((v & 0xff) << 24) | ((v & 0xff00) << 8) |
+                ((v >> 8) & 0xff00) | (v >> 24);
+            mode_ = DICT;
+        }
+        // fall through
+
+        case DICT:
+            if(! havedict_)
+            {
+                ec = error::need_dictionary;
+                return done();
+            }
+            check_ = 1;
+            mode_ = TYPE;
             break;
 
         case TYPE:
@@ -376,8 +628,8 @@ doWrite(z_params& zs, Flush flush, error_code& ec)
             mode_ = COPY_;
             if(flush == Flush::trees)
                 return done();
-            // fall through
         }
+        // fall through
 
         case COPY_:
             mode_ = COPY;
@@ -443,18 +695,19 @@ doWrite(z_params& zs, Flush flush, error_code& ec)
             }
             have_ = 0;
             mode_ = CODELENS;
-            // fall through
         }
+        // fall through
 
         case CODELENS:
         {
             while(have_ < nlen_ + ndist_)
             {
                 std::uint16_t v;
-                if(! bi_.fill(lenbits_, r.in.next, r.in.last))
-                    return done();
-                bi_.peek(v, lenbits_);
+                bi_.fill(lenbits_, r.in.next, r.in.last);
+                bi_.peek_some(v, lenbits_);
                 auto cp = &lencode_[v];
+                if(cp->bits > bi_.size())
+                    return done();
                 if(cp->val < 16)
                 {
                     bi_.drop(cp->bits);
@@ -532,8 +785,8 @@ doWrite(z_params& zs, Flush flush, error_code& ec)
             mode_ = LEN_;
             if(flush == Flush::trees)
                 return done();
-            // fall through
         }
+        // fall through
 
         case LEN_:
             mode_ = LEN;
@@ -541,7 +794,8 @@ doWrite(z_params& zs, Flush flush, error_code& ec)
 
         case LEN:
         {
-            if(r.in.avail() >= 6 && r.out.avail() >= 258)
+            if( r.in.avail() >= fast_in &&
+                r.out.avail() >= fast_out)
             {
                 inflate_fast(r, ec);
                 if(ec)
@@ -553,19 +807,24 @@ doWrite(z_params& zs, Flush flush, error_code& ec)
                     back_ = -1;
                 break;
             }
-            if(! bi_.fill(lenbits_, r.in.next, r.in.last))
-                return done();
+            // The last code in the input may be shorter than
+            // lenbits_, so decode as soon as the code found
+            // with the bits which are available fits in them.
+            bi_.fill(lenbits_, r.in.next, r.in.last);
             std::uint16_t v;
             back_ = 0;
-            bi_.peek(v, lenbits_);
+            bi_.peek_some(v, lenbits_);
             auto cp = &lencode_[v];
+            if(cp->bits > bi_.size())
+                return done();
             if(cp->op && (cp->op & 0xf0) == 0)
             {
                 auto prev = cp;
-                if(! bi_.fill(prev->bits + prev->op, r.in.next, r.in.last))
-                    return done();
-                bi_.peek(v, prev->bits + prev->op);
+                bi_.fill(prev->bits + prev->op, r.in.next, r.in.last);
+                bi_.peek_some(v, prev->bits + prev->op);
                 cp = &lencode_[prev->val + (v >> prev->bits)];
+                if(prev->bits + cp->bits > bi_.size())
+                    return done();
                 bi_.drop(prev->bits + cp->bits);
                 back_ += prev->bits + cp->bits;
             }
@@ -590,8 +849,8 @@ doWrite(z_params& zs, Flush flush, error_code& ec)
                 return err(error::invalid_literal_length);
             extra_ = cp->op & 15;
             mode_ = LENEXT;
-            // fall through
         }
+        // fall through
 
         case LENEXT:
             if(extra_)
@@ -609,18 +868,20 @@ doWrite(z_params& zs, Flush flush, error_code& ec)
 
         case DIST:
         {
-            if(! bi_.fill(distbits_, r.in.next, r.in.last))
-                return done();
+            bi_.fill(distbits_, r.in.next, r.in.last);
             std::uint16_t v;
-            bi_.peek(v, distbits_);
+            bi_.peek_some(v, distbits_);
             auto cp = &distcode_[v];
+            if(cp->bits > bi_.size())
+                return done();
             if((cp->op & 0xf0) == 0)
             {
                 auto prev = cp;
-                if(! bi_.fill(prev->bits + prev->op, r.in.next, r.in.last))
-                    return done();
-                bi_.peek(v, prev->bits + prev->op);
+                bi_.fill(prev->bits + prev->op, r.in.next, r.in.last);
+                bi_.peek_some(v, prev->bits + prev->op);
                 cp = &distcode_[prev->val + (v >> prev->bits)];
+                if(prev->bits + cp->bits > bi_.size())
+                    return done();
                 bi_.drop(prev->bits + cp->bits);
                 back_ += prev->bits + cp->bits;
             }
@@ -634,8 +895,8 @@ doWrite(z_params& zs, Flush flush, error_code& ec)
             offset_ = cp->val;
             extra_ = cp->op & 15;
             mode_ = DISTEXT;
-            // fall through
         }
+        // fall through
 
         case DISTEXT:
             if(extra_)
@@ -658,11 +919,11 @@ doWrite(z_params& zs, Flush flush, error_code& ec)
         {
             if(! r.out.avail())
                 return done();
-            if(offset_ > r.out.used())
+            if(offset_ > r.out.used() + hist_)
             {
                 // copy from window
                 auto offset = static_cast<std::uint16_t>(
-                    offset_ - r.out.used());
+                    offset_ - (r.out.used() + hist_));
                 if(offset > w_.size())
                     return err(error::invalid_distance);
                 auto const n = clamp(clamp(
@@ -696,8 +957,40 @@ doWrite(z_params& zs, Flush flush, error_code& ec)
         }
 
         case CHECK:
+        {
+            if(format_ == Wrap::none)
+            {
+                mode_ = DONE;
+                break;
+            }
+            update_check();
+            if(! bi_.fill(32, r.in.next, r.in.last))
+                return done();
+            std::uint32_t v;
+            bi_.read(v, 32);
+            if(format_ == Wrap::zlib)
+                v = ((v & 0xff) << 24) | ((v & 0xff00) << 8) |
+                    ((v >> 8) & 0xff00) | (v >> 24);
+            if(v != check_)
+                return err(error::incorrect_data_check);
+            mode_ = LENGTH;
+        }
+        // fall through
+
+        case LENGTH:
+        {
+            if(format_ == Wrap::gzip)
+            {
+                if(! bi_.fill(32, r.in.next, r.in.last))
+                    return done();
+                std::uint32_t v;
+                bi_.read(v, 32);
+                if(v != total_)
+                    return err(error::incorrect_length_check);
+            }
             mode_ = DONE;
-            // fall through
+        }
+        // fall through
 
         case DONE:
             ec = error::end_of_stream;
@@ -1125,10 +1418,8 @@ fixedTables()
    Entry assumptions:
 
         state->mode_ == LEN
-        zs.avail_in >= 6
-        zs.avail_out >= 258
-        start >= zs.avail_out
-        state->bits_ < 8
+        zs.avail_in >= fast_in
+        zs.avail_out >= fast_out
 
    On return, state->mode_ is one of:
 
@@ -1138,28 +1429,22 @@ fixedTables()
 
    Notes:
 
-    - The maximum input bits used by a length/distance pair is 15 bits for the
-      length code, 5 bits for the length extra, 15 bits for the distance code,
-      and 13 bits for the distance extra.  This totals 48 bits, or six bytes.
-      Therefore if zs.avail_in >= 6, then there is enough input to avoid
-      checking for available input while decoding.
+    - The bit reservoir is refilled with an unchecked eight byte load which
+      leaves at least 56 bits. This happens once per loop, or twice when one
+      or two literals are followed by a length, which is why zs.avail_in
+      must be at least fast_in.
+
+    - The maximum input bits used by a length/distance pair is 15 bits for
+      the length code, 5 bits for the length extra, 15 bits for the distance
+      code, and 13 bits for the distance extra. This totals 48 bits, so one
+      refill is enough for each pair, and for up to three literals.
 
     - The maximum bytes that a single length/distance pair can output is 258
-      bytes, which is the maximum length that can be coded.  inflate_fast()
-      requires zs.avail_out >= 258 for each loop to avoid checking for
-      output space.
-
-  inflate_fast() speedups that turned out slower (on a PowerPC G3 750CXe):
-   - Using bit fields for code structure
-   - Different op definition to avoid & for extra bits (do & for table bits)
-   - Three separate decoding do-loops for direct, window, and wnext == 0
-   - Special case for distance > 1 copies to do overlapped load and store copy
-   - Explicit branch predictions (based on measured branch probabilities)
-   - Deferring match copy and interspersed it with decoding subsequent codes
-   - Swapping literal/length else
-   - Swapping window/direct else
-   - Larger unrolled copy loops (three is about right)
-   - Moving len -= 3 statement into middle of loop
+      bytes, which is the maximum length that can be coded. It may follow
+      two literals in the same loop. Matches at least eight bytes back are
+      copied eight bytes at a time, which may store up to seven bytes past
+      the end of the match. This is why zs.avail_out must be at least
+      fast_out.
  */
 template<class>
 void
@@ -1176,22 +1461,42 @@ inflate_fast(ranges& r, error_code& ec)
     unsigned const dmask =
         (1U << distbits_) - 1;  // mask for first level of distance codes
 
-    last = r.in.next + (r.in.avail() - 5);
-    end = r.out.next + (r.out.avail() - 257);
+    last = r.in.next + (r.in.avail() - (fast_in - 1));
+    end = r.out.next + (r.out.avail() - (fast_out - 1));
 
     /* decode literals and length/distances until end-of-block or not enough
        input data or output space */
     do
     {
-        if(bi_.size() < 15)
-            bi_.fill_16(r.in.next);
+        bi_.refill(r.in.next);
         auto cp = &lencode_[bi_.peek_fast() & lmask];
+        if(cp->op == 0)
+        {
+            // Up to three literals per refill
+            bi_.drop(cp->bits);
+            *r.out.next++ = (unsigned char)(cp->val);
+            cp = &lencode_[bi_.peek_fast() & lmask];
+            if(cp->op == 0)
+            {
+                bi_.drop(cp->bits);
+                *r.out.next++ = (unsigned char)(cp->val);
+                cp = &lencode_[bi_.peek_fast() & lmask];
+                if(cp->op == 0)
+                {
+                    bi_.drop(cp->bits);
+                    *r.out.next++ = (unsigned char)(cp->val);
+                    continue;
+                }
+            }
+            // Not enough bits for a length/distance pair
+            bi_.refill(r.in.next);
+        }
     dolen:
         bi_.drop(cp->bits);
         op = (unsigned)(cp->op);
         if(op == 0)
         {
-            // literal
+            // literal from a 2nd level code
             *r.out.next++ = (unsigned char)(cp->val);
         }
         else if(op & 16)
@@ -1201,13 +1506,9 @@ inflate_fast(ranges& r, error_code& ec)
             op &= 15; // number of extra bits
             if(op)
             {
-                if(bi_.size() < op)
-                    bi_.fill_8(r.in.next);
                 len += (unsigned)bi_.peek_fast() & ((1U << op) - 1);
                 bi_.drop(op);
             }
-            if(bi_.size() < 15)
-                bi_.fill_16(r.in.next);
             cp = &distcode_[bi_.peek_fast() & dmask];
         dodist:
             bi_.drop(cp->bits);
@@ -1217,12 +1518,6 @@ inflate_fast(ranges& r, error_code& ec)
                 // distance base
                 dist = (unsigned)(cp->val);
                 op &= 15; // number of extra bits
-                if(bi_.size() < op)
-                {
-                    bi_.fill_8(r.in.next);
-                    if(bi_.size() < op)
-                        bi_.fill_8(r.in.next);
-                }
                 dist += (unsigned)bi_.peek_fast() & ((1U << op) - 1);
 #ifdef INFLATE_STRICT
                 if(dist > dmax_)
@@ -1234,7 +1529,7 @@ inflate_fast(ranges& r, error_code& ec)
 #endif
                 bi_.drop(op);
 
-                op = r.out.used();
+                op = static_cast<unsigned>(r.out.used() + hist_);
                 if(dist > op)
                 {
                     // copy from window
@@ -1251,14 +1546,7 @@ inflate_fast(ranges& r, error_code& ec)
                     len -= n;
                 }
                 if(len > 0)
-                {
-                    // copy from output
-                    auto in = r.out.next - dist;
-                    auto n = clamp(len, r.out.avail());
-                    len -= n;
-                    while(n--)
-                        *r.out.next++ = *in++;
-                }
+                    copy_match(r.out.next, dist, len);
             }
             else if((op & 64) == 0)
             {
@@ -1294,10 +1582,52 @@ inflate_fast(ranges& r, error_code& ec)
     }
     while(r.in.next < last && r.out.next < end);
 
-    // return unused bytes (on entry, bits < 8, so in won't go too far back)
+    // return unused bytes
     bi_.rewind(r.in.next);
 }
 
+/*  Copy `len` bytes from `dist` bytes back in the output.
+
+    Overlapping copies repeat the last `dist` bytes. When
+    `dist` is at least eight, each eight byte load is
+    complete before the store which follows it, so the copy
+    is done a word at a time and may store up to seven bytes
+    past the end of the match.
+*/
+template<class>
+void
+inflate_stream::
+copy_match(unsigned char*& out, unsigned dist, unsigned len)
+{
+    auto in = out - dist;
+    auto const e = out + len;
+    if(dist >= 8)
+    {
+        do
+        {
+            std::uint64_t v;
+            std::memcpy(&v, in, 8);
+            std::memcpy(out, &v, 8);
+            in += 8;
+            out += 8;
+        }
+        while(out < e);
+    }
+    else if(dist == 1)
+    {
+        std::memset(out, *in, len);
+    }
+    else
+    {
+        do
+        {
+            *out++ = *in++;
+        }
+        while(out < e);
+    }
+    out = e;
+}
+
 } // detail
 } // zlib
 } // beast
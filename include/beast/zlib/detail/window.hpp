@@ -71,9 +71,21 @@ public:
         return size_;
     }
 
+    std::size_t
+    allocated() const
+    {
+        return p_ ? capacity_ : 0;
+    }
+
     void
     reset(int bits);
 
+    void
+    clear()
+    {
+        p_.reset();
+    }
+
     void
     read(std::uint8_t* out, std::size_t pos, std::size_t n);
 
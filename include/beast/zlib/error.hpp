@@ -119,6 +119,41 @@ enum class error
     /// Incomplete length set
     incomplete_length_set,
 
+    //
+    // Errors generated by the zlib and gzip wrappers
+    //
+
+    /// Incorrect header check
+    incorrect_header_check,
+
+    /// Unknown compression method
+    unknown_compression_method,
+
+    /// Invalid window size
+    invalid_window_size,
+
+    /// Unknown header flags set
+    unknown_header_flags,
+
+    /// Header CRC mismatch
+    header_crc_mismatch,
+
+    /// Incorrect data check
+    incorrect_data_check,
+
+    /// Incorrect length check
+    incorrect_length_check,
+
+    /** A preset dictionary is required.
+
+        The zlib header names a dictionary, which must be
+        set with @ref inflate_stream::dictionary before
+        decompressing can continue.
+    */
+    need_dictionary,
+
+    /// Dictionary does not match the one named by the header
+    incorrect_dictionary,
 
 
     /// general error
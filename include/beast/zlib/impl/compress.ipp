@@ -0,0 +1,213 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef BEAST_ZLIB_IMPL_COMPRESS_IPP
+#define BEAST_ZLIB_IMPL_COMPRESS_IPP
+
+#include <algorithm>
+#include <memory>
+
+namespace beast {
+namespace zlib {
+
+namespace detail {
+
+// The streams used by the one-shot functions on each thread.
+//
+// There is one compressor for each window size, so that
+// resetting it for an input of a similar size never
+// reallocates its buffers.
+//
+class oneshot_engines
+{
+    std::unique_ptr<zlib::deflate_stream> ds_[16 - 9];
+    std::unique_ptr<zlib::inflate_stream> is_;
+
+public:
+    static
+    oneshot_engines&
+    instance()
+    {
+        static thread_local oneshot_engines e;
+        return e;
+    }
+
+    // Returns a compressor reset for n bytes of input
+    zlib::deflate_stream&
+    deflater(std::size_t n, int level)
+    {
+        // The smallest window which holds the whole input
+        // and the lookahead, from which matches can reach
+        // back to the start of the input.
+        int bits = 9;
+        while(bits < 15 &&
+                (std::size_t{1} << bits) < n + 262)
+            ++bits;
+        auto& ds = ds_[bits - 9];
+        if(! ds)
+            ds.reset(new zlib::deflate_stream);
+        // Hash table and symbol buffer to match the window
+        ds->reset(level, bits, (std::min)(bits - 6, 8),
+            Strategy::normal);
+        return *ds;
+    }
+
+    // Returns a decompressor reset for a new stream
+    zlib::inflate_stream&
+    inflater(bool contiguous)
+    {
+        if(! is_)
+            is_.reset(new zlib::inflate_stream);
+        is_->reset(15);
+        is_->contiguous(contiguous);
+        return *is_;
+    }
+};
+
+} // detail
+
+template<class DynamicBuffer, class>
+void
+compress(
+    boost::asio::const_buffer const& in,
+    DynamicBuffer& out,
+    int level,
+    error_code& ec)
+{
+    using boost::asio::buffer_cast;
+    using boost::asio::buffer_size;
+    auto const n = buffer_size(in);
+    auto& ds = detail::oneshot_engines::instance(
+        ).deflater(n, level);
+    // The conservative bound leaves room for the end of the
+    // stream to be reported even when the output fits exactly.
+    auto const mb = out.prepare(deflate_upper_bound(n));
+    z_params zs;
+    zs.next_in = buffer_cast<void const*>(in);
+    zs.avail_in = n;
+    for(boost::asio::mutable_buffer b : mb)
+    {
+        zs.next_out = buffer_cast<void*>(b);
+        zs.avail_out = buffer_size(b);
+        if(zs.avail_out == 0)
+            continue;
+        ds.write(zs, Flush::finish, ec);
+        if(ec == error::end_of_stream)
+        {
+            ec = {};
+            out.commit(zs.total_out);
+            return;
+        }
+        if(ec)
+            return;
+    }
+    ec = error::need_buffers;
+}
+
+inline
+std::size_t
+compress(
+    boost::asio::const_buffer const& in,
+    boost::asio::mutable_buffer const& out,
+    int level,
+    error_code& ec)
+{
+    using boost::asio::buffer_cast;
+    using boost::asio::buffer_size;
+    auto const n = buffer_size(in);
+    auto& ds = detail::oneshot_engines::instance(
+        ).deflater(n, level);
+    z_params zs;
+    zs.next_in = buffer_cast<void const*>(in);
+    zs.avail_in = n;
+    zs.next_out = buffer_cast<void*>(out);
+    zs.avail_out = buffer_size(out);
+    ds.write(zs, Flush::finish, ec);
+    if(ec == error::end_of_stream)
+    {
+        ec = {};
+        return zs.total_out;
+    }
+    if(! ec)
+        ec = error::need_buffers;
+    return 0;
+}
+
+template<class DynamicBuffer, class>
+void
+decompress(
+    boost::asio::const_buffer const& in,
+    DynamicBuffer& out,
+    error_code& ec)
+{
+    using boost::asio::buffer_cast;
+    using boost::asio::buffer_size;
+    auto const n = buffer_size(in);
+    // The output may be stored in separate pieces,
+    // so back-references use the window.
+    auto& is = detail::oneshot_engines::instance(
+        ).inflater(false);
+    z_params zs;
+    zs.next_in = buffer_cast<void const*>(in);
+    zs.avail_in = n;
+    // Start with a guess at the ratio, then double
+    auto size = (std::max)(4 * n, std::size_t{4096});
+    for(;;)
+    {
+        size = (std::min)(size, out.max_size() - out.size());
+        if(size == 0)
+        {
+            ec = error::need_buffers;
+            return;
+        }
+        boost::asio::mutable_buffer const b =
+            *out.prepare(size).begin();
+        zs.next_out = buffer_cast<void*>(b);
+        zs.avail_out = buffer_size(b);
+        zs.total_out = 0;
+        is.write(zs, Flush::sync, ec);
+        out.commit(zs.total_out);
+        if(ec == error::end_of_stream)
+        {
+            ec = {};
+            return;
+        }
+        if(ec)
+            return;
+        size *= 2;
+    }
+}
+
+inline
+std::size_t
+decompress(
+    boost::asio::const_buffer const& in,
+    boost::asio::mutable_buffer const& out,
+    error_code& ec)
+{
+    using boost::asio::buffer_cast;
+    using boost::asio::buffer_size;
+    auto& is = detail::oneshot_engines::instance(
+        ).inflater(true);
+    z_params zs;
+    zs.next_in = buffer_cast<void const*>(in);
+    zs.avail_in = buffer_size(in);
+    zs.next_out = buffer_cast<void*>(out);
+    zs.avail_out = buffer_size(out);
+    is.write(zs, Flush::finish, ec);
+    if(ec == error::end_of_stream)
+    {
+        ec = {};
+        return zs.total_out;
+    }
+    return 0;
+}
+
+} // zlib
+} // beast
+
+#endif
@@ -83,6 +83,16 @@ public:
         case error::over_subscribed_length: return "over-subscribed length";
         case error::incomplete_length_set: return "incomplete length set";
 
+        case error::incorrect_header_check: return "incorrect header check";
+        case error::unknown_compression_method: return "unknown compression method";
+        case error::invalid_window_size: return "invalid window size";
+        case error::unknown_header_flags: return "unknown header flags set";
+        case error::header_crc_mismatch: return "header crc mismatch";
+        case error::incorrect_data_check: return "incorrect data check";
+        case error::incorrect_length_check: return "incorrect length check";
+        case error::need_dictionary: return "need dictionary";
+        case error::incorrect_dictionary: return "incorrect dictionary";
+
         case error::general:
         default:
             return "zlib error";
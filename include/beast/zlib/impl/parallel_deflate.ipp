@@ -0,0 +1,402 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef BEAST_ZLIB_IMPL_PARALLEL_DEFLATE_IPP
+#define BEAST_ZLIB_IMPL_PARALLEL_DEFLATE_IPP
+
+#include <beast/zlib/detail/adler32.hpp>
+#include <beast/zlib/detail/crc32.hpp>
+#include <beast/core/detail/type_traits.hpp>
+#include <boost/asio/buffer.hpp>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <thread>
+
+namespace beast {
+namespace zlib {
+
+// The compressor used by one thread
+class parallel_deflate::engine
+    : private detail::deflate_stream
+{
+public:
+    engine(int level, int windowBits,
+        int memLevel, Strategy strategy)
+    {
+        reset(level, windowBits, memLevel, strategy);
+    }
+
+    void
+    reset(int level, int windowBits,
+        int memLevel, Strategy strategy)
+    {
+        doReset(level, windowBits, memLevel, strategy);
+    }
+
+    void
+    reset()
+    {
+        doReset();
+    }
+
+    std::size_t
+    upper_bound(std::size_t n) const
+    {
+        return doUpperBound(n);
+    }
+
+    void
+    dictionary(void const* data,
+        std::size_t size, error_code& ec)
+    {
+        doDictionary(static_cast<Byte const*>(data),
+            static_cast<uInt>(size), ec);
+    }
+
+    void
+    write(z_params& zs, Flush flush, error_code& ec)
+    {
+        doWrite(zs, flush, ec);
+    }
+};
+
+inline
+parallel_deflate::
+parallel_deflate(std::size_t threads)
+    : threads_(threads)
+{
+    if(threads_ == 0)
+        threads_ = (std::max)(1u,
+            std::thread::hardware_concurrency());
+}
+
+inline
+parallel_deflate::
+~parallel_deflate() = default;
+
+inline
+void
+parallel_deflate::
+block_size(std::size_t n)
+{
+    if(n == 0)
+        throw beast::detail::make_exception<std::invalid_argument>(
+            "invalid block size", __FILE__, __LINE__);
+    block_size_ = n;
+}
+
+inline
+void
+parallel_deflate::
+reset(
+    int level,
+    int windowBits,
+    int memLevel,
+    Strategy strategy,
+    Wrap wrap)
+{
+    if(wrap == Wrap::automatic)
+        throw beast::detail::make_exception<std::invalid_argument>(
+            "invalid wrap", __FILE__, __LINE__);
+    // Validates the other settings
+    if(engines_.empty())
+        engines_.emplace_back(new engine{
+            level, windowBits, memLevel, strategy});
+    for(auto& e : engines_)
+        e->reset(level, windowBits, memLevel, strategy);
+    level_ = level;
+    windowBits_ = windowBits;
+    memLevel_ = memLevel;
+    strategy_ = strategy;
+    wrap_ = wrap;
+}
+
+/*  Put the zlib or gzip header, as deflate_stream does, and
+    return its size. The stream has no preset dictionary.
+*/
+inline
+std::size_t
+parallel_deflate::
+header(std::uint8_t* p) const
+{
+    auto const level =
+        level_ == Z_DEFAULT_COMPRESSION ? 6 : level_;
+    if(wrap_ == Wrap::zlib)
+    {
+        auto const windowBits =
+            windowBits_ == 8 ? 9 : windowBits_;
+        unsigned h = (8 + ((windowBits - 8) << 4)) << 8;
+        unsigned level_flags;
+        if(strategy_ >= Strategy::huffman || level < 2)
+            level_flags = 0;
+        else if(level < 6)
+            level_flags = 1;
+        else if(level == 6)
+            level_flags = 2;
+        else
+            level_flags = 3;
+        h |= level_flags << 6;
+        h += 31 - (h % 31);
+        p[0] = static_cast<std::uint8_t>(h >> 8);
+        p[1] = static_cast<std::uint8_t>(h);
+        return 2;
+    }
+    // ID1, ID2, CM = deflate, no flags, no time
+    std::uint8_t const h[] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0 };
+    std::copy(std::begin(h), std::end(h), p);
+    // XFL
+    p[8] = level == 9 ? 2 :
+        (strategy_ >= Strategy::huffman || level < 2) ? 4 : 0;
+    p[9] = 255; // OS = unknown
+    return 10;
+}
+
+template<class DynamicBuffer>
+void
+parallel_deflate::
+write(
+    DynamicBuffer& out,
+    void const* data,
+    std::size_t size,
+    error_code& ec)
+{
+    state st;
+    st.data = static_cast<char const*>(data);
+    st.size = size;
+    st.blocks = size > 0 ?
+        (size + block_size_ - 1) / block_size_ : 1;
+    auto const n = (std::min)(threads_, st.blocks);
+    // Two slots for each thread let the threads
+    // work ahead while the output is appended.
+    st.slots = (std::min)(2 * n, st.blocks);
+    while(engines_.size() < n)
+        engines_.emplace_back(new engine{
+            level_, windowBits_, memLevel_, strategy_});
+    if(slots_.size() < st.slots)
+        slots_.resize(st.slots);
+    for(std::size_t i = 0; i < st.slots; ++i)
+    {
+        slots_[i].index = i;
+        slots_[i].done = false;
+    }
+    auto const put =
+        [&](void const* p, std::size_t size)
+        {
+            using boost::asio::buffer;
+            using boost::asio::buffer_copy;
+            out.commit(buffer_copy(
+                out.prepare(size), buffer(p, size)));
+        };
+    std::uint32_t check = wrap_ == Wrap::gzip ? 0 : 1;
+    auto const append =
+        [&](slot const& s, std::size_t i)
+        {
+            put(s.buf.data(), s.size);
+            auto const len = (std::min)(
+                block_size_, size - i * block_size_);
+            if(wrap_ == Wrap::zlib)
+                check = detail::adler32_combine(
+                    check, s.check, len);
+            else if(wrap_ == Wrap::gzip)
+                check = detail::crc32_combine(
+                    check, s.check, len);
+        };
+    auto const trailer =
+        [&]
+        {
+            std::uint8_t b[8];
+            if(wrap_ == Wrap::zlib)
+            {
+                b[0] = static_cast<std::uint8_t>(check >> 24);
+                b[1] = static_cast<std::uint8_t>(check >> 16);
+                b[2] = static_cast<std::uint8_t>(check >> 8);
+                b[3] = static_cast<std::uint8_t>(check);
+                put(b, 4);
+            }
+            else if(wrap_ == Wrap::gzip)
+            {
+                // Input size modulo 2^32
+                auto const length =
+                    static_cast<std::uint32_t>(size);
+                for(int j = 0; j < 4; ++j)
+                {
+                    b[j] = static_cast<std::uint8_t>(
+                        check >> (8 * j));
+                    b[4 + j] = static_cast<std::uint8_t>(
+                        length >> (8 * j));
+                }
+                put(b, 8);
+            }
+        };
+    ec = {};
+    if(wrap_ != Wrap::none)
+    {
+        std::uint8_t b[10];
+        put(b, header(b));
+    }
+    if(n == 1)
+    {
+        auto& s = slots_[0];
+        for(std::size_t i = 0; i < st.blocks; ++i)
+        {
+            compress(*engines_[0], s, st, i);
+            if(s.ec)
+            {
+                ec = s.ec;
+                return;
+            }
+            append(s, i);
+        }
+        trailer();
+        return;
+    }
+
+    // Stops and joins the threads on every exit
+    struct cleanup
+    {
+        state& st;
+        std::vector<std::thread> v;
+
+        ~cleanup()
+        {
+            {
+                std::lock_guard<std::mutex> lock{st.m};
+                st.stop = true;
+            }
+            st.cv.notify_all();
+            for(auto& t : v)
+                t.join();
+        }
+    };
+    cleanup c{st, {}};
+    c.v.reserve(n);
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        auto& e = *engines_[i];
+        c.v.emplace_back(
+            [this, &e, &st]
+            {
+                run(e, st);
+            });
+    }
+    for(std::size_t i = 0; i < st.blocks; ++i)
+    {
+        auto& s = slots_[i % st.slots];
+        {
+            std::unique_lock<std::mutex> lock{st.m};
+            st.cv.wait(lock,
+                [&]
+                {
+                    return s.done;
+                });
+        }
+        if(s.ec)
+        {
+            ec = s.ec;
+            return;
+        }
+        append(s, i);
+        {
+            std::lock_guard<std::mutex> lock{st.m};
+            s.done = false;
+            s.index = i + st.slots;
+        }
+        st.cv.notify_all();
+    }
+    trailer();
+}
+
+template<class>
+void
+parallel_deflate::
+compress(engine& e, slot& s,
+    state const& st, std::size_t i)
+{
+    auto const first = i * block_size_;
+    auto const n = (std::min)(block_size_, st.size - first);
+    auto const last = i + 1 == st.blocks;
+    s.size = 0;
+    s.ec = {};
+    if(wrap_ == Wrap::zlib)
+        s.check = detail::adler32(1, st.data + first, n);
+    else if(wrap_ == Wrap::gzip)
+        s.check = detail::crc32(0, st.data + first, n);
+    e.reset();
+    if(first > 0)
+    {
+        // Matches reach back at most 32KB
+        auto const dict = (std::min)(
+            first, std::size_t{32768});
+        e.dictionary(st.data + first - dict, dict, s.ec);
+        if(s.ec)
+            return;
+    }
+    z_params zs;
+    zs.next_in = st.data + first;
+    zs.avail_in = n;
+    // The bound covers the empty stored block
+    // which ends each block.
+    auto const bound = e.upper_bound(n) + 8;
+    if(s.buf.size() < bound)
+        s.buf.resize(bound);
+    for(;;)
+    {
+        zs.next_out = &s.buf[zs.total_out];
+        zs.avail_out = s.buf.size() - zs.total_out;
+        e.write(zs, last ? Flush::finish : Flush::sync, s.ec);
+        if(s.ec == error::end_of_stream)
+        {
+            s.ec = {};
+            break;
+        }
+        if(s.ec)
+            return;
+        if(! last && zs.avail_out > 0)
+            break;
+        s.buf.resize(2 * s.buf.size());
+    }
+    s.size = zs.total_out;
+}
+
+template<class>
+void
+parallel_deflate::
+run(engine& e, state& st)
+{
+    for(;;)
+    {
+        auto const i = st.next++;
+        if(i >= st.blocks)
+            return;
+        auto& s = slots_[i % st.slots];
+        {
+            // Wait for the output of the block
+            // which used the slot to be appended.
+            std::unique_lock<std::mutex> lock{st.m};
+            st.cv.wait(lock,
+                [&]
+                {
+                    return st.stop || s.index == i;
+                });
+            if(st.stop)
+                return;
+        }
+        compress(e, s, st, i);
+        {
+            std::lock_guard<std::mutex> lock{st.m};
+            s.done = true;
+        }
+        st.cv.notify_all();
+    }
+}
+
+} // zlib
+} // beast
+
+#endif
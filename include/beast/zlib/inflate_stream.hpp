@@ -36,6 +36,7 @@
 #define BEAST_ZLIB_INFLATE_STREAM_HPP
 
 #include <beast/config.hpp>
+#include <beast/zlib/preset_dictionary.hpp>
 #include <beast/zlib/detail/inflate_stream.hpp>
 
 namespace beast {
@@ -47,6 +48,9 @@ namespace zlib {
     protocol is a compression protocol described in
     "DEFLATE Compressed Data Format Specification version 1.3"
     located here: https://tools.ietf.org/html/rfc1951
+    The zlib (RFC 1950) and gzip (RFC 1952) wrappers may be
+    chosen with @ref reset, in which case the header is parsed
+    and the check value in the trailer is verified.
 
     The implementation is a refactored port to C++ of ZLib's "inflate".
     A more detailed description of ZLib is at http://zlib.net/.
@@ -91,6 +95,23 @@ public:
         doReset(windowBits);
     }
 
+    /** Reset the stream.
+
+        This puts the stream in a newly constructed state with the
+        specified window size and wrapper, but without de-allocating
+        any dynamically created structures. With `Wrap::automatic`,
+        either a zlib or a gzip header is accepted.
+
+        When a zlib header names a preset dictionary, @ref write
+        fails with `error::need_dictionary`, and the dictionary
+        must be set with @ref dictionary to continue.
+    */
+    void
+    reset(int windowBits, Wrap wrap)
+    {
+        doReset(windowBits, wrap);
+    }
+
     /** Put the stream in a newly constructed state.
 
         All dynamically allocated memory is de-allocated.
@@ -101,6 +122,81 @@ public:
         doClear();
     }
 
+    /** Set a preset dictionary.
+
+        The dictionary is added to the history, as the compressor
+        did, so that the data which follows may refer to it. For
+        raw deflate this may be done at any time, usually after
+        a reset. For the zlib wrapper it is done when @ref write
+        fails with `error::need_dictionary`, after which `write`
+        is called again to continue.
+
+        Dictionaries are not available when the output is
+        contiguous, see @ref contiguous.
+
+        @param data A pointer to the dictionary.
+
+        @param size The size of the dictionary in bytes.
+
+        @param ec Set to `error::stream_error` if the dictionary
+        cannot be set at this point, or `error::incorrect_dictionary`
+        if it is not the one named by the zlib header.
+    */
+    void
+    dictionary(void const* data, std::size_t size, error_code& ec)
+    {
+        doDictionary(
+            static_cast<std::uint8_t const*>(data), size, ec);
+    }
+
+    /** Set a preset dictionary.
+
+        This is the same as setting the bytes of `dict`.
+    */
+    void
+    dictionary(preset_dictionary const& dict, error_code& ec)
+    {
+        doDictionary(
+            static_cast<std::uint8_t const*>(dict.data()),
+                dict.size(), ec);
+    }
+
+    /** Set whether the output is contiguous.
+
+        When this is `true`, the caller guarantees that on each
+        call to @ref write, the output of the previous calls since
+        the last reset, up to the size of the window, immediately
+        precedes `zs.next_out` in memory. This holds when a stream
+        is decompressed into one growing buffer such as a
+        @ref flat_buffer. Back-references are then copied from the
+        output itself, and the sliding window is neither updated
+        nor allocated.
+
+        Otherwise, the last window of output is copied into the
+        sliding window at the end of each call, unless the end of
+        the stream was reached.
+
+        The setting is kept by a reset. It may be turned on at any
+        time, but after turning it off the stream must be reset.
+    */
+    void
+    contiguous(bool value)
+    {
+        doContiguous(value);
+    }
+
+    /** Returns the size of the dynamically allocated internal buffers.
+
+        The buffers are allocated when first needed after construction
+        or a call to `clear`. The value does not include the size of
+        the stream object itself.
+    */
+    std::size_t
+    allocated() const
+    {
+        return doAllocated();
+    }
+
     /** Decompress input and produce output.
 
         This function decompresses as much data as possible, and stops when
@@ -0,0 +1,196 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef BEAST_ZLIB_PARALLEL_DEFLATE_HPP
+#define BEAST_ZLIB_PARALLEL_DEFLATE_HPP
+
+#include <beast/config.hpp>
+#include <beast/zlib/error.hpp>
+#include <beast/zlib/zlib.hpp>
+#include <beast/zlib/detail/deflate_stream.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace beast {
+namespace zlib {
+
+/** A deflate compressor which uses several threads.
+
+    The input is split into blocks which are compressed at the
+    same time on separate threads. Each block is compressed with
+    the preceding 32KB of input as its dictionary, so matches may
+    reach back across block boundaries, and all but the last
+    block end with a sync flush so they can be joined into one
+    raw deflate stream (RFC 1951). The result is decoded by
+    @ref inflate_stream or any other inflater in one piece.
+
+    The stream may be wrapped in a zlib (RFC 1950) or gzip
+    (RFC 1952) header and trailer, chosen with @ref reset. The
+    checksum of each block is computed by the thread which
+    compresses it, and the checksums are combined in order
+    for the trailer.
+
+    The output does not depend on the number of threads. It is
+    slightly larger than that of a single @ref deflate_stream,
+    by the empty stored block at each boundary and the matches
+    which would have started in one block and ended in the next.
+
+    Threads are started for each call to @ref write, which
+    returns once all of them have finished. One compressor is
+    kept for each thread, so memory is allocated only once
+    when the object is reused.
+
+    @par Thread Safety
+    @e Distinct @e objects: Safe.@n
+    @e Shared @e objects: Unsafe.
+*/
+class parallel_deflate
+{
+    class engine;
+
+    // Holds the output of one block
+    struct slot
+    {
+        std::size_t index;          // block which may use the slot
+        bool done = false;          // output is ready
+        std::vector<char> buf;
+        std::size_t size = 0;
+        std::uint32_t check;        // checksum of the input
+        error_code ec;
+    };
+
+    // Shared by the threads during write
+    struct state
+    {
+        char const* data;
+        std::size_t size;
+        std::size_t blocks;
+        std::size_t slots;
+        std::atomic<std::size_t> next{0};
+        std::mutex m;
+        std::condition_variable cv;
+        bool stop = false;
+    };
+
+    std::vector<std::unique_ptr<engine>> engines_;
+    std::vector<slot> slots_;
+    std::size_t threads_;
+    std::size_t block_size_ = default_block_size;
+    int level_ = 6;
+    int windowBits_ = 15;
+    int memLevel_ = 8;
+    Strategy strategy_ = Strategy::normal;
+    Wrap wrap_ = Wrap::none;
+
+public:
+    /// The default number of input bytes in each block
+    static std::size_t constexpr default_block_size = 128 * 1024;
+
+    /** Constructor.
+
+        The compression settings are set to `level = 6`,
+        `windowBits = 15`, `memLevel = 8`,
+        `strategy = Strategy::normal` and `wrap = Wrap::none`.
+
+        @param threads The number of threads to use. If this
+        is zero, the number of hardware threads is used.
+    */
+    explicit
+    parallel_deflate(std::size_t threads = 0);
+
+    /// Destructor
+    ~parallel_deflate();
+
+    parallel_deflate(parallel_deflate const&) = delete;
+    parallel_deflate& operator=(parallel_deflate const&) = delete;
+
+    /// Returns the number of threads used
+    std::size_t
+    threads() const
+    {
+        return threads_;
+    }
+
+    /// Returns the number of input bytes in each block
+    std::size_t
+    block_size() const
+    {
+        return block_size_;
+    }
+
+    /** Set the number of input bytes in each block.
+
+        Smaller blocks spread small inputs over more threads,
+        larger blocks compress slightly better.
+
+        @throws std::invalid_argument if `n` is zero.
+    */
+    void
+    block_size(std::size_t n);
+
+    /** Set the compression settings.
+
+        The interpretation of the settings is as in
+        @ref deflate_stream::reset. The wrapper may be
+        `Wrap::none`, `Wrap::zlib` or `Wrap::gzip`.
+
+        @throws std::invalid_argument if a setting is invalid.
+    */
+    void
+    reset(
+        int level,
+        int windowBits,
+        int memLevel,
+        Strategy strategy,
+        Wrap wrap = Wrap::none);
+
+    /** Compress a buffer.
+
+        The complete input is compressed to a deflate stream with
+        the chosen wrapper, which is appended to the dynamic buffer.
+
+        @param out The dynamic buffer to append the output to.
+
+        @param data A pointer to the input.
+
+        @param size The number of bytes of input.
+
+        @param ec Set to the error, if any occurred.
+    */
+    template<class DynamicBuffer>
+    void
+    write(
+        DynamicBuffer& out,
+        void const* data,
+        std::size_t size,
+        error_code& ec);
+
+private:
+    std::size_t
+    header(std::uint8_t* p) const;
+
+    template<class = void>
+    void
+    compress(engine& e, slot& s,
+        state const& st, std::size_t i);
+
+    template<class = void>
+    void
+    run(engine& e, state& st);
+};
+
+} // zlib
+} // beast
+
+#include <beast/zlib/impl/parallel_deflate.ipp>
+
+#endif
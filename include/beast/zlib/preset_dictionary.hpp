@@ -0,0 +1,122 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef BEAST_ZLIB_PRESET_DICTIONARY_HPP
+#define BEAST_ZLIB_PRESET_DICTIONARY_HPP
+
+#include <beast/config.hpp>
+#include <beast/zlib/zlib.hpp>
+#include <beast/zlib/detail/deflate_stream.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace beast {
+namespace zlib {
+
+/** A preset dictionary, prepared once for many streams.
+
+    A preset dictionary is a sequence of bytes which the
+    compressor and the decompressor both treat as output
+    preceding the stream, so that the first bytes of the
+    stream may refer to it. Small messages which share
+    structure with the dictionary, such as JSON documents
+    with the same keys, compress much better than they
+    would on their own.
+
+    Objects of this type hold the dictionary together with
+    the hash table and hash chains which a @ref deflate_stream
+    builds when the dictionary is loaded. Setting it on a
+    stream with the same `windowBits` and `memLevel`, right
+    after a reset, copies these tables instead of hashing
+    the dictionary again. It may be set on other streams
+    too, which hash the dictionary themselves.
+
+    The object is not changed by use, so one object may be
+    shared by any number of streams on any number of threads.
+
+    @see deflate_stream::dictionary, inflate_stream::dictionary
+*/
+class preset_dictionary
+{
+    std::vector<std::uint8_t> data_;
+    detail::deflate_preset preset_;
+
+    friend class deflate_stream;
+
+public:
+    /** Construct a preset dictionary.
+
+        @param data A pointer to the dictionary. The bytes
+        are copied. The most commonly used strings are best
+        placed towards the end, where the distances to them
+        are shortest. Only the last `1 << windowBits` bytes
+        are used by streams with that window size.
+
+        @param size The size of the dictionary in bytes.
+
+        @param windowBits The window size of the streams which
+        will use the dictionary, for which it is prepared.
+
+        @param memLevel The memory level of the streams which
+        will use the dictionary, for which it is prepared.
+
+        @throws std::invalid_argument if a setting is invalid.
+    */
+    preset_dictionary(void const* data, std::size_t size,
+        int windowBits = 15, int memLevel = 8)
+        : data_(static_cast<std::uint8_t const*>(data),
+            static_cast<std::uint8_t const*>(data) + size)
+    {
+        struct builder : detail::deflate_stream
+        {
+            builder(int windowBits, int memLevel)
+            {
+                doReset(6, windowBits, memLevel, Strategy::normal);
+            }
+
+            void
+            save(detail::deflate_preset& preset,
+                std::vector<std::uint8_t> const& data)
+            {
+                doSavePreset(preset, data.data(),
+                    static_cast<uInt>(data.size()));
+            }
+        };
+        builder{windowBits, memLevel}.save(preset_, data_);
+    }
+
+    /// Returns a pointer to the dictionary
+    void const*
+    data() const
+    {
+        return data_.data();
+    }
+
+    /// Returns the size of the dictionary in bytes
+    std::size_t
+    size() const
+    {
+        return data_.size();
+    }
+
+    /** Returns the identifier of the dictionary.
+
+        This is the Adler-32 checksum of the dictionary, which
+        a zlib header uses to name it (RFC 1950).
+    */
+    std::uint32_t
+    id() const
+    {
+        return preset_.adler;
+    }
+};
+
+} // zlib
+} // beast
+
+#endif
@@ -172,6 +172,44 @@ enum class Strategy
     fixed
 };
 
+/** Stream framing.
+
+    These select the header and trailer written around
+    the compressed data, and expected when decompressing.
+*/
+enum class Wrap
+{
+    /** No header or trailer.
+
+        The stream is raw deflate (RFC 1951), as used by
+        the websocket permessage-deflate extension.
+    */
+    none,
+
+    /** The zlib wrapper (RFC 1950).
+
+        A two byte header is followed by the deflate stream
+        and an Adler-32 of the uncompressed data. This is the
+        "deflate" HTTP content coding.
+    */
+    zlib,
+
+    /** The gzip wrapper (RFC 1952).
+
+        A header of at least ten bytes is followed by the deflate
+        stream, a CRC-32 and the length of the uncompressed data.
+        This is the "gzip" HTTP content coding.
+    */
+    gzip,
+
+    /** Either the zlib or the gzip wrapper.
+
+        The wrapper is detected from the header. This is only
+        valid when decompressing.
+    */
+    automatic
+};
+
 } // zlib
 } // beast
 
@@ -8,6 +8,10 @@
 #include <beast/core/detail/sha1.hpp>
 #include <beast/unit_test/suite.hpp>
 #include <array>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace beast {
 namespace detail {
@@ -57,6 +61,55 @@ public:
         BEAST_EXPECT(result == digest);
     }
 
+    // The digests of several messages at once must
+    // match the digest of each message on its own.
+    void
+    testMulti()
+    {
+        std::string const text =
+            "The quick brown fox jumps over the lazy dog, "
+            "while the five boxing wizards jump quickly; "
+            "pack my box with five dozen liquor jugs.";
+        for(std::size_t size : {0, 1, 24, 55, 56, 60, 63, 64, 65, 119, 120})
+        {
+            for(std::size_t n : {1, 2, 7, 8, 9, 17})
+            {
+                std::vector<std::string> messages;
+                std::vector<void const*> mp;
+                std::vector<std::array<char, 20>> digests(n);
+                std::vector<void*> dp;
+                // Each message holds exactly `size` bytes
+                // of the text, starting at offset i.
+                for(std::size_t i = 0; i < n; ++i)
+                {
+                    std::string m(size, 0);
+                    for(std::size_t j = 0; j < size; ++j)
+                        m[j] = text[(i + j) % text.size()];
+                    messages.push_back(std::move(m));
+                    BEAST_EXPECT(messages[i].size() == size);
+                }
+                for(std::size_t i = 0; i < n; ++i)
+                {
+                    mp.push_back(messages[i].data());
+                    dp.push_back(digests[i].data());
+                }
+                sha1_n(n, mp.data(), size, dp.data());
+                for(std::size_t i = 0; i < n; ++i)
+                {
+                    sha1_context ctx;
+                    char digest[sha1_context::digest_size];
+                    init(ctx);
+                    update(ctx, messages[i].data(), size);
+                    finish(ctx, &digest[0]);
+                    BEAST_EXPECTS(std::memcmp(digest,
+                        digests[i].data(), sizeof(digest)) == 0,
+                            std::to_string(size) + ", " +
+                                std::to_string(n));
+                }
+            }
+        }
+    }
+
     void
     run()
     {
@@ -70,6 +123,7 @@ public:
             "84983e44" "1c3bd26e" "baae4aa1" "f95129e5" "e54670f1");
         check("abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
             "a49b2446" "a02c645b" "f419f995" "b6709125" "3a04a259");
+        testMulti();
     }
 };
 
@@ -9,6 +9,8 @@
 #include <beast/websocket/detail/mask.hpp>
 
 #include <beast/unit_test/suite.hpp>
+#include <algorithm>
+#include <iterator>
 
 namespace beast {
 namespace websocket {
@@ -40,10 +42,44 @@ public:
         }
     };
 
+    void
+    testMaskSource()
+    {
+        // RFC 7539 section 2.3.2
+        std::uint32_t const seed[12] = {
+            0x03020100, 0x07060504, 0x0b0a0908, 0x0f0e0d0c,
+            0x13121110, 0x17161514, 0x1b1a1918, 0x1f1e1d1c,
+            0x00000001, 0x09000000, 0x4a000000, 0x00000000};
+        std::uint32_t const block[16] = {
+            0xe4e7f110, 0x15593bd1, 0x1fdd0f50, 0xc47120a3,
+            0xc7f4d1c7, 0x0368c033, 0x9aaa2204, 0x4e6cd4c3,
+            0x466482d2, 0x09aa9f07, 0x05d7c214, 0xa2028bd9,
+            0xd19c12b5, 0xb94e16de, 0xe883d0cb, 0x4e3c50a2};
+        mask_source ms{seed};
+        for(auto v : block)
+            BEAST_EXPECT(ms.next() == v);
+        // the counter advanced
+        BEAST_EXPECT(ms.next() != block[0]);
+
+        // each thread has its own source
+        auto& ts = mask_source::instance();
+        BEAST_EXPECT(&ts == &mask_source::instance());
+        std::uint32_t a[64];
+        for(auto& v : a)
+        {
+            v = make_mask_key();
+            BEAST_EXPECT(v != 0);
+        }
+        std::sort(std::begin(a), std::end(a));
+        BEAST_EXPECT(std::unique(
+            std::begin(a), std::end(a)) == std::end(a));
+    }
+
     void run() override
     {
         maskgen_t<test_generator> mg;
         BEAST_EXPECT(mg() != 0);
+        testMaskSource();
     }
 };
 
@@ -22,8 +22,13 @@
 #include <boost/asio.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/optional.hpp>
-#include <mutex>
+#include <atomic>
 #include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace beast {
 namespace websocket {
@@ -553,7 +558,13 @@ public:
         ws.set_option(write_buffer_size{2048});
         ws.set_option(message_type{opcode::text});
         ws.set_option(read_buffer_size{8192});
+        ws.set_option(read_ahead{4096});
         ws.set_option(read_message_max{1 * 1024 * 1024});
+        ws.set_option(write_queue{16, 1024 * 1024});
+        ws.set_option(write_cork{4096});
+        ws.set_option(pool_buffers{true});
+        ws.set_option(adaptive_fragment{true, 1024, 16384});
+        ws.set_option(adaptive_fragment{false});
         try
         {
             ws.set_option(write_buffer_size{7});
@@ -572,6 +583,15 @@ public:
         {
             pass();
         }
+        try
+        {
+            adaptive_fragment{true, 4096, 1024};
+            fail();
+        }
+        catch(std::exception const&)
+        {
+            pass();
+        }
     }
 
     //--------------------------------------------------------------------------
@@ -991,6 +1011,101 @@ public:
 
     //--------------------------------------------------------------------------
 
+    void
+    testUpgrade()
+    {
+        using detail::upgrade_request;
+        {
+            upgrade_request req;
+            BEAST_EXPECT(req.parse(string_view{}) ==
+                upgrade_request::need_more);
+            BEAST_EXPECT(req.parse(string_view{"GE"}) ==
+                upgrade_request::need_more);
+            BEAST_EXPECT(req.parse(string_view{"POST /"}) ==
+                upgrade_request::other);
+            BEAST_EXPECT(req.parse(string_view{
+                "GET / HTTP/1.1\r\nHost: x\r\n"}) ==
+                    upgrade_request::need_more);
+        }
+        {
+            string_view const keys[] = {
+                "dGhlIHNhbXBsZSBub25jZQ==",
+                "AQIDBAUGBwgJCgsMDQ4PEC==",
+                "short",
+                "x3JJHMbDL1EzLkh9GBhXDw==",
+                "dGhlIHNhbXBsZSBub25jZQ==",
+                "dGhlIHNhbXBsZSBub25jZQ==",
+                "dGhlIHNhbXBsZSBub25jZQ==",
+                "dGhlIHNhbXBsZSBub25jZQ==",
+                "dGhlIHNhbXBsZSBub25jZQ==",
+                "AQIDBAUGBwgJCgsMDQ4PEC=="};
+            auto const n = sizeof(keys) / sizeof(keys[0]);
+            detail::sec_ws_accept_type accepts[n];
+            detail::make_sec_ws_accept(accepts, keys, n);
+            BEAST_EXPECT(accepts[0] == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+            for(std::size_t i = 0; i < n; ++i)
+            {
+                detail::sec_ws_accept_type accept;
+                detail::make_sec_ws_accept(accept, keys[i]);
+                BEAST_EXPECT(accepts[i] == accept);
+            }
+        }
+        // The response must be the same as
+        // the one built by the general path.
+        auto const check =
+            [&](std::string const& s, bool pmd)
+            {
+                permessage_deflate o;
+                o.server_enable = pmd;
+                auto const decorate = [](response_type&){};
+                for(std::size_t n : {std::size_t{3}, s.size()})
+                {
+                    stream<test::string_iostream> ws1{ios_, s, n};
+                    stream<test::string_iostream> ws2{ios_, s, n};
+                    stream<test::string_iostream> ws3{ios_, s, n};
+                    ws1.set_option(o);
+                    ws2.set_option(o);
+                    ws3.set_option(o);
+                    ws1.accept();
+                    ws2.accept_ex(decorate);
+                    BEAST_EXPECTS(ws1.next_layer().str ==
+                        ws2.next_layer().str, ws1.next_layer().str);
+                    yield_to(
+                        [&](yield_context yield)
+                        {
+                            ws3.async_accept(yield);
+                        });
+                    BEAST_EXPECT(ws3.next_layer().str ==
+                        ws2.next_layer().str);
+                }
+            };
+        std::string const req =
+            "GET / HTTP/1.1\r\n"
+            "Host: localhost:80\r\n"
+            "Upgrade: WebSocket\r\n"
+            "Connection: keep-alive,upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Version: 13\r\n";
+        check(req + "\r\n", false);
+        check(req + "User-Agent: test\r\n\r\n", false);
+        check(
+            "GET /chat?x=1 HTTP/1.1\r\n"
+            "host:localhost\r\n"
+            "upgrade:  websocket \r\n"
+            "connection: Upgrade\r\n"
+            "sec-websocket-version: 13\r\n"
+            "sec-websocket-key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "\r\n", false);
+        std::string const ext =
+            "Sec-WebSocket-Extensions: permessage-deflate; "
+            "client_max_window_bits; server_no_context_takeover\r\n";
+        check(req + ext + "\r\n", true);
+        check(req + ext + "\r\n", false);
+        // handled by the general path
+        check(req + ext + ext + "\r\n", true);
+        check(req + "X: a\r\n b\r\n\r\n", false);
+    }
+
     void testBadHandshakes()
     {
         auto const check =
@@ -1178,6 +1293,95 @@ public:
         );
     }
 
+    void
+    testReadAhead()
+    {
+        // Client frames, masked with a fixed key
+        auto const frame =
+            [](std::string& s, opcode op,
+                bool fin, std::string const& payload)
+            {
+                std::uint8_t const key[4] = {1, 2, 3, 4};
+                s.push_back(static_cast<char>(
+                    (fin ? 0x80 : 0) | static_cast<int>(op)));
+                if(payload.size() < 126)
+                {
+                    s.push_back(static_cast<char>(
+                        0x80 | payload.size()));
+                }
+                else
+                {
+                    s.push_back(static_cast<char>(0x80 | 126));
+                    s.push_back(static_cast<char>(
+                        payload.size() >> 8));
+                    s.push_back(static_cast<char>(
+                        payload.size() & 0xff));
+                }
+                s.append(reinterpret_cast<
+                    char const*>(&key[0]), 4);
+                for(std::size_t i = 0; i < payload.size(); ++i)
+                    s.push_back(static_cast<char>(
+                        payload[i] ^ key[i % 4]));
+            };
+        std::string s =
+            "GET / HTTP/1.1\r\n"
+            "Host: localhost:80\r\n"
+            "Upgrade: WebSocket\r\n"
+            "Connection: upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Version: 13\r\n"
+            "\r\n";
+        std::vector<std::string> v;
+        for(std::size_t i = 1; i <= 40; ++i)
+        {
+            v.emplace_back(i * 7,
+                static_cast<char>('a' + i % 26));
+            frame(s, opcode::text, true, v.back());
+            if(i == 10)
+                frame(s, opcode::ping, true, "ping");
+        }
+        frame(s, opcode::text, false, "Hello, ");
+        frame(s, opcode::cont, true, "world");
+        v.emplace_back("Hello, world");
+
+        for(std::size_t n : {0, 7, 64, 4096})
+        {
+            for(std::size_t max : {5, 65536})
+            {
+                stream<test::string_iostream> ws{ios_, s, max};
+                ws.set_option(read_ahead{n});
+                ws.accept();
+                for(auto const& m : v)
+                {
+                    multi_buffer b;
+                    opcode op;
+                    ws.read(op, b);
+                    BEAST_EXPECT(to_string(b.data()) == m);
+                }
+            }
+        }
+        yield_to(
+            [&](yield_context yield)
+            {
+                for(std::size_t n : {0, 7, 64, 4096})
+                {
+                    stream<test::string_iostream> ws{ios_, s};
+                    ws.set_option(read_ahead{n});
+                    ws.async_accept(yield);
+                    for(auto const& m : v)
+                    {
+                        multi_buffer b;
+                        opcode op;
+                        ws.async_read(op, b, yield);
+                        BEAST_EXPECT(to_string(b.data()) == m);
+                    }
+                    // the ping was answered
+                    BEAST_EXPECT(ws.next_layer().str.find(
+                        "ping") != std::string::npos);
+                }
+            });
+    }
+
     void
     testMask(endpoint_type const& ep,
         yield_context do_yield)
@@ -1601,10 +1805,1125 @@ public:
         }
     }
 
+    void
+    testWriteQueue(endpoint_type const& ep)
+    {
+        using boost::asio::buffer;
+        boost::asio::io_service ios;
+        error_code ec;
+        socket_type sock(ios);
+        sock.connect(ep, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        stream<socket_type&> ws(sock);
+        ws.handshake("localhost", "/", ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ws.set_option(write_queue{8});
+        {
+            write_queue wq{0};
+            ws.get_option(wq);
+            BEAST_EXPECT(wq.depth == 8);
+            BEAST_EXPECT(wq.bytes == 64 * 1024);
+        }
+        // The large message can't be serialized,
+        // the writes following it must wait.
+        std::vector<std::string> v;
+        for(int i = 0; i < 10; ++i)
+            v.push_back("queue-" + std::to_string(i));
+        v[4] = std::string(5000, '*');
+        std::vector<std::size_t> done;
+        std::size_t overflow = 0;
+        for(std::size_t i = 0; i < v.size(); ++i)
+            ws.async_write(buffer(v[i]),
+                [&, i](error_code ec)
+                {
+                    if(ec == boost::asio::error::no_buffer_space)
+                        ++overflow;
+                    else if(BEAST_EXPECTS(! ec, ec.message()))
+                        done.push_back(i);
+                });
+        BEAST_EXPECT(ws.write_queue_size() == 8);
+        BEAST_EXPECT(ws.write_queue_bytes() > 5000);
+        ios.run();
+        BEAST_EXPECT(overflow == 1);
+        BEAST_EXPECT(ws.write_queue_size() == 0);
+        BEAST_EXPECT(ws.write_queue_bytes() == 0);
+        if(! BEAST_EXPECT(done.size() == 9))
+            return;
+        for(std::size_t i = 0; i < done.size(); ++i)
+            BEAST_EXPECT(done[i] == i);
+        for(std::size_t i = 0; i < done.size(); ++i)
+        {
+            multi_buffer b;
+            opcode op;
+            ws.read(op, b, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            BEAST_EXPECT(to_string(b.data()) == v[i]);
+        }
+    }
+
+    void
+    testWriteCork(endpoint_type const& ep)
+    {
+        boost::asio::io_service ios;
+        error_code ec;
+        socket_type sock(ios);
+        sock.connect(ep, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        stream<socket_type&> ws(sock);
+        ws.handshake("localhost", "/", ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        auto const check =
+            [&](std::string const& s)
+            {
+                multi_buffer b;
+                opcode op;
+                ws.read(op, b, ec);
+                if(BEAST_EXPECTS(! ec, ec.message()))
+                    BEAST_EXPECT(to_string(b.data()) == s);
+            };
+
+        // synchronous, read flushes
+        ws.set_option(write_cork{1024});
+        ws.write(sbuf("u"));
+        ws.write(sbuf("v"));
+        ws.write(sbuf("w"));
+        check("u");
+        check("v");
+        check("w");
+
+        // synchronous, limit reached
+        ws.set_option(write_cork{8});
+        ws.write(sbuf("x"));
+        ws.write(sbuf("y"));
+        ws.write(sbuf("z"));
+        ws.flush();
+        check("x");
+        check("y");
+        check("z");
+
+        // asynchronous, automatic flush
+        ws.set_option(write_cork{1024});
+        std::size_t n = 0;
+        std::function<void(error_code)> next =
+            [&](error_code ec)
+            {
+                if(! BEAST_EXPECTS(! ec, ec.message()))
+                    return;
+                if(++n < 3)
+                    ws.async_write(sbuf("*"), next);
+            };
+        ws.async_write(sbuf("*"), next);
+        ios.run();
+        BEAST_EXPECT(n == 3);
+        check("*");
+        check("*");
+        check("*");
+
+        // asynchronous, a batch completes when it is sent
+        ios.reset();
+        ws.set_option(write_queue{8});
+        {
+            std::vector<std::size_t> done;
+            for(std::size_t i = 0; i < 5; ++i)
+                ws.async_write(sbuf("+"),
+                    [&, i](error_code ec)
+                    {
+                        if(BEAST_EXPECTS(! ec, ec.message()))
+                            done.push_back(i);
+                    });
+            ios.run();
+            if(BEAST_EXPECT(done.size() == 5))
+                for(std::size_t i = 0; i < done.size(); ++i)
+                    BEAST_EXPECT(done[i] == i);
+            for(std::size_t i = 0; i < done.size(); ++i)
+                check("+");
+        }
+        ws.set_option(write_queue{0});
+
+        // asynchronous, explicit flush
+        ios.reset();
+        bool flushed = false;
+        ws.async_write(sbuf("Hello"),
+            [&](error_code ec)
+            {
+                if(! BEAST_EXPECTS(! ec, ec.message()))
+                    return;
+                ws.async_flush(
+                    [&](error_code ec)
+                    {
+                        flushed = BEAST_EXPECTS(
+                            ! ec, ec.message());
+                    });
+            });
+        ios.run();
+        BEAST_EXPECT(flushed);
+        check("Hello");
+
+        // larger messages are sent in order
+        ws.write(sbuf("a"));
+        ws.set_option(write_cork{4});
+        ws.write(sbuf("bcdefgh"));
+        check("a");
+        check("bcdefgh");
+    }
+
+    void
+    testWriteCorkLifetime(endpoint_type const& ep)
+    {
+        // The stream may be destroyed once the
+        // handlers of its writes have been called.
+        {
+            boost::asio::io_service ios;
+            error_code ec;
+            socket_type sock(ios);
+            sock.connect(ep, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            std::unique_ptr<stream<socket_type&>> ws{
+                new stream<socket_type&>{sock}};
+            ws->handshake("localhost", "/", ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            ws->set_option(write_cork{1024});
+            bool invoked = false;
+            ws->async_write(sbuf("Hello"),
+                [&](error_code ec)
+                {
+                    invoked = BEAST_EXPECTS(! ec, ec.message());
+                    ws.reset();
+                });
+            ios.run();
+            BEAST_EXPECT(invoked);
+            BEAST_EXPECT(! ws);
+        }
+
+        // An error sending the batch is delivered
+        // to each write in the batch.
+        std::size_t n;
+        for(n = 0; n < 100; ++n)
+        {
+            boost::asio::io_service ios;
+            error_code ec;
+            stream<test::fail_stream<socket_type>> ws{n, ios};
+            ws.next_layer().next_layer().connect(ep, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            ws.handshake("localhost", "/", ec);
+            if(ec)
+                continue;
+            ws.set_option(write_queue{8});
+            ws.set_option(write_cork{1024});
+            std::size_t failed = 0;
+            for(std::size_t i = 0; i < 3; ++i)
+                ws.async_write(sbuf("*"),
+                    [&](error_code ec)
+                    {
+                        if(ec == test::error::fail_error)
+                            ++failed;
+                    });
+            ios.run();
+            BEAST_EXPECT(failed == 3);
+            // The next operation fails too
+            ios.reset();
+            ws.async_write(sbuf("*"),
+                [&](error_code ec)
+                {
+                    BEAST_EXPECTS(ec == boost::asio::error::
+                        operation_aborted, ec.message());
+                });
+            ios.run();
+            break;
+        }
+        BEAST_EXPECT(n < 100);
+    }
+
+    void
+    testCompressionMemory(endpoint_type const& ep)
+    {
+        using boost::asio::buffer;
+        permessage_deflate pmd;
+        pmd.client_enable = true;
+        pmd.client_no_context_takeover = true;
+        pmd.server_no_context_takeover = true;
+        error_code ec;
+        socket_type sock{ios_};
+        sock.connect(ep, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        stream<socket_type&> ws{sock};
+        ws.set_option(pmd);
+        BEAST_EXPECT(ws.compression_memory() == 0);
+        ws.handshake("localhost", "/", ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        // allocated when first needed
+        auto const idle = ws.compression_memory();
+        BEAST_EXPECT(idle > 0);
+        std::string const s(1000, '*');
+        auto const echo =
+            [&]
+            {
+                multi_buffer b;
+                opcode op;
+                ws.write(buffer(s));
+                ws.read(op, b);
+                BEAST_EXPECT(to_string(b.data()) == s);
+            };
+        echo();
+        BEAST_EXPECT(ws.compression_memory() > idle);
+        ws.release_compression_memory();
+        BEAST_EXPECT(ws.compression_memory() == idle);
+        echo();
+        BEAST_EXPECT(ws.compression_memory() > idle);
+        // freed after each message
+        pmd.release_memory = true;
+        ws.set_option(pmd);
+        echo();
+        BEAST_EXPECT(ws.compression_memory() == idle);
+
+        // with context takeover, only the pending buffer is freed
+        pmd.client_no_context_takeover = false;
+        pmd.server_no_context_takeover = false;
+        std::size_t used[2];
+        for(bool release : { false, true })
+        {
+            socket_type sock2{ios_};
+            sock2.connect(ep, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            stream<socket_type&> ws2{sock2};
+            pmd.release_memory = release;
+            ws2.set_option(pmd);
+            ws2.handshake("localhost", "/", ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            multi_buffer b;
+            opcode op;
+            ws2.write(buffer(s));
+            ws2.read(op, b);
+            BEAST_EXPECT(to_string(b.data()) == s);
+            used[release] = ws2.compression_memory();
+        }
+        BEAST_EXPECT(used[0] - used[1] ==
+            std::size_t{1} << (pmd.memLevel + 8));
+    }
+
+    void
+    testPoolBuffers(endpoint_type const& ep)
+    {
+        using boost::asio::buffer;
+        using pool = beast::detail::buffer_pool;
+        pool::instance().clear();
+        error_code ec;
+        socket_type sock{ios_};
+        sock.connect(ep, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        stream<socket_type&> ws{sock};
+        ws.set_option(write_buffer_size{1024});
+        ws.handshake("localhost", "/", ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(ws.buffer_memory() == 0);
+        std::string const s(3000, '*');
+        auto const echo =
+            [&]
+            {
+                multi_buffer b;
+                opcode op;
+                ws.write(buffer(s));
+                ws.read(op, b);
+                BEAST_EXPECT(to_string(b.data()) == s);
+            };
+        // the client keeps its masking buffer
+        echo();
+        BEAST_EXPECT(ws.buffer_memory() == 1024);
+        BEAST_EXPECT(pool::instance().size() == 0);
+        // given back after each message
+        ws.set_option(pool_buffers{true});
+        echo();
+        BEAST_EXPECT(ws.buffer_memory() == 0);
+        BEAST_EXPECT(pool::instance().size() == 1);
+        echo();
+        BEAST_EXPECT(pool::instance().size() == 1);
+        yield_to(
+            [&](yield_context yield)
+            {
+                multi_buffer b;
+                opcode op;
+                ws.async_write(buffer(s), yield);
+                BEAST_EXPECT(ws.buffer_memory() == 0);
+                ws.async_read(op, b, yield);
+                BEAST_EXPECT(to_string(b.data()) == s);
+                BEAST_EXPECT(pool::instance().size() == 1);
+            });
+        // a buffer of another size is not reused
+        ws.set_option(write_buffer_size{2048});
+        echo();
+        BEAST_EXPECT(ws.buffer_memory() == 0);
+        BEAST_EXPECT(pool::instance().size() == 2);
+        ws.close({}, ec);
+        pool::instance().clear();
+    }
+
+    void
+    testAdaptiveFragment(endpoint_type const& ep)
+    {
+        using boost::asio::buffer;
+        using ms = std::chrono::milliseconds;
+        {
+            detail::fragment_sizer fs{512, 8192};
+            fs.reset(100000);
+            BEAST_EXPECT(fs.size() == 8192);
+            fs.reset(0);
+            BEAST_EXPECT(fs.size() == 512);
+            fs.reset(2048);
+            // fast sends grow the fragments
+            fs.update(ms(0), false);
+            BEAST_EXPECT(fs.size() == 4096);
+            fs.update(ms(0), false);
+            fs.update(ms(0), false);
+            BEAST_EXPECT(fs.size() == 8192);
+            // near the target they stay the same
+            fs.update(ms(5), false);
+            BEAST_EXPECT(fs.size() == 8192);
+            // slow sends shrink them
+            fs.update(ms(50), false);
+            BEAST_EXPECT(fs.size() == 4096);
+            // so does a waiting control frame
+            fs.update(ms(0), true);
+            BEAST_EXPECT(fs.size() == 2048);
+            for(int i = 0; i < 8; ++i)
+                fs.update(ms(50), false);
+            BEAST_EXPECT(fs.size() == 512);
+        }
+        error_code ec;
+        socket_type sock{ios_};
+        sock.connect(ep, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        stream<socket_type&> ws{sock};
+        ws.set_option(auto_fragment{true});
+        ws.set_option(write_buffer_size{8192});
+        ws.set_option(adaptive_fragment{true, 512, 8192});
+        ws.handshake("localhost", "/", ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        std::string s(100000, '*');
+        for(std::size_t i = 0; i < s.size(); ++i)
+            s[i] = static_cast<char>(i % 251);
+        ws.set_option(message_type{opcode::binary});
+        {
+            multi_buffer b;
+            opcode op;
+            ws.write(buffer(s));
+            ws.read(op, b);
+            BEAST_EXPECT(to_string(b.data()) == s);
+        }
+        yield_to(
+            [&](yield_context yield)
+            {
+                multi_buffer b;
+                opcode op;
+                ws.async_write(buffer(s), yield);
+                ws.async_read(op, b, yield);
+                BEAST_EXPECT(to_string(b.data()) == s);
+            });
+        ws.close({}, ec);
+    }
+
+    void
+    testCompressionPool(endpoint_type const& ep)
+    {
+        using boost::asio::buffer;
+        using zo_pool = detail::pmd_pool<zlib::deflate_stream>;
+        using zi_pool = detail::pmd_pool<zlib::inflate_stream>;
+        permessage_deflate pmd;
+        pmd.client_enable = true;
+        pmd.client_no_context_takeover = true;
+        pmd.server_no_context_takeover = true;
+        pmd.use_pool = true;
+        error_code ec;
+        socket_type sock1{ios_};
+        socket_type sock2{ios_};
+        sock1.connect(ep, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        sock2.connect(ep, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        stream<socket_type&> ws1{sock1};
+        stream<socket_type&> ws2{sock2};
+        ws1.set_option(pmd);
+        ws2.set_option(pmd);
+        ws1.handshake("localhost", "/", ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ws2.handshake("localhost", "/", ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        auto const idle = ws1.compression_memory();
+        BEAST_EXPECT(ws2.compression_memory() == idle);
+        std::string const s(1000, '*');
+        auto const echo =
+            [&](stream<socket_type&>& ws)
+            {
+                multi_buffer b;
+                opcode op;
+                ws.write(buffer(s));
+                ws.read(op, b);
+                BEAST_EXPECT(to_string(b.data()) == s);
+            };
+        zo_pool::instance().clear();
+        zi_pool::instance().clear();
+        echo(ws1);
+        BEAST_EXPECT(ws1.compression_memory() == idle);
+        BEAST_EXPECT(zo_pool::instance().size() == 1);
+        BEAST_EXPECT(zi_pool::instance().size() == 1);
+        // the second connection reuses the same state
+        echo(ws2);
+        echo(ws1);
+        BEAST_EXPECT(ws2.compression_memory() == idle);
+        BEAST_EXPECT(zo_pool::instance().size() == 1);
+        BEAST_EXPECT(zi_pool::instance().size() == 1);
+        zo_pool::instance().clear();
+        zi_pool::instance().clear();
+    }
+
+    void
+    testCompressionStats(endpoint_type const& ep)
+    {
+        using boost::asio::buffer;
+        permessage_deflate pmd;
+        pmd.client_enable = true;
+        pmd.compress_min_size = 64;
+        pmd.compress_check = true;
+        error_code ec;
+        socket_type sock{ios_};
+        sock.connect(ep, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        stream<socket_type&> ws{sock};
+        ws.set_option(pmd);
+        ws.set_option(message_type{opcode::binary});
+        ws.handshake("localhost", "/", ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        auto const echo =
+            [&](std::string const& s)
+            {
+                multi_buffer b;
+                opcode op;
+                ws.write(buffer(s));
+                ws.read(op, b);
+                BEAST_EXPECT(to_string(b.data()) == s);
+            };
+        std::string noise;
+        std::uint32_t x = 1;
+        for(int i = 0; i < 1000; ++i)
+        {
+            x = x * 1103515245 + 12345;
+            noise.push_back(static_cast<char>(x >> 24));
+        }
+        echo("Hello");
+        echo(std::string(1000, '*'));
+        echo(noise);
+        auto const& st = ws.get_compression_stats();
+        BEAST_EXPECT(st.compressed == 1);
+        BEAST_EXPECT(st.skipped == 2);
+        BEAST_EXPECT(st.bytes_in == 1000);
+        BEAST_EXPECT(st.bytes_out > 0 && st.bytes_out < 100);
+    }
+
+    void
+    testCompressionDictionary(endpoint_type const& ep,
+        permessage_deflate pmd)
+    {
+        using boost::asio::buffer;
+        pmd.client_enable = true;
+        for(bool takeover : { true, false })
+        {
+            pmd.client_no_context_takeover = ! takeover;
+            pmd.server_no_context_takeover = ! takeover;
+            error_code ec;
+            socket_type sock{ios_};
+            sock.connect(ep, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            stream<socket_type&> ws{sock};
+            ws.set_option(pmd);
+            ws.handshake("localhost", "/", ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            auto const echo =
+                [&](std::string const& s)
+                {
+                    multi_buffer b;
+                    opcode op;
+                    ws.write(buffer(s));
+                    ws.read(op, b);
+                    BEAST_EXPECT(to_string(b.data()) == s);
+                };
+            std::string const s =
+                R"({"type":"quote","symbol":"ABC","bid":100.25,"ask":100.5})";
+            for(int i = 0; i < 3; ++i)
+                echo(s);
+            // Each message refers to the dictionary
+            auto const& st = ws.get_compression_stats();
+            BEAST_EXPECT(st.compressed == 3);
+            BEAST_EXPECT(st.bytes_out < 3 * 20);
+        }
+    }
+
+    void
+    testCompressionFrames(endpoint_type const& ep)
+    {
+        using boost::asio::buffer;
+        using boost::asio::buffer_copy;
+        using boost::asio::buffer_size;
+        std::string noise;
+        std::uint32_t x = 1;
+        for(int i = 0; i < 5000; ++i)
+        {
+            x = x * 1103515245 + 12345;
+            noise.push_back(static_cast<char>(x >> 24));
+        }
+        {
+            // Output which does not fit is sent in
+            // pieces, keeping the flush marker back.
+            zlib::deflate_stream zo;
+            zo.reset(6, 15, 8, zlib::Strategy::normal);
+            detail::deflate_buffers out;
+            out.block_size(8);
+            consuming_buffers<
+                boost::asio::const_buffers_1> cb{
+                    buffer(noise.data(), noise.size())};
+            std::string frames;
+            std::size_t count = 0;
+            for(;;)
+            {
+                error_code ec;
+                auto const done =
+                    detail::deflate(zo, out, cb, true, ec);
+                if(! BEAST_EXPECTS(! ec, ec.message()))
+                    return;
+                auto const n = done ? out.size() : out.ready();
+                BEAST_EXPECT(n > 0);
+                std::string s(n, 0);
+                buffer_copy(buffer(&s[0], n), out.data(n));
+                frames += s;
+                out.consume(n);
+                ++count;
+                if(done)
+                    break;
+            }
+            BEAST_EXPECT(count > 1);
+            BEAST_EXPECT(out.capacity() == 0);
+            {
+                // empty message after a flush
+                error_code ec;
+                consuming_buffers<
+                    boost::asio::const_buffers_1> cb{
+                        buffer(noise.data(), 0)};
+                BEAST_EXPECT(detail::deflate(
+                    zo, out, cb, true, ec));
+                BEAST_EXPECTS(! ec, ec.message());
+                BEAST_EXPECT(out.size() == 1);
+                out.consume(out.size());
+            }
+            frames += std::string("\x00\x00\xff\xff", 4);
+            zlib::inflate_stream zi;
+            std::string result(noise.size() + 1, 0);
+            zlib::z_params zs;
+            zs.next_in = frames.data();
+            zs.avail_in = frames.size();
+            zs.next_out = &result[0];
+            zs.avail_out = result.size();
+            error_code ec;
+            zi.write(zs, zlib::Flush::sync, ec);
+            BEAST_EXPECTS(! ec, ec.message());
+            result.resize(zs.total_out);
+            BEAST_EXPECT(result == noise);
+        }
+
+        permessage_deflate pmd;
+        pmd.client_enable = true;
+        error_code ec;
+        socket_type sock{ios_};
+        sock.connect(ep, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        stream<socket_type&> ws{sock};
+        ws.set_option(pmd);
+        ws.set_option(write_buffer_size{64});
+        ws.set_option(message_type{opcode::binary});
+        ws.handshake("localhost", "/", ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        auto const check =
+            [&](std::string const& s)
+            {
+                multi_buffer b;
+                opcode op;
+                ws.read(op, b);
+                BEAST_EXPECT(to_string(b.data()) == s);
+            };
+        // Each message spans many frames
+        ws.write(buffer(noise));
+        check(noise);
+        std::string const s(100000, '*');
+        ws.write(buffer(s));
+        check(s);
+        ws.write_frame(false, buffer(noise.data(), 2000));
+        ws.write_frame(true, buffer(noise.data() + 2000, 3000));
+        check(noise);
+        yield_to(
+            [&](yield_context yield)
+            {
+                multi_buffer b;
+                opcode op;
+                ws.async_write(buffer(noise), yield);
+                ws.async_read(op, b, yield);
+                BEAST_EXPECT(to_string(b.data()) == noise);
+                b.consume(b.size());
+                ws.async_write_frame(false,
+                    buffer(s.data(), 50000), yield);
+                ws.async_write_frame(true,
+                    buffer(s.data() + 50000, 50000), yield);
+                ws.async_read(op, b, yield);
+                BEAST_EXPECT(to_string(b.data()) == s);
+            });
+        ws.close({}, ec);
+    }
+
+    void
+    testReadSome(endpoint_type const& ep,
+        permessage_deflate const& pmd)
+    {
+        using boost::asio::buffer;
+        std::string s;
+        while(s.size() < 5000)
+            s += "Hello, world! " + std::to_string(s.size());
+        {
+            error_code ec;
+            socket_type sock{ios_};
+            sock.connect(ep, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            stream<socket_type&> ws{sock};
+            ws.set_option(pmd);
+            ws.handshake("localhost", "/", ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            char buf[37];
+            std::string got;
+            ws.write(buffer(s));
+            do
+            {
+                auto const n = ws.read_some(buffer(buf));
+                BEAST_EXPECT(n <= sizeof(buf));
+                got.append(buf, n);
+            }
+            while(! ws.is_message_done());
+            BEAST_EXPECT(got == s);
+            BEAST_EXPECT(ws.got_text());
+            // empty message
+            got.clear();
+            ws.set_option(message_type{opcode::binary});
+            ws.write(buffer(s.data(), 0));
+            do
+            {
+                got.append(buf, ws.read_some(buffer(buf)));
+            }
+            while(! ws.is_message_done());
+            BEAST_EXPECT(got.empty());
+            BEAST_EXPECT(! ws.got_text());
+        }
+        yield_to(
+            [&](yield_context yield)
+            {
+                error_code ec;
+                socket_type sock{ios_};
+                sock.async_connect(ep, yield[ec]);
+                if(! BEAST_EXPECTS(! ec, ec.message()))
+                    return;
+                stream<socket_type&> ws{sock};
+                ws.set_option(pmd);
+                ws.async_handshake("localhost", "/", yield[ec]);
+                if(! BEAST_EXPECTS(! ec, ec.message()))
+                    return;
+                char buf[37];
+                std::string got;
+                ws.async_write(buffer(s), yield[ec]);
+                if(! BEAST_EXPECTS(! ec, ec.message()))
+                    return;
+                do
+                {
+                    auto const n = ws.async_read_some(
+                        buffer(buf), yield[ec]);
+                    if(! BEAST_EXPECTS(! ec, ec.message()))
+                        return;
+                    got.append(buf, n);
+                }
+                while(! ws.is_message_done());
+                BEAST_EXPECT(got == s);
+            });
+    }
+
     struct abort_test
     {
     };
 
+    void
+    testKeepalive()
+    {
+        using clock_type = std::chrono::steady_clock;
+        using ms = std::chrono::milliseconds;
+
+        // Reads messages until an error occurs
+        struct reader
+        {
+            stream<socket_type>& ws;
+            std::function<void(error_code)> done;
+            boost::asio::io_service::strand* strand;
+            multi_buffer b;
+            opcode op;
+
+            reader(stream<socket_type>& ws_,
+                    std::function<void(error_code)> done_,
+                    boost::asio::io_service::strand* strand_ = nullptr)
+                : ws(ws_)
+                , done(std::move(done_))
+                , strand(strand_)
+            {
+            }
+
+            void
+            start()
+            {
+                auto f =
+                    [this](error_code ec)
+                    {
+                        if(ec)
+                            return done(ec);
+                        b.consume(b.size());
+                        start();
+                    };
+                if(strand)
+                    ws.async_read(op, b, strand->wrap(f));
+                else
+                    ws.async_read(op, b, f);
+            }
+        };
+
+        // Connect two streams over the loopback interface
+        auto const connect =
+            [&](boost::asio::io_service& ios,
+                stream<socket_type>& client,
+                stream<socket_type>& server)
+            {
+                boost::asio::ip::tcp::acceptor acceptor{ios,
+                    endpoint_type{address_type::from_string(
+                        "127.0.0.1"), 0}};
+                client.next_layer().connect(
+                    acceptor.local_endpoint());
+                acceptor.accept(server.next_layer());
+                int n = 0;
+                server.async_accept(
+                    [&](error_code ec)
+                    {
+                        BEAST_EXPECTS(! ec, ec.message());
+                        ++n;
+                    });
+                client.async_handshake("localhost", "/",
+                    [&](error_code ec)
+                    {
+                        BEAST_EXPECTS(! ec, ec.message());
+                        ++n;
+                    });
+                // the keepalive timer keeps run() from returning
+                while(n < 2)
+                    ios.run_one();
+            };
+
+        // Pings are sent while the connection is quiet
+        {
+            boost::asio::io_service ios;
+            stream<socket_type> client{ios};
+            stream<socket_type> server{ios};
+            client.set_option(keepalive{ms(100), ms(1000)});
+            connect(ios, client, server);
+            std::size_t pings = 0;
+            std::size_t pongs = 0;
+            server.set_option(ping_callback{
+                [&](bool is_pong, ping_data const&)
+                {
+                    if(! is_pong)
+                        ++pings;
+                }});
+            client.set_option(ping_callback{
+                [&](bool is_pong, ping_data const&)
+                {
+                    if(is_pong)
+                        ++pongs;
+                }});
+            reader rc{client, [](error_code){}};
+            reader rs{server, [](error_code){}};
+            rc.start();
+            rs.start();
+            boost::asio::steady_timer timer{ios};
+            timer.expires_from_now(ms(650));
+            timer.async_wait(
+                [&](error_code)
+                {
+                    error_code ec;
+                    client.next_layer().close(ec);
+                    server.next_layer().close(ec);
+                });
+            ios.run();
+            BEAST_EXPECTS(pings >= 2, std::to_string(pings));
+            BEAST_EXPECT(pongs == pings);
+        }
+
+        // Pings are sent on each stream's strand while
+        // the io_service is run from several threads
+        {
+            struct peer
+            {
+                boost::asio::io_service::strand strand;
+                stream<socket_type> ws;
+                reader r;
+
+                explicit
+                peer(boost::asio::io_service& ios)
+                    : strand(ios)
+                    , ws(ios)
+                    , r(ws, [](error_code){}, &strand)
+                {
+                }
+            };
+            struct connection
+            {
+                peer client;
+                peer server;
+
+                explicit
+                connection(boost::asio::io_service& ios)
+                    : client(ios)
+                    , server(ios)
+                {
+                }
+            };
+            boost::asio::io_service ios;
+            std::atomic<std::size_t> pings{0};
+            std::atomic<std::size_t> pongs{0};
+            std::vector<std::unique_ptr<connection>> v;
+            for(int i = 0; i < 8; ++i)
+            {
+                v.emplace_back(new connection{ios});
+                auto& p = *v.back();
+                p.client.ws.set_option(keepalive{
+                    ms(100), ms(1000), ms(0), &p.client.strand});
+                connect(ios, p.client.ws, p.server.ws);
+                p.server.ws.set_option(ping_callback{
+                    [&](bool is_pong, ping_data const&)
+                    {
+                        if(! is_pong)
+                            ++pings;
+                    }});
+                p.client.ws.set_option(ping_callback{
+                    [&](bool is_pong, ping_data const&)
+                    {
+                        if(is_pong)
+                            ++pongs;
+                    }});
+                p.client.strand.dispatch([&p]{ p.client.r.start(); });
+                p.server.strand.dispatch([&p]{ p.server.r.start(); });
+            }
+            boost::asio::steady_timer timer{ios};
+            timer.expires_from_now(ms(650));
+            timer.async_wait(
+                [&](error_code)
+                {
+                    for(auto& p : v)
+                    {
+                        auto& c = p->client;
+                        auto& s = p->server;
+                        c.strand.dispatch(
+                            [&c]
+                            {
+                                error_code ec;
+                                c.ws.next_layer().close(ec);
+                            });
+                        s.strand.dispatch(
+                            [&s]
+                            {
+                                error_code ec;
+                                s.ws.next_layer().close(ec);
+                            });
+                    }
+                });
+            std::vector<std::thread> threads;
+            for(int i = 0; i < 4; ++i)
+                threads.emplace_back([&]{ ios.run(); });
+            for(auto& t : threads)
+                t.join();
+            BEAST_EXPECTS(pings >= 2 * v.size(),
+                std::to_string(pings));
+            BEAST_EXPECT(pongs == pings);
+        }
+
+        // The connection is closed when pongs stop
+        {
+            boost::asio::io_service ios;
+            stream<socket_type> client{ios};
+            stream<socket_type> server{ios};
+            client.set_option(keepalive{ms(100), ms(200)});
+            connect(ios, client, server);
+            boost::asio::steady_timer timer{ios};
+            error_code result;
+            auto const start = clock_type::now();
+            auto elapsed = ms(0);
+            reader rc{client,
+                [&](error_code ec)
+                {
+                    result = ec;
+                    elapsed = std::chrono::duration_cast<
+                        ms>(clock_type::now() - start);
+                    timer.cancel();
+                    server.next_layer().close(ec);
+                }};
+            rc.start();
+            timer.expires_from_now(ms(5000));
+            timer.async_wait(
+                [&](error_code ec)
+                {
+                    if(ec)
+                        return;
+                    fail("pong timeout", __FILE__, __LINE__);
+                    client.next_layer().close(ec);
+                });
+            // the server does not read, so it never responds
+            ios.run();
+            BEAST_EXPECT(result);
+            BEAST_EXPECTS(elapsed >= ms(200),
+                std::to_string(elapsed.count()));
+        }
+
+        // Idle connections are closed
+        {
+            boost::asio::io_service ios;
+            stream<socket_type> client{ios};
+            stream<socket_type> server{ios};
+            client.set_option(keepalive{ms(0), ms(0), ms(200)});
+            connect(ios, client, server);
+            boost::asio::steady_timer timer{ios};
+            error_code rcec;
+            error_code rsec;
+            reader rc{client,
+                [&](error_code ec)
+                {
+                    rcec = ec;
+                    timer.cancel();
+                }};
+            reader rs{server,
+                [&](error_code ec)
+                {
+                    rsec = ec;
+                }};
+            rc.start();
+            rs.start();
+            // some traffic delays the close
+            client.async_write(
+                boost::asio::buffer("Hello", 5),
+                [](error_code){});
+            timer.expires_from_now(ms(5000));
+            timer.async_wait(
+                [&](error_code ec)
+                {
+                    if(ec)
+                        return;
+                    fail("idle timeout", __FILE__, __LINE__);
+                    client.next_layer().close(ec);
+                    server.next_layer().close(ec);
+                });
+            ios.run();
+            BEAST_EXPECTS(rcec == error::closed, rcec.message());
+            BEAST_EXPECTS(rsec == error::closed, rsec.message());
+            BEAST_EXPECT(server.reason().code ==
+                close_code::going_away);
+        }
+
+        // A ping in flight does not touch a destroyed stream
+        {
+            boost::asio::io_service ios;
+            socket_type sock{ios};
+            stream<socket_type> server{ios};
+            std::unique_ptr<stream<socket_type&>> client{
+                new stream<socket_type&>{sock}};
+            client->set_option(keepalive{ms(100)});
+            boost::asio::ip::tcp::acceptor acceptor{ios,
+                endpoint_type{address_type::from_string(
+                    "127.0.0.1"), 0}};
+            acceptor.set_option(boost::asio::socket_base::
+                receive_buffer_size(4096));
+            sock.open(boost::asio::ip::tcp::v4());
+            sock.set_option(boost::asio::socket_base::
+                send_buffer_size(4096));
+            sock.connect(acceptor.local_endpoint());
+            acceptor.accept(server.next_layer());
+            int n = 0;
+            server.async_accept(
+                [&](error_code ec)
+                {
+                    BEAST_EXPECTS(! ec, ec.message());
+                    ++n;
+                });
+            client->async_handshake("localhost", "/",
+                [&](error_code ec)
+                {
+                    BEAST_EXPECTS(! ec, ec.message());
+                    ++n;
+                });
+            while(n < 2)
+                ios.run_one();
+            // Keep the socket full, so pings can't be sent
+            sock.non_blocking(true);
+            std::string const junk(65536, '*');
+            boost::asio::steady_timer fill{ios};
+            std::function<void(error_code)> refill =
+                [&](error_code ec)
+                {
+                    if(ec)
+                        return;
+                    while(! ec)
+                        sock.write_some(
+                            boost::asio::buffer(junk), ec);
+                    fill.expires_from_now(ms(5));
+                    fill.async_wait(refill);
+                };
+            refill({});
+            boost::asio::steady_timer timer{ios};
+            timer.expires_from_now(ms(350));
+            timer.async_wait(
+                [&](error_code)
+                {
+                    fill.cancel();
+                    client.reset();
+                    error_code ec;
+                    sock.close(ec);
+                    server.next_layer().close(ec);
+                });
+            ios.run();
+            BEAST_EXPECT(! client);
+        }
+    }
+
     template<class Client>
     void
     testEndpoint(Client const& c,
@@ -1858,14 +3177,24 @@ public:
         log << "sizeof(websocket::stream) == " <<
             sizeof(websocket::stream<boost::asio::ip::tcp::socket&>) << std::endl;
 
+        // The footprint of an idle connection
+        if(sizeof(void*) == 8)
+            BEAST_EXPECTS(sizeof(websocket::stream<
+                boost::asio::ip::tcp::socket&>) <= 656,
+                    std::to_string(sizeof(websocket::stream<
+                        boost::asio::ip::tcp::socket&>)));
+
         auto const any = endpoint_type{
             address_type::from_string("127.0.0.1"), 0};
 
         testOptions();
         testAccept();
         testHandshake();
+        testUpgrade();
         testBadHandshakes();
         testBadResponses();
+        testReadAhead();
+        testKeepalive();
 
         permessage_deflate pmd;
         pmd.client_enable = false;
@@ -1885,6 +3214,11 @@ public:
             //testPausation5(ep);
             testWriteFrames(ep);
             testAsyncWriteFrame(ep);
+            testWriteQueue(ep);
+            testWriteCork(ep);
+            testWriteCorkLifetime(ep);
+            testPoolBuffers(ep);
+            testAdaptiveFragment(ep);
         }
 
         {
@@ -1946,6 +3280,42 @@ public:
         pmd.client_max_window_bits = 10;
         pmd.client_no_context_takeover = true;
         doClientTests(pmd);
+
+        {
+            error_code ec;
+            ::websocket::sync_echo_server server{nullptr};
+            pmd.client_enable = false;
+            pmd.server_enable = true;
+            pmd.client_no_context_takeover = false;
+            server.set_option(pmd);
+            server.open(any, ec);
+            BEAST_EXPECTS(! ec, ec.message());
+            testCompressionMemory(server.local_endpoint());
+            testCompressionPool(server.local_endpoint());
+            testCompressionStats(server.local_endpoint());
+            testCompressionFrames(server.local_endpoint());
+            pmd.client_enable = false;
+            testReadSome(server.local_endpoint(), pmd);
+            pmd.client_enable = true;
+            testReadSome(server.local_endpoint(), pmd);
+        }
+
+        {
+            error_code ec;
+            ::websocket::sync_echo_server server{nullptr};
+            std::string const dict =
+                R"({"type":"trade","symbol":"XYZ","price":1.0})"
+                R"({"type":"quote","symbol":"ABC","bid":100.25,"ask":100.5})";
+            pmd.client_enable = false;
+            pmd.server_enable = true;
+            pmd.dictionary = std::make_shared<
+                zlib::preset_dictionary const>(dict.data(),
+                    dict.size(), 15, pmd.memLevel);
+            server.set_option(pmd);
+            server.open(any, ec);
+            BEAST_EXPECTS(! ec, ec.message());
+            testCompressionDictionary(server.local_endpoint(), pmd);
+        }
     }
 };
 
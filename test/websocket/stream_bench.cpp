@@ -0,0 +1,442 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <beast/websocket/stream.hpp>
+#include <beast/core/multi_buffer.hpp>
+#include <beast/test/pipe_stream.hpp>
+#include <beast/test/yield_to.hpp>
+#include <beast/unit_test/suite.hpp>
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace beast {
+namespace websocket {
+
+/*  Measures websocket::stream over loopback TCP and an in-memory pipe.
+
+    Each configuration runs three phases on one connection:
+
+        echo    The client sends a message and waits for the echo,
+                giving the round trip latency of each message.
+
+        send    The client sends messages to the server, which are
+                masked.
+
+        recv    The server sends messages to the client, which are
+                not masked.
+
+    One line of comma separated values is logged for each phase,
+    following a header line starting with '#'.
+*/
+class stream_bench_test
+    : public beast::unit_test::suite
+    , public test::enable_yield_to
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+    using socket_type = boost::asio::ip::tcp::socket;
+    using endpoint_type = boost::asio::ip::tcp::endpoint;
+
+    // Bytes sent in each phase, approximately
+    static std::size_t constexpr phase_bytes = 2 * 1024 * 1024;
+
+    struct config
+    {
+        bool pipe;          // in-memory instead of loopback TCP
+        bool async;         // client uses asynchronous calls
+        std::size_t size;   // bytes in each message
+        bool text;          // text instead of binary messages
+        bool frag;          // automatic fragmentation
+        int level;          // compression level, 0 for none
+
+        // Number of messages in each phase
+        std::size_t
+        count() const
+        {
+            return (std::max)(std::size_t{64}, (std::min)(
+                std::size_t{5000}, phase_bytes / size));
+        }
+    };
+
+    struct result
+    {
+        std::size_t n = 0;
+        clock_type::duration elapsed{};
+        std::vector<clock_type::duration> latency;
+    };
+
+    struct sync_io
+    {
+        template<class Stream>
+        void
+        handshake(Stream& ws)
+        {
+            ws.handshake("localhost", "/");
+        }
+
+        template<class Stream, class ConstBufferSequence>
+        void
+        write(Stream& ws, ConstBufferSequence const& bs)
+        {
+            ws.write(bs);
+        }
+
+        template<class Stream>
+        void
+        read(Stream& ws, multi_buffer& b)
+        {
+            opcode op;
+            ws.read(op, b);
+        }
+
+        template<class Stream>
+        void
+        close(Stream& ws)
+        {
+            ws.close({});
+        }
+    };
+
+    struct async_io
+    {
+        yield_context& yield;
+
+        template<class Stream>
+        void
+        handshake(Stream& ws)
+        {
+            ws.async_handshake("localhost", "/", yield);
+        }
+
+        template<class Stream, class ConstBufferSequence>
+        void
+        write(Stream& ws, ConstBufferSequence const& bs)
+        {
+            ws.async_write(bs, yield);
+        }
+
+        template<class Stream>
+        void
+        read(Stream& ws, multi_buffer& b)
+        {
+            opcode op;
+            ws.async_read(op, b, yield);
+        }
+
+        template<class Stream>
+        void
+        close(Stream& ws)
+        {
+            ws.async_close({}, yield);
+        }
+    };
+
+    std::string payload_;
+
+    stream_bench_test()
+    {
+        // Text which compresses like typical messages
+        static char const* const words[] = {
+            "alpha", "bravo", "charlie", "delta", "echo",
+            "foxtrot", "golf", "hotel", "india", "juliet",
+            "kilo", "lima", "mike", "november", "oscar",
+            "papa", "quebec", "romeo", "sierra", "tango" };
+        std::uint32_t x = 1;
+        while(payload_.size() < 1024 * 1024)
+        {
+            x = x * 1103515245 + 12345;
+            payload_ += words[(x >> 16) % 20];
+            payload_ += (x & 0xf) == 0 ? '\n' : ' ';
+        }
+    }
+
+    template<class Stream>
+    static
+    void
+    set_options(stream<Stream>& ws, config const& c)
+    {
+        permessage_deflate pmd;
+        pmd.client_enable = c.level > 0;
+        pmd.server_enable = c.level > 0;
+        if(c.level > 0)
+            pmd.compLevel = c.level;
+        ws.set_option(pmd);
+        ws.set_option(auto_fragment{c.frag});
+        ws.set_option(message_type{
+            c.text ? opcode::text : opcode::binary});
+    }
+
+    template<class Stream>
+    void
+    serve(Stream& s, config const& c, error_code& ec)
+    {
+        using boost::asio::buffer;
+        stream<Stream&> ws{s};
+        set_options(ws, c);
+        ws.accept(ec);
+        if(ec)
+            return;
+        auto const n = c.count();
+        multi_buffer b;
+        opcode op;
+        // echo
+        for(std::size_t i = 0; i < n; ++i)
+        {
+            ws.read(op, b, ec);
+            if(ec)
+                return;
+            ws.write(b.data(), ec);
+            if(ec)
+                return;
+            b.consume(b.size());
+        }
+        // send
+        for(std::size_t i = 0; i < n; ++i)
+        {
+            ws.read(op, b, ec);
+            if(ec)
+                return;
+            b.consume(b.size());
+        }
+        ws.write(buffer(payload_.data(), 1), ec);
+        if(ec)
+            return;
+        // recv
+        for(std::size_t i = 0; i < n; ++i)
+        {
+            ws.write(buffer(payload_.data(), c.size), ec);
+            if(ec)
+                return;
+        }
+        ws.read(op, b, ec);
+        if(ec == error::closed)
+            ec = {};
+    }
+
+    template<class Stream, class IO>
+    void
+    client(Stream& s, IO io, config const& c, result (&r)[3])
+    {
+        using boost::asio::buffer;
+        stream<Stream&> ws{s};
+        set_options(ws, c);
+        io.handshake(ws);
+        auto const n = c.count();
+        auto const m = buffer(payload_.data(), c.size);
+        multi_buffer b;
+        // echo
+        r[0].latency.reserve(n);
+        auto t0 = clock_type::now();
+        for(std::size_t i = 0; i < n; ++i)
+        {
+            auto const t = clock_type::now();
+            io.write(ws, m);
+            io.read(ws, b);
+            r[0].latency.push_back(clock_type::now() - t);
+            b.consume(b.size());
+        }
+        r[0].elapsed = clock_type::now() - t0;
+        // send
+        t0 = clock_type::now();
+        for(std::size_t i = 0; i < n; ++i)
+            io.write(ws, m);
+        io.read(ws, b);
+        b.consume(b.size());
+        r[1].elapsed = clock_type::now() - t0;
+        // recv
+        t0 = clock_type::now();
+        for(std::size_t i = 0; i < n; ++i)
+        {
+            io.read(ws, b);
+            b.consume(b.size());
+        }
+        r[2].elapsed = clock_type::now() - t0;
+        for(auto& e : r)
+            e.n = n;
+        // Finish the closing handshake
+        io.close(ws);
+        try
+        {
+            for(;;)
+                io.read(ws, b);
+        }
+        catch(system_error const& e)
+        {
+            if(e.code() != error::closed)
+                throw;
+        }
+    }
+
+    template<class Stream>
+    void
+    client(Stream& s, config const& c, result (&r)[3])
+    {
+        try
+        {
+            if(! c.async)
+                return client(s, sync_io{}, c, r);
+            yield_to(
+                [&](yield_context yield)
+                {
+                    try
+                    {
+                        client(s, async_io{yield}, c, r);
+                    }
+                    catch(system_error const& e)
+                    {
+                        fail(e.what(), __FILE__, __LINE__);
+                    }
+                });
+        }
+        catch(system_error const& e)
+        {
+            fail(e.what(), __FILE__, __LINE__);
+        }
+    }
+
+    void
+    run_loopback(config const& c, result (&r)[3])
+    {
+        using namespace boost::asio;
+        io_service ios;
+        ip::tcp::acceptor acceptor{ios,
+            endpoint_type{ip::address_v4::loopback(), 0}};
+        error_code ec;
+        std::thread t{
+            [&]
+            {
+                socket_type sock{ios};
+                acceptor.accept(sock, ec);
+                if(ec)
+                    return;
+                sock.set_option(ip::tcp::no_delay{true});
+                serve(sock, c, ec);
+            }};
+        socket_type sock{ios_};
+        sock.connect(acceptor.local_endpoint());
+        sock.set_option(ip::tcp::no_delay{true});
+        client(sock, c, r);
+        // The server's teardown waits for the client
+        // to close, and so does a server left behind
+        // by a failed client.
+        error_code ignored;
+        sock.close(ignored);
+        t.join();
+        BEAST_EXPECTS(! ec, ec.message());
+    }
+
+    void
+    run_pipe(config const& c, result (&r)[3])
+    {
+        boost::asio::io_service ios;
+        test::pipe p{ios_, ios};
+        error_code ec;
+        std::thread t{
+            [&]
+            {
+                serve(p.server, c, ec);
+            }};
+        client(p.client, c, r);
+        p.client.close();
+        t.join();
+        BEAST_EXPECTS(! ec, ec.message());
+    }
+
+    static
+    double
+    percentile(std::vector<clock_type::duration>& v, double q)
+    {
+        using namespace std::chrono;
+        if(v.empty())
+            return 0;
+        std::sort(v.begin(), v.end());
+        auto const i = (std::min)(v.size() - 1,
+            static_cast<std::size_t>(q * v.size()));
+        return duration_cast<duration<double,
+            std::micro>>(v[i]).count();
+    }
+
+    void
+    report(config const& c, char const* phase,
+        char const* masked, result& r)
+    {
+        using namespace std::chrono;
+        auto const secs = (std::max)(1e-9, duration_cast<
+            duration<double>>(r.elapsed).count());
+        log <<
+            "websocket-bench," <<
+            (c.pipe ? "pipe" : "loopback") << "," <<
+            (c.async ? "async" : "sync") << "," <<
+            phase << "," <<
+            masked << "," <<
+            c.size << "," <<
+            (c.text ? "text" : "binary") << "," <<
+            (c.frag ? "on" : "off") << "," <<
+            c.level << "," <<
+            r.n << "," <<
+            static_cast<std::uint64_t>(r.n / secs) << "," <<
+            static_cast<std::uint64_t>(r.n * c.size / secs) << "," <<
+            percentile(r.latency, 0.50) << "," <<
+            percentile(r.latency, 0.99) << std::endl;
+    }
+
+    void
+    bench(config const& c)
+    {
+        result r[3];
+        if(c.pipe)
+            run_pipe(c, r);
+        else
+            run_loopback(c, r);
+        report(c, "echo", "both", r[0]);
+        report(c, "send", "yes", r[1]);
+        report(c, "recv", "no", r[2]);
+    }
+
+    void
+    testBench()
+    {
+        log <<
+            "#bench,transport,api,phase,masked,size,type,"
+            "fragment,deflate,messages,messages_per_sec,"
+            "bytes_per_sec,p50_us,p99_us" << std::endl;
+        static std::size_t constexpr sizes[] = {
+            16, 1024, 16384, 131072 };
+        for(auto const pipe : { false, true })
+        {
+            for(auto const size : sizes)
+            {
+                //          pipe  async  size  text   frag   level
+                bench(config{pipe, false, size, false, false, 0});
+                bench(config{pipe, true,  size, false, false, 0});
+                bench(config{pipe, false, size, true,  false, 0});
+                bench(config{pipe, false, size, false, true,  0});
+                bench(config{pipe, false, size, false, false, 1});
+                bench(config{pipe, false, size, false, false, 6});
+                bench(config{pipe, false, size, false, false, 9});
+            }
+        }
+        pass();
+    }
+
+    void
+    run() override
+    {
+        testBench();
+    }
+};
+
+BEAST_DEFINE_TESTSUITE(stream_bench,websocket,beast);
+
+} // websocket
+} // beast
@@ -0,0 +1,256 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Test that header file is self-contained.
+#include <beast/zlib/compress.hpp>
+
+#include "ztest.hpp"
+#include <beast/core/flat_buffer.hpp>
+#include <beast/core/multi_buffer.hpp>
+#include <beast/core/static_buffer.hpp>
+#include <beast/unit_test/suite.hpp>
+#include <chrono>
+
+namespace beast {
+namespace zlib {
+
+class compress_test : public beast::unit_test::suite
+{
+public:
+    template<class DynamicBuffer>
+    static
+    std::string
+    to_string(DynamicBuffer const& b)
+    {
+        std::string s;
+        s.resize(boost::asio::buffer_size(b.data()));
+        boost::asio::buffer_copy(
+            boost::asio::buffer(&s[0], s.size()), b.data());
+        return s;
+    }
+
+    void
+    testRoundTrip()
+    {
+        using boost::asio::buffer;
+        auto const big = corpus3(300000);
+        for(std::size_t size : { 0, 1, 100, 1000, 5000, 70000, 300000 })
+        {
+            auto const s = big.substr(0, size);
+            for(int level : { -1, 0, 1, 6, 9 })
+            {
+                error_code ec;
+                flat_buffer fb;
+                fb.commit(boost::asio::buffer_copy(
+                    fb.prepare(3), buffer("abc", 3)));
+                compress(buffer(s), fb, level, ec);
+                if(! BEAST_EXPECTS(! ec, ec.message()))
+                    continue;
+                auto const z = to_string(fb).substr(3);
+                BEAST_EXPECT(z_inflator{}(z) == s);
+
+                // Caller provided output
+                std::string z2(deflate_upper_bound(size), 0);
+                z2.resize(compress(buffer(s),
+                    buffer(&z2[0], z2.size()), level, ec));
+                BEAST_EXPECTS(! ec, ec.message());
+                BEAST_EXPECT(z2 == z);
+
+                // Into pieces of a multi_buffer
+                multi_buffer mb{100};
+                compress(buffer(s), mb, level, ec);
+                BEAST_EXPECTS(! ec, ec.message());
+                BEAST_EXPECT(to_string(mb) == z);
+
+                // Decompress both ways
+                flat_buffer out;
+                decompress(buffer(z), out, ec);
+                BEAST_EXPECTS(! ec, ec.message());
+                BEAST_EXPECT(to_string(out) == s);
+                multi_buffer mout{1000};
+                decompress(buffer(z), mout, ec);
+                BEAST_EXPECTS(! ec, ec.message());
+                BEAST_EXPECT(to_string(mout) == s);
+                std::string s2(size + 1, 0);
+                s2.resize(decompress(buffer(z),
+                    buffer(&s2[0], s2.size()), ec));
+                BEAST_EXPECTS(! ec, ec.message());
+                BEAST_EXPECT(s2 == s);
+            }
+        }
+    }
+
+    void
+    testErrors()
+    {
+        using boost::asio::buffer;
+        auto const s = corpus3(10000);
+        std::string z;
+        {
+            flat_buffer b;
+            error_code ec;
+            compress(buffer(s), b, 6, ec);
+            z = to_string(b);
+        }
+        error_code ec;
+
+        // Output too small
+        char small[100];
+        BEAST_EXPECT(compress(buffer(s),
+            buffer(small), 6, ec) == 0);
+        BEAST_EXPECTS(ec == error::need_buffers, ec.message());
+        BEAST_EXPECT(decompress(buffer(z),
+            buffer(small), ec) == 0);
+        BEAST_EXPECTS(ec == error::need_buffers, ec.message());
+        {
+            static_buffer_n<100> b;
+            decompress(buffer(z), b, ec);
+            BEAST_EXPECTS(ec == error::need_buffers, ec.message());
+        }
+
+        // Input ends early
+        auto const part = z.substr(0, z.size() / 2);
+        std::string out(s.size(), 0);
+        BEAST_EXPECT(decompress(buffer(part),
+            buffer(&out[0], out.size()), ec) == 0);
+        BEAST_EXPECTS(ec == error::need_buffers, ec.message());
+        {
+            flat_buffer b;
+            decompress(buffer(part), b, ec);
+            BEAST_EXPECTS(ec == error::need_buffers, ec.message());
+        }
+
+        // Invalid input
+        z[0] = '\xff';
+        BEAST_EXPECT(decompress(buffer(z),
+            buffer(&out[0], out.size()), ec) == 0);
+        BEAST_EXPECTS(ec == error::invalid_block_type, ec.message());
+
+        // Invalid level
+        try
+        {
+            flat_buffer b;
+            compress(buffer(s), b, 10, ec);
+            fail("", __FILE__, __LINE__);
+        }
+        catch(std::invalid_argument const&)
+        {
+            pass();
+        }
+    }
+
+    void
+    testSpeed()
+    {
+        using boost::asio::buffer;
+        using namespace std::chrono;
+        using clock_type = steady_clock;
+        auto const corpus = corpus3(1024 * 1024);
+        for(std::size_t size : { 64, 512, 4096, 65536 })
+        {
+            auto const count = 16 * 1024 * 1024 / size;
+            std::vector<std::string> v;
+            for(std::size_t i = 0; i < 32; ++i)
+                v.push_back(corpus.substr(i * size % (
+                    corpus.size() - size), size));
+            auto const report =
+                [&](char const* label, clock_type::time_point t0,
+                    std::size_t bytes)
+                {
+                    auto const elapsed = duration_cast<
+                        duration<double>>(clock_type::now() - t0).count();
+                    log <<
+                        size << " bytes, " << label << ": " <<
+                        static_cast<std::size_t>(count * size /
+                            (elapsed * 1024 * 1024)) << " MB/s, " <<
+                        bytes / count << " bytes" << std::endl;
+                };
+            std::vector<std::string> z(v.size());
+            {
+                // Streaming, with one stream reset for each message
+                deflate_stream ds;
+                std::string out(ds.upper_bound(size), 0);
+                std::size_t bytes = 0;
+                auto const t0 = clock_type::now();
+                for(std::size_t i = 0; i < count; ++i)
+                {
+                    auto const& s = v[i % v.size()];
+                    ds.reset();
+                    z_params zs;
+                    zs.next_in = s.data();
+                    zs.avail_in = s.size();
+                    zs.next_out = &out[0];
+                    zs.avail_out = out.size();
+                    error_code ec;
+                    ds.write(zs, Flush::finish, ec);
+                    bytes += zs.total_out;
+                }
+                report("deflate_stream", t0, bytes);
+            }
+            {
+                std::string out(deflate_upper_bound(size), 0);
+                std::size_t bytes = 0;
+                auto const t0 = clock_type::now();
+                for(std::size_t i = 0; i < count; ++i)
+                {
+                    error_code ec;
+                    auto const n = compress(buffer(v[i % v.size()]),
+                        buffer(&out[0], out.size()), 6, ec);
+                    if(i < v.size())
+                        z[i] = out.substr(0, n);
+                    bytes += n;
+                }
+                report("compress", t0, bytes);
+            }
+            {
+                // Streaming, with one stream reset for each message
+                inflate_stream is;
+                std::string out(size, 0);
+                auto const t0 = clock_type::now();
+                for(std::size_t i = 0; i < count; ++i)
+                {
+                    auto const& s = z[i % z.size()];
+                    is.reset();
+                    z_params zs;
+                    zs.next_in = s.data();
+                    zs.avail_in = s.size();
+                    zs.next_out = &out[0];
+                    zs.avail_out = out.size();
+                    error_code ec;
+                    is.write(zs, Flush::sync, ec);
+                }
+                report("inflate_stream", t0, count * size);
+                BEAST_EXPECT(out == v[(count - 1) % v.size()]);
+            }
+            {
+                std::string out(size, 0);
+                auto const t0 = clock_type::now();
+                for(std::size_t i = 0; i < count; ++i)
+                {
+                    error_code ec;
+                    decompress(buffer(z[i % z.size()]),
+                        buffer(&out[0], out.size()), ec);
+                }
+                report("decompress", t0, count * size);
+                BEAST_EXPECT(out == v[(count - 1) % v.size()]);
+            }
+        }
+    }
+
+    void
+    run() override
+    {
+        testRoundTrip();
+        testErrors();
+        testSpeed();
+    }
+};
+
+BEAST_DEFINE_TESTSUITE(compress,zlib,beast);
+
+} // zlib
+} // beast
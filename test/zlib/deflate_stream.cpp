@@ -10,6 +10,9 @@
 
 #include "ztest.hpp"
 #include <beast/unit_test/suite.hpp>
+#include <algorithm>
+#include <functional>
+#include <random>
 
 namespace beast {
 namespace zlib {
@@ -319,6 +322,596 @@ public:
         }
     }
 
+    void
+    testAllocated()
+    {
+        std::string const s = "Hello, world!";
+        std::string out;
+        deflate_stream ds;
+        BEAST_EXPECT(ds.allocated() == 0);
+        out.resize(ds.upper_bound(s.size()));
+        z_params zs;
+        zs.next_in = s.data();
+        zs.avail_in = s.size();
+        zs.next_out = &out[0];
+        zs.avail_out = out.size();
+        error_code ec;
+        ds.write(zs, Flush::full, ec);
+        BEAST_EXPECTS(! ec, ec.message());
+        BEAST_EXPECT(ds.allocated() > 0);
+        ds.reset();
+        BEAST_EXPECT(ds.allocated() > 0);
+        ds.clear();
+        BEAST_EXPECT(ds.allocated() == 0);
+    }
+
+    void
+    testLean()
+    {
+        auto const s = corpus3(20000);
+
+        // Footprint is exact
+        for(int windowBits : { 9, 10, 12, 15 })
+        {
+            for(int memLevel : { 1, 2, 3, 4, 8, 9 })
+            {
+                deflate_stream ds;
+                ds.reset(6, windowBits, memLevel, Strategy::normal);
+                std::string out(ds.upper_bound(s.size()), 0);
+                z_params zs;
+                zs.next_in = s.data();
+                zs.avail_in = s.size();
+                zs.next_out = &out[0];
+                zs.avail_out = out.size();
+                error_code ec;
+                ds.write(zs, Flush::sync, ec);
+                BEAST_EXPECTS(! ec, ec.message());
+                BEAST_EXPECT(ds.allocated() ==
+                    deflate_memory(windowBits, memLevel));
+                out.resize(zs.total_out);
+                BEAST_EXPECT(z_inflator{}(out) == s);
+            }
+        }
+        BEAST_EXPECT(deflate_memory(15, 8) == 256 * 1024);
+        BEAST_EXPECT(deflate_memory(9, 1) == 3 * 1024);
+        BEAST_EXPECT(deflate_memory(8, 1) == deflate_memory(9, 1));
+
+        // Pending buffer given back between messages
+        for(int memLevel : { 1, 4, 8 })
+        {
+            deflate_stream ds;
+            ds.reset(6, 12, memLevel, Strategy::normal);
+            ds.pool_pending(true);
+            auto const pool = beast::detail::buffer_pool::instance().size();
+            auto const held =
+                deflate_memory(12, memLevel) - (1 << (memLevel + 8));
+            std::string in;
+            std::string out;
+            for(std::size_t i = 0; i < 8; ++i)
+            {
+                auto const m = s.substr(i * 1000, 500 + i * 300);
+                in += m;
+                std::string z(ds.upper_bound(m.size()), 0);
+                z_params zs;
+                zs.next_in = m.data();
+                zs.avail_in = m.size();
+                zs.next_out = &z[0];
+                // Ask for the output in two steps
+                zs.avail_out = 3;
+                error_code ec;
+                ds.write(zs, Flush::sync, ec);
+                BEAST_EXPECTS(! ec, ec.message());
+                BEAST_EXPECT(ds.allocated() ==
+                    deflate_memory(12, memLevel));
+                zs.avail_out = z.size() - zs.total_out;
+                ds.write(zs, Flush::sync, ec);
+                BEAST_EXPECTS(! ec, ec.message());
+                BEAST_EXPECT(ds.allocated() == held);
+                BEAST_EXPECT(beast::detail::buffer_pool::instance(
+                    ).size() == pool + 1);
+                z.resize(zs.total_out);
+                out += z;
+            }
+            // Messages still refer to earlier ones
+            BEAST_EXPECT(out.size() < in.size() / 2);
+            BEAST_EXPECT(z_inflator{}(out) == in);
+            ds.pool_pending(false);
+            ds.clear();
+            BEAST_EXPECT(ds.allocated() == 0);
+        }
+    }
+
+    void
+    testFixed()
+    {
+        // Only the static trees are used, which
+        // are sized without building the others.
+        for(std::size_t n : { 1, 100, 5000, 70000 })
+        {
+            auto const s = corpus3(n);
+            for(int level : { 1, 6, 9 })
+            {
+                for(int memLevel : { 1, 8 })
+                {
+                    deflate_stream ds;
+                    ds.reset(level, 15, memLevel, Strategy::fixed);
+                    std::string out(ds.upper_bound(n), 0);
+                    z_params zs;
+                    zs.next_in = s.data();
+                    zs.avail_in = s.size();
+                    zs.next_out = &out[0];
+                    zs.avail_out = out.size();
+                    error_code ec;
+                    ds.write(zs, Flush::full, ec);
+                    BEAST_EXPECTS(! ec, ec.message());
+                    out.resize(zs.total_out);
+                    // BTYPE of the first block
+                    BEAST_EXPECT(((out[0] >> 1) & 3) == 1);
+                    BEAST_EXPECT(z_inflator{}(out) == s);
+                }
+            }
+        }
+
+        // Bytes which take 9 bits in the static trees are
+        // stored, while zlib sends a larger static block
+        // since dynamic trees would compress them.
+        {
+            std::string s;
+            std::mt19937 g;
+            std::uniform_int_distribution<int> d{144, 255};
+            while(s.size() < 5000)
+                s.push_back(static_cast<char>(d(g)));
+            for(int level : { 1, 6, 9 })
+            {
+                deflate_stream ds;
+                ds.reset(level, 15, 8, Strategy::fixed);
+                std::string out(ds.upper_bound(s.size()), 0);
+                z_params zs;
+                zs.next_in = s.data();
+                zs.avail_in = s.size();
+                zs.next_out = &out[0];
+                zs.avail_out = out.size();
+                error_code ec;
+                ds.write(zs, Flush::full, ec);
+                BEAST_EXPECTS(! ec, ec.message());
+                out.resize(zs.total_out);
+                BEAST_EXPECT(((out[0] >> 1) & 3) == 0);
+                BEAST_EXPECT(z_inflator{}(out) == s);
+
+                // deflateBound does not cover a static block
+                // larger than the input, so z_deflator can't
+                // be used here.
+                ::z_stream zz;
+                std::memset(&zz, 0, sizeof(zz));
+                deflateInit2(&zz, level, Z_DEFLATED,
+                    -15, 8, Z_FIXED);
+                std::string z(2 * s.size(), 0);
+                zz.next_in = (Bytef*)s.data();
+                zz.avail_in = static_cast<uInt>(s.size());
+                zz.next_out = (Bytef*)&z[0];
+                zz.avail_out = static_cast<uInt>(z.size());
+                BEAST_EXPECT(deflate(&zz, Z_FULL_FLUSH) == Z_OK);
+                BEAST_EXPECT(zz.avail_in == 0);
+                z.resize(zz.total_out);
+                deflateEnd(&zz);
+                BEAST_EXPECT(((z[0] >> 1) & 3) == 1);
+                BEAST_EXPECT(out.size() < z.size());
+            }
+        }
+    }
+
+    void
+    testSlide()
+    {
+        // The window slides many times while the input
+        // arrives in pieces, and the hash chains are
+        // rebased each time.
+        auto const s = corpus1(200000) + corpus3(200000);
+        for(int windowBits : { 9, 12, 15 })
+        {
+            for(int level : { 1, 6, 9 })
+            {
+                for(auto strategy : { Strategy::normal, Strategy::rle })
+                {
+                    deflate_stream ds;
+                    ds.reset(level, windowBits, 8, strategy);
+                    std::string out(ds.upper_bound(s.size()), 0);
+                    z_params zs;
+                    zs.next_out = &out[0];
+                    zs.avail_out = out.size();
+                    error_code ec;
+                    for(std::size_t pos = 0; pos < s.size();)
+                    {
+                        auto const n = (std::min)(
+                            std::size_t{3000}, s.size() - pos);
+                        zs.next_in = s.data() + pos;
+                        zs.avail_in = n;
+                        pos += n;
+                        ds.write(zs, pos < s.size() ?
+                            Flush::none : Flush::finish, ec);
+                        if(ec)
+                            break;
+                    }
+                    BEAST_EXPECTS(ec == error::end_of_stream,
+                        ec.message());
+                    out.resize(zs.total_out);
+                    BEAST_EXPECT(z_inflator{}(out) == s);
+                }
+            }
+        }
+    }
+
+    // Decompress with zlib, which is given the
+    // dictionary first, or when it asks for it.
+    static
+    std::string
+    zinflate(std::string const& in, int windowBits,
+        std::string const& dict)
+    {
+        ::z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        inflateInit2(&zs, windowBits);
+        if(windowBits < 0)
+            inflateSetDictionary(&zs,
+                reinterpret_cast<Bytef const*>(dict.data()),
+                static_cast<uInt>(dict.size()));
+        std::string out(1 << 20, 0);
+        zs.next_in = (Bytef*)in.data();
+        zs.avail_in = static_cast<uInt>(in.size());
+        zs.next_out = (Bytef*)&out[0];
+        zs.avail_out = static_cast<uInt>(out.size());
+        auto result = inflate(&zs, Z_SYNC_FLUSH);
+        if(result == Z_NEED_DICT)
+        {
+            inflateSetDictionary(&zs,
+                reinterpret_cast<Bytef const*>(dict.data()),
+                static_cast<uInt>(dict.size()));
+            inflate(&zs, Z_SYNC_FLUSH);
+        }
+        out.resize(zs.total_out);
+        inflateEnd(&zs);
+        return out;
+    }
+
+    void
+    testDictionary()
+    {
+        auto const dict = corpus3(3000);
+        auto const s = corpus3(5000).substr(2000);
+
+        // Compress `s` after setting the dictionary with `f`
+        auto const compress =
+            [&](int windowBits, int memLevel, Wrap wrap,
+                std::function<void(deflate_stream&, error_code&)> f)
+            {
+                deflate_stream ds;
+                ds.reset(6, windowBits, memLevel,
+                    Strategy::normal, wrap);
+                error_code ec;
+                f(ds, ec);
+                if(! BEAST_EXPECTS(! ec, ec.message()))
+                    return std::string{};
+                std::string out(ds.upper_bound(s.size()), 0);
+                z_params zs;
+                zs.next_in = s.data();
+                zs.avail_in = s.size();
+                zs.next_out = &out[0];
+                zs.avail_out = out.size();
+                ds.write(zs, Flush::finish, ec);
+                BEAST_EXPECTS(ec == error::end_of_stream,
+                    ec.message());
+                out.resize(zs.total_out);
+                return out;
+            };
+        auto const bytes =
+            [&](deflate_stream& ds, error_code& ec)
+            {
+                ds.dictionary(dict.data(), dict.size(), ec);
+            };
+
+        preset_dictionary const preset{
+            dict.data(), dict.size(), 15, 4};
+        BEAST_EXPECT(preset.size() == dict.size());
+        BEAST_EXPECT(preset.id() == adler32(1,
+            reinterpret_cast<Bytef const*>(dict.data()),
+            static_cast<uInt>(dict.size())));
+        auto const from_preset =
+            [&](deflate_stream& ds, error_code& ec)
+            {
+                ds.dictionary(preset, ec);
+            };
+
+        for(Wrap wrap : { Wrap::none, Wrap::zlib })
+        {
+            auto const windowBits = wrap == Wrap::none ? -15 : 15;
+            auto const z = compress(15, 4, wrap, bytes);
+            BEAST_EXPECT(z.size() < compress(15, 4, wrap,
+                [](deflate_stream&, error_code&){}).size());
+            BEAST_EXPECT(zinflate(z, windowBits, dict) == s);
+
+            // The preset gives the same output,
+            // with or without its prepared tables.
+            BEAST_EXPECT(compress(15, 4, wrap, from_preset) == z);
+            BEAST_EXPECT(compress(15, 8, wrap, from_preset) ==
+                compress(15, 8, wrap, bytes));
+            BEAST_EXPECT(compress(10, 4, wrap, from_preset) ==
+                compress(10, 4, wrap, bytes));
+        }
+
+        // Larger than the window
+        {
+            auto const big = corpus3(100000);
+            deflate_stream ds;
+            ds.reset(6, 12, 4, Strategy::normal);
+            error_code ec;
+            ds.dictionary(big.data(), big.size(), ec);
+            BEAST_EXPECTS(! ec, ec.message());
+            preset_dictionary const p{big.data(), big.size(), 12, 4};
+            deflate_stream ds2;
+            ds2.reset(6, 12, 4, Strategy::normal);
+            ds2.dictionary(p, ec);
+            BEAST_EXPECTS(! ec, ec.message());
+            std::string out1(ds.upper_bound(s.size()), 0);
+            std::string out2(out1.size(), 0);
+            z_params zs1;
+            zs1.next_in = s.data();
+            zs1.avail_in = s.size();
+            zs1.next_out = &out1[0];
+            zs1.avail_out = out1.size();
+            z_params zs2 = zs1;
+            zs2.next_out = &out2[0];
+            ds.write(zs1, Flush::finish, ec);
+            ds2.write(zs2, Flush::finish, ec);
+            out1.resize(zs1.total_out);
+            out2.resize(zs2.total_out);
+            BEAST_EXPECT(out1 == out2);
+            BEAST_EXPECT(zinflate(out1, -12,
+                big.substr(big.size() - 4096)) == s);
+        }
+
+        // Not allowed
+        {
+            deflate_stream ds;
+            ds.reset(6, 15, 8, Strategy::normal, Wrap::gzip);
+            error_code ec;
+            ds.dictionary(dict.data(), dict.size(), ec);
+            BEAST_EXPECTS(ec == error::stream_error, ec.message());
+            ds.reset(6, 15, 8, Strategy::normal, Wrap::zlib);
+            ec = {};
+            std::string out(100, 0);
+            z_params zs;
+            zs.next_in = s.data();
+            zs.avail_in = 10;
+            zs.next_out = &out[0];
+            zs.avail_out = out.size();
+            ds.write(zs, Flush::none, ec);
+            BEAST_EXPECTS(! ec, ec.message());
+            ds.dictionary(preset, ec);
+            BEAST_EXPECTS(ec == error::stream_error, ec.message());
+        }
+    }
+
+    // Compress `in` repeatedly at the given level
+    template<class F>
+    void
+    timeDeflate(std::string const& label,
+        std::string const& in, int level, F const& f)
+    {
+        using namespace std::chrono;
+        using clock_type = steady_clock;
+        std::size_t constexpr repeat = 5;
+        std::string out;
+        auto const t0 = clock_type::now();
+        for(std::size_t i = 0; i < repeat; ++i)
+            f(in, out, level);
+        auto const elapsed = duration_cast<
+            duration<double>>(clock_type::now() - t0).count();
+        BEAST_EXPECT(z_inflator{}(out) == in);
+        log <<
+            label << ", level " << level << ": " <<
+            static_cast<std::size_t>(repeat * in.size() /
+                (elapsed * 1024 * 1024)) << " MB/s, " <<
+            out.size() << " bytes" << std::endl;
+    }
+
+    void
+    testChecksums()
+    {
+        // Random lengths and alignments, across the
+        // vector and table sizes and the Adler-32 chunk.
+        auto const in = corpus2(20000);
+        std::mt19937 g;
+        for(int i = 0; i < 500; ++i)
+        {
+            auto const off = g() % 64;
+            auto const n = i < 300 ? i : g() % (in.size() - off);
+            auto const p = reinterpret_cast<
+                Bytef const*>(in.data()) + off;
+            auto const crc = ::crc32(0, p, static_cast<uInt>(n));
+            auto const adler = ::adler32(1, p, static_cast<uInt>(n));
+            BEAST_EXPECT(detail::crc32(0, p, n) == crc);
+            BEAST_EXPECT(detail::adler32(1, p, n) == adler);
+            // In two pieces
+            auto const m = n / 3;
+            BEAST_EXPECT(detail::crc32(detail::crc32(
+                0, p, m), p + m, n - m) == crc);
+            BEAST_EXPECT(detail::adler32(detail::adler32(
+                1, p, m), p + m, n - m) == adler);
+            // Combined from the checksums of the pieces
+            BEAST_EXPECT(detail::crc32_combine(
+                detail::crc32(0, p, m),
+                detail::crc32(0, p + m, n - m), n - m) == crc);
+            BEAST_EXPECT(detail::adler32_combine(
+                detail::adler32(1, p, m),
+                detail::adler32(1, p + m, n - m), n - m) == adler);
+        }
+        // Lengths too large to checksum here
+        for(std::size_t n : { 65520, 65521, 65522, 1 << 30 })
+        {
+            BEAST_EXPECT(detail::crc32_combine(
+                0x12345678, 0x9abcdef0, n) == ::crc32_combine(
+                    0x12345678, 0x9abcdef0, static_cast<z_off_t>(n)));
+            BEAST_EXPECT(detail::adler32_combine(
+                0x12345678, 0x0abcdef0, n) == ::adler32_combine(
+                    0x12345678, 0x0abcdef0, static_cast<z_off_t>(n)));
+        }
+        // Sums which need the most reduction
+        std::string const ff(100000, '\xff');
+        BEAST_EXPECT(detail::adler32(1, ff.data(), ff.size()) ==
+            ::adler32(1, reinterpret_cast<Bytef const*>(ff.data()),
+                static_cast<uInt>(ff.size())));
+    }
+
+    // Compress with deflate_stream using a wrapper,
+    // with output space for at most `chunk` bytes
+    // at a time, then decompress with zlib.
+    void
+    doWrap(Wrap wrap, int windowBits, int level,
+        std::string const& in, std::size_t chunk)
+    {
+        deflate_stream ds;
+        ds.reset(level, 15, 8, Strategy::normal, wrap);
+        std::string out(ds.upper_bound(in.size()), 0);
+        BEAST_EXPECT(out.size() >= in.size());
+        z_params zs;
+        zs.next_in = in.data();
+        zs.avail_in = in.size();
+        for(;;)
+        {
+            zs.next_out = &out[zs.total_out];
+            zs.avail_out = (std::min)(
+                chunk, out.size() - zs.total_out);
+            error_code ec;
+            ds.write(zs, Flush::finish, ec);
+            if(ec == error::end_of_stream)
+                break;
+            if(! BEAST_EXPECTS(! ec || (ec == error::need_buffers &&
+                zs.avail_out == 0), ec.message()))
+                return;
+            if(! BEAST_EXPECT(zs.total_out < out.size()))
+                return;
+        }
+        out.resize(zs.total_out);
+
+        ::z_stream z;
+        std::memset(&z, 0, sizeof(z));
+        if(! BEAST_EXPECT(inflateInit2(&z, windowBits) == Z_OK))
+            return;
+        std::string s(in.size() + 1, 0);
+        z.next_in = (Bytef*)&out[0];
+        z.avail_in = static_cast<uInt>(out.size());
+        z.next_out = (Bytef*)&s[0];
+        z.avail_out = static_cast<uInt>(s.size());
+        BEAST_EXPECT(inflate(&z, Z_FINISH) == Z_STREAM_END);
+        BEAST_EXPECT(z.avail_in == 0);
+        s.resize(z.total_out);
+        BEAST_EXPECT(s == in);
+        inflateEnd(&z);
+    }
+
+    void
+    testWrap()
+    {
+        for(auto const& in : { std::string{}, corpus1(1),
+            corpus3(100000), corpus2(70000) })
+        {
+            for(int level : { 0, 1, 6, 9 })
+            {
+                doWrap(Wrap::zlib, 15, level, in, 1 << 30);
+                doWrap(Wrap::zlib, 47, level, in, 1 << 30);
+                doWrap(Wrap::gzip, 31, level, in, 1 << 30);
+                doWrap(Wrap::gzip, 47, level, in, 1 << 30);
+            }
+            doWrap(Wrap::zlib, 15, 6, in, 1);
+            doWrap(Wrap::gzip, 31, 6, in, 3);
+        }
+
+        // The wrapper is kept by a reset without settings
+        {
+            deflate_stream ds;
+            ds.reset(6, 15, 8, Strategy::normal, Wrap::gzip);
+            for(int i = 0; i < 2; ++i)
+            {
+                ds.reset();
+                std::string out(64, 0);
+                z_params zs;
+                zs.next_in = "abc";
+                zs.avail_in = 3;
+                zs.next_out = &out[0];
+                zs.avail_out = out.size();
+                error_code ec;
+                ds.write(zs, Flush::finish, ec);
+                BEAST_EXPECT(ec == error::end_of_stream);
+                BEAST_EXPECT(zs.total_out == 10 + 5 + 8);
+                BEAST_EXPECT(out.substr(0, 2) == "\x1f\x8b");
+            }
+        }
+
+        try
+        {
+            deflate_stream ds;
+            ds.reset(6, 15, 8, Strategy::normal, Wrap::automatic);
+            fail("", __FILE__, __LINE__);
+        }
+        catch(std::invalid_argument const&)
+        {
+            pass();
+        }
+    }
+
+    void
+    testSpeed()
+    {
+        auto const beast =
+            [](std::string const& in,
+                std::string& out, int level)
+            {
+                deflate_stream ds;
+                ds.reset(level, 15, 8, Strategy::normal);
+                out.resize(ds.upper_bound(in.size()));
+                z_params zs;
+                zs.next_in = in.data();
+                zs.avail_in = in.size();
+                zs.next_out = &out[0];
+                zs.avail_out = out.size();
+                error_code ec;
+                ds.write(zs, Flush::full, ec);
+                out.resize(zs.total_out);
+            };
+        auto const zlib =
+            [](std::string const& in,
+                std::string& out, int level)
+            {
+                ::z_stream zs;
+                memset(&zs, 0, sizeof(zs));
+                deflateInit2(&zs, level, Z_DEFLATED,
+                    -15, 8, Z_DEFAULT_STRATEGY);
+                out.resize(deflateBound(&zs,
+                    static_cast<uLong>(in.size())));
+                zs.next_in = (Bytef*)in.data();
+                zs.avail_in = static_cast<uInt>(in.size());
+                zs.next_out = (Bytef*)&out[0];
+                zs.avail_out = static_cast<uInt>(out.size());
+                deflate(&zs, Z_FULL_FLUSH);
+                out.resize(zs.total_out);
+                deflateEnd(&zs);
+            };
+        std::size_t constexpr size = 1024 * 1024;
+        std::pair<char const*, std::string> const corpus[] = {
+            { "repeats", corpus1(size) },
+            { "json",    corpus3(size) },
+            { "random",  corpus2(size) } };
+        for(auto const& c : corpus)
+        {
+            for(int level : { 1, 4, 6, 9 })
+            {
+                auto const label = std::string(c.first);
+                timeDeflate(label + ", beast", c.second, level, beast);
+                timeDeflate(label + ", zlib ", c.second, level, zlib);
+            }
+        }
+    }
+
     void
     run() override
     {
@@ -327,6 +920,14 @@ public:
             sizeof(deflate_stream) << std::endl;
 
         testDeflate();
+        testAllocated();
+        testLean();
+        testFixed();
+        testSlide();
+        testDictionary();
+        testChecksums();
+        testWrap();
+        testSpeed();
     }
 };
 
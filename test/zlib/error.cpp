@@ -51,6 +51,16 @@ public:
         check("zlib", error::over_subscribed_length);
         check("zlib", error::incomplete_length_set);
 
+        check("zlib", error::incorrect_header_check);
+        check("zlib", error::unknown_compression_method);
+        check("zlib", error::invalid_window_size);
+        check("zlib", error::unknown_header_flags);
+        check("zlib", error::header_crc_mismatch);
+        check("zlib", error::incorrect_data_check);
+        check("zlib", error::incorrect_length_check);
+        check("zlib", error::need_dictionary);
+        check("zlib", error::incorrect_dictionary);
+
         check("zlib", error::general);
     }
 };
@@ -396,6 +396,580 @@ public:
 #endif
     }
 
+    // Decompress `in` repeatedly, producing
+    // output in pieces of size `chunk`.
+    template<class F>
+    void
+    timeInflate(std::string const& label, std::string const& in,
+        std::string const& check, std::size_t chunk, F const& f)
+    {
+        using namespace std::chrono;
+        using clock_type = steady_clock;
+        std::size_t constexpr repeat = 20;
+        std::string out(check.size(), 0);
+        auto const t0 = clock_type::now();
+        for(std::size_t i = 0; i < repeat; ++i)
+            f(in, out, chunk);
+        auto const elapsed = duration_cast<
+            duration<double>>(clock_type::now() - t0).count();
+        BEAST_EXPECT(out == check);
+        log <<
+            label << ": " <<
+            static_cast<std::size_t>(repeat * check.size() /
+                (elapsed * 1024 * 1024)) << " MB/s" << std::endl;
+    }
+
+    void
+    testSpeed()
+    {
+        auto const beast =
+            [](std::string const& in,
+                std::string& out, std::size_t chunk)
+            {
+                inflate_stream is;
+                z_params zs;
+                zs.next_in = in.data();
+                zs.avail_in = in.size();
+                zs.next_out = &out[0];
+                zs.avail_out = 0;
+                for(;;)
+                {
+                    zs.avail_out = (std::min)(
+                        chunk, out.size() - zs.total_out);
+                    error_code ec;
+                    is.write(zs, Flush::sync, ec);
+                    if(ec || zs.total_out == out.size())
+                        break;
+                }
+            };
+        auto const beast_contiguous =
+            [](std::string const& in,
+                std::string& out, std::size_t chunk)
+            {
+                inflate_stream is;
+                is.contiguous(true);
+                z_params zs;
+                zs.next_in = in.data();
+                zs.avail_in = in.size();
+                zs.next_out = &out[0];
+                zs.avail_out = 0;
+                for(;;)
+                {
+                    zs.avail_out = (std::min)(
+                        chunk, out.size() - zs.total_out);
+                    error_code ec;
+                    is.write(zs, Flush::sync, ec);
+                    if(ec || zs.total_out == out.size())
+                        break;
+                }
+            };
+        auto const zlib =
+            [](std::string const& in,
+                std::string& out, std::size_t chunk)
+            {
+                ::z_stream zs;
+                memset(&zs, 0, sizeof(zs));
+                inflateInit2(&zs, -15);
+                zs.next_in = (Bytef*)in.data();
+                zs.avail_in = static_cast<uInt>(in.size());
+                zs.next_out = (Bytef*)&out[0];
+                for(;;)
+                {
+                    zs.avail_out = static_cast<uInt>((std::min)(
+                        chunk, out.size() - zs.total_out));
+                    auto const result = inflate(&zs, Z_SYNC_FLUSH);
+                    if(result != Z_OK || zs.total_out == out.size())
+                        break;
+                }
+                inflateEnd(&zs);
+            };
+        std::size_t constexpr size = 1024 * 1024;
+        std::pair<char const*, std::string> const corpus[] = {
+            { "repeats", corpus1(size) },
+            { "json",    corpus3(size) },
+            { "random",  corpus2(size) } };
+        for(auto const& c : corpus)
+        {
+            z_deflator zd;
+            zd.level(6);
+            zd.windowBits(15);
+            zd.memLevel(8);
+            auto const in = zd(c.second);
+            for(std::size_t chunk : { size, std::size_t{4096} })
+            {
+                auto const label = std::string(c.first) +
+                    (chunk == size ? ", whole" : ", 4K out");
+                timeInflate(label + ", beast", in, c.second, chunk, beast);
+                timeInflate(label + ", beast contiguous",
+                    in, c.second, chunk, beast_contiguous);
+                timeInflate(label + ", zlib ", in, c.second, chunk, zlib);
+            }
+        }
+    }
+
+    void
+    testAllocated()
+    {
+        std::string const s = "Hello, world!";
+        z_deflator zd;
+        auto const in = zd(s);
+        std::string out;
+        out.resize(s.size());
+        inflate_stream is;
+        BEAST_EXPECT(is.allocated() == 0);
+        z_params zs;
+        zs.next_in = in.data();
+        zs.avail_in = in.size();
+        zs.next_out = &out[0];
+        zs.avail_out = out.size();
+        error_code ec;
+        is.write(zs, Flush::sync, ec);
+        BEAST_EXPECT(out == s);
+        BEAST_EXPECT(is.allocated() == 32768);
+        is.reset();
+        BEAST_EXPECT(is.allocated() == 32768);
+        is.clear();
+        BEAST_EXPECT(is.allocated() == 0);
+    }
+
+    // Decompress `in` into one buffer, with at most
+    // `chunk` bytes of input and output in each call.
+    static
+    std::string
+    inflateContiguous(inflate_stream& is,
+        std::string const& in, std::size_t size,
+            std::size_t chunk, error_code& ec)
+    {
+        std::string out(size, 0);
+        z_params zs;
+        zs.next_in = in.data();
+        zs.next_out = &out[0];
+        while(zs.total_out < size)
+        {
+            zs.avail_in = (std::min)(chunk, in.size() - zs.total_in);
+            zs.avail_out = (std::min)(chunk, size - zs.total_out);
+            is.write(zs, Flush::sync, ec);
+            if(ec)
+                break;
+        }
+        out.resize(zs.total_out);
+        return out;
+    }
+
+    void
+    testContiguous()
+    {
+        // The window is not needed once the stream ends
+        {
+            auto const s = corpus3(100000);
+            std::string in;
+            {
+                ::z_stream zs;
+                memset(&zs, 0, sizeof(zs));
+                deflateInit2(&zs, 6, Z_DEFLATED,
+                    -15, 8, Z_DEFAULT_STRATEGY);
+                in.resize(deflateBound(&zs,
+                    static_cast<uLong>(s.size())));
+                zs.next_in = (Bytef*)s.data();
+                zs.avail_in = static_cast<uInt>(s.size());
+                zs.next_out = (Bytef*)&in[0];
+                zs.avail_out = static_cast<uInt>(in.size());
+                deflate(&zs, Z_FINISH);
+                in.resize(zs.total_out);
+                deflateEnd(&zs);
+            }
+            inflate_stream is;
+            std::string out(s.size(), 0);
+            z_params zs;
+            zs.next_in = in.data();
+            zs.avail_in = in.size();
+            zs.next_out = &out[0];
+            zs.avail_out = out.size();
+            error_code ec;
+            is.write(zs, Flush::sync, ec);
+            BEAST_EXPECT(ec == error::end_of_stream);
+            BEAST_EXPECT(out == s);
+            BEAST_EXPECT(is.allocated() == 0);
+        }
+
+        // Back-references are served from the output
+        for(auto const& s : { corpus1(200000), corpus3(200000) })
+        {
+            for(int windowBits : { 9, 15 })
+            {
+                z_deflator zd;
+                zd.windowBits(windowBits);
+                auto const in = zd(s);
+                for(std::size_t chunk : { 1, 1000, 1 << 20 })
+                {
+                    inflate_stream is;
+                    is.reset(windowBits);
+                    is.contiguous(true);
+                    error_code ec;
+                    auto const out = inflateContiguous(
+                        is, in, s.size(), chunk, ec);
+                    BEAST_EXPECTS(! ec, ec.message());
+                    BEAST_EXPECT(out == s);
+                    BEAST_EXPECT(is.allocated() == 0);
+                    // Kept by reset
+                    is.reset();
+                    BEAST_EXPECT(inflateContiguous(
+                        is, in, s.size(), chunk, ec) == s);
+                    BEAST_EXPECT(is.allocated() == 0);
+                }
+            }
+        }
+
+        // Turned on after the first part of the stream
+        {
+            auto const s = corpus3(200000);
+            z_deflator zd;
+            auto const in = zd(s);
+            inflate_stream is;
+            std::string out(50000, 0);
+            z_params zs;
+            zs.next_in = in.data();
+            zs.avail_in = in.size();
+            zs.next_out = &out[0];
+            zs.avail_out = out.size();
+            error_code ec;
+            is.write(zs, Flush::sync, ec);
+            BEAST_EXPECT(! ec);
+            is.contiguous(true);
+            out.resize(s.size());
+            zs.next_out = &out[50000];
+            while(zs.total_out < s.size() && ! ec)
+            {
+                zs.avail_out = (std::min)(std::size_t{777},
+                    s.size() - zs.total_out);
+                is.write(zs, Flush::sync, ec);
+            }
+            BEAST_EXPECTS(! ec, ec.message());
+            BEAST_EXPECT(out == s);
+        }
+
+        // A distance beyond the output is an error
+        {
+            // Compressed with a dictionary the inflater lacks
+            std::string const dict = "0123456789abcdef";
+            auto const s = dict + dict;
+            std::string in(256, 0);
+            ::z_stream zs;
+            memset(&zs, 0, sizeof(zs));
+            deflateInit2(&zs, 6, Z_DEFLATED,
+                -15, 8, Z_DEFAULT_STRATEGY);
+            deflateSetDictionary(&zs,
+                reinterpret_cast<Bytef const*>(dict.data()),
+                static_cast<uInt>(dict.size()));
+            zs.next_in = (Bytef*)s.data();
+            zs.avail_in = static_cast<uInt>(s.size());
+            zs.next_out = (Bytef*)&in[0];
+            zs.avail_out = static_cast<uInt>(in.size());
+            deflate(&zs, Z_FINISH);
+            in.resize(zs.total_out);
+            deflateEnd(&zs);
+            inflate_stream is;
+            is.contiguous(true);
+            error_code ec;
+            inflateContiguous(is, in, s.size(), 1 << 20, ec);
+            BEAST_EXPECTS(ec == error::invalid_distance,
+                ec.message());
+        }
+    }
+
+    // All of the input in one call must reach the
+    // end of the stream, even when the last code is
+    // shorter than the bits used to index its table.
+    void
+    testEndOfInput()
+    {
+        auto const corpus = corpus3(4096);
+        for(int level = 1; level <= 9; level += 4)
+        {
+            for(std::size_t n = 1; n < corpus.size(); n += 37)
+            {
+                auto const check = corpus.substr(0, n);
+                std::string in;
+                {
+                    ::z_stream zs;
+                    memset(&zs, 0, sizeof(zs));
+                    deflateInit2(&zs, level, Z_DEFLATED,
+                        -15, 8, Z_DEFAULT_STRATEGY);
+                    in.resize(deflateBound(&zs,
+                        static_cast<uLong>(n)));
+                    zs.next_in = (Bytef*)check.data();
+                    zs.avail_in = static_cast<uInt>(n);
+                    zs.next_out = (Bytef*)&in[0];
+                    zs.avail_out = static_cast<uInt>(in.size());
+                    deflate(&zs, Z_FINISH);
+                    in.resize(zs.total_out);
+                    deflateEnd(&zs);
+                }
+                std::string out(n + 1, 0);
+                inflate_stream is;
+                z_params zs;
+                zs.next_in = in.data();
+                zs.avail_in = in.size();
+                zs.next_out = &out[0];
+                zs.avail_out = out.size();
+                error_code ec;
+                is.write(zs, Flush::sync, ec);
+                BEAST_EXPECTS(ec == error::end_of_stream,
+                    ec.message());
+                out.resize(zs.total_out);
+                BEAST_EXPECT(out == check);
+            }
+        }
+    }
+
+    // Compress with zlib using the zlib or gzip wrapper
+    static
+    std::string
+    zwrap(std::string const& in, int windowBits,
+        gz_header* head = nullptr,
+        std::string const& dict = {})
+    {
+        ::z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        deflateInit2(&zs, 6, Z_DEFLATED,
+            windowBits, 8, Z_DEFAULT_STRATEGY);
+        if(head)
+            deflateSetHeader(&zs, head);
+        if(! dict.empty())
+            deflateSetDictionary(&zs,
+                reinterpret_cast<Bytef const*>(dict.data()),
+                static_cast<uInt>(dict.size()));
+        std::string out(deflateBound(&zs,
+            static_cast<uLong>(in.size())) + 1024, 0);
+        zs.next_in = (Bytef*)in.data();
+        zs.avail_in = static_cast<uInt>(in.size());
+        zs.next_out = (Bytef*)&out[0];
+        zs.avail_out = static_cast<uInt>(out.size());
+        deflate(&zs, Z_FINISH);
+        out.resize(zs.total_out);
+        deflateEnd(&zs);
+        return out;
+    }
+
+    // Decompress, providing at most `chunk`
+    // bytes of input and output at a time.
+    static
+    std::string
+    unwrap(Wrap wrap, std::string const& in,
+        std::size_t chunk, error_code& ec)
+    {
+        inflate_stream is;
+        is.reset(15, wrap);
+        std::string out;
+        z_params zs;
+        zs.next_in = in.data();
+        for(;;)
+        {
+            char buf[4096];
+            auto const used = zs.total_in;
+            zs.avail_in = (std::min)(chunk, in.size() - used);
+            auto const avail = (std::min)(chunk, sizeof(buf));
+            zs.next_out = buf;
+            zs.avail_out = avail;
+            is.write(zs, Flush::none, ec);
+            out.append(buf, avail - zs.avail_out);
+            if(ec == error::need_buffers &&
+                zs.total_in < in.size())
+                continue;
+            if(ec)
+                break;
+        }
+        return out;
+    }
+
+    void
+    testWrap()
+    {
+        auto const check =
+            [&](Wrap wrap, std::string const& in,
+                std::string const& expected, error e)
+            {
+                for(std::size_t chunk : { 1, 5, 1 << 20 })
+                {
+                    error_code ec;
+                    auto const out = unwrap(wrap, in, chunk, ec);
+                    if(! BEAST_EXPECTS(ec == e, ec.message()))
+                        return;
+                    if(e == error::end_of_stream)
+                        BEAST_EXPECT(out == expected);
+                }
+            };
+        auto const s = corpus3(50000);
+        auto const zlib = zwrap(s, 15);
+        auto const gzip = zwrap(s, 31);
+
+        check(Wrap::zlib, zlib, s, error::end_of_stream);
+        check(Wrap::automatic, zlib, s, error::end_of_stream);
+        check(Wrap::gzip, zlib, s, error::incorrect_header_check);
+        check(Wrap::gzip, gzip, s, error::end_of_stream);
+        check(Wrap::automatic, gzip, s, error::end_of_stream);
+        check(Wrap::zlib, gzip, s, error::incorrect_header_check);
+        check(Wrap::zlib, zwrap({}, 15), {}, error::end_of_stream);
+        check(Wrap::gzip, zwrap({}, 31), {}, error::end_of_stream);
+
+        // gzip header with every optional field
+        {
+            char extra[] = "extra field";
+            char name[] = "file.txt";
+            char comment[] = "a comment";
+            gz_header head;
+            memset(&head, 0, sizeof(head));
+            head.time = 12345678;
+            head.os = 3;
+            head.extra = reinterpret_cast<Bytef*>(extra);
+            head.extra_len = sizeof(extra);
+            head.name = reinterpret_cast<Bytef*>(name);
+            head.comment = reinterpret_cast<Bytef*>(comment);
+            head.hcrc = 1;
+            auto in = zwrap(s, 31, &head);
+            check(Wrap::gzip, in, s, error::end_of_stream);
+            in[20] ^= 1;
+            check(Wrap::gzip, in, s, error::header_crc_mismatch);
+        }
+
+        // Corrupted headers and trailers
+        {
+            auto in = zlib;
+            in[0] = 0x79;
+            check(Wrap::zlib, in, s, error::incorrect_header_check);
+            in = zlib;
+            in[0] = static_cast<char>(0x87);
+            in[1] = 0x05;
+            check(Wrap::zlib, in, s, error::unknown_compression_method);
+            in = zwrap(s, 15);
+            in.back() ^= 1;
+            check(Wrap::zlib, in, s, error::incorrect_data_check);
+            in = gzip;
+            in[2] = 7;
+            check(Wrap::gzip, in, s, error::unknown_compression_method);
+            in = gzip;
+            in[3] = 0x20;
+            check(Wrap::gzip, in, s, error::unknown_header_flags);
+            in = gzip;
+            in[in.size() - 5] ^= 1;
+            check(Wrap::gzip, in, s, error::incorrect_data_check);
+            in = gzip;
+            in.back() ^= 1;
+            check(Wrap::gzip, in, s, error::incorrect_length_check);
+        }
+
+        // Window larger than the stream's
+        {
+            inflate_stream is;
+            is.reset(9, Wrap::zlib);
+            z_params zs;
+            zs.next_in = zlib.data();
+            zs.avail_in = zlib.size();
+            char buf[64];
+            zs.next_out = buf;
+            zs.avail_out = sizeof(buf);
+            error_code ec;
+            is.write(zs, Flush::none, ec);
+            BEAST_EXPECTS(ec == error::invalid_window_size,
+                ec.message());
+        }
+
+        // Preset dictionary named in the header
+        check(Wrap::zlib, zwrap(s, 15, nullptr, "dictionary"),
+            s, error::need_dictionary);
+    }
+
+    void
+    testDictionary()
+    {
+        auto const dict = corpus3(3000);
+        auto const s = corpus3(5000).substr(2000);
+
+        // Decompress in one call, setting the
+        // dictionary when it is asked for.
+        auto const decode =
+            [&](inflate_stream& is, std::string const& in,
+                error_code& ec)
+            {
+                std::string out(s.size() + 1, 0);
+                z_params zs;
+                zs.next_in = in.data();
+                zs.avail_in = in.size();
+                zs.next_out = &out[0];
+                zs.avail_out = out.size();
+                is.write(zs, Flush::sync, ec);
+                if(ec == error::need_dictionary)
+                {
+                    ec = {};
+                    is.dictionary(dict.data(), dict.size(), ec);
+                    if(ec)
+                        return std::string{};
+                    is.write(zs, Flush::sync, ec);
+                }
+                out.resize(zs.total_out);
+                return out;
+            };
+
+        // Raw
+        {
+            auto const in = zwrap(s, -15, nullptr, dict);
+            BEAST_EXPECT(in.size() < zwrap(s, -15).size());
+            inflate_stream is;
+            error_code ec;
+            is.dictionary(dict.data(), dict.size(), ec);
+            BEAST_EXPECTS(! ec, ec.message());
+            BEAST_EXPECT(decode(is, in, ec) == s);
+            BEAST_EXPECTS(ec == error::end_of_stream, ec.message());
+
+            // From a preset, into a smaller window
+            is.reset(12);
+            ec = {};
+            is.dictionary(preset_dictionary{
+                dict.data(), dict.size()}, ec);
+            BEAST_EXPECT(decode(is,
+                zwrap(s, -12, nullptr, dict), ec) == s);
+            BEAST_EXPECTS(ec == error::end_of_stream, ec.message());
+
+            // Not with contiguous output
+            is.reset();
+            is.contiguous(true);
+            ec = {};
+            is.dictionary(dict.data(), dict.size(), ec);
+            BEAST_EXPECTS(ec == error::stream_error, ec.message());
+        }
+
+        // Named by the zlib header
+        for(Wrap wrap : { Wrap::zlib, Wrap::automatic })
+        {
+            auto const in = zwrap(s, 15, nullptr, dict);
+            inflate_stream is;
+            is.reset(15, wrap);
+            error_code ec;
+            // Too early
+            is.dictionary(dict.data(), dict.size(), ec);
+            BEAST_EXPECTS(ec == error::stream_error, ec.message());
+            ec = {};
+            BEAST_EXPECT(decode(is, in, ec) == s);
+            BEAST_EXPECTS(ec == error::end_of_stream, ec.message());
+
+            // The wrong dictionary
+            is.reset();
+            z_params zs;
+            zs.next_in = in.data();
+            zs.avail_in = in.size();
+            char buf[64];
+            zs.next_out = buf;
+            zs.avail_out = sizeof(buf);
+            ec = {};
+            is.write(zs, Flush::sync, ec);
+            BEAST_EXPECTS(ec == error::need_dictionary, ec.message());
+            ec = {};
+            is.dictionary(s.data(), s.size(), ec);
+            BEAST_EXPECTS(ec == error::incorrect_dictionary,
+                ec.message());
+        }
+    }
+
     void
     run() override
     {
@@ -403,6 +977,12 @@ public:
             "sizeof(inflate_stream) == " <<
             sizeof(inflate_stream) << std::endl;
         testInflate();
+        testEndOfInput();
+        testContiguous();
+        testWrap();
+        testDictionary();
+        testAllocated();
+        testSpeed();
     }
 };
 
@@ -0,0 +1,317 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Test that header file is self-contained.
+#include <beast/zlib/parallel_deflate.hpp>
+
+#include "ztest.hpp"
+#include <beast/core/flat_buffer.hpp>
+#include <beast/zlib/deflate_stream.hpp>
+#include <beast/zlib/inflate_stream.hpp>
+#include <beast/unit_test/suite.hpp>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+namespace beast {
+namespace zlib {
+
+class parallel_deflate_test : public beast::unit_test::suite
+{
+public:
+    static
+    std::string
+    compress(parallel_deflate& pd, std::string const& s)
+    {
+        flat_buffer b;
+        error_code ec;
+        pd.write(b, s.data(), s.size(), ec);
+        if(ec)
+            throw system_error{ec};
+        return {boost::asio::buffer_cast<
+            char const*>(b.data()), b.size()};
+    }
+
+    // Decompress with inflate_stream
+    static
+    std::string
+    inflate(std::string const& in, std::size_t size)
+    {
+        std::string out(size + 1, 0);
+        inflate_stream is;
+        z_params zs;
+        zs.next_in = in.data();
+        zs.avail_in = in.size();
+        zs.next_out = &out[0];
+        zs.avail_out = out.size();
+        error_code ec;
+        is.write(zs, Flush::sync, ec);
+        if(ec != error::end_of_stream)
+            return {};
+        out.resize(zs.total_out);
+        return out;
+    }
+
+    void
+    check(parallel_deflate& pd, std::string const& s,
+        std::string& out)
+    {
+        out = compress(pd, s);
+        BEAST_EXPECT(inflate(out, s.size()) == s);
+        BEAST_EXPECT(z_inflator{}(out) == s);
+    }
+
+    void
+    testRoundTrip()
+    {
+        std::size_t constexpr block = 4096;
+        auto const s = corpus3(9 * block + 17);
+        for(int level : { 0, 1, 6, 9 })
+        {
+            for(std::size_t size : { std::size_t{0}, std::size_t{1},
+                block - 1, block, block + 1, s.size() })
+            {
+                auto const in = s.substr(0, size);
+                std::string out1;
+                for(std::size_t threads : { 1, 2, 4 })
+                {
+                    parallel_deflate pd{threads};
+                    pd.block_size(block);
+                    pd.reset(level, 15, 8, Strategy::normal);
+                    std::string out;
+                    check(pd, in, out);
+                    // Output does not depend on the threads
+                    if(threads == 1)
+                        out1 = out;
+                    else
+                        BEAST_EXPECT(out == out1);
+                }
+            }
+        }
+        for(int strategy = 0; strategy <= 4; ++strategy)
+        {
+            parallel_deflate pd{3};
+            pd.block_size(block);
+            pd.reset(6, 9, 4, static_cast<Strategy>(strategy));
+            std::string out;
+            check(pd, corpus1(5 * block), out);
+            check(pd, corpus2(5 * block), out);
+        }
+    }
+
+    void
+    testDictionary()
+    {
+        // Each block repeats the one before it, so with
+        // the dictionary all but the first are tiny.
+        std::size_t constexpr block = 8192;
+        auto const r = corpus2(block);
+        std::string s;
+        for(int i = 0; i < 8; ++i)
+            s += r;
+        parallel_deflate pd{4};
+        pd.block_size(block);
+        std::string out;
+        check(pd, s, out);
+        BEAST_EXPECTS(out.size() < block + block / 2,
+            std::to_string(out.size()));
+    }
+
+    void
+    testReuse()
+    {
+        parallel_deflate pd{2};
+        pd.block_size(1000);
+        std::string out;
+        check(pd, corpus1(10000), out);
+        check(pd, corpus3(3500), out);
+        pd.reset(1, 12, 9, Strategy::filtered);
+        check(pd, corpus3(20000), out);
+        check(pd, std::string{}, out);
+        try
+        {
+            pd.block_size(0);
+            fail("", __FILE__, __LINE__);
+        }
+        catch(std::invalid_argument const&)
+        {
+            pass();
+        }
+        try
+        {
+            pd.reset(10, 15, 8, Strategy::normal);
+            fail("", __FILE__, __LINE__);
+        }
+        catch(std::invalid_argument const&)
+        {
+            pass();
+        }
+    }
+
+    // Decompress a wrapped stream with zlib, which
+    // checks the header and the trailer.
+    static
+    std::string
+    zinflate(std::string const& in, int windowBits,
+        std::size_t size)
+    {
+        ::z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        if(::inflateInit2(&zs, windowBits) != Z_OK)
+            return {};
+        std::string out(size + 1, 0);
+        zs.next_in = (Bytef*)in.data();
+        zs.avail_in = static_cast<uInt>(in.size());
+        zs.next_out = (Bytef*)&out[0];
+        zs.avail_out = static_cast<uInt>(out.size());
+        auto const result = ::inflate(&zs, Z_FINISH);
+        out.resize(zs.total_out);
+        auto const avail_in = zs.avail_in;
+        ::inflateEnd(&zs);
+        if(result != Z_STREAM_END || avail_in != 0)
+            return "error";
+        return out;
+    }
+
+    void
+    testWrap()
+    {
+        std::size_t constexpr block = 4096;
+        auto const s = corpus3(5 * block + 17);
+        for(auto wrap : { Wrap::zlib, Wrap::gzip })
+        {
+            for(int level : { 1, 6, 9 })
+            {
+                for(std::size_t size : { std::size_t{0},
+                    std::size_t{1}, block - 1, s.size() })
+                {
+                    auto const in = s.substr(0, size);
+                    parallel_deflate raw{1};
+                    raw.block_size(block);
+                    raw.reset(level, 15, 8, Strategy::normal);
+                    auto const r = compress(raw, in);
+                    for(std::size_t threads : { 1, 3 })
+                    {
+                        parallel_deflate pd{threads};
+                        pd.block_size(block);
+                        pd.reset(level, 15, 8,
+                            Strategy::normal, wrap);
+                        auto const out = compress(pd, in);
+                        // The raw stream with a header and trailer
+                        auto const head =
+                            wrap == Wrap::zlib ? 2 : 10;
+                        auto const tail =
+                            wrap == Wrap::zlib ? 4 : 8;
+                        BEAST_EXPECT(out.size() ==
+                            head + r.size() + tail);
+                        BEAST_EXPECT(out.substr(head,
+                            r.size()) == r);
+                        BEAST_EXPECT(zinflate(out, wrap ==
+                            Wrap::zlib ? 15 : 31, size) == in);
+
+                        std::string got(size + 1, 0);
+                        inflate_stream is;
+                        is.reset(15, wrap);
+                        z_params zs;
+                        zs.next_in = out.data();
+                        zs.avail_in = out.size();
+                        zs.next_out = &got[0];
+                        zs.avail_out = got.size();
+                        error_code ec;
+                        is.write(zs, Flush::sync, ec);
+                        BEAST_EXPECTS(ec == error::end_of_stream,
+                            ec.message());
+                        got.resize(zs.total_out);
+                        BEAST_EXPECT(got == in);
+                    }
+                }
+            }
+        }
+
+        // The zlib header carries the window size
+        {
+            parallel_deflate pd{2};
+            pd.block_size(block);
+            pd.reset(6, 10, 8, Strategy::normal, Wrap::zlib);
+            auto const out = compress(pd, s);
+            BEAST_EXPECT(((out[0] >> 4) & 0x0f) + 8 == 10);
+            BEAST_EXPECT(zinflate(out, 10, s.size()) == s);
+        }
+
+        try
+        {
+            parallel_deflate pd;
+            pd.reset(6, 15, 8, Strategy::normal, Wrap::automatic);
+            fail("", __FILE__, __LINE__);
+        }
+        catch(std::invalid_argument const&)
+        {
+            pass();
+        }
+    }
+
+    void
+    testSpeed()
+    {
+        using namespace std::chrono;
+        using clock_type = steady_clock;
+        auto const s = corpus3(8 * 1024 * 1024);
+        auto const report =
+            [&](std::string const& label, clock_type::time_point t0,
+                std::size_t size)
+            {
+                auto const elapsed = duration_cast<
+                    duration<double>>(clock_type::now() - t0).count();
+                log <<
+                    label << ": " <<
+                    static_cast<std::size_t>(s.size() /
+                        (elapsed * 1024 * 1024)) << " MB/s, " <<
+                    size << " bytes" << std::endl;
+            };
+        {
+            deflate_stream ds;
+            ds.reset(6, 15, 8, Strategy::normal);
+            std::string out(ds.upper_bound(s.size()), 0);
+            z_params zs;
+            zs.next_in = s.data();
+            zs.avail_in = s.size();
+            zs.next_out = &out[0];
+            zs.avail_out = out.size();
+            auto const t0 = clock_type::now();
+            error_code ec;
+            ds.write(zs, Flush::finish, ec);
+            report("deflate_stream", t0, zs.total_out);
+        }
+        for(std::size_t threads : { 1, 2, 4, 8 })
+        {
+            parallel_deflate pd{threads};
+            auto const t0 = clock_type::now();
+            auto const out = compress(pd, s);
+            report("parallel_deflate, " +
+                std::to_string(threads) + " threads", t0, out.size());
+            BEAST_EXPECT(inflate(out, s.size()) == s);
+        }
+    }
+
+    void
+    run() override
+    {
+        log <<
+            "hardware threads == " <<
+            std::thread::hardware_concurrency() << std::endl;
+        testRoundTrip();
+        testDictionary();
+        testReuse();
+        testWrap();
+        testSpeed();
+    }
+};
+
+BEAST_DEFINE_TESTSUITE(parallel_deflate,zlib,beast);
+
+} // zlib
+} // beast
@@ -0,0 +1,445 @@
+//
+// Copyright (c) 2013-2017 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <beast/zlib/deflate_stream.hpp>
+#include <beast/zlib/inflate_stream.hpp>
+
+#include "ztest.hpp"
+#include <beast/unit_test/suite.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+
+namespace beast {
+namespace zlib {
+
+/*  Measures beast::zlib against the bundled zlib-1.2.8.
+
+    Each corpus is compressed by both implementations, feeding
+    the input in chunks as a streaming caller would, and the
+    output is decompressed by the same implementation. The
+    corpora are:
+
+        text    English-like words and punctuation
+
+        json    JSON-like records, see corpus3
+
+        binary  Fixed size records of little endian integers
+                with slowly changing fields
+
+        random  Uniformly distributed bytes, see corpus2
+
+    Every level and Strategy is run with the default window
+    and memory level, then every windowBits and memLevel in
+    a selection is run with the default level and strategy.
+
+    One line of comma separated values is logged for each
+    configuration, following a header line starting with '#'.
+    Throughput is in megabytes of uncompressed data per
+    second, the best of several runs.
+*/
+class zlib_bench_test : public beast::unit_test::suite
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    // Bytes in each corpus
+    static std::size_t constexpr corpus_size = 1024 * 1024;
+
+    // Bytes of input given to each call
+    static std::size_t constexpr chunk_size = 64 * 1024;
+
+    // Runs of each configuration, the fastest is reported
+    static int constexpr runs = 3;
+
+    struct config
+    {
+        int level;
+        int windowBits;
+        int memLevel;
+        Strategy strategy;
+    };
+
+    struct result
+    {
+        std::size_t size = 0;
+        double deflate_mbps = 0;
+        double inflate_mbps = 0;
+    };
+
+    static
+    std::string
+    text_corpus(std::size_t n)
+    {
+        static char const* const words[] = {
+            "the", "of", "and", "to", "a", "in", "is", "it",
+            "that", "was", "for", "on", "are", "with", "as",
+            "his", "they", "be", "at", "one", "have", "this",
+            "from", "by", "hot", "word", "but", "what", "some",
+            "can", "out", "other", "were", "all", "there",
+            "when", "up", "use", "your", "how", "said", "each",
+            "which", "their", "time", "will", "way", "about",
+            "many", "then", "them", "would", "write", "like",
+            "these", "long", "make", "thing", "see", "look",
+            "compression", "window", "stream", "message",
+            "buffer", "protocol", "connection", "document" };
+        static std::size_t constexpr count =
+            sizeof(words) / sizeof(words[0]);
+        std::string s;
+        s.reserve(n + 32);
+        std::mt19937 g;
+        // Common words are picked more often
+        std::geometric_distribution<std::size_t> d0{0.08};
+        std::uniform_int_distribution<int> d1{0, 99};
+        bool cap = true;
+        while(s.size() < n)
+        {
+            std::string w = words[d0(g) % count];
+            if(cap)
+                w[0] = static_cast<char>(w[0] - 'a' + 'A');
+            s += w;
+            auto const r = d1(g);
+            cap = r < 12;
+            if(r < 8)
+                s += ".  ";
+            else if(r < 10)
+                s += ".\n\n";
+            else if(r < 12)
+                s += "?  ";
+            else if(r < 20)
+                s += ", ";
+            else
+                s += " ";
+        }
+        s.resize(n);
+        return s;
+    }
+
+    static
+    std::string
+    binary_corpus(std::size_t n)
+    {
+        std::string s;
+        s.reserve(n + 16);
+        std::mt19937 g;
+        std::uniform_int_distribution<std::uint32_t> d0{0, 15};
+        std::uniform_int_distribution<std::uint32_t> d1{0, 1000};
+        std::uint32_t id = 0;
+        std::uint32_t time = 1500000000;
+        std::uint32_t value = 50000;
+        auto const put =
+            [&](std::uint32_t v)
+            {
+                for(int i = 0; i < 4; ++i)
+                    s.push_back(static_cast<char>(
+                        (v >> (8 * i)) & 0xff));
+            };
+        while(s.size() < n)
+        {
+            put(++id);
+            time += d0(g);
+            put(time);
+            value = value + d1(g) - 500;
+            put(value);
+            put(d0(g) < 2 ? d1(g) : 0);
+        }
+        s.resize(n);
+        return s;
+    }
+
+    template<class F>
+    static
+    double
+    measure(std::size_t size, F const& f)
+    {
+        using namespace std::chrono;
+        auto best = clock_type::duration::max();
+        for(int i = 0; i < runs; ++i)
+        {
+            auto const t0 = clock_type::now();
+            f();
+            best = (std::min)(best, clock_type::now() - t0);
+        }
+        auto const secs = (std::max)(1e-9,
+            duration_cast<duration<double>>(best).count());
+        return size / secs / 1e6;
+    }
+
+    std::string
+    beast_deflate(config const& c, std::string const& in)
+    {
+        deflate_stream ds;
+        ds.reset(c.level, c.windowBits, c.memLevel, c.strategy);
+        std::string out(ds.upper_bound(in.size()), 0);
+        z_params zs;
+        zs.next_out = &out[0];
+        zs.avail_out = out.size();
+        error_code ec;
+        std::size_t pos = 0;
+        for(;;)
+        {
+            auto const n = (std::min)(
+                std::size_t{chunk_size}, in.size() - pos);
+            zs.next_in = in.data() + pos;
+            zs.avail_in = n;
+            pos += n;
+            ds.write(zs, pos < in.size() ?
+                Flush::none : Flush::finish, ec);
+            if(ec == error::end_of_stream)
+                break;
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                break;
+        }
+        out.resize(zs.total_out);
+        return out;
+    }
+
+    std::string
+    beast_inflate(config const& c,
+        std::string const& in, std::size_t size)
+    {
+        inflate_stream is;
+        is.reset(c.windowBits);
+        std::string out(size, 0);
+        z_params zs;
+        zs.next_out = &out[0];
+        zs.avail_out = out.size();
+        error_code ec;
+        std::size_t pos = 0;
+        for(;;)
+        {
+            auto const n = (std::min)(
+                std::size_t{chunk_size}, in.size() - pos);
+            zs.next_in = in.data() + pos;
+            zs.avail_in = n;
+            pos += n;
+            is.write(zs, Flush::none, ec);
+            if(ec == error::end_of_stream)
+                break;
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                break;
+        }
+        out.resize(zs.total_out);
+        return out;
+    }
+
+    static
+    int
+    to_z(Strategy strategy)
+    {
+        switch(strategy)
+        {
+        case Strategy::normal:   return Z_DEFAULT_STRATEGY;
+        case Strategy::filtered: return Z_FILTERED;
+        case Strategy::huffman:  return Z_HUFFMAN_ONLY;
+        case Strategy::rle:      return Z_RLE;
+        case Strategy::fixed:    return Z_FIXED;
+        }
+        return Z_DEFAULT_STRATEGY;
+    }
+
+    std::string
+    z_deflate(config const& c, std::string const& in)
+    {
+        z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        if(! BEAST_EXPECT(deflateInit2(&zs, c.level,
+                Z_DEFLATED, -c.windowBits, c.memLevel,
+                to_z(c.strategy)) == Z_OK))
+            return {};
+        std::string out(deflateBound(&zs,
+            static_cast<uLong>(in.size())), 0);
+        zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+        zs.avail_out = static_cast<uInt>(out.size());
+        std::size_t pos = 0;
+        for(;;)
+        {
+            auto const n = (std::min)(
+                std::size_t{chunk_size}, in.size() - pos);
+            zs.next_in = reinterpret_cast<Bytef*>(
+                const_cast<char*>(in.data() + pos));
+            zs.avail_in = static_cast<uInt>(n);
+            pos += n;
+            auto const result = deflate(&zs,
+                pos < in.size() ? Z_NO_FLUSH : Z_FINISH);
+            if(result == Z_STREAM_END)
+                break;
+            if(! BEAST_EXPECT(result == Z_OK))
+                break;
+        }
+        out.resize(zs.total_out);
+        deflateEnd(&zs);
+        return out;
+    }
+
+    std::string
+    z_inflate(config const& c,
+        std::string const& in, std::size_t size)
+    {
+        z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        if(! BEAST_EXPECT(inflateInit2(
+                &zs, -c.windowBits) == Z_OK))
+            return {};
+        std::string out(size, 0);
+        zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+        zs.avail_out = static_cast<uInt>(out.size());
+        std::size_t pos = 0;
+        for(;;)
+        {
+            auto const n = (std::min)(
+                std::size_t{chunk_size}, in.size() - pos);
+            zs.next_in = reinterpret_cast<Bytef*>(
+                const_cast<char*>(in.data() + pos));
+            zs.avail_in = static_cast<uInt>(n);
+            pos += n;
+            auto const result = inflate(&zs, Z_NO_FLUSH);
+            if(result == Z_STREAM_END)
+                break;
+            if(! BEAST_EXPECT(result == Z_OK))
+                break;
+        }
+        out.resize(zs.total_out);
+        inflateEnd(&zs);
+        return out;
+    }
+
+    template<class Deflate, class Inflate>
+    result
+    run_one(config const& c, std::string const& in,
+        Deflate const& def, Inflate const& inf)
+    {
+        result r;
+        std::string z;
+        r.deflate_mbps = measure(in.size(),
+            [&]
+            {
+                z = def(c, in);
+            });
+        r.size = z.size();
+        std::string out;
+        r.inflate_mbps = measure(in.size(),
+            [&]
+            {
+                out = inf(c, z, in.size());
+            });
+        BEAST_EXPECT(out == in);
+        return r;
+    }
+
+    static
+    char const*
+    to_string(Strategy strategy)
+    {
+        switch(strategy)
+        {
+        case Strategy::normal:   return "normal";
+        case Strategy::filtered: return "filtered";
+        case Strategy::huffman:  return "huffman";
+        case Strategy::rle:      return "rle";
+        case Strategy::fixed:    return "fixed";
+        }
+        return "?";
+    }
+
+    void
+    report(char const* impl, char const* corpus,
+        config const& c, std::size_t size, result const& r)
+    {
+        log <<
+            "zlib-bench," <<
+            impl << "," <<
+            corpus << "," <<
+            c.level << "," <<
+            to_string(c.strategy) << "," <<
+            c.windowBits << "," <<
+            c.memLevel << "," <<
+            size << "," <<
+            r.size << "," <<
+            static_cast<double>(r.size) / size << "," <<
+            r.deflate_mbps << "," <<
+            r.inflate_mbps << std::endl;
+    }
+
+    void
+    bench(char const* corpus,
+        std::string const& in, config const& c)
+    {
+        report("beast", corpus, c, in.size(), run_one(c, in,
+            [&](config const& c, std::string const& in)
+            {
+                return beast_deflate(c, in);
+            },
+            [&](config const& c, std::string const& in,
+                std::size_t size)
+            {
+                return beast_inflate(c, in, size);
+            }));
+        report("zlib", corpus, c, in.size(), run_one(c, in,
+            [&](config const& c, std::string const& in)
+            {
+                return z_deflate(c, in);
+            },
+            [&](config const& c, std::string const& in,
+                std::size_t size)
+            {
+                return z_inflate(c, in, size);
+            }));
+    }
+
+    void
+    testBench()
+    {
+        log <<
+            "#bench,impl,corpus,level,strategy,windowBits,"
+            "memLevel,bytes,compressed_bytes,ratio,"
+            "deflate_mb_per_sec,inflate_mb_per_sec" << std::endl;
+        struct corpus
+        {
+            char const* name;
+            std::string data;
+        };
+        corpus const corpora[] = {
+            { "text",   text_corpus(corpus_size) },
+            { "json",   corpus3(corpus_size) },
+            { "binary", binary_corpus(corpus_size) },
+            { "random", corpus2(corpus_size) } };
+        static Strategy constexpr strategies[] = {
+            Strategy::normal, Strategy::filtered,
+            Strategy::huffman, Strategy::rle,
+            Strategy::fixed };
+        static int constexpr window_bits[] = { 9, 10, 12, 15 };
+        static int constexpr mem_levels[] = { 1, 4, 8, 9 };
+        for(auto const& cp : corpora)
+        {
+            for(auto const strategy : strategies)
+                for(int level = 0; level <= 9; ++level)
+                    bench(cp.name, cp.data,
+                        config{level, 15, 8, strategy});
+            for(auto const windowBits : window_bits)
+                for(auto const memLevel : mem_levels)
+                    bench(cp.name, cp.data, config{
+                        6, windowBits, memLevel,
+                            Strategy::normal});
+        }
+        pass();
+    }
+
+    void
+    run() override
+    {
+        testBench();
+    }
+};
+
+BEAST_DEFINE_TESTSUITE(zlib_bench,zlib,beast);
+
+} // zlib
+} // beast
@@ -164,4 +164,34 @@ corpus2(std::size_t n)
     return s;
 }
 
+// Generate JSON-like text
+inline
+std::string
+corpus3(std::size_t n)
+{
+    static char const* const keys[] = {
+        "\"id\"", "\"name\"", "\"price\"", "\"active\"",
+        "\"tags\"", "\"updated\"", "\"owner\"", "\"count\"" };
+    std::string s;
+    s.reserve(n + 100);
+    std::mt19937 g;
+    std::uniform_int_distribution<std::uint32_t> d0{0, 7};
+    std::uniform_int_distribution<std::uint32_t> d1{0, 99999};
+    while(s.size() < n)
+    {
+        s += "{";
+        for(int i = 0; i < 5; ++i)
+        {
+            if(i > 0)
+                s += ",";
+            s += keys[d0(g)];
+            s += ":";
+            s += std::to_string(d1(g));
+        }
+        s += "}\n";
+    }
+    s.resize(n);
+    return s;
+}
+
 #endif